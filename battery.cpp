@@ -0,0 +1,206 @@
+/*
+Copyright 2019 Tinic Uro
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#include "./battery.h"
+
+#include <algorithm>
+
+#include "./leds.h"
+#include "./sx1280.h"
+#include "./sdd1306.h"
+
+// SX1280 supply current by operating mode in mA, transmitting at 13 dBm
+static constexpr float radio_ma[] = {
+    0.001f, // MODE_SLEEP
+    2.0f,   // MODE_CALIBRATION
+    0.7f,   // MODE_STDBY_RC
+    2.1f,   // MODE_STDBY_XOSC
+    3.8f,   // MODE_FS
+    5.5f,   // MODE_RX
+    24.0f,  // MODE_TX
+    5.5f    // MODE_CAD
+};
+
+// LiPo resting voltage from empty to full in 10% steps
+static constexpr float ocv_table[] = { 3.30f, 3.60f, 3.69f, 3.73f, 3.77f, 3.80f, 3.84f, 3.90f, 3.97f, 4.06f, 4.20f };
+static constexpr size_t ocv_steps = sizeof(ocv_table) / sizeof(ocv_table[0]) - 1;
+
+Battery &Battery::instance() {
+    static Battery battery;
+    if (!battery.initialized) {
+        battery.initialized = true;
+        battery.init();
+    }
+    return battery;
+}
+
+void Battery::init() {
+    Reset();
+}
+
+void Battery::Reset() {
+    update_time = Model::instance().Time();
+    led_mas = static_cast<double>(led_control::Charge()) * 1e-3;
+    radio_mas = 0.0;
+    for (size_t c = 0; c < sizeof(radio_ma) / sizeof(radio_ma[0]); c++) {
+        radio_mas += static_cast<double>(radio_ma[c]) * SX1280::instance().OperatingModeTime(static_cast<SX1280::RadioOperatingModes>(c));
+    }
+    consumed = Consumers();
+    std::fill(&effect_mah[0], &effect_mah[0] + Model::EffectCount(), 0.0);
+    average_ma = 0.0f;
+    average_led_ma = 0.0f;
+    average_demand_ma = 0.0f;
+    current_scale = 1.0f;
+    average_valid = false;
+    calibrated = false;
+    charging = false;
+    charge_mah = 0.0;
+    counted_mah = 0.0;
+    fit_n = fit_x = fit_y = fit_xx = fit_xy = 0.0;
+}
+
+float Battery::OpenCircuitVoltage(float charge) {
+    float pos = std::min(std::max(charge, 0.0f), 1.0f) * static_cast<float>(ocv_steps);
+    size_t i = std::min(static_cast<size_t>(pos), ocv_steps - 1);
+    float f = pos - static_cast<float>(i);
+    return ocv_table[i] + ( ocv_table[i + 1] - ocv_table[i] ) * f;
+}
+
+float Battery::ChargeFromVoltage(float voltage) {
+    if (voltage <= ocv_table[0]) {
+        return 0.0f;
+    }
+    for (size_t i = 0; i < ocv_steps; i++) {
+        if (voltage < ocv_table[i + 1]) {
+            float f = ( voltage - ocv_table[i] ) / ( ocv_table[i + 1] - ocv_table[i] );
+            return ( static_cast<float>(i) + f ) * ( 1.0f / static_cast<float>(ocv_steps) );
+        }
+    }
+    return 1.0f;
+}
+
+float Battery::StateOfCharge() const {
+    return std::min(std::max(static_cast<float>(charge_mah) / capacity_mah, 0.0f), 1.0f);
+}
+
+double Battery::Runtime() const {
+    if (!calibrated || charging || Current() <= 0.0f) {
+        return -1.0;
+    }
+    double other_ma = static_cast<double>(average_ma - average_led_ma);
+    double slice_mah = std::max(charge_mah, 0.0) / runtime_steps;
+    double ma = static_cast<double>(Current());
+    double seconds = 0.0;
+    for (uint32_t c = 0; c < runtime_steps; c++) {
+        double charge = charge_mah - slice_mah * ( static_cast<double>(c) + 0.5 );
+        float voltage = OpenCircuitVoltage(static_cast<float>(charge) / capacity_mah) - static_cast<float>(ma) * ( internal_resistance / 1000.0f );
+        double leds = static_cast<double>(std::min(average_demand_ma, led_control::BatteryCurrentBudget(voltage)));
+        ma = ( other_ma + leds ) * static_cast<double>(current_scale);
+        seconds += slice_mah / ma * 3600.0;
+    }
+    return seconds;
+}
+
+void Battery::Update() {
+    double now = Model::instance().Time();
+    double dt = now - update_time;
+    update_time = now;
+    if (dt <= 0.0) {
+        return;
+    }
+
+    // What each consumer drew since the last reading, in mAs
+    double leds = static_cast<double>(led_control::Charge()) * 1e-3;
+    double led_delta = leds - led_mas;
+    led_mas = leds;
+
+    double radio = 0.0;
+    for (size_t c = 0; c < sizeof(radio_ma) / sizeof(radio_ma[0]); c++) {
+        radio += static_cast<double>(radio_ma[c]) * SX1280::instance().OperatingModeTime(static_cast<SX1280::RadioOperatingModes>(c));
+    }
+    double radio_delta = radio - radio_mas;
+    radio_mas = radio;
+
+    double display_delta = 0.0;
+    if (SDD1306::instance().DevicePresent() && SDD1306::instance().DisplayIsOn()) {
+        display_delta = static_cast<double>(display_ma + display_pixel_ma * static_cast<float>(SDD1306::instance().LitPixels())) * dt;
+    }
+    double system_delta = static_cast<double>(system_ma) * dt;
+
+    consumed.leds += led_delta * ( 1.0 / 3600.0 );
+    consumed.radio += radio_delta * ( 1.0 / 3600.0 );
+    consumed.display += display_delta * ( 1.0 / 3600.0 );
+    consumed.system += system_delta * ( 1.0 / 3600.0 );
+    effect_mah[Model::instance().Effect() % Model::EffectCount()] += led_delta * ( 1.0 / 3600.0 );
+
+    double delta_mah = ( led_delta + radio_delta + display_delta + system_delta ) * ( 1.0 / 3600.0 );
+    float ma = static_cast<float>(delta_mah * 3600.0 / dt);
+    float led_ma = static_cast<float>(led_delta / dt);
+    float demand_ma = led_control::CurrentDemand();
+    if (!average_valid) {
+        average_ma = ma;
+        average_led_ma = led_ma;
+        average_demand_ma = demand_ma;
+        average_valid = true;
+    } else {
+        float w = static_cast<float>(std::min(dt / average_time, 1.0));
+        average_ma += ( ma - average_ma ) * w;
+        average_led_ma += ( led_ma - average_led_ma ) * w;
+        average_demand_ma += ( demand_ma - average_demand_ma ) * w;
+    }
+
+    float voltage = Model::instance().BatteryVoltage();
+    if (voltage <= 0.0f) {
+        return;
+    }
+
+    // While charging VBUS carries the system and the cell takes the charge
+    // current, otherwise the cell carries the whole draw
+    charging = Model::instance().VbusVoltage() >= 4.0f;
+    float cell_ma = charging ? -Model::instance().ChargeCurrent() : Current();
+    float resting = voltage + cell_ma * ( internal_resistance / 1000.0f );
+    double measured = static_cast<double>(ChargeFromVoltage(resting) * capacity_mah);
+
+    if (!calibrated || charging) {
+        calibrated = true;
+        charge_mah = measured;
+        counted_mah = 0.0;
+        fit_n = fit_x = fit_y = fit_xx = fit_xy = 0.0;
+        return;
+    }
+
+    charge_mah -= delta_mah * static_cast<double>(current_scale);
+    charge_mah += ( measured - charge_mah ) * voltage_weight;
+
+    // The estimates are off by a factor which the voltage shows over time
+    counted_mah += delta_mah;
+    fit_n += 1.0;
+    fit_x += counted_mah;
+    fit_y += measured;
+    fit_xx += counted_mah * counted_mah;
+    fit_xy += counted_mah * measured;
+    double variance = fit_n * fit_xx - fit_x * fit_x;
+    if (counted_mah >= calibration_window * static_cast<double>(capacity_mah) && variance > 0.0) {
+        float scale = static_cast<float>(-( fit_n * fit_xy - fit_x * fit_y ) / variance);
+        current_scale = std::min(std::max(scale, 0.5f), 2.0f);
+    }
+}
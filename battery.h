@@ -0,0 +1,119 @@
+/*
+Copyright 2019 Tinic Uro
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef BATTERY_H_
+#define BATTERY_H_
+
+#include <cstdint>
+
+#include "./model.h"
+
+// Energy accounting and runtime prediction. The draw of the LEDs, radio,
+// display and the rest of the system is estimated from what each of them
+// is doing and counted off the cell. Every battery voltage sample pulls
+// the count towards the charge the voltage indicates, and the voltage drop
+// over longer stretches calibrates how far the estimates are off.
+class Battery {
+public:
+    static Battery &instance();
+
+    // Called with every charger ADC reading, after the model is updated
+    void Update();
+    void Reset();
+
+    struct Consumers {
+        double leds = 0.0;
+        double radio = 0.0;
+        double display = 0.0;
+        double system = 0.0;
+    };
+
+    // mAh drawn since boot by consumer and by LED effect, as estimated
+    const Consumers &Consumed() const { return consumed; }
+    double EffectConsumed(uint32_t effect) const { return effect < Model::EffectCount() ? effect_mah[effect] : 0.0; }
+
+    bool Calibrated() const { return calibrated; }
+    bool Charging() const { return charging; }
+    float StateOfCharge() const;
+    // Average draw in mA, corrected by the calibration
+    float Current() const { return average_ma * current_scale; }
+    float CurrentScale() const { return current_scale; }
+    // Seconds left at the average draw, with the LEDs held to the budget
+    // the limiter will have as the cell runs down. Negative while unknown
+    // or charging.
+    double Runtime() const;
+
+    // Resting voltage of the cell by state of charge and back
+    static float OpenCircuitVoltage(float charge);
+    static float ChargeFromVoltage(float voltage);
+
+    static constexpr float capacity_mah = 1000.0f;
+
+private:
+    // Cell resistance, the terminal voltage sags by this under load
+    static constexpr float internal_resistance = 0.15f;
+    // MCU and regulators
+    static constexpr float system_ma = 12.0f;
+    // SSD1306: controller and charge pump, and each lit pixel
+    static constexpr float display_ma = 0.5f;
+    static constexpr float display_pixel_ma = 0.01f;
+    // Time constant of the average draw in s
+    static constexpr double average_time = 60.0;
+    // How far each voltage sample pulls the count
+    static constexpr double voltage_weight = 0.02;
+    // Share of the capacity that has to be counted before the fit sets the
+    // current scale, ADC steps are worth several percent in the flat part
+    // of the discharge curve
+    static constexpr double calibration_window = 0.1;
+    // Charge slices the runtime is summed over
+    static constexpr uint32_t runtime_steps = 20;
+
+    double update_time = 0.0;
+    double led_mas = 0.0;
+    double radio_mas = 0.0;
+
+    Consumers consumed;
+    double effect_mah[Model::EffectCount()] = {};
+
+    float average_ma = 0.0f;
+    float average_led_ma = 0.0f;
+    float average_demand_ma = 0.0f;
+    float current_scale = 1.0f;
+    bool average_valid = false;
+
+    bool calibrated = false;
+    bool charging = false;
+    double charge_mah = 0.0;
+    // Least squares fit of the voltage derived charge over what was
+    // counted since the last charge, its slope is the current scale
+    double counted_mah = 0.0;
+    double fit_n = 0.0;
+    double fit_x = 0.0;
+    double fit_y = 0.0;
+    double fit_xx = 0.0;
+    double fit_xy = 0.0;
+
+    void init();
+    bool initialized = false;
+};
+
+#endif /* BATTERY_H_ */
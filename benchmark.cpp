@@ -0,0 +1,1843 @@
+/*
+Copyright 2019 Tinic Uro
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#include "./benchmark.h"
+
+#ifdef BENCHMARK
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <limits>
+#include <random>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "./emulator.h"
+#include "./commands.h"
+#include "./model.h"
+#include "./leds.h"
+#include "./ws2812.h"
+#include "./sdd1306.h"
+#include "./sx1280.h"
+#include "./timeline.h"
+#include "./battery.h"
+#include "./fast_math.h"
+#include "./random.h"
+
+Benchmark &Benchmark::instance() {
+    static Benchmark benchmark;
+    if (!benchmark.initialized) {
+        benchmark.initialized = true;
+        benchmark.init();
+    }
+    return benchmark;
+}
+
+void Benchmark::init() {
+}
+
+void Benchmark::FrameStats::Add(uint64_t ns, const emulator_counters &before) {
+    if (frames == 0 || ns < min_ns) {
+        min_ns = ns;
+    }
+    if (frames == 0 || ns > max_ns) {
+        max_ns = ns;
+    }
+    total_ns += ns;
+    frames++;
+    allocations += g_emulator_counters.allocations - before.allocations;
+    function_calls += g_emulator_counters.function_calls - before.function_calls;
+    qspi_transfer_ns += g_emulator_counters.qspi_transfer_ns - before.qspi_transfer_ns;
+    i2c_transactions += g_emulator_counters.i2c_transactions - before.i2c_transactions;
+    i2c_bytes += g_emulator_counters.i2c_bytes - before.i2c_bytes;
+    skipped += g_emulator_counters.led_frames_skipped - before.led_frames_skipped;
+    queued += g_emulator_counters.led_frames_queued - before.led_frames_queued;
+    qspi_bytes += g_emulator_counters.qspi_bytes - before.qspi_bytes;
+}
+
+uint64_t Benchmark::CPUTime() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+// Cycles where the host has a counter, like the DWT on the device
+uint64_t Benchmark::Cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return CPUTime();
+#endif
+}
+
+bool Benchmark::ParseArgs(int argc, char *argv[]) {
+    for (int c = 1; c < argc; c++) {
+        if (strcmp(argv[c], "--headless") == 0) {
+            headless = true;
+        } else if (strcmp(argv[c], "--bench") == 0) {
+            headless = true;
+            suite = true;
+        } else if (strcmp(argv[c], "--json") == 0) {
+            json = true;
+        } else if (strncmp(argv[c], "--json=", 7) == 0) {
+            json = true;
+            json_path = &argv[c][7];
+        } else if (strncmp(argv[c], "--telemetry=", 12) == 0) {
+            headless = true;
+            telemetry_path = &argv[c][12];
+        } else if (strncmp(argv[c], "--seed=", 7) == 0) {
+            Random::instance().SetSeed(static_cast<uint32_t>(strtoul(&argv[c][7], 0, 0)));
+        } else if (strncmp(argv[c], "--frames=", 9) == 0) {
+            int32_t n = atoi(&argv[c][9]);
+            if (n <= 0) {
+                fprintf(stderr, "invalid frame count: %s\n", &argv[c][9]);
+                return false;
+            }
+            frames = static_cast<uint32_t>(n);
+        } else {
+            fprintf(stderr, "usage: %s [--headless] [--bench] [--frames=N] [--seed=N] [--json[=FILE]] [--telemetry=FILE]\n", argv[0]);
+            return false;
+        }
+    }
+    if (json && !headless) {
+        fprintf(stderr, "--json requires --headless or --bench\n");
+        return false;
+    }
+    emulator_set_headless(headless);
+    return true;
+}
+
+void Benchmark::Tick() {
+    now_ms += tick_ms;
+    emulator_set_virtual_time(static_cast<double>(now_ms) * (1.0 / 1000.0));
+
+    Commands &commands = Commands::instance();
+
+    if (emulator_timer_task_due(&commands.update_leds_timer_task)) {
+        emulator_counters counters = g_emulator_counters;
+        uint64_t start = CPUTime();
+        commands.OnLEDTimer();
+        led_stats.Add(CPUTime() - start, counters);
+    }
+
+    if (emulator_timer_task_due(&commands.update_oled_timer_task)) {
+        emulator_counters counters = g_emulator_counters;
+        uint64_t start = CPUTime();
+        commands.OnOLEDTimer();
+        oled_stats.Add(CPUTime() - start, counters);
+    }
+
+    if (emulator_timer_task_due(&commands.update_adc_timer_task)) {
+        emulator_counters counters = g_emulator_counters;
+        uint64_t start = CPUTime();
+        commands.OnADCTimer();
+        adc_stats.Add(CPUTime() - start, counters);
+    }
+
+    commands.OnIdle();
+}
+
+void Benchmark::Settle(uint32_t ms) {
+    for (uint64_t end = now_ms + ms; now_ms < end; ) {
+        Tick();
+    }
+}
+
+void Benchmark::RunFrames(uint32_t led_frames) {
+    // Bounded, as the LED task stops once the effect is static
+    uint64_t target = led_stats.frames + led_frames;
+    for (uint64_t end = now_ms + 2 * led_frames * Commands::ledInterval; led_stats.frames < target && now_ms < end; ) {
+        Tick();
+    }
+}
+
+Benchmark::Result Benchmark::Measure(uint32_t ms) {
+    led_stats.Reset();
+    oled_stats.Reset();
+    adc_stats.Reset();
+
+    Settle(ms);
+
+    Result result;
+    result.window_ms = ms;
+    result.led = led_stats;
+    result.oled = oled_stats;
+    result.adc = adc_stats;
+    return result;
+}
+
+Benchmark::Result Benchmark::MeasureEffect(uint32_t effect) {
+    // As the effect switch does it
+    Model::instance().SetEffect(effect);
+    Commands::instance().Wake(Timeline::Span::Effect);
+    Settle(warmup_ms);
+
+    // As long as the requested frames take at the full frame rate
+    Result result = Measure(frames * Commands::ledInterval);
+    result.from = effect;
+    result.to = effect;
+
+    uint64_t start = CPUTime();
+    led_control::CalcEffect(effect, effect_calc_frames);
+    result.calc_ns = (CPUTime() - start) / effect_calc_frames;
+    return result;
+}
+
+Benchmark::Result Benchmark::MeasureCrossfade(uint32_t from, uint32_t to) {
+    Model::instance().SetEffect(from);
+    Commands::instance().Wake(Timeline::Span::Effect);
+    Settle(warmup_ms);
+
+    led_stats.Reset();
+    oled_stats.Reset();
+    adc_stats.Reset();
+
+    // Exactly the frames which fall inside the blend window
+    Model::instance().SetEffect(to);
+    Commands::instance().Wake(Timeline::Span::Effect);
+    RunFrames(crossfade_ms / Commands::ledInterval);
+
+    Result result;
+    result.from = from;
+    result.to = to;
+    result.led = led_stats;
+    result.oled = oled_stats;
+    result.adc = adc_stats;
+    return result;
+}
+
+Benchmark::Result Benchmark::MeasureBlackout() {
+    // An animated effect at brightness 0 only sends the keep-alive frames
+    float brightness = Model::instance().Brightness();
+    Model::instance().SetBrightness(0.0f);
+    Result result = MeasureEffect(blackout_effect);
+    Model::instance().SetBrightness(brightness);
+    return result;
+}
+
+Benchmark::EncoderResult Benchmark::MeasureEncoder() {
+    // One frame worth of components: 16 LEDs and the center, 3 components each
+    static constexpr size_t components = 17 * 3;
+    static uint8_t input[components][4];
+    static uint8_t reference[components * ws2812::bytes_per_component];
+    static uint8_t table[components * ws2812::bytes_per_component];
+
+    EncoderResult result;
+
+    auto encode = [](uint8_t *(*func)(uint8_t, uint8_t, uint8_t, uint8_t, uint8_t *), uint8_t *out) {
+        for (size_t c = 0; c < components; c++) {
+            out = func(input[c][0], input[c][1], input[c][2], input[c][3], out);
+        }
+    };
+
+    // Every value on every rail, then pseudo random combinations
+    uint32_t seed = 0x12345678;
+    for (uint32_t iter = 0; iter < 256 * 4 + 4096; iter++) {
+        for (size_t c = 0; c < components; c++) {
+            for (size_t r = 0; r < 4; r++) {
+                seed = seed * 1664525 + 1013904223;
+                input[c][r] = static_cast<uint8_t>(seed >> 24);
+            }
+            if (iter < 256 * 4) {
+                input[c][iter / 256] = static_cast<uint8_t>(iter);
+            }
+        }
+        encode(ws2812::encode4_reference, reference);
+        encode(ws2812::encode4, table);
+        if (memcmp(reference, table, sizeof(table)) != 0) {
+            result.mismatches++;
+        }
+    }
+    result.equivalent = result.mismatches == 0;
+
+    uint64_t start = CPUTime();
+    for (uint32_t c = 0; c < encoder_frames; c++) {
+        encode(ws2812::encode4_reference, reference);
+        __asm__ __volatile__("" : : "r"(reference) : "memory");
+    }
+    result.reference_ns = (CPUTime() - start) / encoder_frames;
+
+    start = CPUTime();
+    for (uint32_t c = 0; c < encoder_frames; c++) {
+        encode(ws2812::encode4, table);
+        __asm__ __volatile__("" : : "r"(table) : "memory");
+    }
+    result.table_ns = (CPUTime() - start) / encoder_frames;
+
+    return result;
+}
+
+Benchmark::ColorResult Benchmark::MeasureColorPipeline() {
+    ColorResult result;
+    result.max_error = led_control::FixedPointColorError();
+    result.gradient_error = led_control::GradientTableError();
+    led_control::GradientMemory(result.gradient_ram_before, result.gradient_ram_after, result.gradient_flash);
+
+    volatile uint32_t sink = 0;
+
+    uint64_t start = CPUTime();
+    sink = sink + led_control::SampleColorPipeline(false, color_samples);
+    result.float_ns = CPUTime() - start;
+
+    start = CPUTime();
+    sink = sink + led_control::SampleColorPipeline(true, color_samples);
+    result.fixed_ns = CPUTime() - start;
+
+    return result;
+}
+
+// The sextant switch colors::rgb(const hsv &) was before fastmath::hsv2rgb
+static void hsv_sextants(float h, float s, float v, float &r, float &g, float &b) {
+    int32_t rd = static_cast<int32_t>( 6.0f * h );
+    float f = h * 6.0f - static_cast<float>(rd);
+    float p = v * (1.0f - s);
+    float q = v * (1.0f - f * s);
+    float t = v * (1.0f - (1.0f - f) * s);
+    switch ( rd  % 6 ) {
+        default:
+        case 0: r = v; g = t; b = p; break;
+        case 1: r = q; g = v; b = p; break;
+        case 2: r = p; g = v; b = t; break;
+        case 3: r = p; g = q; b = v; break;
+        case 4: r = t; g = p; b = v; break;
+        case 5: r = v; g = p; b = q; break;
+    }
+}
+
+const char *Benchmark::FastMathName(size_t function) {
+    static const char *names[fast_math_functions] = { "sin", "cos", "exp2", "log2", "pow", "fract", "hsv2rgb" };
+    return function < fast_math_functions ? names[function] : "";
+}
+
+Benchmark::FastMathResult Benchmark::MeasureFastMath() {
+    FastMathResult result;
+    result.within = true;
+
+    auto check = [&result](size_t function, double error, double bound) {
+        result.max_error[function] = std::max(result.max_error[function], error);
+        if (!(error <= bound)) {
+            result.within = false;
+        }
+    };
+
+    // Errors, each against the bound documented in fast_math.h. Radians up
+    // to 64 cover the effect arguments over the first minute after a time
+    // wrap; beyond that the rounding to turns is the same as libm's.
+    for (uint32_t c = 0; c <= fast_math_calls; c++) {
+        float u = static_cast<float>(c) / static_cast<float>(fast_math_calls);
+
+        float x = (u * 2.0f - 1.0f) * 64.0f;
+        double sin_bound = 1e-6 + fabs(static_cast<double>(x)) * (1.0 / 4194304.0);
+        check(0, fabs(static_cast<double>(fastmath::sin(x)) - sin(static_cast<double>(x))), sin_bound);
+        check(1, fabs(static_cast<double>(fastmath::cos(x)) - cos(static_cast<double>(x))), sin_bound);
+
+        float e = -125.0f + u * 252.999f;
+        double exp2_exact = exp2(static_cast<double>(e));
+        check(2, fabs(static_cast<double>(fastmath::exp2(e)) - exp2_exact) / exp2_exact, 2e-7);
+
+        float l = exp2f(-126.0f + u * 253.999f);
+        double log2_exact = log2(static_cast<double>(l));
+        check(3, fabs(static_cast<double>(fastmath::log2(l)) - log2_exact), 4e-7 + fabs(log2_exact) * (1.0 / 16777216.0));
+
+        // Gamma like exponents of colors in [2^-16, 1]
+        static constexpr float exponents[] = { 0.25f, 0.5f, 1.0f / 2.2f, 2.0f, 2.2f, 4.0f };
+        float p = exp2f(-16.0f * u);
+        for (float y : exponents) {
+            if (fabsf(y * log2f(p)) <= 16.0f) {
+                double pow_exact = pow(static_cast<double>(p), static_cast<double>(y));
+                check(4, fabs(static_cast<double>(fastmath::pow(p, y)) - pow_exact) / pow_exact, 1e-6);
+            }
+        }
+
+        float f = (u * 2.0f - 1.0f) * 1000.0f;
+        double fract_exact = static_cast<double>(f) - floor(static_cast<double>(f));
+        check(5, fabs(static_cast<double>(fastmath::fract(f)) - fract_exact), 1.0 / 33554432.0);
+
+        for (float s : { 0.0f, 0.5f, 1.0f }) {
+            float r0, g0, b0, r1, g1, b1;
+            fastmath::hsv2rgb(u, s, 1.0f, r0, g0, b0);
+            hsv_sextants(u, s, 1.0f, r1, g1, b1);
+            check(6, static_cast<double>(std::max({ fabsf(r0 - r1), fabsf(g0 - g1), fabsf(b0 - b1) })), 1e-6);
+        }
+    }
+
+    // Cost per call, against libm and the former hsv switch
+    auto measure = [](auto function, float step) {
+        float x = 0.0f;
+        uint64_t start = Cycles();
+        for (uint32_t c = 0; c < fast_math_calls; c++) {
+            float y = function(x);
+            x += step;
+            __asm__ __volatile__("" : : "g"(y) : "memory");
+        }
+        return static_cast<double>(Cycles() - start) / fast_math_calls;
+    };
+    static constexpr float step = 64.0f / fast_math_calls;
+
+    result.libm_cycles[0] = measure([](float x) { return sinf(x); }, step);
+    result.fast_cycles[0] = measure([](float x) { return fastmath::sin(x); }, step);
+    result.libm_cycles[1] = measure([](float x) { return cosf(x); }, step);
+    result.fast_cycles[1] = measure([](float x) { return fastmath::cos(x); }, step);
+    result.libm_cycles[2] = measure([](float x) { return exp2f(x - 32.0f); }, step);
+    result.fast_cycles[2] = measure([](float x) { return fastmath::exp2(x - 32.0f); }, step);
+    result.libm_cycles[3] = measure([](float x) { return log2f(x + 0.001f); }, step);
+    result.fast_cycles[3] = measure([](float x) { return fastmath::log2(x + 0.001f); }, step);
+    result.libm_cycles[4] = measure([](float x) { return powf(x * (1.0f / 64.0f), 0.5f); }, step);
+    result.fast_cycles[4] = measure([](float x) { return fastmath::pow(x * (1.0f / 64.0f), 0.5f); }, step);
+    result.libm_cycles[5] = measure([](float x) { return fmodf(x, 1.0f); }, step);
+    result.fast_cycles[5] = measure([](float x) { return fastmath::fract(x); }, step);
+    result.libm_cycles[6] = measure([](float x) {
+        float r, g, b;
+        hsv_sextants(x, 1.0f, 1.0f, r, g, b);
+        return r + g + b;
+    }, 1.0f / fast_math_calls);
+    result.fast_cycles[6] = measure([](float x) {
+        float r, g, b;
+        fastmath::hsv2rgb(x, 1.0f, 1.0f, r, g, b);
+        return r + g + b;
+    }, 1.0f / fast_math_calls);
+
+    return result;
+}
+
+Benchmark::EffectStateResult Benchmark::MeasureEffectState() {
+    EffectStateResult result;
+    led_control::EffectStateMemory(result.ram_before, result.ram_after);
+
+    auto effect = [this](uint32_t index, uint32_t ms) {
+        Model::instance().SetEffect(index);
+        Commands::instance().Wake(Timeline::Span::Effect);
+        Settle(ms);
+        return led_control::EffectStateSlots();
+    };
+
+    result.slots_steady = effect(state_effect_from, warmup_ms);
+    result.slots_crossfade = effect(state_effect_to, crossfade_ms / 2);
+    Settle(warmup_ms);
+    result.slots_after = led_control::EffectStateSlots();
+    result.slots_stateless = effect(0, warmup_ms);
+    result.lifetime = result.slots_steady == 1 && result.slots_crossfade == 2 &&
+                      result.slots_after == 1 && result.slots_stateless == 0;
+    return result;
+}
+
+Benchmark::RandomResult Benchmark::MeasureRandom() {
+    RandomResult result;
+    result.ram_before = sizeof(std::mt19937) +
+                        sizeof(std::uniform_real_distribution<float>) +
+                        sizeof(std::uniform_int_distribution<int32_t>);
+    result.ram_after = sizeof(Random::Stream);
+
+    auto measure = [](auto function) {
+        uint64_t start = Cycles();
+        for (uint32_t c = 0; c < random_calls; c++) {
+            auto y = function();
+            __asm__ __volatile__("" : : "g"(y) : "memory");
+        }
+        return static_cast<double>(Cycles() - start) / random_calls;
+    };
+
+    std::mt19937 gen;
+    std::uniform_real_distribution<float> disf { +0.001f, +0.005f };
+    std::uniform_int_distribution<int32_t> disi { 0, 511 };
+    Random::Stream stream(Random::instance().Seed());
+    result.mt_float_cycles = measure([&]() { return disf(gen); });
+    result.mt_int_cycles = measure([&]() { return disi(gen); });
+    result.stream_float_cycles = measure([&]() { return stream.Uniform(+0.001f, +0.005f); });
+    result.stream_int_cycles = measure([&]() { return stream.Bounded(512); });
+
+    // Two runs from the same seed hand out the same streams, and the
+    // streams of one run draw different numbers
+    uint32_t seed = Random::instance().Seed();
+    Random::instance().SetSeed(seed);
+    Random::Stream a0 = Random::instance().NewStream();
+    Random::Stream a1 = Random::instance().NewStream();
+    Random::instance().SetSeed(seed);
+    Random::Stream b0 = Random::instance().NewStream();
+    Random::Stream b1 = Random::instance().NewStream();
+    result.deterministic = true;
+    uint32_t same = 0;
+    for (uint32_t c = 0; c < random_calls; c++) {
+        uint32_t x0 = a0.Get();
+        uint32_t x1 = a1.Get();
+        if (x0 != b0.Get() || x1 != b1.Get()) {
+            result.deterministic = false;
+        }
+        same += x0 == x1 ? 1 : 0;
+    }
+    result.independent = same < random_calls / 65536;
+
+    result.in_range = true;
+    for (uint32_t c = 0; c < random_calls; c++) {
+        uint32_t n = c % 1000 + 1;
+        float f = stream.Uniform(-1.0f, +1.0f);
+        float s = stream.Sign();
+        if (stream.Bounded(n) >= n || f < -1.0f || f >= +1.0f || (s != -1.0f && s != +1.0f)) {
+            result.in_range = false;
+        }
+    }
+    return result;
+}
+
+const char *Benchmark::BlendModeName(size_t mode) {
+    static const char *names[blend_modes] = { "crossfade", "add", "multiply", "mask" };
+    return mode < blend_modes ? names[mode] : "";
+}
+
+const char *Benchmark::OverlayName(size_t overlay) {
+    static const char *names[overlays] = { "message", "bird_color", "ring_color" };
+    return overlay < overlays ? names[overlay] : "";
+}
+
+Benchmark::CompositorResult Benchmark::MeasureCompositor() {
+    CompositorResult result;
+    result.exact = true;
+    for (size_t c = 0; c < blend_modes; c++) {
+        result.blend_error[c] = led_control::BlendError(static_cast<uint32_t>(c));
+        if (!(result.blend_error[c] <= blend_max_error)) {
+            result.exact = false;
+        }
+    }
+
+    Model::instance().SetEffect(compositor_from);
+    Commands::instance().Wake(Timeline::Span::Effect);
+    Settle(warmup_ms);
+
+    // Both effects calculated and crossfaded
+    led_stats.Reset();
+    Model::instance().SetEffect(compositor_effect);
+    Commands::instance().Wake(Timeline::Span::Effect);
+    RunFrames(crossfade_ms / Commands::ledInterval);
+    result.crossfade = led_stats;
+
+    Settle(warmup_ms);
+    led_stats.Reset();
+    RunFrames(overlay_frames);
+    result.effect = led_stats;
+
+    const colors::rgb8 color(0xFF, 0x40, 0x00);
+    auto overlay = [color](size_t index, bool remove) {
+        switch (index) {
+            case 0:
+                // Not removable, runs for as long as a received message
+                if (!remove) {
+                    led_control::PerformV2MessageEffect(color.hex());
+                }
+                break;
+            case 1:
+                led_control::PerformColorBirdDisplay(color, remove);
+                break;
+            case 2:
+                led_control::PerformColorRingDisplay(color, remove);
+                break;
+        }
+    };
+
+    for (size_t c = 0; c < overlays; c++) {
+        led_stats.Reset();
+        overlay(c, false);
+        RunFrames(overlay_fade_ms / Commands::ledInterval);
+        result.fading[c] = led_stats;
+
+        led_stats.Reset();
+        RunFrames(overlay_frames);
+        result.opaque[c] = led_stats;
+
+        overlay(c, true);
+        Settle(c == 0 ? message_ms : warmup_ms);
+    }
+    return result;
+}
+
+Benchmark::DitherResult Benchmark::MeasureDither() {
+    DitherResult result;
+    result.smoother = true;
+    for (size_t c = 0; c < brightness_steps; c++) {
+        float brightness = static_cast<float>(c + 1) / static_cast<float>(brightness_steps);
+        led_control::GrayLevels(brightness, result.truncated[c], result.dithered[c]);
+        if (result.dithered[c] <= result.truncated[c]) {
+            result.smoother = false;
+        }
+    }
+
+    volatile uint32_t sink = 0;
+
+    uint64_t start = CPUTime();
+    sink = sink + led_control::EncodeFrames(false, encoder_frames);
+    result.plain_ns = (CPUTime() - start) / encoder_frames;
+
+    start = CPUTime();
+    sink = sink + led_control::EncodeFrames(true, encoder_frames);
+    result.dither_ns = (CPUTime() - start) / encoder_frames;
+
+    return result;
+}
+
+Benchmark::PowerResult Benchmark::MeasurePower(uint32_t effect) {
+    Model::instance().SetEffect(effect);
+    Commands::instance().Wake(Timeline::Span::Effect);
+    Settle(warmup_ms);
+
+    PowerResult result;
+    for (int limited = 0; limited < 2; limited++) {
+        led_control::SetCurrentLimiter(limited != 0);
+        double total_ma = 0.0;
+        double hours = 0.0;
+        for (size_t step = 0; step < discharge_steps; step++) {
+            // Each step draws an equal share of the capacity at the middle
+            // of its charge range, as the ADC task would report it
+            double charge = 1.0 - ( static_cast<double>(step) + 0.5 ) / discharge_steps;
+            emulator_bq25895_set_adc(Battery::OpenCircuitVoltage(static_cast<float>(charge)), 0.0f, 0.0f);
+            Commands::instance().OnADCTimer();
+            Settle(warmup_ms);
+
+            double sum = 0.0;
+            for (uint32_t t = 0; t < discharge_step_ms; t += tick_ms) {
+                Tick();
+                sum += static_cast<double>(led_control::Current());
+            }
+            double ma = sum * tick_ms / discharge_step_ms;
+            total_ma += ma;
+            hours += ( battery_mah / discharge_steps ) / ( ma + system_ma );
+            if (limited) {
+                result.over_budget = std::max(result.over_budget, ma / static_cast<double>(led_control::CurrentBudget()) - 1.0);
+            }
+        }
+        ( limited ? result.limited_ma : result.unlimited_ma ) = total_ma / discharge_steps;
+        ( limited ? result.limited_h : result.unlimited_h ) = hours;
+    }
+
+    // Back to the charged battery the emulator starts with
+    emulator_bq25895_set_adc(Battery::OpenCircuitVoltage(0.8f), 0.0f, 0.0f);
+    Commands::instance().OnADCTimer();
+    return result;
+}
+
+bool Benchmark::LoadTelemetry(const char *path, std::vector<TelemetrySample> &samples) {
+    // One reading per line: seconds, battery V, VBUS V and charge current
+    // in mA, as logged from the charger ADC. # starts a comment.
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "could not open %s\n", path);
+        return false;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        if (line[0] == '#' || line[strspn(line, " \t\r\n")] == 0) {
+            continue;
+        }
+        TelemetrySample sample;
+        if (sscanf(line, "%lf %f %f %f", &sample.time, &sample.battery, &sample.vbus, &sample.charge_current) != 4 ||
+            (!samples.empty() && sample.time <= samples.back().time)) {
+            fprintf(stderr, "invalid telemetry line: %s", line);
+            fclose(file);
+            return false;
+        }
+        samples.push_back(sample);
+    }
+    fclose(file);
+    if (samples.size() < 2) {
+        fprintf(stderr, "%s holds fewer than two readings\n", path);
+        return false;
+    }
+    return true;
+}
+
+std::vector<Benchmark::TelemetrySample> Benchmark::RecordDischarge() {
+    // A full cell drained by what the accounting estimates, times the bias
+    // of everything it does not model. What the charger ADC reports along
+    // the way is the log.
+    Model::instance().SetEffect(prediction_effect);
+    Commands::instance().Wake(Timeline::Span::Effect);
+    Settle(warmup_ms);
+
+    Battery &battery = Battery::instance();
+    battery.Reset();
+    std::vector<TelemetrySample> samples;
+    double charge_mah = static_cast<double>(Battery::capacity_mah);
+    double start = static_cast<double>(now_ms) * ( 1.0 / 1000.0 );
+    double ma = 0.0;
+    for (;;) {
+        TelemetrySample sample;
+        sample.time = static_cast<double>(now_ms) * ( 1.0 / 1000.0 ) - start;
+        sample.battery = Battery::OpenCircuitVoltage(static_cast<float>(charge_mah) / Battery::capacity_mah) - static_cast<float>(ma * cell_resistance / 1000.0);
+        samples.push_back(sample);
+        if (charge_mah <= 0.0) {
+            break;
+        }
+        emulator_bq25895_set_adc(sample.battery, sample.vbus, sample.charge_current);
+
+        Battery::Consumers before = battery.Consumed();
+        Settle(Commands::adcInterval);
+        const Battery::Consumers &after = battery.Consumed();
+        double drawn = ( ( after.leds - before.leds ) + ( after.radio - before.radio ) +
+                         ( after.display - before.display ) + ( after.system - before.system ) ) * discharge_bias;
+        charge_mah -= drawn;
+        ma = drawn * 3600.0 * 1000.0 / Commands::adcInterval;
+    }
+    return samples;
+}
+
+Benchmark::PredictionResult Benchmark::ReplayTelemetry(const std::vector<TelemetrySample> &samples) {
+    Battery &battery = Battery::instance();
+    battery.Reset();
+
+    PredictionResult result;
+    result.samples = samples.size();
+    result.runtime_s = samples.back().time - samples.front().time;
+
+    size_t point = 0;
+    size_t counted = 0;
+    double start = static_cast<double>(now_ms) * ( 1.0 / 1000.0 ) - samples.front().time;
+    for (const TelemetrySample &sample : samples) {
+        double time = start + sample.time;
+        if (time * 1000.0 > static_cast<double>(now_ms)) {
+            Settle(static_cast<uint32_t>(time * 1000.0 - static_cast<double>(now_ms)));
+        }
+        emulator_bq25895_set_adc(sample.battery, sample.vbus, sample.charge_current);
+        Commands::instance().OnADCTimer();
+
+        double elapsed = ( sample.time - samples.front().time ) / result.runtime_s;
+        double actual = samples.back().time - sample.time;
+        double predicted = battery.Runtime();
+        if (point < prediction_points && elapsed >= 0.25 * static_cast<double>(point + 1)) {
+            result.predicted_s[point] = predicted;
+            result.actual_s[point] = actual;
+            point++;
+        }
+        if (elapsed >= prediction_settle && predicted >= 0.0) {
+            double error = std::abs(predicted - actual) / result.runtime_s;
+            result.max_error = std::max(result.max_error, error);
+            result.mean_error += error;
+            counted++;
+        }
+    }
+    result.mean_error = counted ? result.mean_error / static_cast<double>(counted) : 0.0;
+    result.current_scale = battery.CurrentScale();
+    result.leds_mah = battery.Consumed().leds;
+    result.radio_mah = battery.Consumed().radio;
+    result.display_mah = battery.Consumed().display;
+    result.system_mah = battery.Consumed().system;
+    for (uint32_t effect = 0; effect < Model::EffectCount(); effect++) {
+        result.effect_mah[effect] = battery.EffectConsumed(effect);
+    }
+
+    // Back to the charged battery the emulator starts with
+    emulator_bq25895_set_adc(Battery::OpenCircuitVoltage(0.8f), 0.0f, 0.0f);
+    Commands::instance().OnADCTimer();
+    battery.Reset();
+    return result;
+}
+
+Benchmark::DisplayResult Benchmark::MeasureDisplay() {
+    SDD1306 &display = SDD1306::instance();
+
+    DisplayResult result;
+
+    // Frames are spaced like the OLED timer so the modeled panel scrolls at
+    // its real rate, and every frame is checked against the modeled panel
+    const uint32_t interval = Commands::oledInterval;
+    auto measure = [this, &display, &result, interval](uint32_t count, auto &&frame) {
+        FrameStats stats;
+        // The first frame repaints whatever the previous scenario left behind
+        frame(0);
+        display.Display();
+        for (uint32_t c = 1; c <= count; c++) {
+            now_ms += interval;
+            emulator_set_virtual_time(static_cast<double>(now_ms) * (1.0 / 1000.0));
+            emulator_counters counters = g_emulator_counters;
+            uint64_t start = CPUTime();
+            frame(c);
+            display.Display();
+            stats.Add(CPUTime() - start, counters);
+            if (!display.VerifyPanel()) {
+                result.panel_mismatches++;
+            }
+        }
+        return stats;
+    };
+
+    display.SetBootScreen(false, 0);
+    display.SetAsciiScrollMessage(0, 0);
+    display.SetCenterFlip(0);
+    display.SetVerticalShift(0);
+    display.Clear();
+
+    // A setting being dialed in: the value changes every frame, the
+    // label and the cursor attribute every few frames
+    result.menu = measure(display_frames, [&display](uint32_t c) {
+        static const char *labels[] = { "BRIGHTNESS  ", "COLOR       ", "SPEED       " };
+        char value[13];
+        snprintf(value, sizeof(value), "%12u", static_cast<unsigned>(c * 7));
+        display.PlaceUTF8String(0, 0, labels[(c / 16) % 3]);
+        display.PlaceUTF8String(0, 1, value);
+        display.ClearAttr();
+        display.SetAttr((c / 4) % 12, 1, 1);
+    });
+
+    // One column per frame, which the controller's scroll rate doesn't
+    // follow, so scrolled in software
+    display.EnableHardwareScroll(false);
+    result.scroll = measure(display_frames, [&display](uint32_t c) {
+        display.SetAsciiScrollMessage("DUCK HUNT PENDANT 2019 ", static_cast<int32_t>(c));
+    });
+    display.SetAsciiScrollMessage(0, 0);
+
+    // One received message as the message span formats and shows it: the
+    // text walks in from the right at 128 columns/s, first in software, then
+    // scrolled by the controller with the rest fed into display RAM
+    uint64_t visible_writes = emulator_oled_visible_writes_while_scrolling();
+    char text[64];
+    snprintf(text, sizeof(text), "%8.8s : %8.8s", "DUCKLING", "QUACK!");
+    auto message = [&display, &text, interval](uint32_t c) {
+        display.SetAsciiScrollMessage(text, static_cast<int32_t>(c * interval * 128 / 1000) - 96);
+    };
+    auto show_message = [&](bool hardware, FrameStats &stats) {
+        display.EnableHardwareScroll(hardware);
+        uint64_t bytes = g_emulator_counters.i2c_bytes;
+        stats = measure(message_ms / interval, message);
+        display.SetAsciiScrollMessage(0, 0);
+        display.Display();
+        if (!display.VerifyPanel()) {
+            result.panel_mismatches++;
+        }
+        // Includes the upload and the repaint once the message is gone
+        return g_emulator_counters.i2c_bytes - bytes;
+    };
+    result.message_software_bytes = show_message(false, result.message_software);
+    result.message_hardware_bytes = show_message(true, result.message_hardware);
+    result.visible_writes_while_scrolling = emulator_oled_visible_writes_while_scrolling() - visible_writes;
+
+    display.PlaceUTF8String(0, 0, "DUCK HUNT   ");
+    display.PlaceUTF8String(0, 1, "PENDANT 2019");
+    display.ClearAttr();
+    result.center_flip = measure(display_frames, [&display](uint32_t c) {
+        display.SetCenterFlip(static_cast<int8_t>(48 - (c % 49)));
+    });
+    display.SetCenterFlip(0);
+    display.Display();
+
+    return result;
+}
+
+Benchmark::RadioResult Benchmark::MeasureRadio() {
+    // A V3 message as it goes out over the air
+    uint8_t payload[42];
+    for (size_t c = 0; c < sizeof(payload); c++) {
+        payload[c] = static_cast<uint8_t>(c);
+    }
+
+    emulator_counters counters = g_emulator_counters;
+    SX1280::instance().LoraTxStart(payload, sizeof(payload));
+
+    RadioResult result;
+    result.transfers = g_emulator_counters.spi_transfers - counters.spi_transfers;
+    result.bytes = g_emulator_counters.spi_bytes - counters.spi_bytes;
+    result.dma_transfers = g_emulator_counters.spi_dma_transfers - counters.spi_dma_transfers;
+
+    // TX done to listening again: the DIO1 edge runs ProcessIrqs, which
+    // hands the radio back to SetLoraRX. Forgetting the shadow after the
+    // TX start reproduces a driver that reconfigures everything.
+    auto turnaround = [&](bool invalidate) {
+        SX1280::instance().LoraTxStart(payload, sizeof(payload));
+        if (invalidate) {
+            SX1280::instance().InvalidateShadow();
+        }
+        emulator_counters before = g_emulator_counters;
+        emulator_raise_irq(PIN_PB09);
+        RadioTurnaround t;
+        t.transfers = g_emulator_counters.spi_transfers - before.spi_transfers;
+        t.bytes = g_emulator_counters.spi_bytes - before.spi_bytes;
+        t.wire_ns = g_emulator_counters.spi_wire_ns - before.spi_wire_ns;
+        t.listening = SX1280::instance().GetOperatingMode() == SX1280::MODE_RX;
+        return t;
+    };
+    result.turnaround_full = turnaround(true);
+    result.turnaround_cached = turnaround(false);
+    return result;
+}
+
+Benchmark::PersistenceResult Benchmark::MeasurePersistence() {
+    Model &model = Model::instance();
+    PersistenceResult result;
+    result.saves = persistence_saves;
+
+    // What every save cost before the journal: the HAL rewrites the whole
+    // block around the last page
+    emulator_flash_reset();
+    uint32_t page_size = flash_get_page_size(&FLASH_0);
+    uint32_t legacy_page = flash_get_total_pages(&FLASH_0) - 1;
+    uint8_t page[512];
+    memset(page, 0x5A, sizeof(page));
+    emulator_counters counters = g_emulator_counters;
+    for (uint32_t c = 0; c < persistence_saves; c++) {
+        flash_write(&FLASH_0, legacy_page * page_size, page, sizeof(page));
+    }
+    result.legacy_bytes = g_emulator_counters.flash_bytes_programmed - counters.flash_bytes_programmed;
+    result.legacy_erases = g_emulator_counters.flash_erases - counters.flash_erases;
+    result.legacy_max_block_erases = emulator_flash_max_block_erases();
+
+    // Received messages interleaved with sent message counts, each saved
+    emulator_flash_reset();
+    model.load();
+    counters = g_emulator_counters;
+    for (uint32_t c = 0; c < persistence_saves; c++) {
+        if (c & 1) {
+            model.IncSentMessageCount();
+            model.flush(true);
+        } else {
+            struct Model::Message msg = {};
+            msg.datetime = c;
+            msg.uid = 0x1000 + c;
+            msg.cnt = static_cast<uint16_t>(c);
+            memcpy(msg.name, "DUCKLING    ", sizeof(msg.name));
+            snprintf(reinterpret_cast<char *>(msg.message), sizeof(msg.message), "QUACK %5u", static_cast<unsigned>(c));
+            model.PushRecvMessage(msg);
+            model.save();
+            model.flush(true);
+        }
+    }
+    result.journal_bytes = g_emulator_counters.flash_bytes_programmed - counters.flash_bytes_programmed;
+    result.journal_erases = g_emulator_counters.flash_erases - counters.flash_erases;
+    result.journal_max_block_erases = emulator_flash_max_block_erases();
+
+    // Boot: replay has to reproduce exactly what was saved
+    static uint8_t saved[Model::keyCount][Journal::max_payload];
+    size_t saved_size[Model::keyCount];
+    for (uint8_t key = 0; key < Model::keyCount; key++) {
+        saved_size[key] = model.EncodeRecord(key, saved[key]);
+    }
+    counters = g_emulator_counters;
+    uint64_t start = CPUTime();
+    model.load();
+    result.replay_ns = CPUTime() - start;
+    result.replay_bytes = g_emulator_counters.flash_bytes_read - counters.flash_bytes_read;
+    result.replay_records = model.journal.Records();
+    result.round_trip = true;
+    for (uint8_t key = 0; key < Model::keyCount; key++) {
+        uint8_t loaded[Journal::max_payload];
+        if (model.EncodeRecord(key, loaded) != saved_size[key] || saved_size[key] != Model::RecordSize(key) ||
+            memcmp(loaded, saved[key], saved_size[key]) != 0) {
+            result.round_trip = false;
+        }
+    }
+
+    // A burst of received V3 messages through the radio callback, first
+    // written on every message as the RX path used to, then deferred
+    auto receive = [&](uint32_t index) {
+        uint8_t payload[42] = { 0 };
+        memcpy(payload, "DUCK", 4);
+        payload[7] = static_cast<uint8_t>(index);
+        payload[17] = static_cast<uint8_t>(index);
+        memcpy(&payload[18], "DUCKLING    ", 12);
+        snprintf(reinterpret_cast<char *>(&payload[30]), 12, "BURST %5u", static_cast<unsigned>(index));
+        SX1280::PacketStatus status;
+        memset(&status, 0, sizeof(status));
+        SX1280::instance().RxDone(payload, sizeof(payload), status);
+    };
+
+    counters = g_emulator_counters;
+    for (uint32_t c = 0; c < burst_messages; c++) {
+        receive(c);
+        model.flush(true);
+    }
+    result.burst_sync_writes = g_emulator_counters.flash_writes - counters.flash_writes;
+    result.burst_sync_bytes = g_emulator_counters.flash_bytes_programmed - counters.flash_bytes_programmed;
+
+    counters = g_emulator_counters;
+    for (uint32_t c = 0; c < burst_messages; c++) {
+        receive(burst_messages + c);
+        Settle(burst_spacing_ms);
+    }
+    Settle(static_cast<uint32_t>(Model::saveInterval * 1000.0) + Commands::adcInterval);
+    result.burst_deferred_writes = g_emulator_counters.flash_writes - counters.flash_writes;
+    result.burst_deferred_bytes = g_emulator_counters.flash_bytes_programmed - counters.flash_bytes_programmed;
+    result.burst_persisted = !model.Dirty();
+    return result;
+}
+
+Benchmark::TimelineResult Benchmark::MeasureTimeline() {
+    static Timeline::Span spans[timeline_spans];
+    static Timeline::Span *list[timeline_spans];
+    static const Timeline::Span::Type types[] = { Timeline::Span::Effect, Timeline::Span::Display, Timeline::Span::Message, Timeline::Span::Measurement };
+    Model &model = Model::instance();
+    ticks_t saved_ticks = model.Ticks();
+    ticks_t start_ticks = 1000 * ticks_per_second;
+
+    // The single list the timeline used to be: newest first, every lookup
+    // walks spans of all types
+    size_t list_num = 0;
+    auto list_process = [&](Timeline::Span::Type type, ticks_t now) {
+        size_t kept = 0;
+        for (size_t c = 0; c < list_num; c++) {
+            Timeline::Span *i = list[c];
+            if (i->type == type && !i->Infinite() && (i->End() < now)) {
+                continue;
+            }
+            list[kept++] = i;
+        }
+        list_num = kept;
+    };
+    auto list_top = [&](Timeline::Span::Type type, const Timeline::Span *context, ticks_t now) -> Timeline::Span * {
+        for (size_t c = 0; c < list_num; c++) {
+            Timeline::Span *i = list[c];
+            if (i != context && i->type == type && i->time <= now &&
+                i->End() > now) {
+                return i;
+            }
+        }
+        return 0;
+    };
+
+    // Hundreds of spans over 20 seconds of 100fps ticks, each tick doing
+    // what the LED and OLED timers do
+    auto simulate = [&](bool use_queues, bool use_list, uint64_t &mismatches) {
+        Timeline timeline;
+        list_num = 0;
+        for (size_t c = 0; c < timeline_spans; c++) {
+            Timeline::Span &span = spans[c];
+            span = Timeline::Span();
+            span.type = types[c % 4];
+            span.time = start_ticks + static_cast<ticks_t>(c) * ( ticks_per_second / 20 );
+            span.duration = (c % 5) == 0 ? ticks_infinite : ticks_per_second / 2 + static_cast<ticks_t>(c % 37) * ( ticks_per_second / 4 );
+            if (use_queues) {
+                timeline.Add(span);
+            }
+        }
+        for (size_t c = 0; c < timeline_spans; c++) {
+            list[c] = &spans[timeline_spans - 1 - c];
+        }
+        list_num = use_list ? timeline_spans : 0;
+
+        uint64_t start = CPUTime();
+        for (uint32_t tick = 0; tick < timeline_ticks; tick++) {
+            ticks_t now = start_ticks + static_cast<ticks_t>(tick) * ( ticks_per_second / 100 );
+            model.SetTicks(now);
+            for (Timeline::Span::Type type : { Timeline::Span::Effect, Timeline::Span::Display }) {
+                Timeline::Span *queue_top = 0;
+                Timeline::Span *queue_below = 0;
+                if (use_queues) {
+                    timeline.Process(type);
+                    Timeline::Span &top = timeline.Top(type);
+                    Timeline::Span &below = timeline.Below(&top, type);
+                    queue_top = top.Valid() ? &top : 0;
+                    queue_below = below.Valid() ? &below : 0;
+                }
+                if (use_list) {
+                    list_process(type, now);
+                    Timeline::Span *top = list_top(type, 0, now);
+                    Timeline::Span *below = list_top(type, top, now);
+                    if (use_queues && (top != queue_top || below != queue_below)) {
+                        mismatches++;
+                    }
+                }
+                __asm__ __volatile__("" : : "r"(queue_top), "r"(queue_below) : "memory");
+            }
+        }
+        return (CPUTime() - start) / timeline_ticks;
+    };
+
+    TimelineResult result;
+    simulate(true, true, result.mismatches);
+    uint64_t unused = 0;
+    result.queue_ns = simulate(true, false, unused);
+    result.list_ns = simulate(false, true, unused);
+
+    model.SetTicks(saved_ticks);
+    MeasureTimeBase(result);
+    return result;
+}
+
+void Benchmark::MeasureTimeBase(TimelineResult &result) {
+    Model &model = Model::instance();
+    ticks_t saved_ticks = model.Ticks();
+
+    // The time arithmetic of one LED frame: the cycle count to time, the
+    // crossfade and keep alive windows, two effect phases and the ms until
+    // the next deadline. On the host doubles are in hardware, on the device
+    // every double operation here is a soft float helper call.
+    volatile uint64_t cyccnt = 0;
+    uint64_t start = Cycles();
+    for (uint32_t c = 0; c < time_base_frames; c++) {
+        cyccnt = cyccnt + 1000000;
+        double now = double(static_cast<double>(cyccnt) / 65536.0) * (1.0 / ( 60000000.0 / 65536.0 ) );
+        bool blending = (now - 1.0) < 0.5;
+        bool keep = (now - 2.0) < 1.0;
+        float rgb_walk = fmodf(static_cast<float>(now * (1.0 / 5.0) * 2.0), 1.0f);
+        float val_walk = 1.0f - fmodf(static_cast<float>(now * 2.0), 1.0f);
+        double ms = std::min(ceil(std::min(now + 8.0 - now, 60.0) * 1000.0), 60000.0);
+        __asm__ __volatile__("" : : "g"(blending), "g"(keep), "g"(rgb_walk), "g"(val_walk), "g"(ms) : "memory");
+    }
+    result.seconds_cycles = (Cycles() - start) / time_base_frames;
+
+    cyccnt = 0;
+    start = Cycles();
+    for (uint32_t c = 0; c < time_base_frames; c++) {
+        cyccnt = cyccnt + 1000000;
+        model.SetTicks(static_cast<ticks_t>(cyccnt));
+        ticks_t now = model.Ticks();
+        bool blending = (now - ticks_per_second) < ticks_per_second / 2;
+        bool keep = (now - 2 * ticks_per_second) < ticks_per_second;
+        float rgb_walk = model.Phase(ticks_per_second * 5 / 2);
+        float val_walk = 1.0f - model.Phase(ticks_per_second / 2);
+        static constexpr ticks_t ticks_per_ms = ticks_per_second / 1000;
+        ticks_t ms = std::min((std::min(now + 8 * ticks_per_second - now, 60 * ticks_per_second) + ticks_per_ms - 1) / ticks_per_ms, ticks_t(60000));
+        __asm__ __volatile__("" : : "g"(blending), "g"(keep), "g"(rgb_walk), "g"(val_walk), "g"(ms) : "memory");
+    }
+    result.ticks_cycles = (Cycles() - start) / time_base_frames;
+
+    // Phase of the 2.5s color walk after up to 30 days of uptime, against
+    // the exact phase from the integer ticks
+    static constexpr ticks_t period = ticks_per_second * 5 / 2;
+    for (ticks_t uptime = ticks_per_second; uptime <= 30 * 24 * 3600 * ticks_per_second; uptime *= 2) {
+        for (ticks_t offset = 0; offset < period; offset += period / 64) {
+            ticks_t ticks = uptime + offset;
+            double exact = static_cast<double>(ticks % period) / static_cast<double>(period);
+            model.SetTicks(ticks);
+            float seconds_phase = fmodf(model.FrameTime() * (1.0f / 2.5f), 1.0f);
+            auto error = [exact](float phase) {
+                double e = fabs(static_cast<double>(phase) - exact);
+                return std::min(e, 1.0 - e); // the phase wraps
+            };
+            result.seconds_phase_error = std::max(result.seconds_phase_error, error(seconds_phase));
+            result.ticks_phase_error = std::max(result.ticks_phase_error, error(model.Phase(period)));
+        }
+    }
+
+    model.SetTicks(saved_ticks);
+}
+
+const char *Benchmark::ScreenName(size_t screen) {
+    static const char *names[screen_count] = { "status", "preferences", "send message", "bird color" };
+    return screen < screen_count ? names[screen] : "";
+}
+
+Benchmark::SchedulerResult Benchmark::MeasureScheduler() {
+    Commands &commands = Commands::instance();
+    SchedulerResult result;
+
+    // A static scene: black effect and the status screen. Settled past the
+    // effect crossfade and the boot or menu animations.
+    Model::instance().SetEffect(0);
+    commands.Wake(Timeline::Span::Effect);
+    Settle(warmup_ms);
+
+    result.screens[0] = Measure(screen_ms);
+    result.idle = result.screens[0].led.frames == 0;
+
+    auto press = [this, &commands](void (Commands::*pressed)()) {
+        (commands.*pressed)();
+        Settle(warmup_ms);
+    };
+
+    press(&Commands::Switch3_Pressed);
+    result.screens[1] = Measure(screen_ms);
+
+    press(&Commands::Switch3_Pressed);
+    result.screens[2] = Measure(screen_ms);
+
+    // Back to the status screen after the menu timeout
+    Settle(10000 + warmup_ms);
+
+    press(&Commands::Switch3_Pressed);
+    for (int32_t c = 0; c < 4; c++) {
+        press(&Commands::Switch2_Pressed);
+    }
+    press(&Commands::Switch3_Pressed);
+    result.screens[3] = Measure(screen_ms);
+
+    Settle(10000 + warmup_ms);
+
+    for (size_t c = 0; c < screen_count; c++) {
+        result.screens[c].from = 0;
+        result.screens[c].to = 0;
+    }
+    return result;
+}
+
+void Benchmark::PrintText(const Results &results) const {
+    printf("%2s %-16s %8s %10s %10s %10s %10s %10s %8s %8s %10s %10s %8s %8s %7s %7s\n", "#", "effect", "frames", "led avg", "led min", "led max", "calc", "oled avg", "alloc/f", "call/f", "qspi/f", "queued", "i2c B/f", "wake/s", "duty", "skip");
+
+    for (uint32_t effect = 0; effect < Model::EffectCount(); effect++) {
+        const Result &r = results.effects[effect];
+        printf("%2u %-16s %8llu %8lluns %8lluns %8lluns %8lluns %8lluns %8.2f %8.2f %8lluns %9.1f%% %8.1f %8.1f %6.2f%% %6.1f%%\n",
+            static_cast<unsigned>(effect),
+            led_control::EffectName(effect),
+            static_cast<unsigned long long>(r.led.frames),
+            static_cast<unsigned long long>(r.led.Average()),
+            static_cast<unsigned long long>(r.led.min_ns),
+            static_cast<unsigned long long>(r.led.max_ns),
+            static_cast<unsigned long long>(r.calc_ns),
+            static_cast<unsigned long long>(r.oled.Average()),
+            r.led.AllocationsPerFrame(),
+            r.led.FunctionCallsPerFrame(),
+            static_cast<unsigned long long>(r.led.QSPITransferPerFrame()),
+            r.led.QueuedRatio() * 100.0,
+            r.oled.I2CBytesPerFrame(),
+            r.WakeupsPerSecond(),
+            r.DutyCycle() * 100.0,
+            r.led.SkippedRatio() * 100.0);
+    }
+
+    if (results.suite) {
+        printf("\nws2812 encoder: reference %lluns/frame, table %lluns/frame, %s\n",
+            static_cast<unsigned long long>(results.encoder.reference_ns),
+            static_cast<unsigned long long>(results.encoder.table_ns),
+            results.encoder.equivalent ? "output identical" : "OUTPUT MISMATCH");
+    }
+
+    if (results.suite) {
+        printf("color pipeline: float %.2fns/sample, fixed %.2fns/sample, max error %d (limit %d)%s\n",
+            static_cast<double>(results.color.float_ns) / color_samples,
+            static_cast<double>(results.color.fixed_ns) / color_samples,
+            static_cast<int>(results.color.max_error),
+            static_cast<int>(color_max_error),
+#ifdef FIXED_POINT_COLOR
+            ", effects use fixed point");
+#else  // #ifdef FIXED_POINT_COLOR
+            ", effects use float");
+#endif  // #ifdef FIXED_POINT_COLOR
+        printf("gradients: %zu bytes RAM before, %zu bytes RAM + %zu bytes flash now, max error %d (limit %d)\n",
+            results.color.gradient_ram_before,
+            results.color.gradient_ram_after,
+            results.color.gradient_flash,
+            static_cast<int>(results.color.gradient_error),
+            static_cast<int>(gradient_max_error));
+    }
+
+    if (results.suite) {
+        printf("fast math (host cycles/call libm -> fast, max error):");
+        for (size_t c = 0; c < fast_math_functions; c++) {
+            printf("%s %s %.1f -> %.1f %.1e",
+                c ? "," : "",
+                FastMathName(c),
+                results.fast_math.libm_cycles[c],
+                results.fast_math.fast_cycles[c],
+                results.fast_math.max_error[c]);
+        }
+        printf("%s\n", results.fast_math.within ? ", within bounds" : ", OUT OF BOUNDS");
+    }
+
+    if (results.suite) {
+        printf("effect state: %zu bytes RAM as statics, %zu bytes in the arena, slots used %zu steady, %zu crossfading, %zu after, %zu stateless%s\n",
+            results.effect_state.ram_before,
+            results.effect_state.ram_after,
+            results.effect_state.slots_steady,
+            results.effect_state.slots_crossfade,
+            results.effect_state.slots_after,
+            results.effect_state.slots_stateless,
+            results.effect_state.lifetime ? "" : ", WRONG LIFETIME");
+    }
+
+    if (results.suite) {
+        printf("random: %zu bytes RAM for mt19937 and distributions, %zu bytes per stream, host cycles/call float %.1f -> %.1f, bounded %.1f -> %.1f%s%s%s\n",
+            results.random.ram_before,
+            results.random.ram_after,
+            results.random.mt_float_cycles,
+            results.random.stream_float_cycles,
+            results.random.mt_int_cycles,
+            results.random.stream_int_cycles,
+            results.random.deterministic ? "" : ", NOT REPRODUCIBLE",
+            results.random.independent ? "" : ", STREAMS CORRELATED",
+            results.random.in_range ? "" : ", OUT OF RANGE");
+    }
+
+    if (results.suite) {
+        printf("compositor blend error (16 bit steps):");
+        for (size_t c = 0; c < blend_modes; c++) {
+            printf("%s %s %.3f", c ? "," : "", BlendModeName(c), results.compositor.blend_error[c]);
+        }
+        printf("%s\n", results.compositor.exact ? "" : ", OUT OF BOUNDS");
+        auto frame = [](const FrameStats &stats) {
+            printf("%lluns %.2f call/f", static_cast<unsigned long long>(stats.Average()), stats.FunctionCallsPerFrame());
+        };
+        printf("compositor LED frames over %s: alone ", led_control::EffectName(compositor_effect));
+        frame(results.compositor.effect);
+        printf(", switching from %s ", led_control::EffectName(compositor_from));
+        frame(results.compositor.crossfade);
+        for (size_t c = 0; c < overlays; c++) {
+            printf(", %s fading ", OverlayName(c));
+            frame(results.compositor.fading[c]);
+            printf(" opaque ");
+            frame(results.compositor.opaque[c]);
+        }
+        printf("\n");
+    }
+
+    if (results.suite) {
+        printf("gray levels by brightness (8 bit truncated/dithered):");
+        for (size_t c = 0; c < brightness_steps; c++) {
+            printf(" %u/%u",
+                static_cast<unsigned>(results.dither.truncated[c]),
+                static_cast<unsigned>(results.dither.dithered[c]));
+        }
+        printf("%s\n", results.dither.smoother ? "" : ", NOT SMOOTHER");
+        printf("led encode: %lluns/frame truncated, %lluns/frame dithered\n",
+            static_cast<unsigned long long>(results.dither.plain_ns),
+            static_cast<unsigned long long>(results.dither.dither_ns));
+    }
+
+    if (results.suite) {
+        auto print_display = [](const char *name, const FrameStats &stats) {
+            printf("oled %-12s %8.1f i2c bytes/frame, %6.2f transactions/frame, %8lluns/frame\n",
+                name,
+                stats.I2CBytesPerFrame(),
+                stats.I2CTransactionsPerFrame(),
+                static_cast<unsigned long long>(stats.Average()));
+        };
+        print_display("menu", results.display.menu);
+        print_display("scroll", results.display.scroll);
+        print_display("center flip", results.display.center_flip);
+        printf("oled message: %llu i2c bytes software, %llu i2c bytes hardware scroll, %llu panel mismatches, %llu visible RAM writes while scrolling\n",
+            static_cast<unsigned long long>(results.display.message_software_bytes),
+            static_cast<unsigned long long>(results.display.message_hardware_bytes),
+            static_cast<unsigned long long>(results.display.panel_mismatches),
+            static_cast<unsigned long long>(results.display.visible_writes_while_scrolling));
+    }
+
+    if (results.suite) {
+        printf("radio tx (42 byte payload): %llu spi transfers (%llu by DMA) for %llu bytes\n",
+            static_cast<unsigned long long>(results.radio.transfers),
+            static_cast<unsigned long long>(results.radio.dma_transfers),
+            static_cast<unsigned long long>(results.radio.bytes));
+        printf("radio tx->rx turnaround: full %llu transfers/%llu bytes/%lluus, cached %llu transfers/%llu bytes/%lluus%s\n",
+            static_cast<unsigned long long>(results.radio.turnaround_full.transfers),
+            static_cast<unsigned long long>(results.radio.turnaround_full.bytes),
+            static_cast<unsigned long long>(results.radio.turnaround_full.wire_ns / 1000),
+            static_cast<unsigned long long>(results.radio.turnaround_cached.transfers),
+            static_cast<unsigned long long>(results.radio.turnaround_cached.bytes),
+            static_cast<unsigned long long>(results.radio.turnaround_cached.wire_ns / 1000),
+            (results.radio.turnaround_full.listening && results.radio.turnaround_cached.listening) ? "" : ", NOT LISTENING");
+    }
+
+    if (results.suite) {
+        printf("persistence (%u saves): journal %llu bytes/%llu erases (max %u per block), whole page %llu bytes/%llu erases (max %u per block)\n",
+            static_cast<unsigned>(results.persistence.saves),
+            static_cast<unsigned long long>(results.persistence.journal_bytes),
+            static_cast<unsigned long long>(results.persistence.journal_erases),
+            static_cast<unsigned>(results.persistence.journal_max_block_erases),
+            static_cast<unsigned long long>(results.persistence.legacy_bytes),
+            static_cast<unsigned long long>(results.persistence.legacy_erases),
+            static_cast<unsigned>(results.persistence.legacy_max_block_erases));
+        printf("boot replay: %u records, %llu bytes read, %lluns, %s\n",
+            static_cast<unsigned>(results.persistence.replay_records),
+            static_cast<unsigned long long>(results.persistence.replay_bytes),
+            static_cast<unsigned long long>(results.persistence.replay_ns),
+            results.persistence.round_trip ? "state restored" : "STATE MISMATCH");
+        printf("%u message burst: saved per message %llu flash writes/%llu bytes, deferred %llu writes/%llu bytes%s\n",
+            static_cast<unsigned>(burst_messages),
+            static_cast<unsigned long long>(results.persistence.burst_sync_writes),
+            static_cast<unsigned long long>(results.persistence.burst_sync_bytes),
+            static_cast<unsigned long long>(results.persistence.burst_deferred_writes),
+            static_cast<unsigned long long>(results.persistence.burst_deferred_bytes),
+            results.persistence.burst_persisted ? "" : ", NOT PERSISTED");
+    }
+
+    if (results.suite) {
+        printf("timeline (%zu spans): single list %lluns/tick, per-type queues %lluns/tick, %s\n",
+            timeline_spans,
+            static_cast<unsigned long long>(results.timeline.list_ns),
+            static_cast<unsigned long long>(results.timeline.queue_ns),
+            results.timeline.mismatches ? "RESULT MISMATCH" : "same results");
+        printf("time base: %llu host cycles/frame in double seconds, %llu in integer ticks; phase error after 30 days %.6f from float seconds, %.6f from ticks%s\n",
+            static_cast<unsigned long long>(results.timeline.seconds_cycles),
+            static_cast<unsigned long long>(results.timeline.ticks_cycles),
+            results.timeline.seconds_phase_error,
+            results.timeline.ticks_phase_error,
+            results.timeline.ticks_phase_error <= time_base_max_phase_error ? "" : ", PHASE DRIFTS");
+    }
+
+    if (results.suite) {
+        for (size_t c = 0; c < screen_count; c++) {
+            const Result &r = results.scheduler.screens[c];
+            printf("screen %-13s %8.1f wakeups/s (led %5.1f fps, oled %5.1f fps), %6.3f%% duty%s\n",
+                ScreenName(c),
+                r.WakeupsPerSecond(),
+                double(r.led.frames) * 1000.0 / double(r.window_ms),
+                double(r.oled.frames) * 1000.0 / double(r.window_ms),
+                r.DutyCycle() * 100.0,
+                (c == 0 && !results.scheduler.idle) ? ", NOT IDLE" : "");
+        }
+    }
+
+    if (results.suite) {
+        printf("\nruntime on %.0fmAh with %.0fmA system load, led current unlimited/limited:\n", battery_mah, system_ma);
+        double worst = 0.0;
+        for (uint32_t effect = 0; effect < Model::EffectCount(); effect++) {
+            const PowerResult &p = results.power[effect];
+            worst = std::max(worst, p.over_budget);
+            printf("%2u %-16s %6.0fmA %6.0fmA %6.2fh %6.2fh %+6.1f%%\n",
+                static_cast<unsigned>(effect),
+                led_control::EffectName(effect),
+                p.unlimited_ma,
+                p.limited_ma,
+                p.unlimited_h,
+                p.limited_h,
+                ( p.limited_h / p.unlimited_h - 1.0 ) * 100.0);
+        }
+        printf("limited draw at most %+.1f%% of budget%s\n", worst * 100.0,
+            worst > power_max_over_budget ? ", OVER BUDGET" : "");
+    }
+
+    if (results.suite) {
+        PrintPrediction(results.prediction);
+    }
+
+    if (results.suite) {
+        printf("brightness 0 (%s): %llu led frames, %.1f%% skipped, %llu qspi bytes sent%s\n",
+            led_control::EffectName(blackout_effect),
+            static_cast<unsigned long long>(results.blackout.led.frames),
+            results.blackout.led.SkippedRatio() * 100.0,
+            static_cast<unsigned long long>(results.blackout.led.qspi_bytes),
+            results.blackout.led.SkippedRatio() < blackout_min_skipped ? ", NOT SKIPPED" : "");
+    }
+
+    if (results.crossfade_count == 0) {
+        return;
+    }
+
+    // The full matrix only makes sense as JSON; summarize the worst cases here
+    static constexpr size_t worst_n = 10;
+    size_t worst[worst_n];
+    size_t worst_count = 0;
+    uint64_t total_ns = 0;
+    uint64_t total_frames = 0;
+    for (size_t c = 0; c < results.crossfade_count; c++) {
+        total_ns += results.crossfades[c].led.total_ns;
+        total_frames += results.crossfades[c].led.frames;
+        size_t pos = worst_count;
+        while (pos > 0 && results.crossfades[worst[pos - 1]].led.Average() < results.crossfades[c].led.Average()) {
+            if (pos < worst_n) {
+                worst[pos] = worst[pos - 1];
+            }
+            pos--;
+        }
+        if (pos < worst_n) {
+            worst[pos] = c;
+            if (worst_count < worst_n) {
+                worst_count++;
+            }
+        }
+    }
+
+    printf("\n%zu crossfades, %lluns/frame average, slowest:\n",
+        results.crossfade_count,
+        static_cast<unsigned long long>(total_frames ? total_ns / total_frames : 0));
+    for (size_t c = 0; c < worst_count; c++) {
+        const Result &r = results.crossfades[worst[c]];
+        printf("   %-16s -> %-16s %8lluns %8.2f %8.2f\n",
+            led_control::EffectName(r.from),
+            led_control::EffectName(r.to),
+            static_cast<unsigned long long>(r.led.Average()),
+            r.led.AllocationsPerFrame(),
+            r.led.FunctionCallsPerFrame());
+    }
+}
+
+bool Benchmark::WriteJSON(const Results &results) const {
+    FILE *file = json_path ? fopen(json_path, "w") : stdout;
+    if (!file) {
+        fprintf(stderr, "could not open %s\n", json_path);
+        return false;
+    }
+
+    auto write_stats = [file](const FrameStats &stats) {
+        fprintf(file, "\"frames\": %llu, \"ns_per_frame\": %llu, \"min_ns\": %llu, \"max_ns\": %llu, "
+                      "\"allocations_per_frame\": %.3f, \"function_calls_per_frame\": %.3f, "
+                      "\"qspi_transfer_ns_per_frame\": %llu, \"queued_ratio\": %.3f, "
+                      "\"i2c_transactions_per_frame\": %.3f, \"i2c_bytes_per_frame\": %.3f, \"skipped_ratio\": %.3f",
+            static_cast<unsigned long long>(stats.frames),
+            static_cast<unsigned long long>(stats.Average()),
+            static_cast<unsigned long long>(stats.min_ns),
+            static_cast<unsigned long long>(stats.max_ns),
+            stats.AllocationsPerFrame(),
+            stats.FunctionCallsPerFrame(),
+            static_cast<unsigned long long>(stats.QSPITransferPerFrame()),
+            stats.QueuedRatio(),
+            stats.I2CTransactionsPerFrame(),
+            stats.I2CBytesPerFrame(),
+            stats.SkippedRatio());
+    };
+
+    fprintf(file, "{\n  \"led_interval_ms\": %u,\n  \"effects\": [\n",
+        static_cast<unsigned>(Commands::ledInterval));
+    for (uint32_t effect = 0; effect < Model::EffectCount(); effect++) {
+        const Result &r = results.effects[effect];
+        fprintf(file, "    { \"index\": %u, \"name\": \"%s\", \"led\": { ", 
+            static_cast<unsigned>(effect), led_control::EffectName(effect));
+        write_stats(r.led);
+        fprintf(file, " }, \"oled\": { ");
+        write_stats(r.oled);
+        fprintf(file, " }, \"calc_ns_per_frame\": %llu, \"wakeups_per_second\": %.3f, \"duty_cycle\": %.6f }%s\n",
+            static_cast<unsigned long long>(r.calc_ns), r.WakeupsPerSecond(), r.DutyCycle(), (effect + 1) < Model::EffectCount() ? "," : "");
+    }
+    fprintf(file, "  ],\n  \"crossfades\": [\n");
+    for (size_t c = 0; c < results.crossfade_count; c++) {
+        const Result &r = results.crossfades[c];
+        fprintf(file, "    { \"from\": \"%s\", \"to\": \"%s\", \"led\": { ", 
+            led_control::EffectName(r.from), led_control::EffectName(r.to));
+        write_stats(r.led);
+        fprintf(file, " } }%s\n", (c + 1) < results.crossfade_count ? "," : "");
+    }
+    fprintf(file, "  ]");
+    if (results.suite) {
+        fprintf(file, ",\n  \"encoder\": { \"equivalent\": %s, \"mismatches\": %llu, \"reference_ns_per_frame\": %llu, \"table_ns_per_frame\": %llu }",
+            results.encoder.equivalent ? "true" : "false",
+            static_cast<unsigned long long>(results.encoder.mismatches),
+            static_cast<unsigned long long>(results.encoder.reference_ns),
+            static_cast<unsigned long long>(results.encoder.table_ns));
+    }
+    if (results.suite) {
+        fprintf(file, ",\n  \"color_pipeline\": { \"fixed_point_effects\": %s, \"max_error\": %d, \"float_ns_per_sample\": %.3f, \"fixed_ns_per_sample\": %.3f }",
+#ifdef FIXED_POINT_COLOR
+            "true",
+#else  // #ifdef FIXED_POINT_COLOR
+            "false",
+#endif  // #ifdef FIXED_POINT_COLOR
+            static_cast<int>(results.color.max_error),
+            static_cast<double>(results.color.float_ns) / color_samples,
+            static_cast<double>(results.color.fixed_ns) / color_samples);
+        fprintf(file, ",\n  \"gradients\": { \"max_error\": %d, \"ram_before\": %zu, \"ram_after\": %zu, \"flash\": %zu }",
+            static_cast<int>(results.color.gradient_error),
+            results.color.gradient_ram_before,
+            results.color.gradient_ram_after,
+            results.color.gradient_flash);
+    }
+    if (results.suite) {
+        fprintf(file, ",\n  \"fast_math\": { \"within_bounds\": %s, \"functions\": {", results.fast_math.within ? "true" : "false");
+        for (size_t c = 0; c < fast_math_functions; c++) {
+            fprintf(file, "%s\"%s\": { \"max_error\": %.3e, \"libm_cycles\": %.1f, \"fast_cycles\": %.1f }",
+                c ? ", " : " ",
+                FastMathName(c),
+                results.fast_math.max_error[c],
+                results.fast_math.libm_cycles[c],
+                results.fast_math.fast_cycles[c]);
+        }
+        fprintf(file, " } }");
+    }
+    if (results.suite) {
+        fprintf(file, ",\n  \"effect_state\": { \"ram_before\": %zu, \"ram_after\": %zu, \"slots_steady\": %zu, \"slots_crossfade\": %zu, \"slots_after\": %zu, \"slots_stateless\": %zu, \"lifetime\": %s }",
+            results.effect_state.ram_before,
+            results.effect_state.ram_after,
+            results.effect_state.slots_steady,
+            results.effect_state.slots_crossfade,
+            results.effect_state.slots_after,
+            results.effect_state.slots_stateless,
+            results.effect_state.lifetime ? "true" : "false");
+    }
+    if (results.suite) {
+        fprintf(file, ",\n  \"random\": { \"ram_before\": %zu, \"ram_after\": %zu, \"mt_float_cycles\": %.2f, \"mt_int_cycles\": %.2f, \"stream_float_cycles\": %.2f, \"stream_int_cycles\": %.2f, \"deterministic\": %s, \"independent\": %s, \"in_range\": %s }",
+            results.random.ram_before,
+            results.random.ram_after,
+            results.random.mt_float_cycles,
+            results.random.mt_int_cycles,
+            results.random.stream_float_cycles,
+            results.random.stream_int_cycles,
+            results.random.deterministic ? "true" : "false",
+            results.random.independent ? "true" : "false",
+            results.random.in_range ? "true" : "false");
+    }
+    if (results.suite) {
+        auto frame = [file](const char *name, const FrameStats &stats) {
+            fprintf(file, "\"%s\": { \"avg_ns\": %llu, \"calls_per_frame\": %.3f }",
+                name,
+                static_cast<unsigned long long>(stats.Average()),
+                stats.FunctionCallsPerFrame());
+        };
+        fprintf(file, ",\n  \"compositor\": { \"exact\": %s, \"blend_error\": {", results.compositor.exact ? "true" : "false");
+        for (size_t c = 0; c < blend_modes; c++) {
+            fprintf(file, "%s \"%s\": %.3f", c ? "," : "", BlendModeName(c), results.compositor.blend_error[c]);
+        }
+        fprintf(file, " }, ");
+        frame("effect", results.compositor.effect);
+        fprintf(file, ", ");
+        frame("crossfade", results.compositor.crossfade);
+        fprintf(file, ", \"overlays\": {");
+        for (size_t c = 0; c < overlays; c++) {
+            fprintf(file, "%s \"%s\": { ", c ? "," : "", OverlayName(c));
+            frame("fading", results.compositor.fading[c]);
+            fprintf(file, ", ");
+            frame("opaque", results.compositor.opaque[c]);
+            fprintf(file, " }");
+        }
+        fprintf(file, " } }");
+    }
+    if (results.suite) {
+        fprintf(file, ",\n  \"dither\": { \"levels\": [");
+        for (size_t c = 0; c < brightness_steps; c++) {
+            fprintf(file, "%s{ \"brightness\": %.1f, \"truncated\": %u, \"dithered\": %u }",
+                c ? ", " : "",
+                static_cast<double>(c + 1) / static_cast<double>(brightness_steps),
+                static_cast<unsigned>(results.dither.truncated[c]),
+                static_cast<unsigned>(results.dither.dithered[c]));
+        }
+        fprintf(file, "], \"truncated_ns_per_frame\": %llu, \"dithered_ns_per_frame\": %llu }",
+            static_cast<unsigned long long>(results.dither.plain_ns),
+            static_cast<unsigned long long>(results.dither.dither_ns));
+    }
+    if (results.suite) {
+        fprintf(file, ",\n  \"oled\": {\n    \"menu\": { ");
+        write_stats(results.display.menu);
+        fprintf(file, " },\n    \"scroll\": { ");
+        write_stats(results.display.scroll);
+        fprintf(file, " },\n    \"center_flip\": { ");
+        write_stats(results.display.center_flip);
+        fprintf(file, " },\n    \"message_software\": { ");
+        write_stats(results.display.message_software);
+        fprintf(file, ", \"i2c_bytes\": %llu },\n    \"message_hardware\": { ",
+            static_cast<unsigned long long>(results.display.message_software_bytes));
+        write_stats(results.display.message_hardware);
+        fprintf(file, ", \"i2c_bytes\": %llu },\n    \"panel_mismatches\": %llu, \"visible_writes_while_scrolling\": %llu\n  }",
+            static_cast<unsigned long long>(results.display.message_hardware_bytes),
+            static_cast<unsigned long long>(results.display.panel_mismatches),
+            static_cast<unsigned long long>(results.display.visible_writes_while_scrolling));
+    }
+    if (results.suite) {
+        fprintf(file, ",\n  \"radio_tx\": { \"payload\": 42, \"spi_transfers\": %llu, \"spi_dma_transfers\": %llu, \"spi_bytes\": %llu }",
+            static_cast<unsigned long long>(results.radio.transfers),
+            static_cast<unsigned long long>(results.radio.dma_transfers),
+            static_cast<unsigned long long>(results.radio.bytes));
+        fprintf(file, ",\n  \"radio_turnaround\": { \"full\": { \"spi_transfers\": %llu, \"spi_bytes\": %llu, \"ns\": %llu }, "
+                      "\"cached\": { \"spi_transfers\": %llu, \"spi_bytes\": %llu, \"ns\": %llu } }",
+            static_cast<unsigned long long>(results.radio.turnaround_full.transfers),
+            static_cast<unsigned long long>(results.radio.turnaround_full.bytes),
+            static_cast<unsigned long long>(results.radio.turnaround_full.wire_ns),
+            static_cast<unsigned long long>(results.radio.turnaround_cached.transfers),
+            static_cast<unsigned long long>(results.radio.turnaround_cached.bytes),
+            static_cast<unsigned long long>(results.radio.turnaround_cached.wire_ns));
+    }
+
+    if (results.suite) {
+        fprintf(file, ",\n  \"persistence\": { \"saves\": %u, "
+                      "\"journal\": { \"bytes_programmed\": %llu, \"erases\": %llu, \"max_block_erases\": %u }, "
+                      "\"whole_page\": { \"bytes_programmed\": %llu, \"erases\": %llu, \"max_block_erases\": %u }, "
+                      "\"replay\": { \"records\": %u, \"bytes_read\": %llu, \"ns\": %llu, \"round_trip\": %s }, "
+                      "\"burst\": { \"messages\": %u, \"sync_writes\": %llu, \"sync_bytes\": %llu, \"deferred_writes\": %llu, \"deferred_bytes\": %llu } }",
+            static_cast<unsigned>(results.persistence.saves),
+            static_cast<unsigned long long>(results.persistence.journal_bytes),
+            static_cast<unsigned long long>(results.persistence.journal_erases),
+            static_cast<unsigned>(results.persistence.journal_max_block_erases),
+            static_cast<unsigned long long>(results.persistence.legacy_bytes),
+            static_cast<unsigned long long>(results.persistence.legacy_erases),
+            static_cast<unsigned>(results.persistence.legacy_max_block_erases),
+            static_cast<unsigned>(results.persistence.replay_records),
+            static_cast<unsigned long long>(results.persistence.replay_bytes),
+            static_cast<unsigned long long>(results.persistence.replay_ns),
+            results.persistence.round_trip ? "true" : "false",
+            static_cast<unsigned>(burst_messages),
+            static_cast<unsigned long long>(results.persistence.burst_sync_writes),
+            static_cast<unsigned long long>(results.persistence.burst_sync_bytes),
+            static_cast<unsigned long long>(results.persistence.burst_deferred_writes),
+            static_cast<unsigned long long>(results.persistence.burst_deferred_bytes));
+    }
+
+    if (results.suite) {
+        fprintf(file, ",\n  \"timeline\": { \"spans\": %zu, \"list_ns_per_tick\": %llu, \"queue_ns_per_tick\": %llu, \"mismatches\": %llu, "
+                      "\"seconds_cycles_per_frame\": %llu, \"ticks_cycles_per_frame\": %llu, \"seconds_phase_error\": %.6f, \"ticks_phase_error\": %.6f }",
+            timeline_spans,
+            static_cast<unsigned long long>(results.timeline.list_ns),
+            static_cast<unsigned long long>(results.timeline.queue_ns),
+            static_cast<unsigned long long>(results.timeline.mismatches),
+            static_cast<unsigned long long>(results.timeline.seconds_cycles),
+            static_cast<unsigned long long>(results.timeline.ticks_cycles),
+            results.timeline.seconds_phase_error,
+            results.timeline.ticks_phase_error);
+    }
+
+    if (results.suite) {
+        fprintf(file, ",\n  \"screens\": [\n");
+        for (size_t c = 0; c < screen_count; c++) {
+            const Result &r = results.scheduler.screens[c];
+            fprintf(file, "    { \"name\": \"%s\", \"led_frames\": %llu, \"oled_frames\": %llu, \"adc_runs\": %llu, \"window_ms\": %llu, \"wakeups_per_second\": %.3f, \"duty_cycle\": %.6f }%s\n",
+                ScreenName(c),
+                static_cast<unsigned long long>(r.led.frames),
+                static_cast<unsigned long long>(r.oled.frames),
+                static_cast<unsigned long long>(r.adc.frames),
+                static_cast<unsigned long long>(r.window_ms),
+                r.WakeupsPerSecond(),
+                r.DutyCycle(),
+                (c + 1) < screen_count ? "," : "");
+        }
+        fprintf(file, "  ],\n  \"static_scene_idle\": %s", results.scheduler.idle ? "true" : "false");
+    }
+
+    if (results.suite) {
+        fprintf(file, ",\n  \"power\": { \"battery_mah\": %.0f, \"system_ma\": %.0f, \"effects\": [\n", battery_mah, system_ma);
+        for (uint32_t effect = 0; effect < Model::EffectCount(); effect++) {
+            const PowerResult &p = results.power[effect];
+            fprintf(file, "    { \"name\": \"%s\", \"unlimited_ma\": %.1f, \"limited_ma\": %.1f, \"unlimited_h\": %.3f, \"limited_h\": %.3f, \"over_budget\": %.4f }%s\n",
+                led_control::EffectName(effect),
+                p.unlimited_ma,
+                p.limited_ma,
+                p.unlimited_h,
+                p.limited_h,
+                p.over_budget,
+                (effect + 1) < Model::EffectCount() ? "," : "");
+        }
+        fprintf(file, "  ] }");
+    }
+
+    if (results.suite) {
+        fprintf(file, ",\n  \"prediction\": { \"samples\": %zu, \"runtime_s\": %.0f, \"points\": [",
+            results.prediction.samples, results.prediction.runtime_s);
+        for (size_t c = 0; c < prediction_points; c++) {
+            fprintf(file, "%s{ \"predicted_s\": %.0f, \"actual_s\": %.0f }",
+                c ? ", " : "", results.prediction.predicted_s[c], results.prediction.actual_s[c]);
+        }
+        fprintf(file, "], \"mean_error\": %.4f, \"max_error\": %.4f, \"current_scale\": %.3f, "
+                      "\"consumed_mah\": { \"leds\": %.1f, \"radio\": %.1f, \"display\": %.1f, \"system\": %.1f }, \"effects_mah\": {",
+            results.prediction.mean_error,
+            results.prediction.max_error,
+            static_cast<double>(results.prediction.current_scale),
+            results.prediction.leds_mah,
+            results.prediction.radio_mah,
+            results.prediction.display_mah,
+            results.prediction.system_mah);
+        const char *separator = " ";
+        for (uint32_t effect = 0; effect < Model::EffectCount(); effect++) {
+            if (results.prediction.effect_mah[effect] > 0.0) {
+                fprintf(file, "%s\"%s\": %.1f", separator, led_control::EffectName(effect), results.prediction.effect_mah[effect]);
+                separator = ", ";
+            }
+        }
+        fprintf(file, " } }");
+    }
+
+    if (results.suite) {
+        fprintf(file, ",\n  \"blackout\": { \"effect\": \"%s\", \"led\": { ",
+            led_control::EffectName(blackout_effect));
+        write_stats(results.blackout.led);
+        fprintf(file, ", \"qspi_bytes\": %llu } }",
+            static_cast<unsigned long long>(results.blackout.led.qspi_bytes));
+    }
+    fprintf(file, "\n}\n");
+
+    if (file != stdout) {
+        fclose(file);
+    }
+    return true;
+}
+
+void Benchmark::PrintPrediction(const PredictionResult &prediction) const {
+    printf("\nruntime prediction over %zu readings, %.2fh:", prediction.samples, prediction.runtime_s / 3600.0);
+    for (size_t c = 0; c < prediction_points; c++) {
+        printf(" %.2fh/%.2fh", prediction.predicted_s[c] / 3600.0, prediction.actual_s[c] / 3600.0);
+    }
+    printf(" predicted/left, mean error %.1f%%, max %.1f%%%s\n",
+        prediction.mean_error * 100.0,
+        prediction.max_error * 100.0,
+        prediction.max_error > prediction_max_error ? ", INACCURATE" : "");
+    printf("current scale %.3f, drawn %.1fmAh leds, %.1fmAh radio, %.1fmAh display, %.1fmAh system\n",
+        static_cast<double>(prediction.current_scale),
+        prediction.leds_mah,
+        prediction.radio_mah,
+        prediction.display_mah,
+        prediction.system_mah);
+}
+
+int Benchmark::Run() {
+    // Let the boot screen animation finish before measuring anything
+    Settle(2000);
+
+    if (telemetry_path) {
+        std::vector<TelemetrySample> samples;
+        if (!LoadTelemetry(telemetry_path, samples)) {
+            return 1;
+        }
+        PrintPrediction(ReplayTelemetry(samples));
+        return 0;
+    }
+
+    static Results results;
+    results.suite = suite;
+    double over_budget = 0.0;
+
+    for (uint32_t effect = 0; effect < Model::EffectCount(); effect++) {
+        results.effects[effect] = MeasureEffect(effect);
+    }
+
+    if (suite) {
+        for (uint32_t from = 0; from < Model::EffectCount(); from++) {
+            for (uint32_t to = 0; to < Model::EffectCount(); to++) {
+                if (from != to) {
+                    results.crossfades[results.crossfade_count++] = MeasureCrossfade(from, to);
+                }
+            }
+        }
+        results.encoder = MeasureEncoder();
+        results.color = MeasureColorPipeline();
+        results.fast_math = MeasureFastMath();
+        results.effect_state = MeasureEffectState();
+        results.random = MeasureRandom();
+        results.compositor = MeasureCompositor();
+        results.dither = MeasureDither();
+        results.display = MeasureDisplay();
+        results.radio = MeasureRadio();
+        results.persistence = MeasurePersistence();
+        results.timeline = MeasureTimeline();
+        results.scheduler = MeasureScheduler();
+        results.blackout = MeasureBlackout();
+        for (uint32_t effect = 0; effect < Model::EffectCount(); effect++) {
+            results.power[effect] = MeasurePower(effect);
+            over_budget = std::max(over_budget, results.power[effect].over_budget);
+        }
+        results.prediction = ReplayTelemetry(RecordDischarge());
+    }
+
+    // The firmware frame path does not touch the heap, so any allocation
+    // counted here is a regression
+    uint64_t allocations = results.blackout.led.allocations;
+    for (uint32_t effect = 0; effect < Model::EffectCount(); effect++) {
+        allocations += results.effects[effect].led.allocations;
+    }
+    for (size_t c = 0; c < results.crossfade_count; c++) {
+        allocations += results.crossfades[c].led.allocations;
+    }
+    if (allocations) {
+        fprintf(stderr, "%llu heap allocations in LED frames\n", static_cast<unsigned long long>(allocations));
+    }
+
+    if (json) {
+        if (!WriteJSON(results)) {
+            return 1;
+        }
+    } else {
+        PrintText(results);
+    }
+
+    const Results &r = results;
+    return (suite && (allocations || !r.encoder.equivalent || r.color.max_error > color_max_error || r.color.gradient_error > gradient_max_error || !r.fast_math.within || !r.effect_state.lifetime ||
+                     !r.random.deterministic || !r.random.independent || !r.random.in_range || !r.compositor.exact ||
+                     r.display.panel_mismatches || r.display.visible_writes_while_scrolling ||
+                     !r.radio.turnaround_full.listening || !r.radio.turnaround_cached.listening ||
+                     !r.persistence.round_trip || !r.persistence.burst_persisted ||
+                     r.timeline.mismatches || r.timeline.ticks_phase_error > time_base_max_phase_error || !r.scheduler.idle ||
+                     r.blackout.led.SkippedRatio() < blackout_min_skipped || !r.dither.smoother ||
+                     over_budget > power_max_over_budget || r.prediction.max_error > prediction_max_error)) ? 1 : 0;
+}
+
+#endif  // #ifdef BENCHMARK
@@ -0,0 +1,411 @@
+/*
+Copyright 2019 Tinic Uro
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef BENCHMARK_H_
+#define BENCHMARK_H_
+
+#ifdef BENCHMARK
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "./emulator.h"
+#include "./model.h"
+
+// Headless emulator driver: steps a virtual clock in fixed increments and
+// runs the timer tasks which are due so frame costs and wakeups can be
+// measured.
+// --bench additionally measures every effect-to-effect crossfade and
+// --json emits the results in machine-readable form. --telemetry replays a
+// recorded battery log through the emulated charger and reports how well
+// the runtime was predicted.
+class Benchmark {
+public:
+    static Benchmark &instance();
+
+    bool ParseArgs(int argc, char *argv[]);
+    bool Headless() const { return headless; }
+
+    int Run();
+
+private:
+    struct FrameStats {
+        uint64_t frames = 0;
+        uint64_t total_ns = 0;
+        uint64_t min_ns = 0;
+        uint64_t max_ns = 0;
+        uint64_t allocations = 0;
+        uint64_t function_calls = 0;
+        uint64_t qspi_transfer_ns = 0;
+        uint64_t i2c_transactions = 0;
+        uint64_t i2c_bytes = 0;
+        uint64_t skipped = 0;
+        uint64_t queued = 0;
+        uint64_t qspi_bytes = 0;
+
+        void Reset() { *this = FrameStats(); }
+        void Add(uint64_t ns, const emulator_counters &before);
+        uint64_t Average() const { return frames ? total_ns / frames : 0; }
+        double AllocationsPerFrame() const { return frames ? double(allocations) / double(frames) : 0.0; }
+        double FunctionCallsPerFrame() const { return frames ? double(function_calls) / double(frames) : 0.0; }
+        uint64_t QSPITransferPerFrame() const { return frames ? qspi_transfer_ns / frames : 0; }
+        double I2CTransactionsPerFrame() const { return frames ? double(i2c_transactions) / double(frames) : 0.0; }
+        double I2CBytesPerFrame() const { return frames ? double(i2c_bytes) / double(frames) : 0.0; }
+        double SkippedRatio() const { return frames ? double(skipped) / double(frames) : 0.0; }
+        double QueuedRatio() const { return frames ? double(queued) / double(frames) : 0.0; }
+    };
+
+    struct Result {
+        uint32_t from = 0;
+        uint32_t to = 0;
+        uint64_t window_ms = 0;
+        FrameStats led;
+        FrameStats oled;
+        FrameStats adc;
+        uint64_t calc_ns = 0; // the effect calculation alone, per frame
+
+        uint64_t Wakeups() const { return led.frames + oled.frames + adc.frames; }
+        double WakeupsPerSecond() const { return window_ms ? double(Wakeups()) * 1000.0 / double(window_ms) : 0.0; }
+        double DutyCycle() const { return window_ms ? double(led.total_ns + oled.total_ns + adc.total_ns) / (double(window_ms) * 1000000.0) : 0.0; }
+    };
+
+    void Tick();
+    void Settle(uint32_t ms);
+    void RunFrames(uint32_t led_frames);
+    Result Measure(uint32_t ms);
+
+    Result MeasureEffect(uint32_t effect);
+    Result MeasureCrossfade(uint32_t from, uint32_t to);
+    Result MeasureBlackout();
+
+    struct EncoderResult {
+        bool equivalent = false;
+        uint64_t mismatches = 0;
+        uint64_t reference_ns = 0;
+        uint64_t table_ns = 0;
+    };
+
+    EncoderResult MeasureEncoder();
+
+    struct ColorResult {
+        int32_t max_error = 0;
+        uint64_t float_ns = 0;
+        uint64_t fixed_ns = 0;
+        int32_t gradient_error = 0;
+        size_t gradient_ram_before = 0;
+        size_t gradient_ram_after = 0;
+        size_t gradient_flash = 0;
+    };
+
+    ColorResult MeasureColorPipeline();
+
+    // Largest error of each fast math function against libm over the
+    // ranges the effects use, checked against the bounds documented in
+    // fast_math.h, and host cycles per call of both
+    static constexpr size_t fast_math_functions = 7;
+
+    struct FastMathResult {
+        double max_error[fast_math_functions] = {}; // relative for exp2 and pow
+        double libm_cycles[fast_math_functions] = {};
+        double fast_cycles[fast_math_functions] = {};
+        bool within = false;
+    };
+
+    static const char *FastMathName(size_t function);
+    FastMathResult MeasureFastMath();
+
+    // Effect state in the two arena slots instead of statics, and how many
+    // slots are taken on one effect, during a crossfade between two, after
+    // it and on an effect without state
+    struct EffectStateResult {
+        size_t ram_before = 0;
+        size_t ram_after = 0;
+        size_t slots_steady = 0;
+        size_t slots_crossfade = 0;
+        size_t slots_after = 0;
+        size_t slots_stateless = 0;
+        bool lifetime = false;
+    };
+
+    EffectStateResult MeasureEffectState();
+
+    // Generator state of std::mt19937 with the distributions rgb_band drew
+    // from against a random stream, host cycles per float and bounded
+    // integer of both, and whether the streams replay from the seed, differ
+    // from each other and stay in range
+    struct RandomResult {
+        size_t ram_before = 0;
+        size_t ram_after = 0;
+        double mt_float_cycles = 0.0;
+        double mt_int_cycles = 0.0;
+        double stream_float_cycles = 0.0;
+        double stream_int_cycles = 0.0;
+        bool deterministic = false;
+        bool independent = false;
+        bool in_range = false;
+    };
+
+    RandomResult MeasureRandom();
+
+    // The compositor: largest error of each blend mode against float in 16
+    // bit steps, and LED frames of an effect alone, while switching to it,
+    // and under each overlay while it fades in and once it is opaque
+    static constexpr size_t blend_modes = 4;
+    static constexpr size_t overlays = 3;
+
+    struct CompositorResult {
+        double blend_error[blend_modes] = {};
+        FrameStats effect;
+        FrameStats crossfade;
+        FrameStats fading[overlays];
+        FrameStats opaque[overlays];
+        bool exact = false;
+    };
+
+    static const char *BlendModeName(size_t mode);
+    static const char *OverlayName(size_t overlay);
+    CompositorResult MeasureCompositor();
+
+    static constexpr size_t brightness_steps = 10; // as set from the status screen
+
+    struct DitherResult {
+        uint32_t truncated[brightness_steps] = {};
+        uint32_t dithered[brightness_steps] = {};
+        uint64_t plain_ns = 0;
+        uint64_t dither_ns = 0;
+        bool smoother = false; // more levels at every step
+    };
+
+    DitherResult MeasureDither();
+
+    // Average LED draw and runtime over a replayed battery discharge, with
+    // and without the current limiter
+    struct PowerResult {
+        double unlimited_ma = 0.0;
+        double limited_ma = 0.0;
+        double unlimited_h = 0.0;
+        double limited_h = 0.0;
+        double over_budget = 0.0; // worst step, limited draw relative to the budget
+    };
+
+    PowerResult MeasurePower(uint32_t effect);
+
+    // One charger ADC reading of a recorded log
+    struct TelemetrySample {
+        double time = 0.0; // s from the start of the log
+        float battery = 0.0f;
+        float vbus = 0.0f;
+        float charge_current = 0.0f;
+    };
+
+    static constexpr size_t prediction_points = 3; // at 25%, 50% and 75% of the log
+
+    // Predicted runtime against what was left until the end of the log
+    struct PredictionResult {
+        size_t samples = 0;
+        double runtime_s = 0.0;
+        double predicted_s[prediction_points] = {};
+        double actual_s[prediction_points] = {};
+        double mean_error = 0.0; // relative to the whole runtime
+        double max_error = 0.0;
+        float current_scale = 1.0f;
+        double leds_mah = 0.0;
+        double radio_mah = 0.0;
+        double display_mah = 0.0;
+        double system_mah = 0.0;
+        double effect_mah[Model::EffectCount()] = {};
+    };
+
+    static bool LoadTelemetry(const char *path, std::vector<TelemetrySample> &samples);
+    std::vector<TelemetrySample> RecordDischarge();
+    PredictionResult ReplayTelemetry(const std::vector<TelemetrySample> &samples);
+    void PrintPrediction(const PredictionResult &prediction) const;
+
+    struct DisplayResult {
+        FrameStats menu;
+        FrameStats scroll;
+        FrameStats center_flip;
+        FrameStats message_software;
+        FrameStats message_hardware;
+        uint64_t message_software_bytes = 0;
+        uint64_t message_hardware_bytes = 0;
+        uint64_t panel_mismatches = 0;
+        uint64_t visible_writes_while_scrolling = 0;
+    };
+
+    DisplayResult MeasureDisplay();
+
+    struct RadioTurnaround {
+        uint64_t transfers = 0;
+        uint64_t bytes = 0;
+        uint64_t wire_ns = 0;
+        bool listening = false;
+    };
+
+    struct RadioResult {
+        uint64_t transfers = 0;
+        uint64_t bytes = 0;
+        uint64_t dma_transfers = 0;
+        RadioTurnaround turnaround_full;
+        RadioTurnaround turnaround_cached;
+    };
+
+    RadioResult MeasureRadio();
+
+    struct PersistenceResult {
+        uint32_t saves = 0;
+        uint64_t journal_bytes = 0;
+        uint64_t journal_erases = 0;
+        uint32_t journal_max_block_erases = 0;
+        uint64_t legacy_bytes = 0;
+        uint64_t legacy_erases = 0;
+        uint32_t legacy_max_block_erases = 0;
+        uint64_t replay_ns = 0;
+        uint64_t replay_bytes = 0;
+        uint32_t replay_records = 0;
+        bool round_trip = false;
+        uint64_t burst_sync_writes = 0;
+        uint64_t burst_sync_bytes = 0;
+        uint64_t burst_deferred_writes = 0;
+        uint64_t burst_deferred_bytes = 0;
+        bool burst_persisted = false;
+    };
+
+    PersistenceResult MeasurePersistence();
+
+    struct TimelineResult {
+        uint64_t list_ns = 0;
+        uint64_t queue_ns = 0;
+        uint64_t mismatches = 0;
+        // Host cycles for the time arithmetic of one LED frame, in double
+        // seconds as before and in integer ticks, and the largest effect
+        // phase error over long uptimes from float seconds and from ticks
+        uint64_t seconds_cycles = 0;
+        uint64_t ticks_cycles = 0;
+        double seconds_phase_error = 0.0;
+        double ticks_phase_error = 0.0;
+    };
+
+    TimelineResult MeasureTimeline();
+    void MeasureTimeBase(TimelineResult &result);
+
+    static constexpr size_t screen_count = 4;
+
+    struct SchedulerResult {
+        Result screens[screen_count];
+        bool idle = false; // no LED frames on a static effect
+    };
+
+    static const char *ScreenName(size_t screen);
+    SchedulerResult MeasureScheduler();
+
+    // Everything one run measured; the sections after the effects are only
+    // filled in with --suite
+    struct Results {
+        Result effects[Model::EffectCount()];
+        Result crossfades[Model::EffectCount() * (Model::EffectCount() - 1)];
+        size_t crossfade_count = 0;
+        bool suite = false;
+        EncoderResult encoder;
+        ColorResult color;
+        FastMathResult fast_math;
+        EffectStateResult effect_state;
+        RandomResult random;
+        CompositorResult compositor;
+        DitherResult dither;
+        DisplayResult display;
+        RadioResult radio;
+        PersistenceResult persistence;
+        TimelineResult timeline;
+        SchedulerResult scheduler;
+        Result blackout;
+        PowerResult power[Model::EffectCount()];
+        PredictionResult prediction;
+    };
+
+    void PrintText(const Results &results) const;
+    bool WriteJSON(const Results &results) const;
+
+    static uint64_t CPUTime();
+    static uint64_t Cycles();
+
+    static constexpr uint32_t tick_ms = 1;
+    static constexpr uint32_t warmup_ms = 600; // covers the 0.5s effect crossfade
+    static constexpr uint32_t crossfade_ms = 500;
+    static constexpr uint32_t encoder_frames = 20000;
+    static constexpr uint32_t effect_calc_frames = 2000;
+    static constexpr uint32_t color_samples = 1000000;
+    static constexpr int32_t color_max_error = 1;
+    static constexpr int32_t gradient_max_error = 2;
+    static constexpr uint32_t fast_math_calls = 1000000;
+    static constexpr uint32_t random_calls = 1000000;
+    static constexpr uint32_t persistence_saves = 1000;
+    static constexpr size_t timeline_spans = 400;
+    static constexpr uint32_t timeline_ticks = 2000;
+    static constexpr uint32_t time_base_frames = 100000;
+    static constexpr double time_base_max_phase_error = 1e-5;
+    static constexpr uint32_t burst_messages = 50;
+    static constexpr uint32_t burst_spacing_ms = 100;
+    static constexpr uint32_t display_frames = 480;
+    static constexpr uint32_t message_ms = 8000; // how long a received message is shown
+    static constexpr uint32_t screen_ms = 5000; // shorter than the menu timeout
+    static constexpr uint32_t blackout_effect = 2; // rgb_band, changes every frame
+    static constexpr uint32_t state_effect_from = 16; // twinkle
+    static constexpr uint32_t state_effect_to = 2; // rgb_band
+    static constexpr uint32_t compositor_from = 22; // overdrive
+    static constexpr uint32_t compositor_effect = 23; // ironman, both rings calculated
+    static constexpr uint32_t overlay_fade_ms = 250;
+    static constexpr uint32_t overlay_frames = 100;
+    static constexpr double blend_max_error = 1.0;
+    static constexpr double blackout_min_skipped = 0.9;
+    static constexpr double battery_mah = 1000.0;
+    static constexpr double system_ma = 30.0; // MCU, radio receiving and display
+    static constexpr size_t discharge_steps = 10;
+    static constexpr uint32_t discharge_step_ms = 300;
+    static constexpr double power_max_over_budget = 0.05;
+    static constexpr uint32_t prediction_effect = 1; // static_color, held at the current budget
+    static constexpr double discharge_bias = 1.15; // what the estimates miss
+    static constexpr double cell_resistance = 0.15; // ohm
+    static constexpr double prediction_settle = 0.2; // share of the log before errors count
+    static constexpr double prediction_max_error = 0.1;
+
+    bool headless = false;
+    bool suite = false;
+    bool json = false;
+    const char *json_path = 0;
+    const char *telemetry_path = 0;
+    uint32_t frames = 1000;
+
+    uint64_t now_ms = 0;
+
+    FrameStats led_stats;
+    FrameStats oled_stats;
+    FrameStats adc_stats;
+
+    void init();
+    bool initialized = false;
+};
+
+#endif  // #ifdef BENCHMARK
+
+#endif  // #ifndef BENCHMARK_H_
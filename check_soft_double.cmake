@@ -0,0 +1,44 @@
+# Copyright 2019 Tinic Uro
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the
+# "Software"), to deal in the Software without restriction, including
+# without limitation the rights to use, copy, modify, merge, publish,
+# distribute, sublicense, and/or sell copies of the Software, and to
+# permit persons to whom the Software is furnished to do so, subject to
+# the following conditions:
+# 
+# The above copyright notice and this permission notice shall be included
+# in all copies or substantial portions of the Software.
+# 
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+# OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+# MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+# IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+# CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+# TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+# SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+# Fails the build when the LED frame path calls the soft double helpers.
+# The FPU is single precision only, so any double arithmetic in these
+# objects costs a libgcc call per operation.
+#
+# cmake -DNM=<nm> -DOBJECT_DIR=<dir> -DSOURCES=<a.cpp;b.cpp> -P check_soft_double.cmake
+
+foreach(SOURCE ${SOURCES})
+	file(GLOB_RECURSE OBJECTS "${OBJECT_DIR}/${SOURCE}.o" "${OBJECT_DIR}/${SOURCE}.obj")
+	if(NOT OBJECTS)
+		message(FATAL_ERROR "No object file for ${SOURCE} in ${OBJECT_DIR}")
+	endif()
+	foreach(OBJECT ${OBJECTS})
+		execute_process(COMMAND ${NM} -u ${OBJECT} OUTPUT_VARIABLE SYMBOLS RESULT_VARIABLE RESULT)
+		if(NOT RESULT EQUAL 0)
+			message(FATAL_ERROR "${NM} failed on ${OBJECT}")
+		endif()
+		string(REGEX MATCHALL "__aeabi_d[a-z0-9]+|__aeabi_u?[fil]2d" HELPERS "${SYMBOLS}")
+		if(HELPERS)
+			list(REMOVE_DUPLICATES HELPERS)
+			message(FATAL_ERROR "${SOURCE} uses soft double helpers: ${HELPERS}")
+		endif()
+	endforeach()
+endforeach()
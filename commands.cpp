@@ -27,10 +27,12 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include <cstring>
 #include <cmath>
 #include <limits>
+#include <algorithm>
 
 #include "./model.h"
 #include "./sx1280.h"
 #include "./bq25895.h"
+#include "./battery.h"
 #include "./sdd1306.h"
 #include "./timeline.h"
 #include "./leds.h"
@@ -87,11 +89,14 @@ void Commands::Boot() {
         });
 		
         SX1280::instance().SetRxDoneCallback([=](const uint8_t *payload, uint8_t size, SX1280::PacketStatus) {
+            // The timer tasks may be idle, so the model time can be stale
+            Model::instance().SetTicks(system_ticks());
+
             if (size >= 24 && memcmp(payload, "PLEASEPLEASERANGEMENOW!!", 24) == 0) {
                 static Timeline::Span s;
                 s.type = Timeline::Span::Measurement;
-                s.time = Model::instance().Time();
-                s.duration = 60.0; // timeout
+                s.time = Model::instance().Ticks();
+                s.duration = 60 * ticks_per_second; // timeout
 
                 s.startFunc = [=](Timeline::Span &) {
                     SX1280::instance().SetRangingRX();
@@ -137,6 +142,7 @@ void Commands::Boot() {
                 tm.tm_hour %= 24;
 
                 Model::instance().SetDateTime((static_cast<double>(tm.tm_hour) * 60.0 * 60.0 + static_cast<double>(tm.tm_min) * 60.0 + static_cast<double>(tm.tm_sec)));
+                Wake(Timeline::Span::Display);
                 
             // Do V2 messages
             } else if (size >= 24 && memcmp(payload, "DUCK!!", 6) == 0) {
@@ -157,15 +163,15 @@ void Commands::Boot() {
                     static Timeline::Span s;
                     if (!Timeline::instance().Scheduled(s)) {
                         s.type = Timeline::Span::Display;
-                        s.time = Model::instance().Time();
-                        s.duration = 8.0;
+                        s.time = Model::instance().Ticks();
+                        s.duration = 8 * ticks_per_second;
                         s.calcFunc = [=](Timeline::Span &span, Timeline::Span &below) {
                             char str[64];
                             snprintf(str, 64, "%8.8s : %8.8s", &payload[16], &payload[8] );
                             const float speed = 128.0;
-                            int32_t text_walk = static_cast<int32_t>(static_cast<float>(Model::instance().Time() - static_cast<double>(span.time)) * speed - 96.0f);
+                            int32_t text_walk = static_cast<int32_t>(span.Elapsed() * speed - 96.0f);
                             float interp = 0;
-                            if (span.InBeginPeriod(interp, 0.5f)) {
+                            if (span.InBeginPeriod(interp, ticks_per_second / 2)) {
                                 if (interp < 0.5f) {
                                     SDD1306::instance().SetVerticalShift(-static_cast<int8_t>(interp * 2.0f * 16));
                                     below.Calc();
@@ -173,7 +179,7 @@ void Commands::Boot() {
                                     SDD1306::instance().SetVerticalShift(16-static_cast<int8_t>((interp * 2.0f - 1.0f ) * 16.0f));
                                     SDD1306::instance().SetAsciiScrollMessage(str,text_walk);
                                 }
-                            } else  if (span.InEndPeriod(interp, 0.5f)) {
+                            } else  if (span.InEndPeriod(interp, ticks_per_second / 2)) {
                                 if (interp < 0.5f) {
                                     SDD1306::instance().SetVerticalShift(-static_cast<int8_t>(interp * 2.0f * 16.0f));
                                     SDD1306::instance().SetAsciiScrollMessage(str,text_walk);
@@ -230,22 +236,22 @@ void Commands::Boot() {
 				static Timeline::Span s;
 				if (!Timeline::instance().Scheduled(s)) {
 					s.type = Timeline::Span::Display;
-					s.time = Model::instance().Time();
-					s.duration = 15.0;
+					s.time = Model::instance().Ticks();
+					s.duration = 15 * ticks_per_second;
 					s.calcFunc = [=](Timeline::Span &span, Timeline::Span &) {
 						char str[256];
 						snprintf(str, 256, " [%s] %s ", Model::instance().CurrentRecvMessage().NameStr(), Model::instance().CurrentRecvMessage().MessageStr());
 						const float speed = 128.0;
-						int32_t text_walk = static_cast<int32_t>(static_cast<float>(Model::instance().Time() - static_cast<double>(span.time)) * speed - 96.0f);
+						int32_t text_walk = static_cast<int32_t>(span.Elapsed() * speed - 96.0f);
 						float interp = 0;
-						if (span.InBeginPeriod(interp, 0.5f)) {
+						if (span.InBeginPeriod(interp, ticks_per_second / 2)) {
 							if (interp < 0.5f) {
 								SDD1306::instance().SetVerticalShift(-static_cast<int8_t>(interp * 2.0f * 16));
 							} else {
 								SDD1306::instance().SetVerticalShift(16-static_cast<int8_t>((interp * 2.0f - 1.0f ) * 16.0f));
 								SDD1306::instance().SetAsciiScrollMessage(str,text_walk);
 							}
-						} else  if (span.InEndPeriod(interp, 0.5f)) {
+						} else  if (span.InEndPeriod(interp, ticks_per_second / 2)) {
 							if (interp < 0.5f) {
 								SDD1306::instance().SetVerticalShift(-static_cast<int8_t>(interp * 2.0f * 16.0f));
 								SDD1306::instance().SetAsciiScrollMessage(str,text_walk);
@@ -302,18 +308,18 @@ void Commands::Boot() {
 
     static Timeline::Span s0;
     s0.type = Timeline::Span::Display;
-    s0.time = Model::instance().Time();
-    s0.duration = 1.0; // timeout
+    s0.time = Model::instance().Ticks();
+    s0.duration = ticks_per_second; // timeout
 
 	static Timeline::Span s1;
 	s1.type = Timeline::Span::Display;
 	s1.time = s0.time + s0.duration;
-	s1.duration = 0.25; // timeout
+	s1.duration = ticks_per_second / 4; // timeout
 
 	static Timeline::Span s2;
 	s2.type = Timeline::Span::Display;
 	s2.time = s1.time + s1.duration;
-	s2.duration = 0.25; // timeout
+	s2.duration = ticks_per_second / 4; // timeout
 
     s0.startFunc = [=](Timeline::Span &) {
         SDD1306::instance().Clear();
@@ -321,9 +327,8 @@ void Commands::Boot() {
 		SDD1306::instance().Display();
     };
     s0.calcFunc = [=](Timeline::Span &span, Timeline::Span &) {
-		double now = Model::instance().Time();
-		double delta = (span.time + span.duration) - now;
-		SDD1306::instance().SetBootScreen(true, static_cast<int32_t>(120.0f * Cubic::easeIn(static_cast<float>(delta), 0.0f, 1.0f, 1.0f)));
+		float delta = span.Remaining();
+		SDD1306::instance().SetBootScreen(true, static_cast<int32_t>(120.0f * Cubic::easeIn(delta, 0.0f, 1.0f, 1.0f)));
 		SDD1306::instance().Display();
     };
     s0.doneFunc = [=](Timeline::Span &span) {
@@ -337,9 +342,8 @@ void Commands::Boot() {
 	};
 
 	s1.calcFunc = [=](Timeline::Span &span, Timeline::Span &) {
-		double now = Model::instance().Time();
-		double delta = ( (span.time + span.duration) - now ) / span.duration;
-		SDD1306::instance().SetVerticalShift(-static_cast<int8_t>(16.0f * (1.0f - Cubic::easeOut(static_cast<float>(delta), 0.0f, 1.0f, 1.0f))));
+		float delta = 1.0f - span.Progress();
+		SDD1306::instance().SetVerticalShift(-static_cast<int8_t>(16.0f * (1.0f - Cubic::easeOut(delta, 0.0f, 1.0f, 1.0f))));
 		SDD1306::instance().Display();
 	};
 	s1.doneFunc = [=](Timeline::Span &span) {
@@ -358,9 +362,8 @@ void Commands::Boot() {
 	};
 	s2.calcFunc = [=](Timeline::Span &span, Timeline::Span &below) {
 		below.Calc();
-		double now = Model::instance().Time();
-		double delta = ( (span.time + span.duration) - now ) / span.duration;
-		SDD1306::instance().SetCenterFlip(static_cast<int8_t>(48.0 * (delta)));
+		float delta = 1.0f - span.Progress();
+		SDD1306::instance().SetCenterFlip(static_cast<int8_t>(48.0f * (delta)));
 		SDD1306::instance().Display();
 	};
 	s2.doneFunc = [=](Timeline::Span &span) {
@@ -376,17 +379,21 @@ void Commands::Boot() {
 
 void Commands::StartTimers() {
 
-    update_leds_timer_task.interval = 10; // 100fps
+    Timeline::instance().SetWakeCallback([=](Timeline::Span::Type type) {
+        Wake(type);
+    });
+
+    timersRunning = true;
+
     update_leds_timer_task.cb = &OnLEDTimer_C;
-    update_leds_timer_task.mode = TIMER_TASK_REPEAT;
-    timer_add_task(&TIMER_0, &update_leds_timer_task);
+    update_leds_timer_task.mode = TIMER_TASK_ONE_SHOT;
+    Arm(update_leds_timer_task, ledArmed, ledInterval);
 
-    update_oled_timer_task.interval = 16; // 60fps
     update_oled_timer_task.cb = &OnOLEDTimer_C;
-    update_oled_timer_task.mode = TIMER_TASK_REPEAT;
-    timer_add_task(&TIMER_0, &update_oled_timer_task);
+    update_oled_timer_task.mode = TIMER_TASK_ONE_SHOT;
+    Arm(update_oled_timer_task, oledArmed, oledInterval);
 
-    update_adc_timer_task.interval = 2000; // Every 2 seconds
+    update_adc_timer_task.interval = adcInterval;
     update_adc_timer_task.cb = &OnADCTimer_C;
     update_adc_timer_task.mode = TIMER_TASK_REPEAT;
     timer_add_task(&TIMER_0, &update_adc_timer_task);
@@ -403,13 +410,60 @@ void Commands::StartTimers() {
 }
 
 void Commands::StopTimers() {
-    timer_remove_task(&TIMER_0, &update_leds_timer_task);
-    timer_remove_task(&TIMER_0, &update_oled_timer_task);
+    timersRunning = false;
+
+    if (ledArmed) {
+        timer_remove_task(&TIMER_0, &update_leds_timer_task);
+        ledArmed = false;
+    }
+    if (oledArmed) {
+        timer_remove_task(&TIMER_0, &update_oled_timer_task);
+        oledArmed = false;
+    }
     timer_remove_task(&TIMER_0, &update_adc_timer_task);
     
     timer_stop(&TIMER_0);
 }
 
+void Commands::Arm(struct timer_task &task, bool &armed, uint32_t interval) {
+    if (armed) {
+        if (task.interval <= interval) {
+            return;
+        }
+        timer_remove_task(&TIMER_0, &task);
+    }
+    task.interval = interval;
+    timer_add_task(&TIMER_0, &task);
+    armed = true;
+}
+
+void Commands::Rearm(struct timer_task &task, bool &armed, uint32_t interval, Timeline::Span::Type type) {
+    ticks_t next = Timeline::instance().NextDeadline(type);
+    if (next == ticks_infinite) {
+        return; // Idle until Wake()
+    }
+    // Capped so the timer still fires should a deadline be far off
+    static constexpr ticks_t ticks_per_ms = ticks_per_second / 1000;
+    ticks_t ms = std::min((next + ticks_per_ms - 1) / ticks_per_ms, ticks_t(60000));
+    Arm(task, armed, std::max(interval, static_cast<uint32_t>(ms)));
+}
+
+void Commands::Wake(Timeline::Span::Type type) {
+    if (!timersRunning) {
+        return;
+    }
+    switch (type) {
+        case Timeline::Span::Effect: {
+            Arm(update_leds_timer_task, ledArmed, ledInterval);
+        } break;
+        case Timeline::Span::Display: {
+            Arm(update_oled_timer_task, oledArmed, oledInterval);
+        } break;
+        default: {
+        } break;
+    }
+}
+
 void Commands::SendV2Message(const char *name, const char *message, uint8_t color) {
     static uint8_t buf[32];
     memcpy(&buf[0],"DUCK!!",6);
@@ -462,17 +516,23 @@ void Commands::SendDateTimeRequest() {
 }
 
 void Commands::OnLEDTimer() {
-    Model::instance().SetTime(system_time());
+    ledArmed = false;
+
+    Model::instance().SetTicks(system_ticks());
 
     Timeline::instance().ProcessEffect();
     if (Timeline::instance().TopEffect().Valid()) {
         Timeline::instance().TopEffect().Calc();
         Timeline::instance().TopEffect().Commit();
     }
+
+    Rearm(update_leds_timer_task, ledArmed, ledInterval, Timeline::Span::Effect);
 }
 
 void Commands::OnOLEDTimer() {
-    Model::instance().SetTime(system_time());
+    oledArmed = false;
+
+    Model::instance().SetTicks(system_ticks());
 
     Timeline::instance().ProcessDisplay();
     if (Timeline::instance().TopDisplay().Valid()) {
@@ -483,38 +543,66 @@ void Commands::OnOLEDTimer() {
 #ifdef EMULATOR
     display_debug_area(1);
 #endif  // #ifdef EMULATOR
+
+    Rearm(update_oled_timer_task, oledArmed, oledInterval, Timeline::Span::Display);
 }
 
 void Commands::OnADCTimer() {
-    Model::instance().SetTime(system_time());
+    Model::instance().SetTicks(system_ticks());
 
     Model::instance().SetBatteryVoltage(BQ25895::instance().BatteryVoltage());
     Model::instance().SetSystemVoltage(BQ25895::instance().SystemVoltage());
     Model::instance().SetVbusVoltage(BQ25895::instance().VBUSVoltage());
     Model::instance().SetChargeCurrent(BQ25895::instance().ChargeCurrent());
 
+    Battery::instance().Update();
+
     BQ25895::instance().OneShotADC();
+
+    // Charger state and battery level are on the status screen
+    Wake(Timeline::Span::Display);
+
+    // The LED current budget follows the battery and charger
+    if (led_control::CurrentLimitPending()) {
+        Wake(Timeline::Span::Effect);
+    }
+}
+
+// Flash erases and writes take milliseconds, so the model is flushed from
+// the main loop where the radio and switch interrupts can preempt them.
+// The ADC task wakes the core often enough to meet the save interval.
+void Commands::OnIdle() {
+    Model::instance().flush();
 }
 
 void Commands::Switch1_Pressed() {
+    Model::instance().SetTicks(system_ticks());
     Timeline::instance().ProcessDisplay();
     if (Timeline::instance().TopDisplay().Valid()) {
         Timeline::instance().TopDisplay().ProcessSwitch1();
     }
+    Wake(Timeline::Span::Effect);
+    Wake(Timeline::Span::Display);
 }
 
 void Commands::Switch2_Pressed() {
+    Model::instance().SetTicks(system_ticks());
     Timeline::instance().ProcessDisplay();
     if (Timeline::instance().TopDisplay().Valid()) {
         Timeline::instance().TopDisplay().ProcessSwitch2();
     }
+    Wake(Timeline::Span::Effect);
+    Wake(Timeline::Span::Display);
 }
 
 void Commands::Switch3_Pressed() {
+    Model::instance().SetTicks(system_ticks());
     Timeline::instance().ProcessDisplay();
     if (Timeline::instance().TopDisplay().Valid()) {
         Timeline::instance().TopDisplay().ProcessSwitch3();
     }
+    Wake(Timeline::Span::Effect);
+    Wake(Timeline::Span::Display);
 }
 
 #ifdef MCP
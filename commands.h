@@ -28,6 +28,7 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 #include "./emulator.h"
 #include "./leds.h"
+#include "./timeline.h"
 
 class Commands {
 public:
@@ -44,12 +45,26 @@ public:
     void SendV3Message(const char *name, const char *message, colors::rgb8 color = colors::rgb8());
     void SendDateTimeRequest();
 
+    // Runs the LED or OLED task on the next tick instead of at its
+    // scheduled deadline, for events which change what is shown
+    void Wake(Timeline::Span::Type type);
+
 private:
+#ifndef BENCHMARK
     friend int main();
+#else  // #ifndef BENCHMARK
+    friend int main(int argc, char *argv[]);
+    friend class Benchmark;
+#endif  // #ifndef BENCHMARK
 
     void OnLEDTimer();
     void OnOLEDTimer();
     void OnADCTimer();
+    // Runs from the main loop after each wakeup, below every interrupt
+    void OnIdle();
+
+    void Arm(struct timer_task &task, bool &armed, uint32_t interval);
+    void Rearm(struct timer_task &task, bool &armed, uint32_t interval, Timeline::Span::Type type);
 
     void Switch1_Pressed();
     void Switch2_Pressed();
@@ -71,10 +86,21 @@ private:
     static void OnMCPTimer_C(const timer_task *);
 #endif  // #ifdef MCP
 
-    struct timer_task update_leds_timer_task = {0, 0, 0, 0, TIMER_TASK_REPEAT};
-    struct timer_task update_oled_timer_task = {0, 0, 0, 0, TIMER_TASK_REPEAT};
+    // The LED and OLED tasks are one-shot: each pass arms the next one for
+    // the earliest span deadline, and nothing is armed while all spans are
+    // idle. The intervals are the shortest frame time.
+    static constexpr uint32_t ledInterval = 10; // 100fps
+    static constexpr uint32_t oledInterval = 16; // 60fps
+    static constexpr uint32_t adcInterval = 2000; // Every 2 seconds
+
+    struct timer_task update_leds_timer_task = {0, 0, 0, 0, TIMER_TASK_ONE_SHOT};
+    struct timer_task update_oled_timer_task = {0, 0, 0, 0, TIMER_TASK_ONE_SHOT};
     struct timer_task update_adc_timer_task = {0, 0, 0, 0, TIMER_TASK_REPEAT};
 
+    bool timersRunning = false;
+    bool ledArmed = false;
+    bool oledArmed = false;
+
 #ifdef MCP
     struct timer_task update_mcp_timer_task = {0, 0, 0, 0, TIMER_TASK_REPEAT};
 #endif  // #ifdef MCP
@@ -28,17 +28,56 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 #ifdef EMULATOR
 
-#include <list>
 #include <vector>
 #include <thread>
+#include <chrono>
 #include <algorithm>
 #include <memory.h>
+#include <cstdlib>
+#include <new>
 
 std::recursive_mutex g_print_mutex;
 
+emulator_counters g_emulator_counters = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+#ifdef BENCHMARK
+// Route all heap allocations through a counter so per-frame allocation
+// rates can be measured. Arrays and sized deletes fall through to these.
+void *operator new(size_t size) {
+    g_emulator_counters.allocations++;
+    void *ptr = malloc(size ? size : 1);
+    if (!ptr) {
+        abort();
+    }
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+    free(ptr);
+}
+#endif  // #ifdef BENCHMARK
+
 struct flash_descriptor FLASH_0;
 
-static uint8_t flash_memory[512] = { 0 };
+// SAMD51G18A main array: 512 byte pages, erased in 8 KB blocks
+static constexpr uint32_t flash_page_size = 512;
+static constexpr uint32_t flash_block_size = 8192;
+static constexpr uint32_t flash_size = 0x40000;
+static uint8_t flash_memory[flash_size];
+static uint32_t flash_block_erases[flash_size / flash_block_size] = { 0 };
+static uint32_t flash_debug_page = 0;
+
+static bool headless = false;
+static double virtual_time = 0.0;
+
+// Matches CONF_QSPI_BAUD; 4 data lines move one byte every 2 clocks
+static constexpr double qspi_baud = 24000000.0;
+static constexpr double qspi_bytes_per_second = qspi_baud / 2.0;
+static double qspi_busy_until = 0.0;
 
 #define BYTE_TO_BINARY_PATTERN "%c%c%c%c%c%c%c%c"
 
@@ -80,12 +119,25 @@ struct spi_byte {
     uint32_t seq;
 };
 
+// Matches CONF_SERCOM_0_SPI_BAUD
+static constexpr double spi_baud = 500000.0;
+// Chip select setup/hold plus the BUSY poll the driver does around every
+// command; the SX1280 datasheet puts command processing in the low microseconds
+static constexpr uint64_t spi_transaction_overhead_ns = 4000;
+
+// SX1280 IRQ status register; SetTx completes immediately in the model
+static uint16_t sx1280_irq_status = 0;
+
 static uint32_t spiSeqIdx = 0;
 static uint32_t spiSeqCmd = 0;
 static uint32_t spiSeqID = 0;
 static std::vector<spi_byte> spiBuf;
 
 void display_debug_area(int32_t area) {
+    if (headless) {
+        return;
+    }
+
     std::lock_guard<std::recursive_mutex> lock(g_print_mutex);
 
     const int32_t sy = 35;
@@ -156,14 +208,14 @@ void display_debug_area(int32_t area) {
             for (int32_t y=0; y<32; y++) {
                 printf("\x1b[%d;%df",sy+1+y,0);
                 for (int32_t x=0; x<16; x++) {
-                    printf("%02x ", flash_memory[y*16+x]);
+                    printf("%02x ", flash_memory[flash_debug_page*flash_page_size+y*16+x]);
                 }
             }
 
             for (int32_t y=0; y<32; y++) {
                 printf("\x1b[%d;%df",sy+1+y,49);
                 for (int32_t x=0; x<16; x++) {
-                    char c = static_cast<char>(flash_memory[y*16+x]);
+                    char c = static_cast<char>(flash_memory[flash_debug_page*flash_page_size+y*16+x]);
                     if ( c < 0x20 ) {
                         c = '.';
                     }
@@ -182,17 +234,89 @@ void display_debug_area(int32_t area) {
 }
 
 
-int32_t flash_write(struct flash_descriptor *, uint32_t, uint8_t *buffer, uint32_t length) {
+static bool flash_range(uint32_t addr, uint32_t length) {
+    return addr <= flash_size && length <= flash_size - addr;
+}
+
+static void flash_erase_block(uint32_t block) {
+    memset(&flash_memory[block * flash_block_size], 0xFF, flash_block_size);
+    flash_block_erases[block]++;
+    g_emulator_counters.flash_erases++;
+}
+
+// NOR flash: programming can only clear bits
+static void flash_program(uint32_t addr, const uint8_t *buffer, uint32_t length) {
+    for (uint32_t c = 0; c < length; c++) {
+        flash_memory[addr + c] &= buffer[c];
+    }
+    g_emulator_counters.flash_writes++;
+    g_emulator_counters.flash_bytes_programmed += length;
+    flash_debug_page = addr / flash_page_size;
+}
+
+// Like the HAL: read-modify-write of every block the range touches
+int32_t flash_write(struct flash_descriptor *, uint32_t dst_addr, uint8_t *buffer, uint32_t length) {
+    std::lock_guard<std::recursive_mutex> lock(g_print_mutex);
+    if (!flash_range(dst_addr, length)) {
+        return -1;
+    }
+    static uint8_t block_copy[flash_block_size];
+    uint32_t end = dst_addr + length;
+    for (uint32_t block = dst_addr / flash_block_size; block * flash_block_size < end; block++) {
+        uint32_t block_addr = block * flash_block_size;
+        memcpy(block_copy, &flash_memory[block_addr], flash_block_size);
+        uint32_t from = std::max(dst_addr, block_addr);
+        uint32_t to = std::min(end, block_addr + flash_block_size);
+        memcpy(&block_copy[from - block_addr], &buffer[from - dst_addr], to - from);
+        flash_erase_block(block);
+        flash_program(block_addr, block_copy, flash_block_size);
+    }
+    return 0;
+}
+
+int32_t flash_append(struct flash_descriptor *, uint32_t dst_addr, uint8_t *buffer, uint32_t length) {
+    std::lock_guard<std::recursive_mutex> lock(g_print_mutex);
+    if (!flash_range(dst_addr, length)) {
+        return -1;
+    }
+    flash_program(dst_addr, buffer, length);
+    return 0;
+}
+
+int32_t flash_erase(struct flash_descriptor *, uint32_t dst_addr, uint32_t page_nums) {
     std::lock_guard<std::recursive_mutex> lock(g_print_mutex);
-    memcpy(flash_memory, buffer, std::min(uint32_t(512),length));
+    if (!flash_range(dst_addr, page_nums * flash_page_size) ||
+        (dst_addr % flash_block_size) || ((page_nums * flash_page_size) % flash_block_size)) {
+        return -1;
+    }
+    for (uint32_t c = 0; c < page_nums * flash_page_size; c += flash_block_size) {
+        flash_erase_block((dst_addr + c) / flash_block_size);
+    }
     return 0;
 }
 
-int32_t flash_read(struct flash_descriptor *, uint32_t, uint8_t *buffer, uint32_t length) {
-    memcpy(buffer, flash_memory, std::min(uint32_t(512),length));
+int32_t flash_read(struct flash_descriptor *, uint32_t src_addr, uint8_t *buffer, uint32_t length) {
+    if (!flash_range(src_addr, length)) {
+        return -1;
+    }
+    memcpy(buffer, &flash_memory[src_addr], length);
+    g_emulator_counters.flash_bytes_read += length;
     return 0;
 }
 
+void emulator_flash_reset(void) {
+    memset(flash_memory, 0xFF, sizeof(flash_memory));
+    memset(flash_block_erases, 0, sizeof(flash_block_erases));
+}
+
+uint32_t emulator_flash_max_block_erases(void) {
+    uint32_t max = 0;
+    for (uint32_t erases : flash_block_erases) {
+        max = std::max(max, erases);
+    }
+    return max;
+}
+
 bool gpio_get_pin_level(const uint8_t) {
     return 0;
 }
@@ -203,6 +327,7 @@ void gpio_set_pin_level(const uint8_t pin, const bool level) {
                 if (!level) {
                     spiSeqID ++;
                     spiSeqIdx = 0;
+                    g_emulator_counters.spi_wire_ns += spi_transaction_overhead_ns;
                 }
                 break;
     }
@@ -214,6 +339,151 @@ static int32_t i2c_addr = 0;
 
 static int32_t bq25895_read_reg = 0;
 
+// SSD1306 model: display RAM, page addressing and continuous horizontal
+// scrolling, enough to check what the panel shows for a given I2C stream.
+// Frame rate: ~370kHz oscillator, 53 clocks per row (phase 1 + phase 2 +
+// 50 with 0xD9 0x10), 16 rows (0xA8 0x0F).
+static constexpr double ssd1306_frame_hz = 370000.0 / (53.0 * 16.0);
+static constexpr uint32_t ssd1306_width = 128;
+static constexpr uint32_t ssd1306_visible = 96;
+
+static struct {
+    uint8_t ram[8][ssd1306_width];
+    uint32_t page;
+    uint32_t column;
+    uint8_t cmd[8];
+    size_t cmd_len;
+    size_t cmd_need;
+    bool scroll_left;
+    uint32_t scroll_start_page;
+    uint32_t scroll_end_page;
+    uint32_t scroll_frames;
+    bool scrolling;
+    double scroll_start;
+    uint64_t visible_writes_while_scrolling;
+} ssd1306;
+
+static uint32_t ssd1306_scroll_columns() {
+    if (!ssd1306.scrolling) {
+        return 0;
+    }
+    double frames = (system_time() - ssd1306.scroll_start) * ssd1306_frame_hz;
+    return static_cast<uint32_t>(frames / ssd1306.scroll_frames) % ssd1306_width;
+}
+
+static uint32_t ssd1306_ram_column(uint32_t page, uint32_t x) {
+    if (!ssd1306.scrolling || page < ssd1306.scroll_start_page || page > ssd1306.scroll_end_page) {
+        return x;
+    }
+    uint32_t shift = ssd1306_scroll_columns();
+    return ssd1306.scroll_left ? (x + shift) % ssd1306_width : (x + ssd1306_width - shift) % ssd1306_width;
+}
+
+static bool ssd1306_column_visible(uint32_t page, uint32_t column) {
+    if (!ssd1306.scrolling || page < ssd1306.scroll_start_page || page > ssd1306.scroll_end_page) {
+        return column < ssd1306_visible;
+    }
+    uint32_t shift = ssd1306_scroll_columns();
+    uint32_t x = ssd1306.scroll_left ? (column + ssd1306_width - shift) % ssd1306_width : (column + shift) % ssd1306_width;
+    return x < ssd1306_visible;
+}
+
+static size_t ssd1306_command_length(uint8_t cmd) {
+    switch (cmd) {
+        case 0x26: case 0x27:
+            return 7;
+        case 0x29: case 0x2A:
+            return 6;
+        case 0x21: case 0x22: case 0xA3:
+            return 3;
+        case 0x20: case 0x81: case 0x8D: case 0xA8: case 0xD3:
+        case 0xD5: case 0xD9: case 0xDA: case 0xDB:
+            return 2;
+        default:
+            return 1;
+    }
+}
+
+static void ssd1306_command(const uint8_t *cmd) {
+    if (cmd[0] >= 0xB0 && cmd[0] <= 0xB7) {
+        ssd1306.page = cmd[0] & 0x07;
+    } else if (cmd[0] <= 0x0F) {
+        ssd1306.column = (ssd1306.column & 0xF0) | cmd[0];
+    } else if (cmd[0] >= 0x10 && cmd[0] <= 0x1F) {
+        ssd1306.column = ((cmd[0] & 0x0F) << 4) | (ssd1306.column & 0x0F);
+    } else if (cmd[0] == 0x26 || cmd[0] == 0x27) {
+        static const uint32_t interval_frames[8] = { 5, 64, 128, 256, 3, 4, 25, 2 };
+        ssd1306.scroll_left = cmd[0] == 0x27;
+        ssd1306.scroll_start_page = cmd[2] & 0x07;
+        ssd1306.scroll_frames = interval_frames[cmd[3] & 0x07];
+        ssd1306.scroll_end_page = cmd[4] & 0x07;
+    } else if (cmd[0] == 0x2F) {
+        ssd1306.scrolling = true;
+        ssd1306.scroll_start = system_time();
+    } else if (cmd[0] == 0x2E) {
+        // The panel keeps showing the scrolled image; the RAM content is
+        // undefined afterwards, which this model treats as the scrolled image
+        uint8_t ram[8][ssd1306_width];
+        for (uint32_t p = 0; p < 8; p++) {
+            for (uint32_t x = 0; x < ssd1306_width; x++) {
+                ram[p][x] = ssd1306.ram[p][ssd1306_ram_column(p, x)];
+            }
+        }
+        memcpy(ssd1306.ram, ram, sizeof(ram));
+        ssd1306.scrolling = false;
+    }
+}
+
+static void ssd1306_write(const uint8_t *buf, size_t length) {
+    if (length == 0) {
+        return;
+    }
+    if (buf[0] == 0x40) {
+        for (size_t c = 1; c < length; c++) {
+            if (ssd1306.scrolling && ssd1306_column_visible(ssd1306.page, ssd1306.column)) {
+                ssd1306.visible_writes_while_scrolling++;
+            }
+            ssd1306.ram[ssd1306.page][ssd1306.column] = buf[c];
+            ssd1306.column = (ssd1306.column + 1) % ssd1306_width;
+        }
+    } else if (buf[0] == 0x00) {
+        for (size_t c = 1; c < length; c++) {
+            if (ssd1306.cmd_len == 0) {
+                ssd1306.cmd_need = ssd1306_command_length(buf[c]);
+            }
+            ssd1306.cmd[ssd1306.cmd_len++] = buf[c];
+            if (ssd1306.cmd_len == ssd1306.cmd_need) {
+                ssd1306_command(ssd1306.cmd);
+                ssd1306.cmd_len = 0;
+            }
+        }
+    }
+}
+
+void emulator_oled_visible(uint8_t *columns) {
+    for (uint32_t p = 0; p < 2; p++) {
+        for (uint32_t x = 0; x < ssd1306_visible; x++) {
+            columns[p * ssd1306_visible + x] = ssd1306.ram[p][ssd1306_ram_column(p, x)];
+        }
+    }
+}
+
+uint64_t emulator_oled_visible_writes_while_scrolling(void) {
+    return ssd1306.visible_writes_while_scrolling;
+}
+
+void emulator_bq25895_set_adc(float battery, float vbus, float charge_current) {
+    auto reg = [](float v, float offset, float step) {
+        return static_cast<uint8_t>(std::min(std::max((v - offset) / step + 0.5f, 0.0f), 127.0f));
+    };
+    uint8_t vbat = reg(battery, 2.304f, 2.540f / 127.0f);
+    bq25895_regs[0x0E] = static_cast<uint8_t>((bq25895_regs[0x0E] & 0x80) | vbat);
+    bq25895_regs[0x0F] = vbat;
+    bool vbus_good = vbus >= 4.0f;
+    bq25895_regs[0x11] = static_cast<uint8_t>((vbus_good ? 0x80 : 0x00) | (vbus_good ? reg(vbus, 2.6f, 12.7f / 127.0f) : 0));
+    bq25895_regs[0x12] = reg(charge_current, 0.0f, 6350.0f / 127.0f);
+}
+
 int32_t i2c_m_sync_enable(struct i2c_m_sync_desc *) {
     return 0;
 }
@@ -228,6 +498,9 @@ int32_t i2c_m_sync_set_slaveaddr(struct i2c_m_sync_desc *, int16_t addr, int32_t
 }
 
 int32_t io_write(struct io_descriptor * const, const uint8_t *const buf, const uint16_t length) {
+    // Bus bytes include the address byte which starts every transaction
+    g_emulator_counters.i2c_transactions++;
+    g_emulator_counters.i2c_bytes += 1 + length;
     switch (i2c_addr) {
         case 0x6A: {
             if (length == 1) {
@@ -242,12 +515,15 @@ int32_t io_write(struct io_descriptor * const, const uint8_t *const buf, const u
             }
         } break;
         case 0x3C: {
-        }
+            ssd1306_write(buf, length);
+        } break;
     }
     return length;
 }
 
 int32_t io_read(struct io_descriptor * const, uint8_t *const buf, const uint16_t length) {
+    g_emulator_counters.i2c_transactions++;
+    g_emulator_counters.i2c_bytes += 1 + length;
     switch (i2c_addr) {
         case 0x6A: {
             if (bq25895_read_reg >= 0 && length == 1) {
@@ -274,23 +550,76 @@ void delay_ms(int32_t) {
 
 struct timer_descriptor TIMER_0;
 
-std::list<std::reference_wrapper<struct timer_task>> timer_tasks;
+// Fixed storage like the HAL's intrusive list, so re-arming a one-shot
+// task does not allocate
+static constexpr size_t timer_tasks_max = 8;
+static struct timer_task *timer_tasks[timer_tasks_max];
+static size_t timer_tasks_num = 0;
+
+static size_t timer_task_index(const struct timer_task *task) {
+    for (size_t c = 0; c < timer_tasks_num; c++) {
+        if (timer_tasks[c] == task) {
+            return c;
+        }
+    }
+    return timer_tasks_max;
+}
+
+static void timer_task_erase(size_t index) {
+    std::copy(&timer_tasks[index + 1], &timer_tasks[timer_tasks_num], &timer_tasks[index]);
+    timer_tasks_num--;
+}
 
 int32_t timer_add_task(struct timer_descriptor * const, struct timer_task *const task) {
-    timer_tasks.push_back(*task);
+    std::lock_guard<std::recursive_mutex> lock(g_print_mutex);
+    if (timer_tasks_num >= timer_tasks_max) {
+        abort();
+    }
+    task->time_label = system_time();
+    timer_tasks[timer_tasks_num++] = task;
     return 0;
 }
 
+bool emulator_timer_task_due(struct timer_task *task) {
+    std::lock_guard<std::recursive_mutex> lock(g_print_mutex);
+    size_t index = timer_task_index(task);
+    if (index == timer_tasks_max) {
+        return false;
+    }
+    double now = system_time();
+    if (((now - task->time_label) * 1000.0 + 1e-6) < static_cast<double>(task->interval)) {
+        return false;
+    }
+    // Like the RTC handler: one-shot tasks are gone before their callback
+    // runs, so the callback may add them again
+    if (task->mode == TIMER_TASK_ONE_SHOT) {
+        timer_task_erase(index);
+    } else {
+        task->time_label = now;
+    }
+    return true;
+}
+
 int32_t timer_start(struct timer_descriptor * const) {
+    // In headless mode the caller steps the virtual clock and runs the tasks
+    if (headless) {
+        return 0;
+    }
     std::thread t([=]() {
         for (;;) {
-            double now = system_time();
-            for (auto it = timer_tasks.cbegin(); it != timer_tasks.cend(); it++) {
-                if (uint32_t((now - (*it).get().time_label) * 1000.0) >= (*it).get().interval) { 
-                    (*it).get().time_label = now;
-                    (*it).get().cb(&(*it).get());
+            struct timer_task *tasks[timer_tasks_max];
+            size_t tasks_num = 0;
+            {
+                std::lock_guard<std::recursive_mutex> lock(g_print_mutex);
+                tasks_num = timer_tasks_num;
+                std::copy(&timer_tasks[0], &timer_tasks[tasks_num], &tasks[0]);
+            }
+            for (size_t c = 0; c < tasks_num; c++) {
+                if (emulator_timer_task_due(tasks[c])) {
+                    tasks[c]->cb(tasks[c]);
                 }
             }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
         }
     });
     t.detach();
@@ -301,14 +630,30 @@ int32_t timer_stop(struct timer_descriptor * const) {
     return 0;
 }
 
-int32_t timer_remove_task(struct timer_descriptor * const, const struct timer_task * const) {
+int32_t timer_remove_task(struct timer_descriptor * const, const struct timer_task * const task) {
+    std::lock_guard<std::recursive_mutex> lock(g_print_mutex);
+    size_t index = timer_task_index(task);
+    if (index != timer_tasks_max) {
+        timer_task_erase(index);
+    }
     return 0;
 }
 
-int32_t ext_irq_register(const uint32_t, ext_irq_cb_t) {
+static std::vector<std::pair<uint32_t, ext_irq_cb_t>> ext_irqs;
+
+int32_t ext_irq_register(const uint32_t pin, ext_irq_cb_t cb) {
+    ext_irqs.push_back({pin, cb});
     return 0;
 }
 
+void emulator_raise_irq(uint32_t pin) {
+    for (auto &irq : ext_irqs) {
+        if (irq.first == pin && irq.second) {
+            irq.second();
+        }
+    }
+}
+
 struct qspi_sync_descriptor QUAD_SPI_0;
 
 int32_t qspi_sync_enable(struct qspi_sync_descriptor *) {
@@ -322,42 +667,99 @@ void spi_m_sync_enable(struct spi_m_sync_descriptor *) {
 
 
 int32_t spi_m_sync_transfer(struct spi_m_sync_descriptor *, const struct spi_xfer *xfer) {
+    g_emulator_counters.spi_transfers++;
+    g_emulator_counters.spi_bytes += xfer->size;
+    g_emulator_counters.spi_wire_ns += static_cast<uint64_t>(xfer->size * 8.0 * 1000000000.0 / spi_baud);
     for (size_t c = 0; c < xfer->size; c++) {
+        // Like the HAL, a missing buffer means dummy bytes out or data discarded
+        uint8_t tx = xfer->txbuf ? xfer->txbuf[c] : 0x00;
+        uint8_t rx = 0x00;
         if (spiSeqIdx == 0) {
-            spiSeqCmd = xfer->txbuf[c];
+            spiSeqCmd = tx;
         }
-        xfer->rxbuf[c] = 0x00;
         switch(spiSeqCmd) {
             case SX1280::RADIO_READ_REGISTER: {
                 static uint8_t read_reg[5];
-                read_reg[spiSeqIdx] = xfer->txbuf[c];
+                if (spiSeqIdx < sizeof(read_reg)) {
+                    read_reg[spiSeqIdx] = tx;
+                }
                 if (spiSeqIdx == 4) {
                     switch((read_reg[1]<<8)|(read_reg[2]<<0)) {
                         case SX1280::REG_LR_FIRMWARE_VERSION_MSB: {
-                            xfer->rxbuf[c] = 0xa9;
+                            rx = 0xa9;
                         } break;
                         case SX1280::REG_LR_FIRMWARE_VERSION_MSB+1: {
-                            xfer->rxbuf[c] = 0xb5;
+                            rx = 0xb5;
                         } break;
                     }
                 }
             } break;
+            case SX1280::RADIO_SET_TX: {
+                if (spiSeqIdx == 0) {
+                    sx1280_irq_status |= SX1280::IRQ_TX_DONE;
+                }
+            } break;
+            case SX1280::RADIO_GET_IRQSTATUS: {
+                if (spiSeqIdx == 2) {
+                    rx = static_cast<uint8_t>(sx1280_irq_status >> 8);
+                } else if (spiSeqIdx == 3) {
+                    rx = static_cast<uint8_t>(sx1280_irq_status);
+                }
+            } break;
+            case SX1280::RADIO_CLR_IRQSTATUS: {
+                if (spiSeqIdx == 1) {
+                    sx1280_irq_status &= ~static_cast<uint16_t>(tx << 8);
+                } else if (spiSeqIdx == 2) {
+                    sx1280_irq_status &= ~static_cast<uint16_t>(tx);
+                }
+            } break;
+        }
+        if (xfer->rxbuf) {
+            xfer->rxbuf[c] = rx;
         }
-        spiBuf.push_back({xfer->txbuf[c],xfer->rxbuf[c],spiSeqID});
+        spiBuf.push_back({tx,rx,spiSeqID});
         spiSeqIdx++;
     }
     return 0;
 }
 
 uint32_t flash_get_page_size(struct flash_descriptor *) {
-    return 512;
+    return flash_page_size;
 }
 
 uint32_t flash_get_total_pages(struct flash_descriptor *) {
-    return 1;
+    return flash_size / flash_page_size;
 }
 
 void system_init(void) {
+    emulator_flash_reset();
+}
+
+bool emulator_headless(void) {
+    return headless;
+}
+
+void emulator_set_headless(bool state) {
+    headless = state;
+}
+
+double emulator_virtual_time(void) {
+    return virtual_time;
+}
+
+void emulator_set_virtual_time(double time) {
+    virtual_time = time;
+}
+
+void emulator_qspi_dma_transmit(uint32_t count) {
+    double duration = static_cast<double>(count) / qspi_bytes_per_second;
+    qspi_busy_until = system_time() + duration;
+    g_emulator_counters.qspi_bytes += count;
+    g_emulator_counters.qspi_transfer_ns += static_cast<uint64_t>(duration * 1000000000.0);
+}
+
+bool emulator_qspi_dma_busy(void) {
+    return system_time() < qspi_busy_until;
 }
 
 #endif  // #ifdef EMULATOR
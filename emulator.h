@@ -43,6 +43,27 @@ enum gpio_port { GPIO_PORTA, GPIO_PORTB, GPIO_PORTC, GPIO_PORTD, GPIO_PORTE };
 #ifdef __cplusplus
 #include <mutex>
 extern std::recursive_mutex g_print_mutex;
+
+// Running totals sampled by the benchmark around each timer task
+struct emulator_counters {
+    uint64_t allocations;
+    uint64_t function_calls;
+    uint64_t qspi_bytes;
+    uint64_t qspi_transfer_ns;
+    uint64_t i2c_transactions;
+    uint64_t i2c_bytes;
+    uint64_t spi_transfers;
+    uint64_t spi_bytes;
+    uint64_t spi_dma_transfers;
+    uint64_t spi_wire_ns;
+    uint64_t flash_erases;
+    uint64_t flash_writes;
+    uint64_t flash_bytes_programmed;
+    uint64_t flash_bytes_read;
+    uint64_t led_frames_skipped;
+    uint64_t led_frames_queued;
+};
+extern emulator_counters g_emulator_counters;
 #endif  // #ifdef __cplusplus
 
 #ifdef __cplusplus
@@ -264,6 +285,8 @@ extern struct flash_descriptor FLASH_0;
 
 int32_t flash_write(struct flash_descriptor *flash, uint32_t dst_addr, uint8_t *buffer, uint32_t length);
 int32_t flash_read(struct flash_descriptor *flash, uint32_t src_addr, uint8_t *buffer, uint32_t length);
+int32_t flash_append(struct flash_descriptor *flash, uint32_t dst_addr, uint8_t *buffer, uint32_t length);
+int32_t flash_erase(struct flash_descriptor *flash, const uint32_t dst_addr, const uint32_t page_nums);
 
 uint32_t flash_get_page_size(struct flash_descriptor *flash);
 uint32_t flash_get_total_pages(struct flash_descriptor *flash);
@@ -272,10 +295,50 @@ void system_init(void);
 
 void display_debug_area(int32_t area);
 
+bool emulator_headless(void);
+void emulator_set_headless(bool headless);
+
+double emulator_virtual_time(void);
+void emulator_set_virtual_time(double time);
+
+// Stand-in for the DMAC driven QSPI transfer: models wire time at the
+// configured QSPI clock and how long a new frame waits for the previous one.
+void emulator_qspi_dma_transmit(uint32_t count);
+bool emulator_qspi_dma_busy(void);
+
+// Calls the callbacks registered with ext_irq_register for this pin, as the
+// EIC would on an edge.
+void emulator_raise_irq(uint32_t pin);
+
+// True when the task is added and its interval has passed at the current
+// (virtual) time; repeat tasks are re-armed and one-shot tasks removed, as
+// the RTC handler would before calling them.
+bool emulator_timer_task_due(struct timer_task *task);
+
+// The modeled flash starts out erased; erases are counted per 8 KB block.
+void emulator_flash_reset(void);
+uint32_t emulator_flash_max_block_erases(void);
+
+// What the modeled SSD1306 panel shows: 2 pages of 96 columns, after any
+// hardware scrolling. Bytes written to columns on the panel during a scroll
+// are counted as they tear the image; off-screen columns can be refilled.
+void emulator_oled_visible(uint8_t *columns);
+uint64_t emulator_oled_visible_writes_while_scrolling(void);
+
+// Sets what the modeled BQ25895 ADC reports, in V and mA, to replay a
+// battery discharge or a charger being plugged in.
+void emulator_bq25895_set_adc(float battery, float vbus, float charge_current);
+
 #ifdef __cplusplus
 };
 #endif
 
 #endif  // #ifdef EMULATOR
 
+#if defined(EMULATOR) && defined(__cplusplus)
+#define EMULATOR_COUNT(counter, n) (g_emulator_counters.counter += (n))
+#else  // #if defined(EMULATOR) && defined(__cplusplus)
+#define EMULATOR_COUNT(counter, n) ((void)0)
+#endif  // #if defined(EMULATOR) && defined(__cplusplus)
+
 #endif  // #ifndef EMULATOR_H_
@@ -0,0 +1,156 @@
+/*
+Copyright 2019 Tinic Uro
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef FAST_MATH_H_
+#define FAST_MATH_H_
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <cmath>
+
+// Approximations of the libm functions the LED effects call per LED, using
+// only multiplies, adds, compares and float to int conversions, which the
+// Cortex-M4F FPU does in a cycle or two, plus one division in log2.
+// newlib's sinf, exp2f and powf evaluate in double, which this FPU runs
+// through soft float helpers, and fmodf is an integer loop. Built the same
+// on the host so the emulator renders what the device does. The bounds
+// below are enforced against libm by the emulator's --bench suite.
+namespace fastmath {
+
+    // x - floor(x), in [0, 1]. Exactly 1 only when x is less than 2^-25
+    // below an integer. Valid for |x| < 2^31.
+    inline float fract(float x) {
+        float f = x - static_cast<float>(static_cast<int32_t>(x));
+        return (f < 0.0f) ? (f + 1.0f) : f;
+    }
+
+    // t - round(t), in [-0.5, 0.5]. Exact: every step is a difference of
+    // floats close enough to be representable.
+    inline float reduce_turns(float t) {
+        float r = t - static_cast<float>(static_cast<int32_t>(t));
+        r = (r >  0.5f) ? (r - 1.0f) : r;
+        return (r < -0.5f) ? (r + 1.0f) : r;
+    }
+
+    // sin(2 pi r) for r in [-0.25, 0.25], odd minimax polynomial
+    inline float sin_quarter(float r) {
+        static constexpr float c1 =  6.283164044e+00f;
+        static constexpr float c3 = -4.133714238e+01f;
+        static constexpr float c5 =  8.134076904e+01f;
+        static constexpr float c7 = -7.099343456e+01f;
+        float r2 = r * r;
+        return r * (c1 + r2 * (c3 + r2 * (c5 + r2 * c7)));
+    }
+
+    // sin(2 pi t) and cos(2 pi t) for t in turns, |t| < 2^31. Max absolute
+    // error 1e-6 at any t since the reduction is exact.
+    inline float sin_turns(float t) {
+        float r = reduce_turns(t);
+        r = (r >  0.25f) ? ( 0.5f - r) : r;
+        r = (r < -0.25f) ? (-0.5f - r) : r;
+        return sin_quarter(r);
+    }
+
+    inline float cos_turns(float t) {
+        return sin_quarter(0.25f - fabsf(reduce_turns(t)));
+    }
+
+    // sin and cos in radians. Max absolute error 1e-6 plus |x| * 2^-22
+    // from rounding x to turns, the same loss as float seconds to phase.
+    static constexpr float inv_two_pi = 0.159154943f;
+
+    inline float sin(float x) {
+        return sin_turns(x * inv_two_pi);
+    }
+
+    inline float cos(float x) {
+        return cos_turns(x * inv_two_pi);
+    }
+
+    // 2^x, max relative error 2e-7 for x in [-125, 128). Inputs below -126
+    // return about 2^-126, inputs at or above 128 are undefined.
+    inline float exp2(float x) {
+        static constexpr float c0 = 9.999999251e-01f;
+        static constexpr float c1 = 6.931530732e-01f;
+        static constexpr float c2 = 2.401536170e-01f;
+        static constexpr float c3 = 5.582631828e-02f;
+        static constexpr float c4 = 8.989339824e-03f;
+        static constexpr float c5 = 1.877576783e-03f;
+        x = std::max(x, -126.0f);
+        int32_t i = static_cast<int32_t>(x);
+        i -= (x < static_cast<float>(i)) ? 1 : 0;
+        float f = x - static_cast<float>(i);
+        float p = c0 + f * (c1 + f * (c2 + f * (c3 + f * (c4 + f * c5))));
+        uint32_t bits = static_cast<uint32_t>(i + 127) << 23;
+        float scale;
+        memcpy(&scale, &bits, sizeof(scale));
+        return p * scale;
+    }
+
+    // log2(x) for normal x > 0, max absolute error 4e-7 plus half an ulp of
+    // the exponent once it is added, 4e-6 at the extremes. The mantissa is
+    // folded into [sqrt(1/2), sqrt(2)) so the series in (m-1)/(m+1) stays
+    // short.
+    inline float log2(float x) {
+        static constexpr float c1 = 2.885391289e+00f;
+        static constexpr float c3 = 9.614708092e-01f;
+        static constexpr float c5 = 5.989738788e-01f;
+        uint32_t bits;
+        memcpy(&bits, &x, sizeof(bits));
+        uint32_t upper = ((bits & 0x7FFFFF) > 0x3504F3) ? 1 : 0; // mantissa above sqrt(2)
+        int32_t e = static_cast<int32_t>(bits >> 23) - 127 + static_cast<int32_t>(upper);
+        bits = (bits & 0x7FFFFF) | ((127 - upper) << 23);
+        float m;
+        memcpy(&m, &bits, sizeof(m));
+        float s = (m - 1.0f) / (m + 1.0f);
+        float s2 = s * s;
+        return static_cast<float>(e) + s * (c1 + s2 * (c3 + s2 * c5));
+    }
+
+    // x^y as 2^(y log2 x). 0 for x <= 0. Max relative error 1e-6 for
+    // |y log2 x| <= 16, which covers the gamma like exponents of the effects
+    // on [2^-16, 1].
+    inline float pow(float x, float y) {
+        return (x > 0.0f) ? exp2(y * log2(x)) : 0.0f;
+    }
+
+    // HSV to RGB, all in [0, 1] and the hue wrapping around. Every channel
+    // is v minus a clamped ramp of the hue, offset by a third of the circle
+    // per channel, so there is no sextant switch. Max absolute error 1e-6
+    // against the switch form.
+    inline void hsv2rgb(float h, float s, float v, float &r, float &g, float &b) {
+        float k = fract(h) * 6.0f;
+        float vs = v * s;
+        auto channel = [k, v, vs](float n) {
+            float kn = k + n;
+            kn = (kn >= 6.0f) ? (kn - 6.0f) : kn;
+            float w = std::min(std::max(std::min(kn, 4.0f - kn), 0.0f), 1.0f);
+            return v - vs * w;
+        };
+        r = channel(5.0f);
+        g = channel(3.0f);
+        b = channel(1.0f);
+    }
+};
+
+#endif /* FAST_MATH_H_ */
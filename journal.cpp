@@ -0,0 +1,190 @@
+/*
+Copyright 2019 Tinic Uro
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#include "./journal.h"
+#include "./emulator.h"
+
+#include <atmel_start.h>
+
+#include <cstring>
+
+#include "./murmur_hash3.h"
+
+void Journal::init() {
+    region_address = flash_get_total_pages(&FLASH_0) * flash_get_page_size(&FLASH_0) - region_size;
+    active_block = block_count - 1;
+    write_offset = block_size;
+    sequence = 0;
+    active = false;
+
+    for (uint32_t block = 0; block < block_count; block++) {
+        uint32_t seq = 0;
+        bool committed = false;
+        if (ReadHeader(block, seq, committed) && committed && (!active || int32_t(seq - sequence) > 0)) {
+            active = true;
+            active_block = block;
+            sequence = seq;
+        }
+    }
+}
+
+bool Journal::ReadHeader(uint32_t block, uint32_t &seq, bool &committed) const {
+    uint8_t buf[first_record];
+    flash_read(&FLASH_0, BlockAddress(block), buf, sizeof(buf));
+    Header header;
+    memcpy(&header, buf, sizeof(header));
+    if (header.magic != header_magic) {
+        return false;
+    }
+    uint32_t commit = 0;
+    memcpy(&commit, &buf[align], sizeof(commit));
+    seq = header.sequence;
+    committed = commit == commit_magic;
+    return true;
+}
+
+bool Journal::Replay(const ReplayFunc &apply) {
+    for (size_t c = 0; c < key_count; c++) {
+        key_offset[c] = 0;
+    }
+    records = 0;
+
+    if (!active) {
+        return false;
+    }
+
+    uint32_t address = BlockAddress(active_block);
+    write_offset = first_record;
+    while (write_offset + align <= block_size) {
+        uint8_t record[4 + max_payload];
+        flash_read(&FLASH_0, address + write_offset, record, align);
+        uint8_t key = record[0];
+        size_t size = record[1];
+        if (key == 0xFF) {
+            break;
+        }
+        uint32_t length = (4 + size + align - 1) & ~(align - 1);
+        if (key >= key_count || size > max_payload || write_offset + length > block_size) {
+            // Torn write; the next Append starts a fresh snapshot
+            write_offset = block_size;
+            break;
+        }
+        if (length > align) {
+            flash_read(&FLASH_0, address + write_offset + align, &record[align], length - align);
+        }
+        uint16_t crc = static_cast<uint16_t>(record[2] | (record[3] << 8));
+        if (CRC16(&record[4], size, CRC16(record, 2)) != crc) {
+            write_offset = block_size;
+            break;
+        }
+        apply(key, &record[4], size);
+        key_offset[key] = write_offset;
+        key_hash[key] = MurmurHash3_32(&record[4], static_cast<int>(size), key);
+        write_offset += length;
+        records++;
+    }
+    return true;
+}
+
+bool Journal::Append(uint8_t key, const uint8_t *data, size_t size) {
+    if (key >= key_count || size > max_payload) {
+        return false;
+    }
+
+    uint32_t hash = MurmurHash3_32(data, static_cast<int>(size), key);
+    if (key_offset[key] && key_hash[key] == hash && Stored(key, data, size)) {
+        return true;
+    }
+
+    uint32_t length = (4 + size + align - 1) & ~(align - 1);
+    if (!active || write_offset + length > block_size) {
+        return false;
+    }
+
+    uint8_t record[4 + max_payload];
+    memset(record, 0xFF, sizeof(record));
+    record[0] = key;
+    record[1] = static_cast<uint8_t>(size);
+    memcpy(&record[4], data, size);
+    uint16_t crc = CRC16(&record[4], size, CRC16(record, 2));
+    record[2] = static_cast<uint8_t>(crc);
+    record[3] = static_cast<uint8_t>(crc >> 8);
+    Program(BlockAddress(active_block) + write_offset, record, length);
+
+    key_offset[key] = write_offset;
+    key_hash[key] = hash;
+    write_offset += length;
+    records++;
+    return true;
+}
+
+// A matching hash is confirmed against the record in flash, so a collision
+// cannot drop a real change
+bool Journal::Stored(uint8_t key, const uint8_t *data, size_t size) const {
+    uint8_t record[4 + max_payload];
+    flash_read(&FLASH_0, BlockAddress(active_block) + key_offset[key], record, static_cast<uint32_t>(4 + size));
+    return record[1] == size && memcmp(&record[4], data, size) == 0;
+}
+
+void Journal::StartSnapshot() {
+    active_block = (active_block + 1) % block_count;
+    sequence++;
+
+    flash_erase(&FLASH_0, BlockAddress(active_block), block_size / flash_get_page_size(&FLASH_0));
+
+    uint8_t buf[align];
+    memset(buf, 0xFF, sizeof(buf));
+    Header header = { header_magic, sequence, { 0xFFFFFFFF, 0xFFFFFFFF } };
+    memcpy(buf, &header, sizeof(header));
+    Program(BlockAddress(active_block), buf, sizeof(buf));
+
+    for (size_t c = 0; c < key_count; c++) {
+        key_offset[c] = 0;
+    }
+    write_offset = first_record;
+    records = 0;
+    active = true;
+}
+
+void Journal::Commit() {
+    uint8_t buf[align];
+    memset(buf, 0xFF, sizeof(buf));
+    memcpy(buf, &commit_magic, sizeof(commit_magic));
+    Program(BlockAddress(active_block) + align, buf, sizeof(buf));
+}
+
+void Journal::Program(uint32_t address, const uint8_t *data, uint32_t size) {
+    uint8_t buf[4 + max_payload];
+    memcpy(buf, data, size);
+    flash_append(&FLASH_0, address, buf, size);
+}
+
+uint16_t Journal::CRC16(const uint8_t *data, size_t size, uint16_t crc) {
+    // CRC-16/CCITT, bitwise; records are short
+    for (size_t c = 0; c < size; c++) {
+        crc ^= static_cast<uint16_t>(data[c] << 8);
+        for (int32_t b = 0; b < 8; b++) {
+            crc = static_cast<uint16_t>((crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1));
+        }
+    }
+    return crc;
+}
@@ -0,0 +1,98 @@
+/*
+Copyright 2019 Tinic Uro
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef JOURNAL_H_
+#define JOURNAL_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+
+// Append-only record log in a ring of flash erase blocks at the end of
+// flash. Each block starts with a header; when the active block is full
+// the next block in the ring is erased and receives a full snapshot, so
+// erases rotate over the whole region instead of hitting one page.
+class Journal {
+public:
+    static constexpr uint32_t block_size = 8192;  // NVMCTRL_BLOCK_SIZE
+    static constexpr uint32_t block_count = 4;
+    static constexpr uint32_t region_size = block_size * block_count;
+    // Quad word, the smallest unit the NVM controller programs with ECC
+    static constexpr uint32_t align = 16;
+    static constexpr size_t max_payload = 64 - 4;
+    static constexpr size_t key_count = 32;
+
+    typedef std::function<void (uint8_t key, const uint8_t *data, size_t size)> ReplayFunc;
+
+    void init();
+
+    // Applies the records of the newest committed block in order.
+    // Returns false if the region holds no committed block.
+    bool Replay(const ReplayFunc &apply);
+
+    // Appends a record unless the last one written for this key had the
+    // same payload. Returns false if the active block is full, or if the
+    // key or size is out of range and nothing could be written.
+    bool Append(uint8_t key, const uint8_t *data, size_t size);
+
+    // Erases the next block in the ring and makes it active. The caller
+    // Appends every key and then calls Commit.
+    void StartSnapshot();
+    void Commit();
+
+    uint32_t RegionAddress() const { return region_address; }
+    uint32_t Sequence() const { return sequence; }
+    uint32_t Records() const { return records; }
+
+private:
+    struct Header {
+        uint32_t magic;
+        uint32_t sequence;
+        uint32_t reserved[2];
+    };
+
+    static constexpr uint32_t header_magic = 0x4a524e4c;
+    static constexpr uint32_t commit_magic = 0x434d4954;
+    // Header quad word, then the commit quad word written after the snapshot
+    static constexpr uint32_t first_record = align * 2;
+
+    static uint16_t CRC16(const uint8_t *data, size_t size, uint16_t crc = 0xFFFF);
+
+    uint32_t BlockAddress(uint32_t block) const { return region_address + block * block_size; }
+    bool ReadHeader(uint32_t block, uint32_t &seq, bool &committed) const;
+    bool Stored(uint8_t key, const uint8_t *data, size_t size) const;
+    void Program(uint32_t address, const uint8_t *data, uint32_t size);
+
+    uint32_t region_address = 0;
+    uint32_t active_block = 0;
+    uint32_t write_offset = 0;
+    uint32_t sequence = 0;
+    uint32_t records = 0;
+    bool active = false;
+
+    // Where the last record of each key is in the active block, 0 if none,
+    // and the hash of its payload to skip reading it back on most saves
+    uint32_t key_offset[key_count] = { 0 };
+    uint32_t key_hash[key_count] = { 0 };
+};
+
+#endif /* JOURNAL_H_ */
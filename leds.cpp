@@ -24,10 +24,14 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include "./emulator.h"
 
 #include <atmel_start.h>
+#ifndef EMULATOR
+#include <hpl_dma.h>
+#endif  // #ifndef EMULATOR
 
 #include <array>
-#include <random>
 #include <limits>
+#include <new>
+#include <type_traits>
 #include <stdio.h>
 
 #ifdef EMULATOR
@@ -37,102 +41,171 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 #include "./model.h"
 #include "./timeline.h"
+#include "./ws2812.h"
+#include "./murmur_hash3.h"
+#include "./fast_math.h"
+#include "./random.h"
 
 static float signf(float x) {
 	return (x > 0.0f) ? 1.0f : ( (x < 0.0f) ? -1.0f : 1.0f);
 }
 
-class pseudo_random {
+// State of the running effects. At most two effects run at a time, during
+// the crossfade, so two slots sized to the largest effect state replace a
+// static per effect. An effect's state is constructed on its first frame
+// and destroyed when it is neither the current nor the previous effect.
+template<size_t slot_size, size_t slot_align> class effect_arena {
 public:
-    
-    void set_seed(uint32_t seed) {
-        uint32_t i;
-        a = 0xf1ea5eed, b = c = d = seed;
-        for (i=0; i<20; ++i) {
-            (void)get();
-        }
+    static constexpr size_t slots_n = 2;
+
+    ~effect_arena() {
+        retain(none, none);
+    }
+
+    // The effect the following state() calls are for
+    void select(uint32_t effect) {
+        selected = effect;
     }
 
-    #define rot(x,k) (((x)<<(k))|((x)>>(32-(k))))
-    uint32_t get() {
-        uint32_t e = a - rot(b, 27);
-        a = b ^ rot(c, 17);
-        b = c + d;
-        c = d + e;
-        d = e + a;
-        return d;
+    // Destroys the state of all other effects
+    void retain(uint32_t current, uint32_t previous) {
+        for (slot &s : slots) {
+            if (s.destroy && s.effect != current && s.effect != previous) {
+                s.destroy(s.storage);
+                s.destroy = 0;
+            }
+        }
     }
 
-    float get(float lower, float upper) {
-        return static_cast<float>(static_cast<double>(get()) * (static_cast<double>(upper-lower)/static_cast<double>(1LL<<32)) ) + lower;
+    template<class T> T &state() {
+        static_assert(sizeof(T) <= slot_size && alignof(T) <= slot_align, "effect state does not fit the arena");
+        use_count++;
+        slot *lru = &slots[0];
+        for (slot &s : slots) {
+            if (s.destroy && s.effect == selected) {
+                s.last_use = use_count;
+                return *std::launder(reinterpret_cast<T *>(s.storage));
+            }
+            if (!s.destroy || (lru->destroy && s.last_use < lru->last_use)) {
+                lru = &s;
+            }
+        }
+        // Only taken from an effect still in use when effects are calculated
+        // outside of the effect span, like in the emulator benchmarks
+        if (lru->destroy) {
+            lru->destroy(lru->storage);
+        }
+        T *t = new (lru->storage) T();
+        lru->effect = selected;
+        lru->last_use = use_count;
+        lru->destroy = [](void *p) { static_cast<T *>(p)->~T(); };
+        return *t;
     }
 
-    int32_t get(int32_t lower, int32_t upper) {
-        return (static_cast<int32_t>(get()) % (upper-lower)) + lower;
+    size_t used() const {
+        size_t n = 0;
+        for (const slot &s : slots) {
+            n += s.destroy ? 1 : 0;
+        }
+        return n;
     }
 
 private:
-    uint32_t a; 
-    uint32_t b; 
-    uint32_t c; 
-    uint32_t d; 
+    static constexpr uint32_t none = ~0U;
+
+    struct slot {
+        alignas(slot_align) uint8_t storage[slot_size];
+        uint32_t effect = none;
+        uint32_t last_use = 0;
+        void (*destroy)(void *) = 0;
+    };
 
+    slot slots[slots_n];
+    uint32_t selected = none;
+    uint32_t use_count = 0;
 };
 
 namespace colors {
 
-    class rgb8out {
+    // Output color after gamma, 16 bits per channel so that fades keep
+    // their precision until update_leds() dithers them down to 8 bits
+    class rgb16out {
     public:
 
         union {
             struct {
-                uint8_t r;
-                uint8_t g;
-                uint8_t b;
-                uint8_t x;
+                uint16_t r;
+                uint16_t g;
+                uint16_t b;
+                uint16_t x;
             };
-            uint32_t rgbx;
+            uint64_t rgbx;
         };
 
-        rgb8out() :
+        rgb16out() :
             r(0),
             g(0),
             b(0),
             x(0){
         }
     
-        rgb8out(const rgb8out &from) :
+        rgb16out(const rgb16out &from) :
             r(from.r),
             g(from.g),
             b(from.b),
             x(0) {
         }
 
-        explicit rgb8out(const rgb &from) {
-            r = sat8(from.r * global_limit_factor);
-            g = sat8(from.g * global_limit_factor);
-            b = sat8(from.b * global_limit_factor);
+        rgb16out &operator=(const rgb16out &) = default;
+
+        explicit rgb16out(const rgb &from) {
+#ifdef FIXED_POINT_COLOR
+            r = sat16_fixed(from.r * global_limit_factor);
+            g = sat16_fixed(from.g * global_limit_factor);
+            b = sat16_fixed(from.b * global_limit_factor);
+#else  // #ifdef FIXED_POINT_COLOR
+            r = sat16(from.r * global_limit_factor);
+            g = sat16(from.g * global_limit_factor);
+            b = sat16(from.b * global_limit_factor);
+#endif  // #ifdef FIXED_POINT_COLOR
             x = 0;
         }
 
-        explicit rgb8out(uint8_t _r, uint8_t _g, uint8_t _b) :
+        explicit rgb16out(uint16_t _r, uint16_t _g, uint16_t _b) :
             r(_r),
             g(_g),
             b(_b),
             x(0) {
         }
     
-    private:
-    
-        float gamma28(float v) const { // approximate 2^2.8
+        static float gamma28(float v) { // approximate 2^2.8
             float v2 = v*v;
             return 0.2f*v2 + 0.8f*v*v2;
         }
 
-        uint8_t sat8(const float v) const {
-            return v < 0.0f ? uint8_t(0) : ( v > 1.0f ? uint8_t(0xFF) : uint8_t( gamma28(v) * 255.f ) );
+        static uint16_t sat16(const float v) {
+            return v < 0.0f ? uint16_t(0) : ( v > 1.0f ? uint16_t(0xFFFF) : uint16_t( gamma28(v) * 65535.f ) );
+        }
+
+        // Same curve in Q16, one float to int conversion per channel
+        static uint16_t sat16_fixed(const float v) {
+            int32_t q = static_cast<int32_t>(v * 65536.0f);
+            if (q <= 0) {
+                return 0;
+            }
+            if (q >= 65536) {
+                return 0xFFFF;
+            }
+            uint32_t q1 = static_cast<uint32_t>(q);
+            uint32_t q2 = (q1 * q1) >> 16;
+            uint32_t q3 = (q2 * q1) >> 16;
+            uint32_t g = (13107 * q2 + 52429 * q3) >> 16;
+            return static_cast<uint16_t>((g * 65535) >> 16);
         }
 
+        static uint8_t sat8(const float v) { return static_cast<uint8_t>(sat16(v) >> 8); }
+        static uint8_t sat8_fixed(const float v) { return static_cast<uint8_t>(sat16_fixed(v) >> 8); }
+
     };
 
     class hsp {
@@ -293,10 +366,10 @@ namespace colors {
         b = static_cast<float>(from.b) * (1.0f/255.0f);
     }
 
-    rgb::rgb(const rgb8out &from) {
-        r = static_cast<float>(from.r) * (1.0f/255.0f);
-        g = static_cast<float>(from.g) * (1.0f/255.0f);
-        b = static_cast<float>(from.b) * (1.0f/255.0f);
+    rgb::rgb(const rgb16out &from) {
+        r = static_cast<float>(from.r) * (1.0f/65535.0f);
+        g = static_cast<float>(from.g) * (1.0f/65535.0f);
+        b = static_cast<float>(from.b) * (1.0f/65535.0f);
     }
 
     static float value(  float const &p, float const &q, float const &t ) {
@@ -327,43 +400,58 @@ namespace colors {
     }
 
     rgb::rgb(const hsv &from) {
-        float v = from.v;
-        float h = from.h;
-        float s = from.s;
-
-        int32_t rd = static_cast<int32_t>( 6.0f * h );
-        float f = h * 6.0f - rd;
-        float p = v * (1.0f - s);
-        float q = v * (1.0f - f * s);
-        float t = v * (1.0f - (1.0f - f) * s);
-
-        switch ( rd  % 6 ) {
-            case 0: r = v; g = t; b = p; break;
-            case 1: r = q; g = v; b = p; break;
-            case 2: r = p; g = v; b = t; break;
-            case 3: r = p; g = q; b = v; break;
-            case 4: r = t; g = p; b = v; break;
-            case 5: r = v; g = p; b = q; break;
-        }
+        fastmath::hsv2rgb(from.h, from.s, from.v, r, g, b);
     }
 
     rgb::rgb(const hsp &from) {
         from.HSPtoRGB(from.h, from.s, from.p, &r, &g, &b);
     }
 
-    static rgb8out ip(const rgb8out &a, const rgb8out &b, float i) {
+    // How a layer combines with what is below it. rgb16out is after the
+    // gamma curve, proportional to the light of the LED, so all modes work
+    // in linear light.
+    enum class blend_mode {
+        crossfade,  // from below to the layer
+        add,        // the layer added to below, saturating
+        multiply,   // below filtered through the layer
+        mask        // below scaled by the brightest channel of the layer
+    };
+
+    // Layer weights in 1/65536, converted once per frame
+    static constexpr uint32_t weight_one = 65536;
+
+    static uint32_t weight(float i) {
         if ( i <= 0.0f ) {
-            return a;
+            return 0;
         } else if ( i >= 1.0f) {
-            return b;
-        } else {
-            int32_t ii = static_cast<int32_t>(i * 256.0f);
-            return rgb8out(
-                static_cast<uint8_t>(( ( a.r * ( 256 - ii ) ) + ( b.r * ii ) ) / 256),
-                static_cast<uint8_t>(( ( a.g * ( 256 - ii ) ) + ( b.g * ii ) ) / 256),
-                static_cast<uint8_t>(( ( a.b * ( 256 - ii ) ) + ( b.b * ii ) ) / 256)
-            );
+            return weight_one;
         }
+        return static_cast<uint32_t>(i * 65536.0f);
+    }
+
+    template<blend_mode mode> static rgb16out blend(const rgb16out &a, const rgb16out &b, uint32_t w) {
+        // x * y / 65535 rounded
+        auto product = [](uint32_t x, uint32_t y) {
+            uint32_t t = x * y + 0x8000;
+            return ( t + ( t >> 16 ) ) >> 16;
+        };
+        auto channel = [w, &product](uint32_t x, uint32_t y, uint32_t m) {
+            switch (mode) {
+                case blend_mode::crossfade:
+                    break;
+                case blend_mode::add:
+                    return static_cast<uint16_t>(std::min(x + ( ( y * w + 0x8000 ) >> 16 ), uint32_t(0xFFFF)));
+                case blend_mode::multiply:
+                    y = product(x, y);
+                    break;
+                case blend_mode::mask:
+                    y = product(x, m);
+                    break;
+            }
+            return static_cast<uint16_t>(( ( x * ( weight_one - w ) ) + ( y * w ) + 0x8000 ) >> 16);
+        };
+        uint32_t m = mode == blend_mode::mask ? std::max(std::max(b.r, b.g), b.b) : 0;
+        return rgb16out(channel(a.r, b.r, m), channel(a.g, b.g, m), channel(a.b, b.b, m));
     }
 
 #if 0
@@ -405,6 +493,8 @@ namespace colors {
 }
 
 namespace geom {
+    class rotation2d;
+
     class float4 {
     public:
         float x = 0.0f;
@@ -412,7 +502,7 @@ namespace geom {
         float z = 0.0f;
         float w = 0.0f;
         
-        float4() {
+        constexpr float4() {
             x = 0.0f;
             y = 0.0f;
             z = 0.0f;
@@ -433,7 +523,7 @@ namespace geom {
             this->w = v;
         }
 
-        float4(float _x, float _y, float _z, float _w = 0.0f) {
+        constexpr float4(float _x, float _y, float _z, float _w = 0.0f) {
             this->x = _x;
             this->y = _y;
             this->z = _z;
@@ -665,11 +755,12 @@ namespace geom {
                           std::max(a.w, b.w));
         }
         
+        // w is not a color channel and passes through
         float4 pow(float v) {
-            return float4(powf(this->x, v),
-                          powf(this->y, v),
-                          powf(this->z, v),
-                          powf(this->w, v));
+            return float4(fastmath::pow(this->x, v),
+                          fastmath::pow(this->y, v),
+                          fastmath::pow(this->z, v),
+                          this->w);
         }
         
         float4 abs() {
@@ -736,13 +827,7 @@ namespace geom {
                           sqrtf(a.w));
         }
         
-        float4 rotate2d(float angle) {
-            return float4(
-                this->x * cosf(angle) - this->y * sinf(angle),
-                this->y * cosf(angle) + this->x * sinf(angle),
-                this->z,
-                this->w);
-        }
+        float4 rotate2d(const rotation2d &r);
         
         float4 reflect() {
             return float4(
@@ -822,42 +907,275 @@ namespace geom {
         float reflect(float i) {
             i = fabsf(i);
             if ((static_cast<int32_t>(i) & 1) == 0) {
-                i = fmodf(i, 1.0f);
+                i = fastmath::fract(i);
             } else {
-                i = fmodf(i, 1.0f);
+                i = fastmath::fract(i);
                 i = 1.0f - i;
             }
             return i;
         }
     };
+
+    // One rotation for every LED of a frame, so sin and cos of the angle
+    // are evaluated once instead of per LED
+    class rotation2d {
+    public:
+        explicit rotation2d(float angle) :
+            c(fastmath::cos(angle)),
+            s(fastmath::sin(angle)) {
+        }
+
+        float c;
+        float s;
+    };
+
+    inline float4 float4::rotate2d(const rotation2d &r) {
+        return float4(
+            this->x * r.c - this->y * r.s,
+            this->y * r.c + this->x * r.s,
+            this->z,
+            this->w);
+    }
+
 }
 
 namespace colors {
-    class gradient {
 
+    struct gradient_stop {
+        uint32_t color;
+        float pos;
+    };
+
+    // 256 entry gradient table in rgb8. Gradients with fixed stops are built
+    // at compile time and live in flash, see gradient_cache for the others.
+    class gradient_table {
+    public:
         static constexpr size_t colors_n = 256;
+
+        uint8_t colors[colors_n][3];
+
+        constexpr gradient_table() : colors() {
+        }
+
+        template<size_t N> constexpr gradient_table(const gradient_stop (&stops)[N]) : colors() {
+            build(stops, N);
+        }
+
+        constexpr void build(const gradient_stop *stops, size_t n) {
+            for (size_t c = 0; c < colors_n; c++) {
+                float f = static_cast<float>(c) / static_cast<float>(colors_n - 1); 
+                gradient_stop a = stops[0];
+                gradient_stop b = stops[1];
+                if (n > 2) {
+                  for (int32_t d = static_cast<int32_t>(n-2); d >= 0 ; d--) {
+                      if ( f >= (stops[d].pos) ) {
+                        a = stops[d+0];
+                        b = stops[d+1];
+                        break;
+                      }
+                  }
+                }
+                f -= a.pos;
+                f /= b.pos - a.pos;
+                for (size_t e = 0; e < 3; e++) {
+                    uint32_t shift = 16 - 8 * e;
+                    float ca = static_cast<float>((a.color >> shift) & 0xFF);
+                    float cb = static_cast<float>((b.color >> shift) & 0xFF);
+                    float v = ca * (1.0f - f) + cb * f;
+                    v = v < 0.0f ? 0.0f : (v > 255.0f ? 255.0f : v);
+                    colors[c][e] = static_cast<uint8_t>(v + 0.5f);
+                }
+            }
+        }
+    };
+
+    // Samples a gradient_table. The float variant lerps in float, the fixed
+    // point variant samples in Q16 without any float lerp.
+    // FIXED_POINT_COLOR selects which one the effects use.
+    template<bool fixed_point> class gradient_t {
+
+        static constexpr size_t colors_n = gradient_table::colors_n;
         static constexpr float colors_mul = 255.0;
         static constexpr size_t colors_mask = 0xFF;
-        colors::rgb colors[colors_n];
-        bool initialized = false;
-        
+
+        const gradient_table *table;
+
+        geom::float4 entry(size_t c) const {
+            const uint8_t *e = table->colors[c];
+            return geom::float4(static_cast<float>(e[0]) * (1.0f / 255.0f),
+                                static_cast<float>(e[1]) * (1.0f / 255.0f),
+                                static_cast<float>(e[2]) * (1.0f / 255.0f),
+                                1.0f);
+        }
+
+        geom::float4 sample(float i) const {
+            i *= colors_mul;
+            return geom::float4::lerp(entry((static_cast<size_t>(i))&colors_mask), entry((static_cast<size_t>(i)+1)&colors_mask), fastmath::fract(i));
+        }
+
+        // f is the position in [0, 1] as Q16
+        geom::float4 sample_fixed(uint32_t f) const {
+            uint32_t pos = f * 255;
+            const uint8_t *e0 = table->colors[(pos >> 16) & colors_mask];
+            const uint8_t *e1 = table->colors[((pos >> 16) + 1) & colors_mask];
+            uint32_t w1 = pos & 0xFFFF;
+            uint32_t w0 = 0x10000 - w1;
+            return geom::float4(static_cast<float>(e0[0] * w0 + e1[0] * w1) * (1.0f / (255.0f * 65536.0f)),
+                                static_cast<float>(e0[1] * w0 + e1[1] * w1) * (1.0f / (255.0f * 65536.0f)),
+                                static_cast<float>(e0[2] * w0 + e1[2] * w1) * (1.0f / (255.0f * 65536.0f)),
+                                1.0f);
+        }
+
     public:
-    
-        bool check_init() {
-            return !initialized;
+
+        explicit gradient_t(const gradient_table &t) : table(&t) {
         }
         
-        void init(const geom::float4 stops[], size_t n) {
-            initialized = true;
+        geom::float4 repeat(float i) const {
+            if constexpr (fixed_point) {
+                if (fabsf(i) >= 32768.0f) {
+                    i = fastmath::fract(i);
+                }
+                return sample_fixed(static_cast<uint32_t>(static_cast<int32_t>(i * 65536.0f)) & 0xFFFF);
+            } else {
+                return sample(fastmath::fract(i));
+            }
+        }
+
+        geom::float4 reflect(float i) const {
+            i = fabsf(i);
+            if constexpr (fixed_point) {
+                if (i >= 32768.0f) {
+                    i = fastmath::fract(i * 0.5f) * 2.0f;
+                }
+                uint32_t q = static_cast<uint32_t>(i * 65536.0f);
+                uint32_t f = q & 0xFFFF;
+                return sample_fixed((q & 0x10000) ? (0x10000 - f) : f);
+            } else {
+                if ((static_cast<int32_t>(i) & 1) == 0) {
+                    i = fastmath::fract(i);
+                } else {
+                    i = fastmath::fract(i);
+                    i = 1.0f - i;
+                }
+                return sample(i);
+            }
+        }
+
+        geom::float4 clamp(float i) const {
+            if (i <= 0.0f) {
+                return entry(0);
+            }
+            if (i >= 1.0f) {
+                return entry(colors_n-1);
+            }
+            if constexpr (fixed_point) {
+                return sample_fixed(static_cast<uint32_t>(i * 65536.0f));
+            } else {
+                return sample(i);
+            }
+        }
+    };
+
+#ifdef FIXED_POINT_COLOR
+    using gradient = gradient_t<true>;
+#else  // #ifdef FIXED_POINT_COLOR
+    using gradient = gradient_t<false>;
+#endif  // #ifdef FIXED_POINT_COLOR
+
+    // Tables for gradients whose stops depend on the model (mostly the ring
+    // color). Effects look their stops up every frame; a few entries cover
+    // an effect crossfade plus recent color changes.
+    class gradient_cache {
+    public:
+        static constexpr size_t entries_n = 4;
+        static constexpr size_t stops_max = 8;
+
+        static gradient_cache &instance() {
+            static gradient_cache cache;
+            if (!cache.initialized) {
+                cache.initialized = true;
+                cache.init();
+            }
+            return cache;
+        }
+
+        template<size_t N> const gradient_table &get(const gradient_stop (&stops)[N]) {
+            static_assert(N <= stops_max, "too many gradient stops");
+            return get(stops, N);
+        }
+
+        const gradient_table &get(const gradient_stop *stops, size_t n) {
+            use_count++;
+            entry *lru = &entries[0];
+            for (size_t c = 0; c < entries_n; c++) {
+                entry &e = entries[c];
+                if (e.matches(stops, n)) {
+                    e.last_use = use_count;
+                    return e.table;
+                }
+                if (e.last_use < lru->last_use) {
+                    lru = &e;
+                }
+            }
+            lru->n = n;
+            for (size_t c = 0; c < n; c++) {
+                lru->stops[c] = stops[c];
+            }
+            lru->table.build(stops, n);
+            lru->last_use = use_count;
+            return lru->table;
+        }
+
+    private:
+        struct entry {
+            gradient_stop stops[stops_max];
+            size_t n = 0;
+            uint32_t last_use = 0;
+            gradient_table table;
+
+            bool matches(const gradient_stop *s, size_t sn) const {
+                if (n != sn) {
+                    return false;
+                }
+                for (size_t c = 0; c < n; c++) {
+                    if (stops[c].color != s[c].color || stops[c].pos != s[c].pos) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+        };
+
+        entry entries[entries_n];
+        uint32_t use_count = 0;
+
+        void init() {
+        }
+        bool initialized = false;
+    };
+
+#ifdef EMULATOR
+    // The former per-effect float gradient, kept to check the tables against
+    class gradient_reference {
+
+        static constexpr size_t colors_n = 256;
+        static constexpr float colors_mul = 255.0;
+        static constexpr size_t colors_mask = 0xFF;
+        colors::rgb colors[colors_n];
+
+    public:
+
+        void init(const gradient_stop stops[], size_t n) {
             for (size_t c = 0; c < colors_n; c++) {
                 float f = static_cast<float>(c) / static_cast<float>(colors_n - 1); 
-                geom::float4 a = stops[0];
-                geom::float4 b = stops[1];
+                geom::float4 a(stops[0].color, stops[0].pos);
+                geom::float4 b(stops[1].color, stops[1].pos);
                 if (n > 2) {
                   for (int32_t d = static_cast<int32_t>(n-2); d >= 0 ; d--) {
-                      if ( f >= (stops[d].w) ) {
-                        a = stops[d+0];
-                        b = stops[d+1];
+                      if ( f >= (stops[d].pos) ) {
+                        a = geom::float4(stops[d+0].color, stops[d+0].pos);
+                        b = geom::float4(stops[d+1].color, stops[d+1].pos);
                         break;
                       }
                   }
@@ -867,7 +1185,7 @@ namespace colors {
                 colors[c] = a.lerp(b,f);
             }
         }
-        
+
         geom::float4 repeat(float i) {
             i = fmodf(i, 1.0f);
             i *= colors_mul;
@@ -897,43 +1215,104 @@ namespace colors {
             return geom::float4::lerp(colors[(static_cast<size_t>(i))&colors_mask], colors[(static_cast<size_t>(i)+1)&colors_mask], fmodf(i, 1.0f));
         }
     };
+#endif  // #ifdef EMULATOR
 };
 
 #ifndef EMULATOR
-static void _qspi_memcpy(volatile uint8_t *dst, uint8_t *src, uint32_t count)
-{
-    if (count < 1) {
-        return;
-    }
-    if (count >= 4) {
-		__asm volatile (
-			"1:\n\t"
-			"ldr r0, [%[src]], #4\n\t"
-			"str r0, [%[dst]], #4\n\t"
-			"subs %[count], #4\n\t"
-			"bge 1b\n\t"
-			:
-			: [dst] "r" (dst), [src] "r" (src), [count] "r" (count)
-			: "r0", "cc", "memory"
-		);
-        count &= ~0x3UL;
-        if (count < 1) {
-            return;
-        }
+static constexpr uint8_t qspi_dma_channel = 0;
+#endif  // #ifndef EMULATOR
+
+// The frame on the wire, and the next one waiting for it to finish
+static const uint8_t *qspi_streaming = 0;
+static const uint8_t *qspi_queued = 0;
+static uint32_t qspi_queued_count = 0;
+
+static void qspi_dma_start(const uint8_t *src, uint32_t count) {
+#ifndef EMULATOR
+    struct _qspi_command cmd;
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.inst_frame.bits.width = QSPI_INST4_ADDR4_DATA4;
+    cmd.inst_frame.bits.data_en = 1;
+    cmd.inst_frame.bits.tfr_type = QSPI_WRITE_ACCESS;
+
+    hri_qspi_write_INSTRFRAME_reg(QSPI, cmd.inst_frame.word);
+
+    __DSB();
+
+    _dma_set_source_address(qspi_dma_channel, src);
+    _dma_set_destination_address(qspi_dma_channel, reinterpret_cast<void *>(QSPI_AHB));
+    _dma_set_data_amount(qspi_dma_channel, count / 4);
+    _dma_enable_transaction(qspi_dma_channel, true);
+#else  // #ifndef EMULATOR
+    emulator_qspi_dma_transmit(count);
+#endif  // #ifndef EMULATOR
+    qspi_streaming = src;
+}
+
+// The DMAC clears the channel enable once the last beat is out
+static bool qspi_dma_idle() {
+#ifndef EMULATOR
+    return !hri_dmac_get_CHCTRLA_ENABLE_bit(DMAC, qspi_dma_channel);
+#else  // #ifndef EMULATOR
+    return !emulator_qspi_dma_busy();
+#endif  // #ifndef EMULATOR
+}
+
+// Closes the QSPI instruction of the frame that left the DMAC. Only the
+// last word is still in the QSPI then, so INSTREND follows within a few
+// QSPI clocks.
+static void qspi_dma_finish() {
+#ifndef EMULATOR
+    hri_dmac_clear_CHINTFLAG_TCMPL_bit(DMAC, qspi_dma_channel);
+    hri_dmac_clear_CHINTFLAG_TERR_bit(DMAC, qspi_dma_channel);
+    hri_qspi_write_CTRLA_reg(QSPI, QSPI_CTRLA_ENABLE | QSPI_CTRLA_LASTXFER);
+    while (!hri_qspi_get_INTFLAG_INSTREND_bit(QSPI)) { };
+    hri_qspi_clear_INTFLAG_INSTREND_bit(QSPI);
+#endif  // #ifndef EMULATOR
+    qspi_streaming = 0;
+}
+
+#ifndef EMULATOR
+static void qspi_dma_done(struct _dma_resource *) {
+    qspi_dma_finish();
+    if (qspi_queued) {
+        qspi_dma_start(qspi_queued, qspi_queued_count);
+        qspi_queued = 0;
     }
-    __asm volatile (
-        "1:\n\t"
-        "ldrb r0, [%[src]], #1\n\t"
-        "strb r0, [%[dst]], #1\n\t"
-        "subs %[count], #1\n\t"
-        "bge 1b\n\t"
-        :
-        : [dst] "r" (dst), [src] "r" (src), [count] "r" (count)
-        : "r0", "cc", "memory"
-    );
+}
+
+static void qspi_dma_init() {
+    struct _dma_resource *resource = 0;
+    _dma_get_channel_resource(&resource, qspi_dma_channel);
+    resource->dma_cb.transfer_done = qspi_dma_done;
+    resource->dma_cb.error = qspi_dma_done;
+    _dma_set_irq_state(qspi_dma_channel, DMA_TRANSFER_COMPLETE_CB, true);
+    _dma_set_irq_state(qspi_dma_channel, DMA_TRANSFER_ERROR_CB, true);
 }
 #endif  // #ifndef EMULATOR
 
+// Hands a frame to the LED rails. It streams at once when the channel is
+// idle. Otherwise it is queued and the completion interrupt starts it; a
+// newer frame replaces one still queued. src must stay untouched while it
+// is qspi_streaming or qspi_queued. The completion interrupt has the same
+// priority as the timer interrupt this runs in, so neither preempts the
+// other.
+static void qspi_dma_transmit(const uint8_t *src, uint32_t count) {
+    if (qspi_streaming && qspi_dma_idle()) {
+        // Done, with the completion still pending behind us (the emulator
+        // has no completion interrupt at all)
+        qspi_dma_finish();
+    }
+    if (qspi_streaming) {
+        EMULATOR_COUNT(led_frames_queued, 1);
+        qspi_queued = src;
+        qspi_queued_count = count;
+        return;
+    }
+    qspi_queued = 0;
+    qspi_dma_start(src, count);
+}
+
 class led_bank {
     static constexpr size_t ws2812_commit_time = 384;
     static constexpr size_t ws2812_rails = 4;
@@ -944,15 +1323,71 @@ class led_bank {
 
     static constexpr size_t leds_buffer_size = ws2812_commit_time * ws2812_rails * 2 + ( leds_rings_n + 1 ) * ws2812_rails * leds_components * 8;
 
-    colors::rgb8out leds_centr[2];
-
-    colors::rgb8out leds_outer[2][leds_rings_n];
-    colors::rgb8out leds_inner[2][leds_rings_n];
+    // Unchanged frames are resent this often in case an LED latched a glitch
+    static constexpr ticks_t keep_alive_interval = ticks_per_second;
+
+    // Output levels from here up are truncated, one 8 bit step is too small
+    // to see there. Below, the temporal dither carries the remainder.
+    static constexpr uint32_t dither_limit = 32 << 8;
+
+    // An unchanged frame that needs dithering is dithered this many frames
+    // longer, enough to average to within 1/32 of a step, and then held
+    // like any other unchanged frame
+    static constexpr uint32_t dither_hold_frames = 32;
+
+    static constexpr size_t dither_components = ( leds_rings_n + 1 ) * ws2812_rails * leds_components;
+
+    // Supply current estimate: a WS2812 draws about 1 mA doing nothing and
+    // up to 12 mA more per channel at full output
+    static constexpr size_t leds_encoded = dither_components / leds_components;
+    static constexpr float led_idle_ma = 1.0f;
+    static constexpr float led_channel_ma = 12.0f;
+    static constexpr float leds_idle_ma = led_idle_ma * static_cast<float>(leds_encoded);
+
+    // What the LEDs may draw: the share of the USB input left over by the
+    // rest of the system, or on battery a budget that shrinks towards a
+    // reserve as the cell approaches cutoff
+    static constexpr float usb_budget_ma = 400.0f;
+    static constexpr float battery_budget_ma = 600.0f;
+    static constexpr float reserve_budget_ma = 100.0f;
+    static constexpr float full_budget_voltage = 3.9f;
+
+    // The limiter gain drops at once when over budget and recovers by this
+    // much per frame, so busy effects do not pump
+    static constexpr float gain_release = 0.02f;
+
+    colors::rgb16out leds_centr[2];
+
+    colors::rgb16out leds_outer[2][leds_rings_n];
+    colors::rgb16out leds_inner[2][leds_rings_n];
+
+    // Parts of the frame the compositor works on: the outer ring, and the
+    // inner ring with the center, which the bird color paints over
+    static constexpr uint32_t region_outer = 1 << 0;
+    static constexpr uint32_t region_inner = 1 << 1;
+    static constexpr uint32_t region_all = region_outer | region_inner;
+
+    // What the layer above paints over opaquely this frame. The layer
+    // below leaves it out, and is not calculated at all when all of it is.
+    uint32_t covered = 0;
+
+    // Remainder below one output step per encoded component, in 1/256 steps
+    uint8_t dither_error[dither_components] = {};
+    // The last frame sent has components between two output steps
+    bool dithering = false;
+
+    // Estimated draw of the last frame sent, and the gain it was sent at
+    float current_ma = leds_idle_ma;
+    float current_gain = 1.0f;
+    // The estimate integrated up to charge_time, in uAs
+    int64_t charge_uas = 0;
+    ticks_t charge_time = 0;
+    // The gain moved on the last frame, more frames are needed to settle
+    bool limiter_settling = false;
+    bool limiter_enabled = true;
 
     bool initialized = false;
 
-    pseudo_random random;
-
 public:
 
     static led_bank &instance() {
@@ -964,203 +1399,269 @@ public:
         return leds;
     }
     
-    const std::array<geom::float4, 33> &ledpos() {
-        static std::array<geom::float4, 33> leds;
-        static bool init = false;
-        if (!init) {
-            init = true;
-            leds[ 0] = geom::float4(-0.00000000f,-1.00000000f,+0.00000000f,+0.00000000f);
-            leds[ 1] = geom::float4(-0.38268343f,-0.92387953f,+0.00000000f,+0.00000000f);
-            leds[ 2] = geom::float4(-0.70710678f,-0.70710678f,+0.00000000f,+0.00000000f);
-            leds[ 3] = geom::float4(-0.92387953f,-0.38268343f,+0.00000000f,+0.00000000f);
-            leds[ 4] = geom::float4(-1.00000000f,-0.00000000f,+0.00000000f,+0.00000000f);
-            leds[ 5] = geom::float4(-0.92387953f,+0.38268343f,+0.00000000f,+0.00000000f);
-            leds[ 6] = geom::float4(-0.70710678f,+0.70710678f,+0.00000000f,+0.00000000f);
-            leds[ 7] = geom::float4(-0.38268343f,+0.92387953f,+0.00000000f,+0.00000000f);
-            leds[ 8] = geom::float4(-0.00000000f,+1.00000000f,+0.00000000f,+0.00000000f);
-            leds[ 9] = geom::float4(+0.38268343f,+0.92387953f,+0.00000000f,+0.00000000f);
-            leds[10] = geom::float4(+0.70710678f,+0.70710678f,+0.00000000f,+0.00000000f);
-            leds[11] = geom::float4(+0.92387953f,+0.38268343f,+0.00000000f,+0.00000000f);
-            leds[12] = geom::float4(+1.00000000f,+0.00000000f,+0.00000000f,+0.00000000f);
-            leds[13] = geom::float4(+0.92387953f,-0.38268343f,+0.00000000f,+0.00000000f);
-            leds[14] = geom::float4(+0.70710678f,-0.70710678f,+0.00000000f,+0.00000000f);
-            leds[15] = geom::float4(+0.38268343f,-0.92387953f,+0.00000000f,+0.00000000f);
-
-            leds[16] = geom::float4(-0.00000000f,-0.50000000f,+0.00000000f,+0.00000000f);
-            leds[17] = geom::float4(-0.19134172f,-0.46193977f,+0.00000000f,+0.00000000f);
-            leds[18] = geom::float4(-0.35355339f,-0.35355339f,+0.00000000f,+0.00000000f);
-            leds[19] = geom::float4(-0.46193977f,-0.19134172f,+0.00000000f,+0.00000000f);
-            leds[20] = geom::float4(-0.50000000f,-0.00000000f,+0.00000000f,+0.00000000f);
-            leds[21] = geom::float4(-0.46193977f,+0.19134172f,+0.00000000f,+0.00000000f);
-            leds[22] = geom::float4(-0.35355339f,+0.35355339f,+0.00000000f,+0.00000000f);
-            leds[23] = geom::float4(-0.19134172f,+0.46193977f,+0.00000000f,+0.00000000f);
-            leds[24] = geom::float4(-0.00000000f,+0.50000000f,+0.00000000f,+0.00000000f);
-            leds[25] = geom::float4(+0.19134172f,+0.46193977f,+0.00000000f,+0.00000000f);
-            leds[26] = geom::float4(+0.35355339f,+0.35355339f,+0.00000000f,+0.00000000f);
-            leds[27] = geom::float4(+0.46193977f,+0.19134172f,+0.00000000f,+0.00000000f);
-            leds[28] = geom::float4(+0.50000000f,+0.00000000f,+0.00000000f,+0.00000000f);
-            leds[29] = geom::float4(+0.46193977f,-0.19134172f,+0.00000000f,+0.00000000f);
-            leds[30] = geom::float4(+0.35355339f,-0.35355339f,+0.00000000f,+0.00000000f);
-            leds[31] = geom::float4(+0.19134172f,-0.46193977f,+0.00000000f,+0.00000000f);
-
-            leds[32] = geom::float4(+0.00000000f,+0.00000000f,+0.00000000f,+0.00000000f);
+    float current_budget() const {
+        if (Model::instance().VbusVoltage() >= 4.0f) {
+            return usb_budget_ma;
+        }
+        float voltage = Model::instance().BatteryVoltage();
+        if (voltage <= 0.0f) {
+            // Not measured yet
+            return battery_budget_ma;
+        }
+        return battery_budget(voltage);
+    }
+
+    static float battery_budget(float voltage) {
+        float f = ( voltage - Model::MinBatteryVoltage() ) / ( full_budget_voltage - Model::MinBatteryVoltage() );
+        return reserve_budget_ma + ( battery_budget_ma - reserve_budget_ma ) * std::min(std::max(f, 0.0f), 1.0f);
+    }
+
+    // What the last frame would have drawn without the limiter
+    float demand() const {
+        if (current_gain <= 0.0f) {
+            return current_ma;
+        }
+        return leds_idle_ma + ( current_ma - leds_idle_ma ) / current_gain;
+    }
+
+    bool limiter_on() const {
+        return limiter_enabled;
+    }
+
+    float current() const {
+        return current_ma;
+    }
+
+    int64_t charge() const {
+        return charge_uas + charge_since(Model::instance().Ticks());
+    }
+
+    int64_t charge_since(ticks_t now) const {
+        return static_cast<int64_t>(current_ma * ( 1000.0f / static_cast<float>(ticks_per_second) ) * static_cast<float>(now - charge_time));
+    }
+
+    // Gain that brings the last frame sent within the present budget. The
+    // draw above idle scales with the gain, so one step lands on the budget.
+    float next_gain() const {
+        if (!limiter_enabled) {
+            return 1.0f;
+        }
+        float target = 1.0f;
+        if (current_ma > leds_idle_ma) {
+            target = current_gain * std::max(current_budget() - leds_idle_ma, 0.0f) / ( current_ma - leds_idle_ma );
+        }
+        return std::min(std::min(target, current_gain + gain_release), 1.0f);
+    }
+
+    // A static scene is not redrawn by itself, so when the budget moves
+    // under it the caller needs to wake the LED task
+    bool limiter_pending() const {
+        return gain_level(next_gain()) != gain_level(current_gain);
+    }
+
+    void set_limiter(bool state) {
+        limiter_enabled = state;
+        current_gain = 1.0f;
+        limiter_settling = false;
+    }
+
+    static uint32_t gain_level(float gain) {
+        return static_cast<uint32_t>(gain * 256.0f);
+    }
+
+    // Position of each LED on a unit circle, the outer ring 0-15, the inner
+    // ring 16-31 and the center 32, with its angle in turns counterclockwise
+    // from the bottom, (atan2(x, y) + pi) / 2pi, its radius and its ring
+    struct led_geometry {
+        geom::float4 pos;
+        float angle;
+        float radius;
+        uint32_t ring;
+    };
+
+    static constexpr led_geometry leds_geometry[33] = {
+        { geom::float4(-0.00000000f,-1.00000000f,+0.00000000f,+0.00000000f), 0.0000f, 1.0f, 0 },
+        { geom::float4(-0.38268343f,-0.92387953f,+0.00000000f,+0.00000000f), 0.0625f, 1.0f, 0 },
+        { geom::float4(-0.70710678f,-0.70710678f,+0.00000000f,+0.00000000f), 0.1250f, 1.0f, 0 },
+        { geom::float4(-0.92387953f,-0.38268343f,+0.00000000f,+0.00000000f), 0.1875f, 1.0f, 0 },
+        { geom::float4(-1.00000000f,-0.00000000f,+0.00000000f,+0.00000000f), 0.2500f, 1.0f, 0 },
+        { geom::float4(-0.92387953f,+0.38268343f,+0.00000000f,+0.00000000f), 0.3125f, 1.0f, 0 },
+        { geom::float4(-0.70710678f,+0.70710678f,+0.00000000f,+0.00000000f), 0.3750f, 1.0f, 0 },
+        { geom::float4(-0.38268343f,+0.92387953f,+0.00000000f,+0.00000000f), 0.4375f, 1.0f, 0 },
+        { geom::float4(-0.00000000f,+1.00000000f,+0.00000000f,+0.00000000f), 0.5000f, 1.0f, 0 },
+        { geom::float4(+0.38268343f,+0.92387953f,+0.00000000f,+0.00000000f), 0.5625f, 1.0f, 0 },
+        { geom::float4(+0.70710678f,+0.70710678f,+0.00000000f,+0.00000000f), 0.6250f, 1.0f, 0 },
+        { geom::float4(+0.92387953f,+0.38268343f,+0.00000000f,+0.00000000f), 0.6875f, 1.0f, 0 },
+        { geom::float4(+1.00000000f,+0.00000000f,+0.00000000f,+0.00000000f), 0.7500f, 1.0f, 0 },
+        { geom::float4(+0.92387953f,-0.38268343f,+0.00000000f,+0.00000000f), 0.8125f, 1.0f, 0 },
+        { geom::float4(+0.70710678f,-0.70710678f,+0.00000000f,+0.00000000f), 0.8750f, 1.0f, 0 },
+        { geom::float4(+0.38268343f,-0.92387953f,+0.00000000f,+0.00000000f), 0.9375f, 1.0f, 0 },
+
+        { geom::float4(-0.00000000f,-0.50000000f,+0.00000000f,+0.00000000f), 0.0000f, 0.5f, 1 },
+        { geom::float4(-0.19134172f,-0.46193977f,+0.00000000f,+0.00000000f), 0.0625f, 0.5f, 1 },
+        { geom::float4(-0.35355339f,-0.35355339f,+0.00000000f,+0.00000000f), 0.1250f, 0.5f, 1 },
+        { geom::float4(-0.46193977f,-0.19134172f,+0.00000000f,+0.00000000f), 0.1875f, 0.5f, 1 },
+        { geom::float4(-0.50000000f,-0.00000000f,+0.00000000f,+0.00000000f), 0.2500f, 0.5f, 1 },
+        { geom::float4(-0.46193977f,+0.19134172f,+0.00000000f,+0.00000000f), 0.3125f, 0.5f, 1 },
+        { geom::float4(-0.35355339f,+0.35355339f,+0.00000000f,+0.00000000f), 0.3750f, 0.5f, 1 },
+        { geom::float4(-0.19134172f,+0.46193977f,+0.00000000f,+0.00000000f), 0.4375f, 0.5f, 1 },
+        { geom::float4(-0.00000000f,+0.50000000f,+0.00000000f,+0.00000000f), 0.5000f, 0.5f, 1 },
+        { geom::float4(+0.19134172f,+0.46193977f,+0.00000000f,+0.00000000f), 0.5625f, 0.5f, 1 },
+        { geom::float4(+0.35355339f,+0.35355339f,+0.00000000f,+0.00000000f), 0.6250f, 0.5f, 1 },
+        { geom::float4(+0.46193977f,+0.19134172f,+0.00000000f,+0.00000000f), 0.6875f, 0.5f, 1 },
+        { geom::float4(+0.50000000f,+0.00000000f,+0.00000000f,+0.00000000f), 0.7500f, 0.5f, 1 },
+        { geom::float4(+0.46193977f,-0.19134172f,+0.00000000f,+0.00000000f), 0.8125f, 0.5f, 1 },
+        { geom::float4(+0.35355339f,-0.35355339f,+0.00000000f,+0.00000000f), 0.8750f, 0.5f, 1 },
+        { geom::float4(+0.19134172f,-0.46193977f,+0.00000000f,+0.00000000f), 0.9375f, 0.5f, 1 },
+
+        { geom::float4(+0.00000000f,+0.00000000f,+0.00000000f,+0.00000000f), 0.5000f, 0.0f, 2 }
+    };
+
+    void calc_effect(uint32_t effect) {
+        arena.select(effect);
+        switch (effect) {
+            case 0:
+                black();
+            break;
+            case 1:
+                static_color();
+            break;
+            case 2:
+                rgb_band();
+            break;
+            case 3:
+                color_walker();
+            break;
+            case 4:
+                light_walker();
+            break;
+            case 5:
+                rgb_glow();
+            break;
+            case 6:
+                lightning();
+            break;
+            case 7:
+                lightning_crazy();
+            break;
+            case 8:
+                sparkle();
+            break;
+            case 9:
+                rando();
+            break;
+            case 10:
+                red_green();
+            break;
+            case 11:
+                brilliance();
+            break;
+            case 12:
+                highlight();
+            break;
+            case 13:
+                autumn();
+            break;
+            case 14:
+                heartbeat();
+            break;
+            case 15:
+                moving_rainbow();
+            break;
+            case 16:
+                twinkle();
+            break;
+            case 17:
+                twinkly();
+            break;
+            case 18:
+                randomfader();
+            break;
+            case 19:
+                chaser();
+            break;
+            case 20:
+                brightchaser();
+            break;
+            case 21:
+                gradient();
+            break;
+            case 22:
+                overdrive();
+            break;
+            case 23:
+                ironman();
+            break;
+            case 24:
+                sweep();
+            break;
+            case 25:
+                sweephighlight();
+            break;
+            case 26:
+                rainbow_circle();
+            break;
+            case 27:
+                rainbow_grow();
+            break;
+            case 28:
+                rotor();
+            break;
+            case 29:
+                rotor_sparse();
+            break;
+            case 30:
+                fullcolor();
+            break;
+            case 31:
+                flip_colors();
+            break;
         }
-        return leds;
     }
 
     void init() {
         qspi_sync_enable(&QUAD_SPI_0);
+#ifndef EMULATOR
+        qspi_dma_init();
+#endif  // #ifndef EMULATOR
 
         static Timeline::Span span;
 
         static uint32_t current_effect = 0;
         static uint32_t previous_effect = 0;
-        static double switch_time = 0;
-        
-        random.set_seed(Model::instance().RandomUInt32());
+        static ticks_t switch_time = 0;
+        static constexpr ticks_t blend_duration = ticks_per_second / 2;
 
         span.type = Timeline::Span::Effect;
         span.time = 0;
-        span.duration = std::numeric_limits<double>::infinity();
+        span.duration = ticks_infinite;
 
         span.calcFunc = [=](Timeline::Span &, Timeline::Span &) {
 
             if ( current_effect != Model::instance().Effect() ) {
                 previous_effect = current_effect;
                 current_effect = Model::instance().Effect();
-                switch_time = Model::instance().Time();
+                switch_time = Model::instance().Ticks();
             }
 
-            auto calc_effect = [=] (uint32_t effect) mutable {
-                switch (effect) {
-                    case 0:
-                        black();
-                    break;
-                    case 1:
-                        static_color();
-                    break;
-                    case 2:
-                        rgb_band();
-                    break;
-                    case 3:
-                        color_walker();
-                    break;
-                    case 4:
-                        light_walker();
-                    break;
-                    case 5:
-                        rgb_glow();
-                    break;
-                    case 6:
-                        lightning();
-                    break;
-                    case 7:
-                        lightning_crazy();
-                    break;
-                    case 8:
-                        sparkle();
-                    break;
-                    case 9:
-                        rando();
-                    break;
-                    case 10:
-                        red_green();
-                    break;
-                    case 11:
-                        brilliance();
-                    break;
-                    case 12:
-                        highlight();
-                    break;
-                    case 13:
-                        autumn();
-                    break;
-                    case 14:
-                        heartbeat();
-                    break;
-                    case 15:
-                        moving_rainbow();
-                    break;
-                    case 16:
-                        twinkle();
-                    break;
-                    case 17:
-                        twinkly();
-                    break;
-                    case 18:
-                        randomfader();
-                    break;
-                    case 19:
-                        chaser();
-                    break;
-                    case 20:
-                        brightchaser();
-                    break;
-                    case 21:
-                        gradient();
-                    break;
-                    case 22:
-                        overdrive();
-                    break;
-                    case 23:
-                        ironman();
-                    break;
-                    case 24:
-                        sweep();
-                    break;
-                    case 25:
-                        sweephighlight();
-                    break;
-                    case 26:
-                        rainbow_circle();
-                    break;
-                    case 27:
-                        rainbow_grow();
-                    break;
-                    case 28:
-                        rotor();
-                    break;
-                    case 29:
-                        rotor_sparse();
-                    break;
-                    case 30:
-                        fullcolor();
-                    break;
-                    case 31:
-                        flip_colors();
-                    break;
-                }
-            };
-
-            double blend_duration = 0.5;
-            double now = Model::instance().Time();
+            ticks_t now = Model::instance().Ticks();
             
             if ((now - switch_time) < blend_duration) {
-                calc_effect(previous_effect);
+                arena.retain(current_effect, previous_effect);
 
-                colors::rgb8out leds_centr_prev[2];
-                colors::rgb8out leds_outer_prev[2][leds_rings_n];
-                colors::rgb8out leds_inner_prev[2][leds_rings_n];
+                calc_effect(previous_effect);
 
-                memcpy(leds_centr_prev, leds_centr, sizeof(leds_centr));
-                memcpy(leds_outer_prev, leds_outer, sizeof(leds_outer));
-                memcpy(leds_inner_prev, leds_inner, sizeof(leds_inner));
+                led_layer previous;
+                save_layer(previous);
 
                 calc_effect(current_effect);
 
+                // The previous effect fades out over the current one
                 float blend = static_cast<float>(now - switch_time) * (1.0f / static_cast<float>(blend_duration));
-
-                for (size_t c = 0; c < leds_rings_n; c++) {
-                    leds_outer[0][c] = colors::ip(leds_outer_prev[0][c], leds_outer[0][c], blend);
-                    leds_outer[1][c] = colors::ip(leds_outer_prev[1][c], leds_outer[1][c], blend);
-                    leds_inner[0][c] = colors::ip(leds_inner_prev[0][c], leds_inner[0][c], blend);
-                    leds_inner[1][c] = colors::ip(leds_inner_prev[1][c], leds_inner[1][c], blend);
-                }
-
-                leds_centr[0] = colors::ip(leds_centr_prev[0], leds_centr[0], blend);
-                leds_centr[1] = colors::ip(leds_centr_prev[1], leds_centr[1], blend);
+                composite<colors::blend_mode::crossfade>(previous, colors::weight_one - colors::weight(blend));
 
             } else {
+                arena.retain(current_effect, current_effect);
                 calc_effect(current_effect);
             }
 
@@ -1168,10 +1669,21 @@ public:
         span.commitFunc = [=](Timeline::Span &) {
             led_bank::instance().update_leds();
         };
+        // black and static_color only change with the model, which is
+        // edited from the switches, and those wake the LED task. Once idle
+        // the last dithered frame stays, within one step of the level as
+        // truncation was. The current limiter gets frames until it settles.
+        span.nextFunc = [=](Timeline::Span &) {
+            if (current_effect != Model::instance().Effect() ||
+                (Model::instance().Ticks() - switch_time) < blend_duration) {
+                return ticks_t(0);
+            }
+            return current_effect <= 1 && !limiter_settling ? Timeline::Span::Idle(span) : ticks_t(0);
+        };
 
         Timeline::instance().Add(span);
         current_effect = Model::instance().Effect();
-        switch_time = Model::instance().Time();
+        switch_time = Model::instance().Ticks();
     }
 
     void enable_leds() {
@@ -1184,29 +1696,83 @@ public:
         gpio_set_pin_level(ENABLE_O, false);
     }
 
-    void update_leds(bool hide_non_covered = true) {
+    // Temporal error diffusion from 16 to 8 bits: the remainder is carried
+    // into the next frame, so at 100 fps a level between two steps is
+    // shown as the average of both instead of being truncated.
+    static uint8_t quantize(uint32_t v, uint8_t &error, bool &dithered) {
+        if (v >= dither_limit) {
+            error = 0;
+            return static_cast<uint8_t>(v >> 8);
+        }
+        uint32_t sum = v + error;
+        error = static_cast<uint8_t>(sum & 0xFF);
+        dithered = dithered || (v & 0xFF) != 0;
+        return static_cast<uint8_t>(sum >> 8);
+    }
+
+    // The level is brightness times limiter gain in 16 bits. Returns whether
+    // any component needed dithering and the sum of all output bytes.
+    bool encode_frame(uint8_t *buf, uint32_t level, const uint8_t *top_mask, const uint8_t *bottom_mask, bool dither, uint32_t &sum) {
+        uint8_t *error = dither_error;
+        bool dithered = false;
+        sum = 0;
+
+        auto out = [level, dither, &error, &dithered, &sum](uint16_t p, uint32_t mask = 1) {
+            uint32_t v = ( p * mask * level ) >> 16;
+            uint8_t o = dither ? quantize(v, *error, dithered) : static_cast<uint8_t>(v >> 8);
+            error++;
+            sum += o;
+            return o;
+        };
 
-        enable_leds();
+        for (size_t c = 0; c < leds_rings_n; c++) {
+            buf = ws2812::encode4(out(leds_inner[0][c].g, top_mask[c]),
+                                  out(leds_outer[0][c].g),
+                                  out(leds_inner[1][c].g, bottom_mask[c]),
+                                  out(leds_outer[1][c].g),
+                                  buf);
+            buf = ws2812::encode4(out(leds_inner[0][c].r, top_mask[c]),
+                                  out(leds_outer[0][c].r),
+                                  out(leds_inner[1][c].r, bottom_mask[c]),
+                                  out(leds_outer[1][c].r),
+                                  buf);
+            buf = ws2812::encode4(out(leds_inner[0][c].b, top_mask[c]),
+                                  out(leds_outer[0][c].b),
+                                  out(leds_inner[1][c].b, bottom_mask[c]),
+                                  out(leds_outer[1][c].b),
+                                  buf);
+        }
+
+        // Center LEDs are wired to two rails each
+        buf = ws2812::encode4(out(leds_centr[0].g), out(leds_centr[0].g),
+                              out(leds_centr[1].g), out(leds_centr[1].g), buf);
+        buf = ws2812::encode4(out(leds_centr[0].r), out(leds_centr[0].r),
+                              out(leds_centr[1].r), out(leds_centr[1].r), buf);
+        buf = ws2812::encode4(out(leds_centr[0].b), out(leds_centr[0].b),
+                              out(leds_centr[1].b), out(leds_centr[1].b), buf);
+
+        return dithered;
+    }
 
-        static const uint8_t conv_lookup[16][4] = {
-            {   0b11111111, 0b00000000, 0b00000000, 0b00000000 }, // 0b0000
-            {   0b11111111, 0b00010001, 0b00010000, 0b00000000 }, // 0b0001
-            {   0b11111111, 0b00100010, 0b00100000, 0b00000000 }, // 0b0010
-            {   0b11111111, 0b00110011, 0b00110000, 0b00000000 }, // 0b0011
-            {   0b11111111, 0b01000100, 0b01000000, 0b00000000 }, // 0b0100
-            {   0b11111111, 0b01010101, 0b01010000, 0b00000000 }, // 0b0101
-            {   0b11111111, 0b01101100, 0b01100000, 0b00000000 }, // 0b0110
-            {   0b11111111, 0b01110111, 0b01110000, 0b00000000 }, // 0b0111
-            {   0b11111111, 0b10001000, 0b10000000, 0b00000000 }, // 0b1000
-            {   0b11111111, 0b10011001, 0b10010000, 0b00000000 }, // 0b1001
-            {   0b11111111, 0b10101010, 0b10100000, 0b00000000 }, // 0b1010
-            {   0b11111111, 0b10111011, 0b10110000, 0b00000000 }, // 0b1011
-            {   0b11111111, 0b11001100, 0b11000000, 0b00000000 }, // 0b1100
-            {   0b11111111, 0b11011101, 0b11010000, 0b00000000 }, // 0b1101
-            {   0b11111111, 0b11101110, 0b11100000, 0b00000000 }, // 0b1110
-            {   0b11111111, 0b11111111, 0b11110000, 0b00000000 }, // 0b1111
-        };
+#ifdef EMULATOR
+    // Encodes without the transfer at brightness 0.1, for the benchmark
+    uint32_t encode_frames(bool dither, uint32_t frames) {
+        alignas(4) static uint8_t buffer[leds_buffer_size];
+        static uint8_t all_on[leds_rings_n];
+        std::fill(&all_on[0], &all_on[0] + leds_rings_n, 1);
+        uint32_t sum = 0;
+        for (uint32_t c = 0; c < frames; c++) {
+            uint32_t unused = 0;
+            encode_frame(&buffer[ws2812_commit_time * ws2812_rails], 26 * 256, all_on, all_on, dither, unused);
+            sum += buffer[ws2812_commit_time * ws2812_rails + c % (leds_buffer_size - ws2812_commit_time * ws2812_rails * 2)];
+        }
+        return sum;
+    }
+#endif  // #ifdef EMULATOR
 
+    void update_leds(bool hide_non_covered = true) {
+
+        enable_leds();
 
         static const uint8_t disabled_inner_leds_top_off[16] = {
             0x1, 0x0, 0x0, 0x1,
@@ -1246,122 +1812,58 @@ public:
 
         int32_t brightness = static_cast<int32_t>(Model::instance().Brightness() * 256);
 
-        size_t buf_pos = 0;
-        static uint8_t buffer[leds_buffer_size];
-
-        for (size_t c = 0; c < ws2812_commit_time; c++) {
-            buffer[buf_pos++] = 0;
-            buffer[buf_pos++] = 0;
-            buffer[buf_pos++] = 0;
-            buffer[buf_pos++] = 0;
-        }
-
-        auto transfer4 = [](uint8_t p0, uint8_t p1, uint8_t p2, uint8_t p3, uint8_t *buf, size_t &bp, int32_t bright) {
-            p0 = static_cast<uint8_t>(( p0 * bright ) / 256);
-            p1 = static_cast<uint8_t>(( p1 * bright ) / 256);
-            p2 = static_cast<uint8_t>(( p2 * bright ) / 256);
-            p3 = static_cast<uint8_t>(( p3 * bright ) / 256);
-
-            for(int32_t d = 7; d >=0; d--) {
-                const uint8_t *src = conv_lookup[
-                ((p0&(1<<d))?0x8:0x0)|
-                ((p1&(1<<d))?0x4:0x0)|
-                ((p2&(1<<d))?0x2:0x0)|
-                ((p3&(1<<d))?0x1:0x0)];
-                buf[bp++] = *src++;
-                buf[bp++] = *src++;
-                buf[bp++] = *src++;
-                buf[bp++] = *src++;
-            }
-        };
-
-        for (size_t c = 0; c < leds_rings_n; c++) {
-            transfer4(leds_inner[0][c].g * disabled_inner_leds_top[c],
-                      leds_outer[0][c].g,
-                      leds_inner[1][c].g * disabled_inner_leds_bottom[c],
-                      leds_outer[1][c].g,
-                      buffer, buf_pos, brightness);
-            transfer4(leds_inner[0][c].r * disabled_inner_leds_top[c],
-                      leds_outer[0][c].r,
-                      leds_inner[1][c].r * disabled_inner_leds_bottom[c],
-                      leds_outer[1][c].r,
-                      buffer, buf_pos, brightness);
-            transfer4(leds_inner[0][c].b * disabled_inner_leds_top[c],
-                      leds_outer[0][c].b,
-                      leds_inner[1][c].b * disabled_inner_leds_bottom[c],
-                      leds_outer[1][c].b,
-                      buffer, buf_pos, brightness);
-        }
-
-        auto transfer2 = [](uint8_t p0, uint8_t p1, uint8_t *buf, size_t &bp, int32_t bright) {
-            p0 = static_cast<uint8_t>(( p0 * bright ) / 256);
-            p1 = static_cast<uint8_t>(( p1 * bright ) / 256);
-            for(int32_t d = 7; d >=0; d--) {
-                const uint8_t *src = conv_lookup[
-                ((p0&(1<<d))?0x8:0x0)|
-                ((p0&(1<<d))?0x4:0x0)|
-                ((p1&(1<<d))?0x2:0x0)|
-                ((p1&(1<<d))?0x1:0x0)];
-                buf[bp++] = *src++;
-                buf[bp++] = *src++;
-                buf[bp++] = *src++;
-                buf[bp++] = *src++;
-            }
-        };
-
-        transfer2(leds_centr[0].g,
-                  leds_centr[1].g,
-                  buffer, buf_pos, brightness);
-        transfer2(leds_centr[0].r,
-                  leds_centr[1].r,
-                  buffer, buf_pos, brightness);
-        transfer2(leds_centr[0].b,
-                  leds_centr[1].b,
-                  buffer, buf_pos, brightness);
-    
-        for (size_t c = 0; c < ws2812_commit_time; c++) {
-            buffer[buf_pos++] = 0;
-            buffer[buf_pos++] = 0;
-            buffer[buf_pos++] = 0;
-            buffer[buf_pos++] = 0;
+        // Closed loop on the estimated draw of the last frame sent. The gain
+        // is only taken over with a frame that is sent, so it stays paired
+        // with current_ma when a frame is skipped or dropped.
+        float gain = next_gain();
+        limiter_settling = gain_level(gain) != gain_level(current_gain);
+        uint32_t level = static_cast<uint32_t>(brightness) * gain_level(gain);
+
+        // Skip encoding and transmit when the frame hashes the same as the
+        // last one sent. At level 0 every frame is black.
+        static uint32_t sent_hash = 0;
+        static ticks_t sent_time = -keep_alive_interval;
+        uint32_t hash = level | (hide_non_covered ? 0x80000000UL : 0UL);
+        if (level != 0) {
+            hash = MurmurHash3_32(leds_outer, sizeof(leds_outer), hash);
+            hash = MurmurHash3_32(leds_inner, sizeof(leds_inner), hash);
+            hash = MurmurHash3_32(leds_centr, sizeof(leds_centr), hash);
+        }
+        static uint32_t unchanged_frames = 0;
+        if (hash != sent_hash) {
+            unchanged_frames = 0;
+        } else if (unchanged_frames < dither_hold_frames) {
+            unchanged_frames++;
+        }
+        bool settled = !dithering || unchanged_frames >= dither_hold_frames;
+        ticks_t now = Model::instance().Ticks();
+        if (hash == sent_hash && settled && (now - sent_time) < keep_alive_interval) {
+            EMULATOR_COUNT(led_frames_skipped, 1);
+            return;
         }
+        sent_hash = hash;
+        sent_time = now;
+        current_gain = gain;
 
-#ifndef EMULATOR
-        static bool pending = false;
+        // Preamble and postamble are zero and never touched, only the payload
+        // in between is rewritten each frame. A frame is encoded into the
+        // buffer that is not streaming while the other one is.
+        alignas(4) static uint8_t buffers[2][leds_buffer_size];
+        uint8_t *buffer = buffers[qspi_streaming == buffers[0] ? 1 : 0];
 
-        struct _qspi_command cmd;
-        memset(&cmd, 0, sizeof(cmd));
-        cmd.inst_frame.bits.width = QSPI_INST4_ADDR4_DATA4;
-        cmd.inst_frame.bits.data_en = 1;
-        cmd.inst_frame.bits.tfr_type = QSPI_WRITE_ACCESS;
-    
-
-        if (pending) {
-            hri_qspi_write_CTRLA_reg(QSPI, QSPI_CTRLA_ENABLE | QSPI_CTRLA_LASTXFER);
-
-            while (!hri_qspi_get_INTFLAG_INSTREND_bit(QSPI)) { };
+        uint32_t sum = 0;
+        dithering = encode_frame(&buffer[ws2812_commit_time * ws2812_rails], level, disabled_inner_leds_top, disabled_inner_leds_bottom, true, sum);
+        charge_uas += charge_since(now);
+        charge_time = now;
+        current_ma = leds_idle_ma + static_cast<float>(sum) * ( led_channel_ma / 255.0f );
 
-            hri_qspi_clear_INTFLAG_INSTREND_bit(QSPI);
+        qspi_dma_transmit(buffer, leds_buffer_size);
 
-            pending = false;
+#ifdef EMULATOR
+        if (emulator_headless()) {
+            return;
         }
 
-        hri_qspi_write_INSTRFRAME_reg(QSPI, cmd.inst_frame.word);
-        volatile uint8_t *qspi_mem = reinterpret_cast<volatile uint8_t *>(QSPI_AHB);
-
-        __disable_irq();
-        
-        _qspi_memcpy(qspi_mem, buffer, buf_pos);
-
-        __DSB();
-        __ISB();
-
-        __enable_irq();
-
-        pending = true;
-#endif  // #ifndef EMULATOR
-
-#ifdef EMULATOR
         auto print_leds = [](int32_t pos_x, int32_t pos_y, const std::vector<colors::rgb> &leds) {
             std::lock_guard<std::recursive_mutex> lock(g_print_mutex);
 
@@ -1419,49 +1921,119 @@ public:
             }
         };
 
+        auto shade = [level](const colors::rgb16out &c, uint32_t mask = 1) {
+            float f = static_cast<float>(mask * level) * (1.0f / (65536.0f * 65535.0f));
+            return colors::rgb(static_cast<float>(c.r) * f, static_cast<float>(c.g) * f, static_cast<float>(c.b) * f);
+        };
+
         std::vector<colors::rgb> leds_top;
         for (size_t c = 0; c < leds_rings_n; c++) {
-            uint8_t r = static_cast<uint8_t>((leds_outer[0][c].r * brightness ) / 256);
-            uint8_t g = static_cast<uint8_t>((leds_outer[0][c].g * brightness ) / 256);
-            uint8_t b = static_cast<uint8_t>((leds_outer[0][c].b * brightness ) / 256);
-            leds_top.push_back(colors::rgb(colors::rgb8out(r,g,b)));
+            leds_top.push_back(shade(leds_outer[0][c]));
         }
         for (size_t c = 0; c < leds_rings_n; c++) {
-            uint8_t r = static_cast<uint8_t>((leds_inner[0][c].r * brightness * disabled_inner_leds_top[c]) / 256);
-            uint8_t g = static_cast<uint8_t>((leds_inner[0][c].g * brightness * disabled_inner_leds_top[c]) / 256);
-            uint8_t b = static_cast<uint8_t>((leds_inner[0][c].b * brightness * disabled_inner_leds_top[c]) / 256);
-            leds_top.push_back(colors::rgb(colors::rgb8out(r,g,b)));
-        }
-        leds_top.push_back(colors::rgb(colors::rgb8out(
-                static_cast<uint8_t>((leds_centr[0].r * brightness) / 256),
-                static_cast<uint8_t>((leds_centr[0].g * brightness) / 256),
-                static_cast<uint8_t>((leds_centr[0].b * brightness) / 256))));
+            leds_top.push_back(shade(leds_inner[0][c], disabled_inner_leds_top[c]));
+        }
+        leds_top.push_back(shade(leds_centr[0]));
         print_leds(0, 0, leds_top);
         
         std::vector<colors::rgb> leds_btm;
         for (size_t c = 0; c < leds_rings_n; c++) {
-            uint8_t r = static_cast<uint8_t>((leds_outer[1][c].r * brightness ) / 256);
-            uint8_t g = static_cast<uint8_t>((leds_outer[1][c].g * brightness ) / 256);
-            uint8_t b = static_cast<uint8_t>((leds_outer[1][c].b * brightness ) / 256);
-            leds_btm.push_back(colors::rgb(colors::rgb8out(r,g,b)));
+            leds_btm.push_back(shade(leds_outer[1][c]));
         }
         for (size_t c = 0; c < leds_rings_n; c++) {
-            uint8_t r = static_cast<uint8_t>((leds_inner[0][c].r * brightness * disabled_inner_leds_bottom[c]) / 256);
-            uint8_t g = static_cast<uint8_t>((leds_inner[0][c].g * brightness * disabled_inner_leds_bottom[c]) / 256);
-            uint8_t b = static_cast<uint8_t>((leds_inner[0][c].b * brightness * disabled_inner_leds_bottom[c]) / 256);
-            leds_btm.push_back(colors::rgb(colors::rgb8out(r,g,b)));
-        }
-        leds_btm.push_back(colors::rgb(colors::rgb8out(
-                static_cast<uint8_t>((leds_centr[1].r * brightness) / 256),
-                static_cast<uint8_t>((leds_centr[1].g * brightness) / 256),
-                static_cast<uint8_t>((leds_centr[1].b * brightness) / 256))));
+            leds_btm.push_back(shade(leds_inner[0][c], disabled_inner_leds_bottom[c]));
+        }
+        leds_btm.push_back(shade(leds_centr[1]));
         print_leds(30, 0, leds_btm);
 #endif  // #ifdef EMULATOR
     }
 
+    // One compositor layer: every LED of both sides in linear light, 16
+    // bits per channel. Effects and overlays draw into the frame
+    // (leds_centr, leds_outer, leds_inner), a layer keeps a finished frame
+    // to be composited with the next one.
+    struct led_layer {
+        colors::rgb16out centr[2];
+        colors::rgb16out outer[2][leds_rings_n];
+        colors::rgb16out inner[2][leds_rings_n];
+    };
+
+    void save_layer(led_layer &layer) const {
+        std::copy(&leds_centr[0], &leds_centr[0] + 2, &layer.centr[0]);
+        std::copy(&leds_outer[0][0], &leds_outer[0][0] + 2 * leds_rings_n, &layer.outer[0][0]);
+        std::copy(&leds_inner[0][0], &leds_inner[0][0] + 2 * leds_rings_n, &layer.inner[0][0]);
+    }
+
+    // A layer crossfaded in fully is copied, one at weight 0 is skipped
+    template<colors::blend_mode mode> static void composite_led(colors::rgb16out &below, const colors::rgb16out &above, uint32_t weight) {
+        if (mode == colors::blend_mode::crossfade && weight == colors::weight_one) {
+            below = above;
+        } else {
+            below = colors::blend<mode>(below, above, weight);
+        }
+    }
+
+    // Composites a layer over the frame in the regions not covered from
+    // above. Gamma is already applied and quantization to 8 bits only
+    // happens in update_leds().
+    template<colors::blend_mode mode> void composite(const led_layer &layer, uint32_t weight, uint32_t regions = region_all) {
+        regions &= ~covered;
+        if (weight == 0) {
+            return;
+        }
+        for (size_t s = 0; s < 2; s++) {
+            if (regions & region_outer) {
+                for (size_t c = 0; c < leds_rings_n; c++) {
+                    composite_led<mode>(leds_outer[s][c], layer.outer[s][c], weight);
+                }
+            }
+            if (regions & region_inner) {
+                for (size_t c = 0; c < leds_rings_n; c++) {
+                    composite_led<mode>(leds_inner[s][c], layer.inner[s][c], weight);
+                }
+                composite_led<mode>(leds_centr[s], layer.centr[s], weight);
+            }
+        }
+    }
+
+    // Same for a layer of one color, as the overlays draw
+    template<colors::blend_mode mode> void composite(const colors::rgb16out &color, uint32_t weight, uint32_t regions = region_all) {
+        regions &= ~covered;
+        if (weight == 0) {
+            return;
+        }
+        for (size_t s = 0; s < 2; s++) {
+            if (regions & region_outer) {
+                for (size_t c = 0; c < leds_rings_n; c++) {
+                    composite_led<mode>(leds_outer[s][c], color, weight);
+                }
+            }
+            if (regions & region_inner) {
+                for (size_t c = 0; c < leds_rings_n; c++) {
+                    composite_led<mode>(leds_inner[s][c], color, weight);
+                }
+                composite_led<mode>(leds_centr[s], color, weight);
+            }
+        }
+    }
+
+    // Calculates the layer below with what this one paints over opaquely
+    // left out, or not at all when that is everything
+    void calc_below(Timeline::Span &below, uint32_t opaque) {
+        uint32_t above = covered;
+        covered |= opaque;
+        if (covered != region_all) {
+            below.Calc();
+        }
+        covered = above;
+    }
+
     void set_bird_color(const colors::rgb &col) {
+        if (covered & region_inner) {
+            return;
+        }
 
-        const colors::rgb8out col8(col);
+        const colors::rgb16out col8(col);
 
         leds_centr[0] = col8;
         leds_centr[1] = col8;
@@ -1473,40 +2045,71 @@ public:
 
     }
 
-    void calc_outer(const std::function<geom::float4 (const geom::float4 &pos)> &func) {
-        for (size_t c = 0; c < 16; c++) {
-            leds_outer[0][c] = colors::rgb8out(colors::rgb(func(ledpos()[c])));
-            leds_outer[1][c] = colors::rgb8out(colors::rgb(func(ledpos()[c])));
+    // Per-position kernel results for calc_outer/calc_inner/calc_all, one
+    // array per channel. Kernels are pure functions of position (and index)
+    // or of the whole led_geometry, so each position is evaluated once and
+    // written to both sides.
+    struct calc_buffer {
+        float r[33];
+        float g[33];
+        float b[33];
+    };
+
+    template<typename F> void calc_range(const F &func, size_t first, size_t count, calc_buffer &buf, size_t index = 0) {
+        for (size_t c = 0; c < count; c++) {
+            geom::float4 v;
+            if constexpr (std::is_invocable_v<const F &, const led_geometry &>) {
+                v = func(leds_geometry[first + c]);
+            } else if constexpr (std::is_invocable_v<const F &, const geom::float4 &, const size_t>) {
+                v = func(leds_geometry[first + c].pos, index + c);
+            } else {
+                v = func(leds_geometry[first + c].pos);
+            }
+            buf.r[first + c] = v.x;
+            buf.g[first + c] = v.y;
+            buf.b[first + c] = v.z;
+        }
+    }
+
+    void quantize_range(const calc_buffer &buf, size_t first, size_t count, colors::rgb16out *side0, colors::rgb16out *side1) {
+        for (size_t c = 0; c < count; c++) {
+            colors::rgb16out out(colors::rgb(buf.r[first + c], buf.g[first + c], buf.b[first + c]));
+            side0[c] = out;
+            side1[c] = out;
         }
     }
 
-    void calc_outer(const std::function<geom::float4 (const geom::float4 &pos, const size_t index)> &func) {
-        for (size_t c = 0; c < 16; c++) {
-            leds_outer[0][c] = colors::rgb8out(colors::rgb(func(ledpos()[c],c)));
-            leds_outer[1][c] = colors::rgb8out(colors::rgb(func(ledpos()[c],c)));
+    // Regions covered from above are not evaluated
+    template<typename F> void calc_outer(const F &func) {
+        if (covered & region_outer) {
+            return;
         }
+        calc_buffer buf;
+        calc_range(func, 0, leds_rings_n, buf);
+        quantize_range(buf, 0, leds_rings_n, leds_outer[0], leds_outer[1]);
     }
 
-    void calc_all(const std::function<geom::float4 (const geom::float4 &pos)> &func) {
-        for (size_t c = 0; c < 16; c++) {
-            leds_outer[0][c] = colors::rgb8out(colors::rgb(func(ledpos()[c])));
-            leds_outer[1][c] = colors::rgb8out(colors::rgb(func(ledpos()[c])));
+    template<typename F> void calc_all(const F &func) {
+        calc_buffer buf;
+        if (!(covered & region_outer)) {
+            calc_range(func, 0, leds_rings_n, buf);
+            quantize_range(buf, 0, leds_rings_n, leds_outer[0], leds_outer[1]);
         }
-        for (size_t c = 0; c < 16; c++) {
-            leds_inner[0][c] = colors::rgb8out(colors::rgb(func(ledpos()[c+16])));
-            leds_inner[1][c] = colors::rgb8out(colors::rgb(func(ledpos()[c+16])));
+        if (!(covered & region_inner)) {
+            calc_range(func, leds_rings_n, leds_rings_n + 1, buf, leds_rings_n);
+            quantize_range(buf, leds_rings_n, leds_rings_n, leds_inner[0], leds_inner[1]);
+            quantize_range(buf, leds_rings_n * 2, 1, &leds_centr[0], &leds_centr[1]);
         }
-        leds_centr[0] = colors::rgb8out(colors::rgb(func(ledpos()[32])));
-        leds_centr[1] = colors::rgb8out(colors::rgb(func(ledpos()[32])));
     }
 
-    void calc_inner(const std::function<geom::float4 (const geom::float4 &pos)> &func) {
-        for (size_t c = 0; c < 16; c++) {
-            leds_inner[0][c] = colors::rgb8out(colors::rgb(func(ledpos()[c+16])));
-            leds_inner[1][c] = colors::rgb8out(colors::rgb(func(ledpos()[c+16])));
+    template<typename F> void calc_inner(const F &func) {
+        if (covered & region_inner) {
+            return;
         }
-        leds_centr[0] = colors::rgb8out(colors::rgb(func(ledpos()[32])));
-        leds_centr[1] = colors::rgb8out(colors::rgb(func(ledpos()[32])));
+        calc_buffer buf;
+        calc_range(func, leds_rings_n, leds_rings_n + 1, buf);
+        quantize_range(buf, leds_rings_n, leds_rings_n, leds_inner[0], leds_inner[1]);
+        quantize_range(buf, leds_rings_n * 2, 1, &leds_centr[0], &leds_centr[1]);
     }
     
     //
@@ -1525,13 +2128,17 @@ public:
     // RGB BAND
     //
 
-    float rgb_band_r_walk = 0.0f;
-    float rgb_band_g_walk = 0.0f;
-    float rgb_band_b_walk = 0.0f;
+    struct rgb_band_state {
+        Random::Stream rng = Random::instance().NewStream();
+
+        float r_walk = 0.0f;
+        float g_walk = 0.0f;
+        float b_walk = 0.0f;
 
-    float rgb_band_r_walk_step = 2.0f;
-    float rgb_band_g_walk_step = 2.0f;
-    float rgb_band_b_walk_step = 2.0f;
+        float r_walk_step = 2.0f;
+        float g_walk_step = 2.0f;
+        float b_walk_step = 2.0f;
+    };
 
     template<const std::size_t n> void band_mapper(std::array<float, n> &stops, float stt, float end) {
 
@@ -1574,53 +2181,51 @@ public:
     }
 
     void black() {
-        memset(leds_centr, 0, sizeof(leds_centr));
-        memset(leds_outer, 0, sizeof(leds_outer));
-        memset(leds_inner, 0, sizeof(leds_inner));
+        std::fill(&leds_centr[0], &leds_centr[0] + 2, colors::rgb16out());
+        std::fill(&leds_outer[0][0], &leds_outer[0][0] + 2 * leds_rings_n, colors::rgb16out());
+        std::fill(&leds_inner[0][0], &leds_inner[0][0] + 2 * leds_rings_n, colors::rgb16out());
     }
 
     void rgb_band() {
         led_bank::set_bird_color(colors::rgb(Model::instance().BirdColor()));
 
-        static std::mt19937 gen;
-        static std::uniform_real_distribution<float> disf(+0.001f, +0.005f);
-        static std::uniform_int_distribution<int32_t> disi(0, 1);
+        rgb_band_state &s = arena.state<rgb_band_state>();
 
         std::array<float, leds_rings_n> band_r;
         std::array<float, leds_rings_n> band_g;
         std::array<float, leds_rings_n> band_b;
 
-        if (fabsf(rgb_band_r_walk) >= 2.0f) {
-            while (rgb_band_r_walk >= +1.0f) { rgb_band_r_walk -= 1.0f; }
-            while (rgb_band_r_walk <= -1.0f) { rgb_band_r_walk += 1.0f; }
-            rgb_band_r_walk_step = disf(gen) * (disi(gen) ? 1.0f : -1.0f);
+        if (fabsf(s.r_walk) >= 2.0f) {
+            while (s.r_walk >= +1.0f) { s.r_walk -= 1.0f; }
+            while (s.r_walk <= -1.0f) { s.r_walk += 1.0f; }
+            s.r_walk_step = s.rng.Uniform(+0.001f, +0.005f) * s.rng.Sign();
         }
     
-        if (fabsf(rgb_band_g_walk) >= 2.0f) {
-            while (rgb_band_g_walk >= +1.0f) { rgb_band_g_walk -= 1.0f; }
-            while (rgb_band_g_walk <= -1.0f) { rgb_band_g_walk += 1.0f; }
-            rgb_band_g_walk_step = disf(gen) * (disi(gen) ? 1.0f : -1.0f);
+        if (fabsf(s.g_walk) >= 2.0f) {
+            while (s.g_walk >= +1.0f) { s.g_walk -= 1.0f; }
+            while (s.g_walk <= -1.0f) { s.g_walk += 1.0f; }
+            s.g_walk_step = s.rng.Uniform(+0.001f, +0.005f) * s.rng.Sign();
         }
     
-        if (fabsf(rgb_band_b_walk) >= 2.0f) {
-            while (rgb_band_b_walk >= +1.0f) { rgb_band_b_walk -= 1.0f; }
-            while (rgb_band_b_walk <= -1.0f) { rgb_band_b_walk += 1.0f; }
-            rgb_band_b_walk_step = disf(gen) * (disi(gen) ? 1.0f : -1.0f);
+        if (fabsf(s.b_walk) >= 2.0f) {
+            while (s.b_walk >= +1.0f) { s.b_walk -= 1.0f; }
+            while (s.b_walk <= -1.0f) { s.b_walk += 1.0f; }
+            s.b_walk_step = s.rng.Uniform(+0.001f, +0.005f) * s.rng.Sign();
         }
 
-        band_mapper(band_r, rgb_band_r_walk, rgb_band_r_walk + (1.0f / 3.0f));
-        band_mapper(band_g, rgb_band_g_walk, rgb_band_g_walk + (1.0f / 3.0f));
-        band_mapper(band_b, rgb_band_b_walk, rgb_band_b_walk + (1.0f / 3.0f));
+        band_mapper(band_r, s.r_walk, s.r_walk + (1.0f / 3.0f));
+        band_mapper(band_g, s.g_walk, s.g_walk + (1.0f / 3.0f));
+        band_mapper(band_b, s.b_walk, s.b_walk + (1.0f / 3.0f));
 
         for (size_t c = 0; c < leds_rings_n; c++) {
-            colors::rgb8out out = colors::rgb8out(colors::rgb(band_r[c], band_g[c], band_b[c]));        
+            colors::rgb16out out = colors::rgb16out(colors::rgb(band_r[c], band_g[c], band_b[c]));        
             leds_outer[0][c] = out;
             leds_outer[1][leds_rings_n-1-c] = out;
         }
     
-        rgb_band_r_walk -= rgb_band_r_walk_step;
-        rgb_band_g_walk += rgb_band_g_walk_step;
-        rgb_band_b_walk += rgb_band_b_walk_step;
+        s.r_walk -= s.r_walk_step;
+        s.g_walk += s.g_walk_step;
+        s.b_walk += s.b_walk_step;
     }
 
     //
@@ -1630,12 +2235,9 @@ public:
     void color_walker() {
         led_bank::set_bird_color(colors::rgb(Model::instance().BirdColor()));
 
-        double now = Model::instance().Time();
-
-        const double speed = 2.0;
-
-        float rgb_walk = (       static_cast<float>(fmodf(static_cast<float>(now * (1.0 / 5.0) * speed), 1.0)));
-        float val_walk = (1.0f - static_cast<float>(fmodf(static_cast<float>(now               * speed), 1.0)));
+        // Periods of 2.5s and 0.5s
+        float rgb_walk = (       Model::instance().Phase(ticks_per_second * 5 / 2));
+        float val_walk = (1.0f - Model::instance().Phase(ticks_per_second / 2));
 
         colors::hsp col(rgb_walk, 1.0f, 1.0f);
         for (size_t c = 0; c < leds_rings_n; c++) {
@@ -1645,7 +2247,7 @@ public:
             }
             col.p = std::min(1.0f, mod_walk);
 
-            colors::rgb8out out = colors::rgb8out(colors::rgb(col));        
+            colors::rgb16out out = colors::rgb16out(colors::rgb(col));        
 
             leds_outer[0][c] = out;
             leds_outer[1][leds_rings_n-1-c] = out;
@@ -1660,12 +2262,9 @@ public:
     void light_walker() {
         led_bank::set_bird_color(colors::rgb(Model::instance().BirdColor()));
 
-        double now = Model::instance().Time();
-
-        const double speed = 2.0;
-
-        float rgb_walk = (       static_cast<float>(fmodf(static_cast<float>(now * (1.0 / 5.0) * speed), 1.0)));
-        float val_walk = (1.0f - static_cast<float>(fmodf(static_cast<float>(now               * speed), 1.0)));
+        // Periods of 2.5s and 0.5s
+        float rgb_walk = (       Model::instance().Phase(ticks_per_second * 5 / 2));
+        float val_walk = (1.0f - Model::instance().Phase(ticks_per_second / 2));
     
         colors::hsv col(rgb_walk, 1.0f, 1.0f);
         for (size_t c = 0; c < leds_rings_n; c++) {
@@ -1677,7 +2276,7 @@ public:
             col.s = 1.0f - std::min(1.0f, mod_walk);
             col.v = std::min(1.0f, mod_walk);
 
-            colors::rgb8out out = colors::rgb8out(colors::rgb(col));        
+            colors::rgb16out out = colors::rgb16out(colors::rgb(col));        
 
             leds_outer[0][c] = out;
             leds_outer[1][leds_rings_n-1-c] = out;
@@ -1691,14 +2290,11 @@ public:
     void rgb_glow() {
         led_bank::set_bird_color(colors::rgb(Model::instance().BirdColor()));
 
-        double now = Model::instance().Time();
-
-        const double speed = 0.5;
-
-        float rgb_walk = (static_cast<float>(fmodf(static_cast<float>(now * (1.0 / 5.0) * speed), 1.0)));
+        // Period of 10s
+        float rgb_walk = (Model::instance().Phase(ticks_per_second * 10));
     
         colors::hsv col(rgb_walk, 1.0f, 1.0f);
-        colors::rgb8out out = colors::rgb8out(colors::rgb(col));        
+        colors::rgb16out out = colors::rgb16out(colors::rgb(col));        
         for (size_t c = 0; c < leds_rings_n; c++) {
             leds_outer[0][c] = out;
             leds_outer[1][c] = out;
@@ -1709,17 +2305,24 @@ public:
     // LIGHTNING
     //
 
+    // Effects that only need their own random numbers
+    struct random_state {
+        Random::Stream rng = Random::instance().NewStream();
+    };
+
     void lightning() {
         led_bank::set_bird_color(colors::rgb(Model::instance().BirdColor()));
 
-        colors::rgb8out black = colors::rgb8out(colors::rgb(0.0f,0.0f,0.0f));       
+        Random::Stream &rng = arena.state<random_state>().rng;
+
+        colors::rgb16out black = colors::rgb16out(colors::rgb(0.0f,0.0f,0.0f));       
         for (size_t c = 0; c < leds_rings_n; c++) {
             leds_outer[0][c] = black;
             leds_outer[1][c] = black;
         }
 
-        size_t index = static_cast<size_t>(random.get(static_cast<int32_t>(0),static_cast<int32_t>(16*2 * 16)));
-        colors::rgb8out white = colors::rgb8out(colors::rgb(1.0f,1.0f,1.0f));       
+        size_t index = rng.Bounded(16*2 * 16);
+        colors::rgb16out white = colors::rgb16out(colors::rgb(1.0f,1.0f,1.0f));       
         if (index < 16) {
             leds_outer[0][index] = white;
         } else if (index < 32) {
@@ -1734,14 +2337,16 @@ public:
     void lightning_crazy() {
         led_bank::set_bird_color(colors::rgb(Model::instance().BirdColor()));
 
-        colors::rgb8out black = colors::rgb8out(colors::rgb(0.0f,0.0f,0.0f));       
+        Random::Stream &rng = arena.state<random_state>().rng;
+
+        colors::rgb16out black = colors::rgb16out(colors::rgb(0.0f,0.0f,0.0f));       
         for (size_t c = 0; c < leds_rings_n; c++) {
             leds_outer[0][c] = black;
             leds_outer[1][c] = black;
         }
 
-        size_t index = static_cast<size_t>(random.get(static_cast<int32_t>(0),static_cast<int32_t>(leds_rings_n*2)));
-        colors::rgb8out white = colors::rgb8out(colors::rgb(1.0f,1.0f,1.0f));       
+        size_t index = rng.Bounded(leds_rings_n*2);
+        colors::rgb16out white = colors::rgb16out(colors::rgb(1.0f,1.0f,1.0f));       
         if (index < leds_rings_n) {
             leds_outer[0][index] = white;
         } else if (index < leds_rings_n*2) {
@@ -1756,17 +2361,19 @@ public:
     void sparkle() {
         led_bank::set_bird_color(colors::rgb(Model::instance().BirdColor()));
 
-        colors::rgb8out black = colors::rgb8out(colors::rgb(0.0f,0.0f,0.0f));       
+        Random::Stream &rng = arena.state<random_state>().rng;
+
+        colors::rgb16out black = colors::rgb16out(colors::rgb(0.0f,0.0f,0.0f));       
         for (size_t c = 0; c < leds_rings_n; c++) {
             leds_outer[0][c] = black;
             leds_outer[1][c] = black;
         }
 
-        size_t index = static_cast<size_t>(random.get(static_cast<int32_t>(0),static_cast<int32_t>(leds_rings_n*2)));
-        colors::rgb8out col = colors::rgb8out(colors::rgb(
-            random.get(0.0f,1.0f),
-            random.get(0.0f,1.0f),
-            random.get(0.0f,1.0f)));        
+        size_t index = rng.Bounded(leds_rings_n*2);
+        colors::rgb16out col = colors::rgb16out(colors::rgb(
+            rng.Uniform(0.0f,1.0f),
+            rng.Uniform(0.0f,1.0f),
+            rng.Uniform(0.0f,1.0f)));        
         if (index < leds_rings_n) {
             leds_outer[0][index] = col;
         } else if (index < leds_rings_n*2) {
@@ -1781,11 +2388,13 @@ public:
     void rando() {
         led_bank::set_bird_color(colors::rgb(Model::instance().BirdColor()));
 
+        Random::Stream &rng = arena.state<random_state>().rng;
+
         for (size_t c = 0; c < leds_rings_n; c++) {
-            colors::rgb8out col = colors::rgb8out(colors::rgb(
-                random.get(0.0f,1.0f),
-                random.get(0.0f,1.0f),
-                random.get(0.0f,1.0f)));        
+            colors::rgb16out col = colors::rgb16out(colors::rgb(
+                rng.Uniform(0.0f,1.0f),
+                rng.Uniform(0.0f,1.0f),
+                rng.Uniform(0.0f,1.0f)));        
             leds_outer[0][c] = col;
             leds_outer[1][c] = col;
         }
@@ -1798,11 +2407,14 @@ public:
     void red_green() {
         led_bank::set_bird_color(colors::rgb(Model::instance().BirdColor()));
 
-        float now = static_cast<float>(Model::instance().Time());
+        float now = Model::instance().FrameTime();
+
+        float sx = fastmath::sin(now);
+        float sy = fastmath::cos(now);
 
         calc_outer([=](geom::float4 pos) {
-            pos.x *= sinf(now);
-            pos.y *= cosf(now);
+            pos.x *= sx;
+            pos.y *= sy;
             return pos;
         });
     }
@@ -1811,34 +2423,40 @@ public:
     // BRILLIANCE
     //
 
+    // A highlight sweeping in a random direction, also used by HIGHLIGHT
+    struct sweep_state {
+        Random::Stream rng = Random::instance().NewStream();
+        float next = -1.0f;
+        float dir = 0.0f;
+    };
+
     void brilliance() {
         led_bank::set_bird_color(colors::rgb(Model::instance().BirdColor()));
 
-        float now = static_cast<float>(Model::instance().Time());
+        float now = Model::instance().FrameTime();
 
-        static float next = -1.0f;
-        static float dir = 0.0f;
+        sweep_state &s = arena.state<sweep_state>();
         
-        if ((next - now) < 0.0f || next < 0.0f) {
-            next = now + random.get(2.0f, 20.0f);
-            dir = random.get(0.0f, 3.141f * 2.0f);
-        }
+        if ((s.next - now) < 0.0f || s.next < 0.0f) {
+            s.next = now + s.rng.Uniform(2.0f, 20.0f);
+            s.dir = s.rng.Uniform(0.0f, 3.141f * 2.0f);
+        }
+        float next = s.next;
+
+        uint32_t ring_hex = Model::instance().RingColor().hex();
+        const colors::gradient_stop bwg[] = {
+            { ring_hex, 0.00f },
+            { ring_hex, 0.14f },
+            { 0xffffff, 0.21f },
+            { ring_hex, 0.28f },
+            { ring_hex, 1.00f }
+        };
+        colors::gradient bw(colors::gradient_cache::instance().get(bwg));
 
-        static colors::gradient bw;
-        static colors::rgb8 col;
-        if (bw.check_init() || col != Model::instance().RingColor()) {
-            col = Model::instance().RingColor();
-            const geom::float4 bwg[] = {
-                geom::float4(Model::instance().RingColor().hex(), 0.00f),
-                geom::float4(Model::instance().RingColor().hex(), 0.14f),
-                geom::float4(0xffffff, 0.21f),
-                geom::float4(Model::instance().RingColor().hex(), 0.28f),
-                geom::float4(Model::instance().RingColor().hex(), 1.00f)};
-            bw.init(bwg,5);
-        }
+        geom::rotation2d rotation(s.dir);
 
         calc_outer([=](geom::float4 pos) {
-            pos = pos.rotate2d(dir);
+            pos = pos.rotate2d(rotation);
             pos *= 0.50f;
             pos += (next - now) * 8.0f;
             pos *= 0.05f;
@@ -1853,31 +2471,30 @@ public:
     void highlight() {
         led_bank::set_bird_color(colors::rgb(Model::instance().BirdColor()));
 
-        float now = static_cast<float>(Model::instance().Time());
+        float now = Model::instance().FrameTime();
 
-        static float next = -1.0f;
-        static float dir = 0.0f;
+        sweep_state &s = arena.state<sweep_state>();
         
-        if ((next - now) < 0.0f || next < 0.0f) {
-            next = now + random.get(2.0f, 10.0f);
-            dir = random.get(0.0f, 3.141f * 2.0f);
-        }
+        if ((s.next - now) < 0.0f || s.next < 0.0f) {
+            s.next = now + s.rng.Uniform(2.0f, 10.0f);
+            s.dir = s.rng.Uniform(0.0f, 3.141f * 2.0f);
+        }
+        float next = s.next;
+
+        uint32_t ring_hex = Model::instance().RingColor().hex();
+        const colors::gradient_stop bwg[] = {
+            { ring_hex, 0.00f },
+            { ring_hex, 0.40f },
+            { 0xffffff, 0.50f },
+            { ring_hex, 0.60f },
+            { ring_hex, 1.00f }
+        };
+        colors::gradient bw(colors::gradient_cache::instance().get(bwg));
 
-        static colors::gradient bw;
-        static colors::rgb8 col;
-        if (bw.check_init() || col != Model::instance().RingColor()) {
-            col = Model::instance().RingColor();
-            const geom::float4 bwg[] = {
-                geom::float4(Model::instance().RingColor().hex(), 0.00f),
-                geom::float4(Model::instance().RingColor().hex(), 0.40f),
-                geom::float4(0xffffff, 0.50f),
-                geom::float4(Model::instance().RingColor().hex(), 0.60f),
-                geom::float4(Model::instance().RingColor().hex(), 1.00f)};
-            bw.init(bwg,5);
-        }
+        geom::rotation2d rotation(s.dir);
 
         calc_outer([=](geom::float4 pos) {
-            pos = pos.rotate2d(dir);
+            pos = pos.rotate2d(rotation);
             pos *= 0.50f;
             pos += (next - now);
             pos *= 0.50f;
@@ -1892,23 +2509,24 @@ public:
     void autumn() {
         led_bank::set_bird_color(colors::rgb(Model::instance().BirdColor()));
 
-        float now = static_cast<float>(Model::instance().Time());
+        float now = Model::instance().FrameTime();
 
-        static colors::gradient g;
-        if (g.check_init()) {
-            const geom::float4 gg[] = {
-               geom::float4(0x968b3f, 0.00f),
-               geom::float4(0x097916, 0.20f),
-               geom::float4(0x00d4ff, 0.40f),
-               geom::float4(0xffffff, 0.50f),
-               geom::float4(0x8a0e45, 0.80f),
-               geom::float4(0x968b3f, 1.00f)};
-            g.init(gg,6);
-        }
+        static constexpr colors::gradient_stop gg[] = {
+            { 0x968b3f, 0.00f },
+            { 0x097916, 0.20f },
+            { 0x00d4ff, 0.40f },
+            { 0xffffff, 0.50f },
+            { 0x8a0e45, 0.80f },
+            { 0x968b3f, 1.00f }
+        };
+        static constexpr colors::gradient_table g_table(gg);
+        colors::gradient g(g_table);
+
+        geom::rotation2d rotation(now);
 
         calc_outer([=](geom::float4 pos) {
             pos += 0.5f;
-            pos = pos.rotate2d(now);
+            pos = pos.rotate2d(rotation);
             pos *= 0.5f;
             pos += 1.0f;
             return g.repeat(pos.x);
@@ -1922,17 +2540,14 @@ public:
     void heartbeat() {
         led_bank::set_bird_color(colors::rgb(Model::instance().BirdColor()));
 
-        float now = static_cast<float>(Model::instance().Time());
+        float now = Model::instance().FrameTime();
         
-        static colors::gradient g;
-        static colors::rgb8 col;
-        if (g.check_init() || col != Model::instance().RingColor()) {
-            col = Model::instance().RingColor();
-            const geom::float4 gg[] = {
-               geom::float4(0x000000, 0.00f),
-               geom::float4(Model::instance().RingColor().hex(), 1.00)};
-            g.init(gg,2);
-        }
+        uint32_t ring_hex = Model::instance().RingColor().hex();
+        const colors::gradient_stop gg[] = {
+            { 0x000000, 0.00f },
+            { ring_hex, 1.00f }
+        };
+        colors::gradient g(colors::gradient_cache::instance().get(gg));
 
         calc_outer([=](geom::float4) {
             return g.reflect(now);
@@ -1946,10 +2561,12 @@ public:
     void moving_rainbow() {
         led_bank::set_bird_color(colors::rgb(Model::instance().BirdColor()));
 
-        float now = static_cast<float>(Model::instance().Time());
+        float now = Model::instance().FrameTime();
+
+        geom::rotation2d rotation(-now * 0.25f);
 
         calc_outer([=](geom::float4 pos) {
-            pos = pos.rotate2d(-now * 0.25f);
+            pos = pos.rotate2d(rotation);
             pos += now;
             pos *= 0.25f;
             pos = pos.reflect();
@@ -1961,39 +2578,43 @@ public:
     // TWINKLE
     //
 
+    // LEDs lit at random until their next time, also used by TWINKLY
+    struct twinkle_state {
+        static constexpr size_t many = 8;
+        Random::Stream rng = Random::instance().NewStream();
+        float next[many] = { -1.0f, -1.0f, -1.0f, -1.0f, -1.0f, -1.0f, -1.0f, -1.0f };
+        size_t which[many] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+    };
+
     void twinkle() {
         led_bank::set_bird_color(colors::rgb(Model::instance().BirdColor()));
 
-        float now = static_cast<float>(Model::instance().Time());
+        float now = Model::instance().FrameTime();
 
-        static constexpr size_t many = 8;
-        static float next[many] = { -1.0f, -1.0f, -1.0f, -1.0f, -1.0f, -1.0f, -1.0f, -1.0f };
-        static size_t which[many] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+        static constexpr size_t many = twinkle_state::many;
+        twinkle_state &s = arena.state<twinkle_state>();
         
         for (size_t c = 0; c < many; c++) {
-            if ((next[c] - now) < 0.0f || next[c] < 0.0f) {
-                next[c] = now + random.get(0.5f, 4.0f);
-                which[c] = static_cast<size_t>(random.get(static_cast<int32_t>(0), leds_rings_n));
+            if ((s.next[c] - now) < 0.0f || s.next[c] < 0.0f) {
+                s.next[c] = now + s.rng.Uniform(0.5f, 4.0f);
+                s.which[c] = s.rng.Bounded(leds_rings_n);
             }
         }
 
-        static colors::gradient g;
-        static colors::rgb8 col;
-        if (g.check_init() || col != Model::instance().RingColor()) {
-            col = Model::instance().RingColor();
-            const geom::float4 gg[] = {
-               geom::float4(0x000000, 0.00f),
-               geom::float4(Model::instance().RingColor().hex(), 0.25f),
-               geom::float4(0xFFFFFF, 0.50f),
-               geom::float4(Model::instance().RingColor().hex(), 0.75f),
-               geom::float4(0x000000, 1.00f)};
-            g.init(gg,5);
-        }
+        uint32_t ring_hex = Model::instance().RingColor().hex();
+        const colors::gradient_stop gg[] = {
+            { 0x000000, 0.00f },
+            { ring_hex, 0.25f },
+            { 0xFFFFFF, 0.50f },
+            { ring_hex, 0.75f },
+            { 0x000000, 1.00f }
+        };
+        colors::gradient g(colors::gradient_cache::instance().get(gg));
         
-        calc_outer([=](geom::float4, size_t index) {
+        calc_outer([=, &s](geom::float4, size_t index) {
             for (size_t c = 0; c < many; c++) {
-                if (which[c] == index) {
-                    return g.clamp(next[c] - now).pow(0.5);
+                if (s.which[c] == index) {
+                    return g.clamp(s.next[c] - now).pow(0.5);
                 }
             }
             return geom::float4();
@@ -2008,36 +2629,32 @@ public:
     void twinkly() {
         led_bank::set_bird_color(colors::rgb(Model::instance().BirdColor()));
 
-        float now = static_cast<float>(Model::instance().Time());
+        float now = Model::instance().FrameTime();
 
-        static constexpr size_t many = 8;
-        static float next[many] = { -1.0f, -1.0f, -1.0f, -1.0f, -1.0f, -1.0f, -1.0f, -1.0f };
-        static size_t which[many] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+        static constexpr size_t many = twinkle_state::many;
+        twinkle_state &s = arena.state<twinkle_state>();
         
         for (size_t c = 0; c < many; c++) {
-            if ((next[c] - now) < 0.0f || next[c] < 0.0f) {
-                next[c] = now + random.get(0.5f, 4.0f);
-                which[c] = static_cast<size_t>(random.get(static_cast<int32_t>(0), leds_rings_n));
+            if ((s.next[c] - now) < 0.0f || s.next[c] < 0.0f) {
+                s.next[c] = now + s.rng.Uniform(0.5f, 4.0f);
+                s.which[c] = s.rng.Bounded(leds_rings_n);
             }
         }
 
-        static colors::gradient g;
-        static colors::rgb8 col;
-        if (g.check_init() || col != Model::instance().RingColor()) {
-            col = Model::instance().RingColor();
-            const geom::float4 gg[] = {
-               geom::float4(0x000000, 0.00f),
-               geom::float4(0xFFFFFF, 0.80f),
-               geom::float4(0x000000, 1.00f)};
-            g.init(gg,3);
-        }
+        static constexpr colors::gradient_stop gg[] = {
+            { 0x000000, 0.00f },
+            { 0xFFFFFF, 0.80f },
+            { 0x000000, 1.00f }
+        };
+        static constexpr colors::gradient_table g_table(gg);
+        colors::gradient g(g_table);
         
         colors::rgb ring(Model::instance().RingColor());
         
-        calc_outer([=](geom::float4, size_t index) {
+        calc_outer([=, &s](geom::float4, size_t index) {
             for (size_t c = 0; c < many; c++) {
-                if (which[c] == index) {
-                    return g.clamp(next[c] - now) + geom::float4(ring);
+                if (s.which[c] == index) {
+                    return g.clamp(s.next[c] - now) + geom::float4(ring);
                 }
             }
             return geom::float4(ring);
@@ -2048,28 +2665,38 @@ public:
     // RANDOMFADER
     //
 
+    struct randomfader_state {
+        Random::Stream rng = Random::instance().NewStream();
+        float next = -1.0f;
+        size_t which = 0;
+        colors::rgb color;
+        colors::rgb prev_color;
+    };
+
     void randomfader() {
         led_bank::set_bird_color(colors::rgb(Model::instance().BirdColor()));
 
-        float now = static_cast<float>(Model::instance().Time());
+        float now = Model::instance().FrameTime();
 
-        static float next = -1.0f;
-        static size_t which = 0;
-        static colors::rgb color;
-        static colors::rgb prev_color;
+        randomfader_state &s = arena.state<randomfader_state>();
         
-        if ((next - now) < 0.0f || next < 0.0f) {
-            next = now + 2.0f;
-            which = static_cast<size_t>(random.get(static_cast<int32_t>(0), leds_rings_n));
-            prev_color = color;
-            color = colors::rgb(
-                random.get(0.0f,1.0f),
-                random.get(0.0f,1.0f),
-                random.get(0.0f,1.0f));
+        if ((s.next - now) < 0.0f || s.next < 0.0f) {
+            s.next = now + 2.0f;
+            s.which = s.rng.Bounded(leds_rings_n);
+            s.prev_color = s.color;
+            s.color = colors::rgb(
+                s.rng.Uniform(0.0f,1.0f),
+                s.rng.Uniform(0.0f,1.0f),
+                s.rng.Uniform(0.0f,1.0f));
         }
 
+        float next = s.next;
+        size_t which = s.which;
+        geom::float4 color(s.color);
+        geom::float4 prev_color(s.prev_color);
+
         calc_outer([=](geom::float4 pos) {
-            float dist = pos.dist(ledpos()[which]) * (next - now);
+            float dist = pos.dist(leds_geometry[which].pos) * (next - now);
             if (dist > 1.0f) dist = 1.0f;
             return geom::float4::lerp(color, prev_color, dist);
         });
@@ -2082,12 +2709,14 @@ public:
     void chaser() {
         led_bank::set_bird_color(colors::rgb(Model::instance().BirdColor()));
 
-        float now = static_cast<float>(Model::instance().Time());
+        float now = Model::instance().FrameTime();
         
         colors::rgb ring(Model::instance().RingColor());
 
+        geom::rotation2d rotation(now);
+
         calc_outer([=](geom::float4 pos) {
-            pos = pos.rotate2d(now);
+            pos = pos.rotate2d(rotation);
             return ring * pos.x;
         });
     }
@@ -2099,21 +2728,20 @@ public:
     void brightchaser() {
         led_bank::set_bird_color(colors::rgb(Model::instance().BirdColor()));
 
-        float now = static_cast<float>(Model::instance().Time());
+        float now = Model::instance().FrameTime();
 
-        static colors::gradient g;
-        static colors::rgb8 col;
-        if (g.check_init() || col != Model::instance().RingColor()) {
-            col = Model::instance().RingColor();
-            const geom::float4 gg[] = {
-               geom::float4(0x000000, 0.00f),
-               geom::float4(Model::instance().RingColor().hex(), 0.50f),
-               geom::float4(0xFFFFFF, 1.00f)};
-            g.init(gg,3);
-        }
+        uint32_t ring_hex = Model::instance().RingColor().hex();
+        const colors::gradient_stop gg[] = {
+            { 0x000000, 0.00f },
+            { ring_hex, 0.50f },
+            { 0xFFFFFF, 1.00f }
+        };
+        colors::gradient g(colors::gradient_cache::instance().get(gg));
+
+        geom::rotation2d rotation(now);
 
         calc_outer([=](geom::float4 pos) {
-            pos = pos.rotate2d(now);
+            pos = pos.rotate2d(rotation);
             return g.clamp(pos.x).pow(0.5);
         });
     }
@@ -2133,28 +2761,24 @@ public:
     }
 
     void overdrive() {
-        float now = static_cast<float>(Model::instance().Time());
-
-        static colors::gradient g;
-        static colors::rgb8 col;
-        if (g.check_init() || col != Model::instance().RingColor()) {
-            col = Model::instance().RingColor();
-            const geom::float4 gg[] = {
-               geom::float4(0x000000, 0.00f),
-               geom::float4(Model::instance().RingColor().hex(), 1.0f)
-            };
-            g.init(gg,2);
-        }
+        float now = Model::instance().FrameTime();
+
+        uint32_t ring_hex = Model::instance().RingColor().hex();
+        const colors::gradient_stop gg[] = {
+            { 0x000000, 0.00f },
+            { ring_hex, 1.0f }
+        };
+        colors::gradient g(colors::gradient_cache::instance().get(gg));
 
         calc_inner([=](geom::float4 pos) {
-        	float x = sinf(pos.x + 1.0f + now * 1.77f);
-        	float y = cosf(pos.y + 1.0f + now * 2.01f);
+        	float x = fastmath::sin(pos.x + 1.0f + now * 1.77f);
+        	float y = fastmath::cos(pos.y + 1.0f + now * 2.01f);
             return (g.reflect(x * y) * 8.0f).clamp();
         });
 
         calc_outer([=](geom::float4 pos) {
-        	float x = sinf(pos.x + 1.0f + now * 1.77f);
-        	float y = cosf(pos.y + 1.0f + now * 2.01f);
+        	float x = fastmath::sin(pos.x + 1.0f + now * 1.77f);
+        	float y = fastmath::cos(pos.y + 1.0f + now * 2.01f);
             return (g.reflect(x * y) * 8.0f).clamp();
         });
     }
@@ -2162,49 +2786,43 @@ public:
     void ironman() {
         led_bank::set_bird_color(colors::rgb(Model::instance().BirdColor()));
 
-        float now = static_cast<float>(Model::instance().Time());
+        float now = Model::instance().FrameTime();
 
-        static colors::gradient g;
-        static colors::rgb8 col;
-        if (g.check_init() || col != Model::instance().RingColor()) {
-            col = Model::instance().RingColor();
-            const geom::float4 gg[] = {
-               geom::float4(0xffffff, 0.00f),
-               geom::float4(Model::instance().RingColor().hex(), 0.10f),
-               geom::float4(0x000000, 1.00f),
-            };
-            g.init(gg,3);
-        }
+        uint32_t ring_hex = Model::instance().RingColor().hex();
+        const colors::gradient_stop gg[] = {
+            { 0xffffff, 0.00f },
+            { ring_hex, 0.10f },
+            { 0x000000, 1.00f }
+        };
+        colors::gradient g(colors::gradient_cache::instance().get(gg));
 
-        calc_inner([=](geom::float4 pos) {
-        	float len = pos.len();
-        	return g.clamp(1.0f-((len!=0.0f)?1.0f/len:1000.0f)*(fabsf(sinf(now)))).pow(0.5);
+        float pulse = fabsf(fastmath::sin(now));
+
+        calc_inner([=](const led_geometry &led) {
+        	return g.clamp(1.0f-((led.radius!=0.0f)?1.0f/led.radius:1000.0f)*pulse).pow(0.5);
         });
 
-        calc_outer([=](geom::float4 pos) {
-        	float len = pos.len();
-        	return g.clamp(1.0f-((len!=0.0f)?1.0f/len:1000.0f)*(fabsf(sinf(now)))).pow(0.5);
+        calc_outer([=](const led_geometry &led) {
+        	return g.clamp(1.0f-((led.radius!=0.0f)?1.0f/led.radius:1000.0f)*pulse).pow(0.5);
         });
     }
 
     void sweep() {
         led_bank::set_bird_color(colors::rgb(Model::instance().BirdColor()));
 
-        float now = static_cast<float>(Model::instance().Time());
+        float now = Model::instance().FrameTime();
 
-        static colors::gradient g;
-        static colors::rgb8 col;
-        if (g.check_init() || col != Model::instance().RingColor()) {
-            col = Model::instance().RingColor();
-            const geom::float4 gg[] = {
-               geom::float4(0x000000, 0.00f),
-               geom::float4(Model::instance().RingColor().hex(), 1.0f),
-            };
-            g.init(gg,2);
-        }
+        uint32_t ring_hex = Model::instance().RingColor().hex();
+        const colors::gradient_stop gg[] = {
+            { 0x000000, 0.00f },
+            { ring_hex, 1.0f }
+        };
+        colors::gradient g(colors::gradient_cache::instance().get(gg));
+
+        geom::rotation2d rotation(-now * 0.5f);
 
         calc_outer([=](geom::float4 pos) {
-        	pos = pos.rotate2d(-now * 0.5f);
+        	pos = pos.rotate2d(rotation);
             return g.reflect(pos.y - now * 8.0f);
         });
     }
@@ -2212,22 +2830,20 @@ public:
     void sweephighlight() {
         led_bank::set_bird_color(colors::rgb(Model::instance().BirdColor()));
 
-        float now = static_cast<float>(Model::instance().Time());
+        float now = Model::instance().FrameTime();
 
-        static colors::gradient g;
-        static colors::rgb8 col;
-        if (g.check_init() || col != Model::instance().RingColor()) {
-            col = Model::instance().RingColor();
-            const geom::float4 gg[] = {
-               geom::float4(0x000000, 0.00f),
-               geom::float4(Model::instance().RingColor().hex(), 0.7f),
-               geom::float4(0xffffff, 1.00f),
-            };
-            g.init(gg,3);
-        }
+        uint32_t ring_hex = Model::instance().RingColor().hex();
+        const colors::gradient_stop gg[] = {
+            { 0x000000, 0.00f },
+            { ring_hex, 0.7f },
+            { 0xffffff, 1.00f }
+        };
+        colors::gradient g(colors::gradient_cache::instance().get(gg));
+
+        geom::rotation2d rotation(-now * 0.25f);
 
         calc_outer([=](geom::float4 pos) {
-        	pos = pos.rotate2d(-now * 0.25f);
+        	pos = pos.rotate2d(rotation);
             return g.reflect(pos.y - now * 2.0f);
         });
     }
@@ -2235,109 +2851,103 @@ public:
     void rainbow_circle() {
         led_bank::set_bird_color(colors::rgb(Model::instance().BirdColor()));
 
-        float now = static_cast<float>(Model::instance().Time());
+        float now = Model::instance().FrameTime();
 
-        calc_outer([=](geom::float4 pos) {
-            return geom::float4(colors::rgb(colors::hsv(fmodf((atan2f(pos.x, pos.y) + 3.14159f) / (3.14159f * 2.0f) + now * 0.5f, 1.0f), 1.0f, 1.0f)));
+        calc_outer([=](const led_geometry &led) {
+            return geom::float4(colors::rgb(colors::hsv(fastmath::fract(led.angle + now * 0.5f), 1.0f, 1.0f)));
         }); 
     }
 
     void rainbow_grow() {
         led_bank::set_bird_color(colors::rgb(Model::instance().BirdColor()));
 
-        float now = static_cast<float>(Model::instance().Time());
+        float now = Model::instance().FrameTime();
 
         calc_outer([=](geom::float4 pos) {
-            return geom::float4(colors::rgb(colors::hsv(fmodf(fabsf(pos.x * 0.25f + signf(pos.x) * now * 0.25f), 1.0f), 1.0f, 1.0f)));
+            return geom::float4(colors::rgb(colors::hsv(fastmath::fract(fabsf(pos.x * 0.25f + signf(pos.x) * now * 0.25f)), 1.0f, 1.0f)));
         });
     }
 
     void rotor() {
         led_bank::set_bird_color(colors::rgb(Model::instance().BirdColor()));
 
-        float now = static_cast<float>(Model::instance().Time());
+        float now = Model::instance().FrameTime();
 
-        static colors::gradient g;
-        static colors::rgb8 col;
-        if (g.check_init() || col != Model::instance().RingColor()) {
-            col = Model::instance().RingColor();
-            const geom::float4 gg[] = {
-               geom::float4(Model::instance().RingColor().hex(), 0.00f),
-               geom::float4(0xffffff, 0.50f),
-               geom::float4(Model::instance().RingColor().hex(), 1.00f)
-            };
-            g.init(gg,3);
-        }
+        uint32_t ring_hex = Model::instance().RingColor().hex();
+        const colors::gradient_stop gg[] = {
+            { ring_hex, 0.00f },
+            { 0xffffff, 0.50f },
+            { ring_hex, 1.00f }
+        };
+        colors::gradient g(colors::gradient_cache::instance().get(gg));
 
-        calc_outer([=](geom::float4 pos) {
-        	return g.repeat(fmodf((atan2f(pos.x, pos.y) + 3.14159f) / (3.14159f * 2.0f) + now * 0.5f, 1.0f) * 4.0f);
+        calc_outer([=](const led_geometry &led) {
+        	return g.repeat(fastmath::fract(led.angle + now * 0.5f) * 4.0f);
         }); 
     }
 
     void rotor_sparse() {
         led_bank::set_bird_color(colors::rgb(Model::instance().BirdColor()));
 
-        float now = static_cast<float>(Model::instance().Time());
-
-        static colors::gradient g;
-        static colors::rgb8 col;
-        if (g.check_init() || col != Model::instance().RingColor()) {
-            col = Model::instance().RingColor();
-            const geom::float4 gg[] = {
-               geom::float4(0x000000, 0.00f),
-               geom::float4(Model::instance().RingColor().hex(), 0.40f),
-               geom::float4(Model::instance().RingColor().hex(), 0.60f),
-               geom::float4(0x000000, 1.00f)
-            };
-            g.init(gg,5);
-        }
+        float now = Model::instance().FrameTime();
 
-        calc_outer([=](geom::float4 pos) {
-        	return g.repeat(fmodf((atan2f(pos.x, pos.y) + 3.14159f) / (3.14159f * 2.0f) + now * 0.5f, 1.0f) * 3.0f);
+        uint32_t ring_hex = Model::instance().RingColor().hex();
+        const colors::gradient_stop gg[] = {
+            { 0x000000, 0.00f },
+            { ring_hex, 0.40f },
+            { ring_hex, 0.60f },
+            { 0x000000, 1.00f }
+        };
+        colors::gradient g(colors::gradient_cache::instance().get(gg));
+
+        calc_outer([=](const led_geometry &led) {
+        	return g.repeat(fastmath::fract(led.angle + now * 0.5f) * 3.0f);
         }); 
     }
 
     void fullcolor() {
         led_bank::set_bird_color(colors::rgb(Model::instance().BirdColor()));
 
-        float now = static_cast<float>(Model::instance().Time());
+        float now = Model::instance().FrameTime();
 
-        static colors::gradient g;
-        static colors::rgb8 col;
-        if (g.check_init() || col != Model::instance().RingColor()) {
-            col = Model::instance().RingColor();
-            const geom::float4 gg[] = {
-               geom::float4(0x000000, 0.00f),
-               geom::float4(0xFFFFFF, 0.50f),
-               geom::float4(0x000000, 1.00f)
-            };
-            g.init(gg,3);
-        }
+        static constexpr colors::gradient_stop gg[] = {
+            { 0x000000, 0.00f },
+            { 0xFFFFFF, 0.50f },
+            { 0x000000, 1.00f }
+        };
+        static constexpr colors::gradient_table g_table(gg);
+        colors::gradient g(g_table);
 
-        calc_outer([=](geom::float4 pos) {
+        calc_outer([=](const led_geometry &led) {
         	return geom::float4(
-	        	g.repeat(fmodf((atan2f(pos.x, pos.y) + 3.14159f) / (3.14159f * 2.0f) + now * 0.50f, 1.0f)).x,
-	        	g.repeat(fmodf((atan2f(pos.x, pos.y) + 3.14159f) / (3.14159f * 2.0f) + now * 0.75f, 1.0f)).x,
-	        	g.repeat(fmodf((atan2f(pos.x, pos.y) + 3.14159f) / (3.14159f * 2.0f) + now * 0.33f, 1.0f)).x
+	        	g.repeat(fastmath::fract(led.angle + now * 0.50f)).x,
+	        	g.repeat(fastmath::fract(led.angle + now * 0.75f)).x,
+	        	g.repeat(fastmath::fract(led.angle + now * 0.33f)).x
 	        );
         }); 
     }
 
     void flip_colors() {
-        float now = static_cast<float>(Model::instance().Time());
+        float now = Model::instance().FrameTime();
         
         geom::float4 bird(colors::rgb(Model::instance().BirdColor()));
         geom::float4 ring(colors::rgb(Model::instance().RingColor()));
 
+        float blend = (fastmath::sin(now) + 1.0f) * 0.5f;
+
         calc_inner([=](geom::float4) {
-        	return geom::float4::lerp(bird, ring, (sinf(now) + 1.0f) * 0.5f);
+        	return geom::float4::lerp(bird, ring, blend);
         });
 
         calc_outer([=](geom::float4) {
-        	return geom::float4::lerp(ring, bird, (sinf(now) + 1.0f) * 0.5f);
+        	return geom::float4::lerp(ring, bird, blend);
         });
     }
 
+    // One slot for the current effect, one for the effect it crossfades from
+    effect_arena<std::max({ sizeof(rgb_band_state), sizeof(random_state), sizeof(sweep_state), sizeof(twinkle_state), sizeof(randomfader_state) }),
+                 std::max({ alignof(rgb_band_state), alignof(random_state), alignof(sweep_state), alignof(twinkle_state), alignof(randomfader_state) })> arena;
+
     //
     // BURN TEST
     //
@@ -2345,15 +2955,11 @@ public:
     float burn_test_flip = 1.0f;
 
     void burn_test() {
-
-        static std::mt19937 gen;
-        static std::uniform_real_distribution<float> disf(+1.0f, -1.0f);
-        
         for (size_t c = 0; c < leds_rings_n; c++) {
 
             burn_test_flip *= -1.0f;
 
-            colors::rgb8out out = colors::rgb8out(colors::rgb(1.0f, 1.0f, 1.0f) * burn_test_flip );
+            colors::rgb16out out = colors::rgb16out(colors::rgb(1.0f, 1.0f, 1.0f) * burn_test_flip );
 
             leds_outer[0][c] = out;
             leds_outer[1][c] = out;
@@ -2364,7 +2970,7 @@ public:
     }
 
 	void flashlight(colors::rgb8 color) {
-        colors::rgb8out out = colors::rgb8out(color.r, color.g, color.b);
+        colors::rgb16out out = colors::rgb16out(static_cast<uint16_t>(color.r * 257), static_cast<uint16_t>(color.g * 257), static_cast<uint16_t>(color.b * 257));
         for (size_t c = 0; c < leds_rings_n; c++) {
 			leds_inner[0][c] = out;
 			leds_inner[1][c] = out;
@@ -2375,39 +2981,29 @@ public:
         leds_centr[1] = out;
 	}
 
+    // Weight of an overlay: fading in over its first quarter second, out
+    // over its last, opaque in between
+    static uint32_t overlay_weight(Timeline::Span &span) {
+        float blend = 0.0f;
+        if (span.InBeginPeriod(blend)) {
+            return colors::weight(blend);
+        } else if (span.InEndPeriod(blend)) {
+            return colors::weight(1.0f - blend);
+        }
+        return colors::weight_one;
+    }
+
     //
     // BIRD COLOR MODIFIER
     //
 
     void bird_color(colors::rgb8 color, Timeline::Span &span, Timeline::Span &below) {
-        float blend = 0.0f;
+        uint32_t weight = overlay_weight(span);
 
-        // Continue to run effect below
-        below.Calc();
+        // Continue to run effect below, on the outer ring only once opaque
+        calc_below(below, weight == colors::weight_one ? region_inner : 0);
 
-        if (span.InBeginPeriod(blend, 0.25f)) {
-        } else if (span.InEndPeriod(blend, 0.25f)) {
-            blend = 1.0f - blend;
-        }
-        
-        colors::rgb8out out = colors::rgb8out(colors::rgb(color));
-        
-        for (size_t c = 0; c < leds_rings_n; c++) {
-            if (blend != 0.0f) {
-                leds_inner[0][c] = colors::ip(leds_inner[0][c], out, blend);
-                leds_inner[1][c] = colors::ip(leds_inner[1][c], out, blend);
-            } else {
-                leds_inner[0][c] = out;
-                leds_inner[1][c] = out;
-            }
-        }
-        if (blend != 0.0f) {
-            leds_centr[0] = colors::ip(leds_centr[0], out, blend);
-            leds_centr[1] = colors::ip(leds_centr[1], out, blend);
-        } else {
-            leds_centr[0] = out;
-            leds_centr[1] = out;
-        }
+        composite<colors::blend_mode::crossfade>(colors::rgb16out(colors::rgb(color)), weight, region_inner);
     }
 
     //
@@ -2415,27 +3011,12 @@ public:
     //
 
     void ring_color(colors::rgb8 color, Timeline::Span &span, Timeline::Span &below) {
-        float blend = 0.0f;
+        uint32_t weight = overlay_weight(span);
 
-        // Continue to run effect below
-        below.Calc();
+        // Continue to run effect below, on the bird only once opaque
+        calc_below(below, weight == colors::weight_one ? region_outer : 0);
 
-        if (span.InBeginPeriod(blend, 0.25f)) {
-        } else if (span.InEndPeriod(blend, 0.25f)) {
-            blend = 1.0f - blend;
-        }
-        
-        colors::rgb8out out = colors::rgb8out(colors::rgb(color));
-        
-        for (size_t c = 0; c < leds_rings_n; c++) {
-            if (blend != 0.0f) {
-                leds_outer[0][c] = colors::ip(leds_outer[0][c], out, blend);
-                leds_outer[1][c] = colors::ip(leds_outer[1][c], out, blend);
-            } else {
-                leds_outer[0][c] = out;
-                leds_outer[1][c] = out;
-            }
-        }
+        composite<colors::blend_mode::crossfade>(colors::rgb16out(colors::rgb(color)), weight, region_outer);
     }
     
     //
@@ -2443,146 +3024,379 @@ public:
     // 
 
     void message_color(colors::rgb8 color, Timeline::Span &span, Timeline::Span &below) {
+        uint32_t weight = overlay_weight(span);
 
-        float blend = 0.0f;
-        if (span.InBeginPeriod(blend, 0.25f)) {
-            below.Calc();
-        } else if (span.InEndPeriod(blend, 0.25f)) {
-            below.Calc();
-            blend = 1.0f - blend;
-        }
-
-        colors::rgb8out out = colors::rgb8out(colors::rgb(color));
+        calc_below(below, weight == colors::weight_one ? region_all : 0);
 
-        for (size_t c = 0; c < leds_rings_n; c++) {
+        composite<colors::blend_mode::crossfade>(colors::rgb16out(colors::rgb(color)), weight);
+    }
 
-            if (blend != 0.0f) {
-                leds_outer[0][c] = colors::ip(leds_outer[0][c], out, blend);
-                leds_outer[1][c] = colors::ip(leds_outer[1][c], out, blend);
+    //
+    // V2 MESSAGE
+    //
+    
+    void message_v2(uint32_t color, Timeline::Span &span, Timeline::Span &below) {
+        uint32_t weight = overlay_weight(span);
 
-                leds_inner[0][c] = colors::ip(leds_inner[0][c], out, blend);
-                leds_inner[1][c] = colors::ip(leds_inner[1][c], out, blend);
+        calc_below(below, weight == colors::weight_one ? region_all : 0);
 
-            } else {
-                leds_outer[0][c] = out;
-                leds_outer[1][c] = out;
+        // Three walks per second
+        const ticks_t period = ticks_per_second / 3;
+        ticks_t walk = Model::instance().Ticks() - span.time;
+        int32_t direction = static_cast<int32_t>(walk / period) & 1;
+        float color_walk = static_cast<float>(walk % period) * (1.0f / static_cast<float>(period));
 
-                leds_inner[0][c] = out;
-                leds_inner[1][c] = out;
-            }
-        }
+        colors::rgb16out out = colors::rgb16out(colors::rgb(color) * (direction ? (1.0f - color_walk) : color_walk) * 1.6f );
 
-        if (blend != 0.0f) {
-            leds_centr[0] = colors::ip(leds_centr[0], out, blend);
-            leds_centr[1] = colors::ip(leds_centr[1], out, blend);
-        } else {
-            leds_centr[0] = out;
-            leds_centr[1] = out;
-        }
+        composite<colors::blend_mode::crossfade>(out, weight);
     }
 
     //
-    // V2 MESSAGE
+    // V3 MESSAGE
     //
     
-    void message_v2(uint32_t color, Timeline::Span &span, Timeline::Span &below) {
+    void message_v3(colors::rgb8 color, Timeline::Span &span, Timeline::Span &below) {
+        uint32_t weight = overlay_weight(span);
 
-        float blend = 0.0f;
-        if (span.InBeginPeriod(blend, 0.25f)) {
-            below.Calc();
-        } else if (span.InEndPeriod(blend, 0.25f)) {
-            below.Calc();
-            blend = 1.0f - blend;
-        }
+        calc_below(below, weight == colors::weight_one ? region_all : 0);
 
-        const double speed = 3.0;
-        double now = Model::instance().Time();
-        int32_t direction = static_cast<int32_t>((now - span.time)  * speed) & 1;
-        float color_walk = fmodf(static_cast<float>((now - span.time) * speed), 1.0f);
+        // Three walks per second
+        const ticks_t period = ticks_per_second / 3;
+        ticks_t walk = Model::instance().Ticks() - span.time;
+        int32_t direction = static_cast<int32_t>(walk / period) & 1;
+        float color_walk = static_cast<float>(walk % period) * (1.0f / static_cast<float>(period));
 
-        colors::rgb8out out = colors::rgb8out(colors::rgb(color) * (direction ? (1.0f - color_walk) : color_walk) * 1.6f );
+        colors::rgb16out out = colors::rgb16out(colors::rgb(color) * (direction ? (1.0f - color_walk) : color_walk) * 1.6f );
 
-        for (size_t c = 0; c < leds_rings_n; c++) {
+        composite<colors::blend_mode::crossfade>(out, weight);
+    }
+};
 
-            if (blend != 0.0f) {
-                leds_outer[0][c] = colors::ip(leds_outer[0][c], out, blend);
-                leds_outer[1][c] = colors::ip(leds_outer[1][c], out, blend);
+void led_control::init () {
+    led_bank::instance();
+}
 
-                leds_inner[0][c] = colors::ip(leds_inner[0][c], out, blend);
-                leds_inner[1][c] = colors::ip(leds_inner[1][c], out, blend);
+const char *led_control::EffectName(uint32_t effect) {
+    static const char *names[] = {
+        "black",
+        "static_color",
+        "rgb_band",
+        "color_walker",
+        "light_walker",
+        "rgb_glow",
+        "lightning",
+        "lightning_crazy",
+        "sparkle",
+        "rando",
+        "red_green",
+        "brilliance",
+        "highlight",
+        "autumn",
+        "heartbeat",
+        "moving_rainbow",
+        "twinkle",
+        "twinkly",
+        "randomfader",
+        "chaser",
+        "brightchaser",
+        "gradient",
+        "overdrive",
+        "ironman",
+        "sweep",
+        "sweephighlight",
+        "rainbow_circle",
+        "rainbow_grow",
+        "rotor",
+        "rotor_sparse",
+        "fullcolor",
+        "flip_colors",
+    };
+    static_assert(sizeof(names) / sizeof(names[0]) == Model::EffectCount(), "effect name table out of sync");
+    if (effect >= Model::EffectCount()) {
+        return "unknown";
+    }
+    return names[effect];
+}
 
-            } else {
-                leds_outer[0][c] = out;
-                leds_outer[1][c] = out;
+float led_control::Current() {
+    return led_bank::instance().current();
+}
 
-                leds_inner[0][c] = out;
-                leds_inner[1][c] = out;
-            }
+int64_t led_control::Charge() {
+    return led_bank::instance().charge();
+}
+
+float led_control::CurrentDemand() {
+    return led_bank::instance().demand();
+}
+
+float led_control::BatteryCurrentBudget(float voltage) {
+    if (!led_bank::instance().limiter_on()) {
+        return std::numeric_limits<float>::max();
+    }
+    return led_bank::battery_budget(voltage);
+}
+
+float led_control::CurrentBudget() {
+    return led_bank::instance().current_budget();
+}
+
+bool led_control::CurrentLimitPending() {
+    return led_bank::instance().limiter_pending();
+}
+
+#ifdef EMULATOR
+// Effects sampling a gradient, and how many of those have fixed stops
+static constexpr size_t gradient_effects_n = 14;
+static constexpr size_t gradient_effects_constexpr_n = 3;
+
+static constexpr colors::gradient_stop color_pipeline_stops[] = {
+    { 0x968b3f, 0.00f },
+    { 0x097916, 0.20f },
+    { 0x00d4ff, 0.40f },
+    { 0xffffff, 0.50f },
+    { 0x8a0e45, 0.80f },
+    { 0x968b3f, 1.00f }
+};
+
+static constexpr colors::gradient_table color_pipeline_table(color_pipeline_stops);
+
+int32_t led_control::FixedPointColorError() {
+    int32_t error = 0;
+
+    auto diff = [&error](uint8_t a, uint8_t b) {
+        error = std::max(error, std::abs(static_cast<int32_t>(a) - static_cast<int32_t>(b)));
+    };
+
+    for (int32_t c = -4096; c <= 65536 + 4096; c++) {
+        float v = static_cast<float>(c) * (1.0f / 65536.0f);
+        diff(colors::rgb16out::sat8(v), colors::rgb16out::sat8_fixed(v));
+    }
+
+    colors::gradient_t<false> g_float(color_pipeline_table);
+    colors::gradient_t<true> g_fixed(color_pipeline_table);
+
+    auto compare = [&diff](const geom::float4 &a, const geom::float4 &b) {
+        diff(colors::rgb16out::sat8(a.x), colors::rgb16out::sat8_fixed(b.x));
+        diff(colors::rgb16out::sat8(a.y), colors::rgb16out::sat8_fixed(b.y));
+        diff(colors::rgb16out::sat8(a.z), colors::rgb16out::sat8_fixed(b.z));
+    };
+
+    for (int32_t c = -1024; c < 4 * 4096; c++) {
+        float i = static_cast<float>(c) * (1.0f / 4096.0f);
+        if (i >= 0.0f) {
+            compare(g_float.repeat(i), g_fixed.repeat(i));
         }
+        compare(g_float.reflect(i), g_fixed.reflect(i));
+        compare(g_float.clamp(i), g_fixed.clamp(i));
+    }
+
+    return error;
+}
+
+uint32_t led_control::SampleColorPipeline(bool fixed_point, uint32_t samples) {
+    colors::gradient_t<false> g_float(color_pipeline_table);
+    colors::gradient_t<true> g_fixed(color_pipeline_table);
 
-        if (blend != 0.0f) {
-            leds_centr[0] = colors::ip(leds_centr[0], out, blend);
-            leds_centr[1] = colors::ip(leds_centr[1], out, blend);
+    uint32_t sum = 0;
+    for (uint32_t c = 0; c < samples; c++) {
+        float i = static_cast<float>(c & 0xFFF) * (1.0f / 1024.0f);
+        if (fixed_point) {
+            geom::float4 v = g_fixed.reflect(i);
+            sum += colors::rgb16out::sat8_fixed(v.x) + colors::rgb16out::sat8_fixed(v.y) + colors::rgb16out::sat8_fixed(v.z);
         } else {
-            leds_centr[0] = out;
-            leds_centr[1] = out;
+            geom::float4 v = g_float.reflect(i);
+            sum += colors::rgb16out::sat8(v.x) + colors::rgb16out::sat8(v.y) + colors::rgb16out::sat8(v.z);
         }
-    
     }
+    return sum;
+}
 
-    //
-    // V3 MESSAGE
-    //
-    
-    void message_v3(colors::rgb8 color, Timeline::Span &span, Timeline::Span &below) {
+void led_control::GrayLevels(float brightness, uint32_t &truncated, uint32_t &dithered) {
+    static constexpr uint32_t ramp = 4096;
+    static constexpr uint32_t frames = 256;
+    static bool seen_truncated[256];
+    static bool seen_dithered[256 * frames];
+    std::fill(&seen_truncated[0], &seen_truncated[0] + 256, false);
+    std::fill(&seen_dithered[0], &seen_dithered[0] + 256 * frames, false);
 
-        float blend = 0.0f;
-        if (span.InBeginPeriod(blend, 0.25f)) {
-            below.Calc();
-        } else if (span.InEndPeriod(blend, 0.25f)) {
-            below.Calc();
-            blend = 1.0f - blend;
+    uint32_t b = static_cast<uint32_t>(brightness * 256);
+    truncated = 0;
+    dithered = 0;
+    for (uint32_t c = 0; c <= ramp; c++) {
+        float v = static_cast<float>(c) * (1.0f / static_cast<float>(ramp));
+
+        // As update_leds() did before: 8 bit after gamma, scaled in 8 bits
+        uint32_t t = ( colors::rgb16out::sat8(v) * b ) / 256;
+        if (!seen_truncated[t]) {
+            seen_truncated[t] = true;
+            truncated++;
+        }
+
+        // The level the eye integrates over the dithered frames
+        uint32_t p = ( colors::rgb16out::sat16(v) * b ) >> 8;
+        uint8_t error = 0;
+        bool unused = false;
+        uint32_t sum = 0;
+        for (uint32_t f = 0; f < frames; f++) {
+            sum += led_bank::quantize(p, error, unused);
+        }
+        if (!seen_dithered[sum]) {
+            seen_dithered[sum] = true;
+            dithered++;
         }
+    }
+}
 
-        const double speed = 3.0;
-        double now = Model::instance().Time();
-        int32_t direction = static_cast<int32_t>((now - span.time)  * speed) & 1;
-        float color_walk = fmodf(static_cast<float>((now - span.time) * speed), 1.0f);
+uint32_t led_control::EncodeFrames(bool dither, uint32_t frames) {
+    return led_bank::instance().encode_frames(dither, frames);
+}
 
-        colors::rgb8out out = colors::rgb8out(colors::rgb(color) * (direction ? (1.0f - color_walk) : color_walk) * 1.6f );
+void led_control::SetCurrentLimiter(bool state) {
+    led_bank::instance().set_limiter(state);
+}
 
-        for (size_t c = 0; c < leds_rings_n; c++) {
+void led_control::CalcEffect(uint32_t effect, uint32_t frames) {
+    Model &model = Model::instance();
+    ticks_t start = model.Ticks();
+    for (uint32_t c = 0; c < frames; c++) {
+        model.SetTicks(start + static_cast<ticks_t>(c) * ( ticks_per_second / 100 ));
+        led_bank::instance().calc_effect(effect);
+    }
+    model.SetTicks(start);
+}
 
-            if (blend != 0.0f) {
-                leds_outer[0][c] = colors::ip(leds_outer[0][c], out, blend);
-                leds_outer[1][c] = colors::ip(leds_outer[1][c], out, blend);
+int32_t led_control::GradientTableError() {
+    int32_t error = 0;
 
-                leds_inner[0][c] = colors::ip(leds_inner[0][c], out, blend);
-                leds_inner[1][c] = colors::ip(leds_inner[1][c], out, blend);
+    auto compare = [&error](const geom::float4 &a, const geom::float4 &b) {
+        colors::rgb16out out(colors::rgb(b.x, b.y, b.z));
+        error = std::max(error, std::abs(static_cast<int32_t>(colors::rgb16out::sat8(a.x)) - static_cast<int32_t>(out.r >> 8)));
+        error = std::max(error, std::abs(static_cast<int32_t>(colors::rgb16out::sat8(a.y)) - static_cast<int32_t>(out.g >> 8)));
+        error = std::max(error, std::abs(static_cast<int32_t>(colors::rgb16out::sat8(a.z)) - static_cast<int32_t>(out.b >> 8)));
+    };
 
-            } else {
-                leds_outer[0][c] = out;
-                leds_outer[1][c] = out;
+    auto check = [&compare](const colors::gradient_stop *stops, size_t n) {
+        static colors::gradient_reference reference;
+        reference.init(stops, n);
+        colors::gradient g(colors::gradient_cache::instance().get(stops, n));
+        for (int32_t c = -1024; c < 4 * 4096; c++) {
+            float i = static_cast<float>(c) * (1.0f / 4096.0f);
+            if (i >= 0.0f) {
+                compare(reference.repeat(i), g.repeat(i));
+            }
+            compare(reference.reflect(i), g.reflect(i));
+            compare(reference.clamp(i), g.clamp(i));
+        }
+    };
+
+    check(color_pipeline_stops, sizeof(color_pipeline_stops) / sizeof(color_pipeline_stops[0]));
+
+    static const uint32_t rings[] = { 0xFF0000, 0x00FF00, 0x12A4F0, 0x808080, 0xFFFFFF };
+    for (uint32_t ring : rings) {
+        const colors::gradient_stop two[] = {
+            { 0x000000, 0.00f },
+            { ring, 1.00f }
+        };
+        const colors::gradient_stop highlight[] = {
+            { ring, 0.00f },
+            { ring, 0.40f },
+            { 0xffffff, 0.50f },
+            { ring, 0.60f },
+            { ring, 1.00f }
+        };
+        const colors::gradient_stop three[] = {
+            { 0xffffff, 0.00f },
+            { ring, 0.10f },
+            { 0x000000, 1.00f }
+        };
+        check(two, 2);
+        check(highlight, 5);
+        check(three, 3);
+    }
+
+    return error;
+}
 
-                leds_inner[0][c] = out;
-                leds_inner[1][c] = out;
+void led_control::GradientMemory(size_t &ram_before, size_t &ram_after, size_t &flash) {
+    ram_before = gradient_effects_n * sizeof(colors::gradient_reference);
+    ram_after = sizeof(colors::gradient_cache);
+    flash = gradient_effects_constexpr_n * sizeof(colors::gradient_table);
+}
+
+void led_control::EffectStateMemory(size_t &ram_before, size_t &ram_after) {
+    // brilliance and highlight, twinkle and twinkly each had their own,
+    // and lightning, lightning_crazy, sparkle and rando their generator
+    ram_before = sizeof(led_bank::rgb_band_state) +
+                 sizeof(led_bank::random_state) * 4 +
+                 sizeof(led_bank::sweep_state) * 2 +
+                 sizeof(led_bank::twinkle_state) * 2 +
+                 sizeof(led_bank::randomfader_state);
+    ram_after = sizeof(led_bank::instance().arena);
+}
+
+size_t led_control::EffectStateSlots() {
+    return led_bank::instance().arena.used();
+}
+
+double led_control::BlendError(uint32_t mode) {
+    static constexpr uint32_t weights[] = { 0, 1, 0x100, 0x4000, 0x8000, 0xC000, 0xFF00, 0xFFFF, colors::weight_one };
+    double error = 0.0;
+
+    // The layer is red over half as much green, so mask scales by its red
+    // where multiply filters each channel
+    auto check = [mode, &error](uint32_t a, uint32_t b, uint32_t w) {
+        colors::rgb16out below(static_cast<uint16_t>(a), static_cast<uint16_t>(a), 0);
+        colors::rgb16out above(static_cast<uint16_t>(b), static_cast<uint16_t>(b / 2), 0);
+        double f = static_cast<double>(w) / static_cast<double>(colors::weight_one);
+        double x = static_cast<double>(a);
+        double y[2] = { static_cast<double>(above.r), static_cast<double>(above.g) };
+        double expected[2] = {};
+        colors::rgb16out out;
+        for (size_t c = 0; c < 2; c++) {
+            switch (mode) {
+                case 0:
+                    expected[c] = x + ( y[c] - x ) * f;
+                    break;
+                case 1:
+                    expected[c] = std::min(x + y[c] * f, 65535.0);
+                    break;
+                case 2:
+                    expected[c] = x + ( x * y[c] / 65535.0 - x ) * f;
+                    break;
+                case 3:
+                    expected[c] = x + ( x * y[0] / 65535.0 - x ) * f;
+                    break;
             }
         }
+        switch (mode) {
+            case 0:
+                out = colors::blend<colors::blend_mode::crossfade>(below, above, w);
+                break;
+            case 1:
+                out = colors::blend<colors::blend_mode::add>(below, above, w);
+                break;
+            case 2:
+                out = colors::blend<colors::blend_mode::multiply>(below, above, w);
+                break;
+            case 3:
+                out = colors::blend<colors::blend_mode::mask>(below, above, w);
+                break;
+        }
+        error = std::max(error, fabs(static_cast<double>(out.r) - expected[0]));
+        error = std::max(error, fabs(static_cast<double>(out.g) - expected[1]));
+    };
 
-        if (blend != 0.0f) {
-            leds_centr[0] = colors::ip(leds_centr[0], out, blend);
-            leds_centr[1] = colors::ip(leds_centr[1], out, blend);
-        } else {
-            leds_centr[0] = out;
-            leds_centr[1] = out;
+    for (uint32_t a = 0; a <= 0xFFFF; a += 0x101) {
+        for (uint32_t b = 0; b <= 0xFFFF; b += 0xFF) {
+            for (uint32_t w : weights) {
+                check(a, b, w);
+            }
         }
-    
     }
-};
-
-void led_control::init () {
-    led_bank::instance();
+    return error;
 }
+#endif  // #ifdef EMULATOR
 
 void led_control::PerformV2MessageEffect(uint32_t color, bool remove) {
     static Timeline::Span s;
@@ -2592,14 +3406,14 @@ void led_control::PerformV2MessageEffect(uint32_t color, bool remove) {
     }
 
     if (remove) {
-        s.time = Model::instance().Time();
-        s.duration = 0.25;
+        s.time = Model::instance().Ticks();
+        s.duration = ticks_per_second / 4;
         return;
     }
 
     s.type = Timeline::Span::Effect;
-    s.time = Model::instance().Time();
-    s.duration = 8.0;
+    s.time = Model::instance().Ticks();
+    s.duration = 8 * ticks_per_second;
     s.calcFunc = [=](Timeline::Span &span, Timeline::Span &below) {
         led_bank::instance().message_v2(color, span, below);
     };
@@ -2618,14 +3432,14 @@ void led_control::PerformV3MessageEffect(colors::rgb8 color, bool remove) {
     }
 
     if (remove) {
-        s.time = Model::instance().Time();
-        s.duration = 0.25;
+        s.time = Model::instance().Ticks();
+        s.duration = ticks_per_second / 4;
         return;
     }
 
     s.type = Timeline::Span::Effect;
-    s.time = Model::instance().Time();
-    s.duration = 15.0;
+    s.time = Model::instance().Ticks();
+    s.duration = 15 * ticks_per_second;
     s.calcFunc = [=](Timeline::Span &span, Timeline::Span &below) {
         led_bank::instance().message_v3(color, span, below);
     };
@@ -2644,8 +3458,8 @@ void led_control::PerformColorBirdDisplay(colors::rgb8 color, bool remove) {
     passThroughColor = color;
 
     if (remove) {
-        s.time = Model::instance().Time();
-        s.duration = 0.25;
+        s.time = Model::instance().Ticks();
+        s.duration = ticks_per_second / 4;
         return;
     }
 
@@ -2654,8 +3468,8 @@ void led_control::PerformColorBirdDisplay(colors::rgb8 color, bool remove) {
     }
 
     s.type = Timeline::Span::Effect;
-    s.time = Model::instance().Time();
-    s.duration = std::numeric_limits<double>::infinity();
+    s.time = Model::instance().Ticks();
+    s.duration = ticks_infinite;
     s.calcFunc = [=](Timeline::Span &span, Timeline::Span &below) {
         led_bank::instance().bird_color(passThroughColor, span, below);
     };
@@ -2674,8 +3488,8 @@ void led_control::PerformFlashlight(colors::rgb8 color, bool remove) {
     passThroughColor = color;
 
     if (remove) {
-        s.time = Model::instance().Time();
-        s.duration = 0.25;
+        s.time = Model::instance().Ticks();
+        s.duration = ticks_per_second / 4;
         return;
     }
 
@@ -2684,8 +3498,8 @@ void led_control::PerformFlashlight(colors::rgb8 color, bool remove) {
     }
 
     s.type = Timeline::Span::Effect;
-    s.time = Model::instance().Time();
-    s.duration = std::numeric_limits<double>::infinity();
+    s.time = Model::instance().Ticks();
+    s.duration = ticks_infinite;
     s.calcFunc = [=](Timeline::Span &, Timeline::Span &) {
         led_bank::instance().flashlight(passThroughColor);
     };
@@ -2706,8 +3520,8 @@ void led_control::PerformColorRingDisplay(colors::rgb8 color, bool remove) {
     passThroughColor = color;
 
     if (remove) {
-        s.time = Model::instance().Time();
-        s.duration = 0.25;
+        s.time = Model::instance().Ticks();
+        s.duration = ticks_per_second / 4;
         return;
     }
 
@@ -2716,8 +3530,8 @@ void led_control::PerformColorRingDisplay(colors::rgb8 color, bool remove) {
     }
 
     s.type = Timeline::Span::Effect;
-    s.time = Model::instance().Time();
-    s.duration = std::numeric_limits<double>::infinity();
+    s.time = Model::instance().Ticks();
+    s.duration = ticks_infinite;
     s.calcFunc = [=](Timeline::Span &span, Timeline::Span &below) {
         led_bank::instance().ring_color(passThroughColor, span, below);
     };
@@ -2736,8 +3550,8 @@ void led_control::PerformMessageColorDisplay(colors::rgb8 color, bool remove) {
     passThroughColor = color;
 
     if (remove) {
-        s.time = Model::instance().Time();
-        s.duration = 0.25;
+        s.time = Model::instance().Ticks();
+        s.duration = ticks_per_second / 4;
         return;
     }
 
@@ -2746,8 +3560,8 @@ void led_control::PerformMessageColorDisplay(colors::rgb8 color, bool remove) {
     }
 
     s.type = Timeline::Span::Effect;
-    s.time = Model::instance().Time();
-    s.duration = std::numeric_limits<double>::infinity();
+    s.time = Model::instance().Ticks();
+    s.duration = ticks_infinite;
     s.calcFunc = [=](Timeline::Span &span, Timeline::Span &below) {
         led_bank::instance().message_color(passThroughColor, span, below);
     };
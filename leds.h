@@ -37,7 +37,7 @@ namespace colors {
 #endif  // #ifndef EMULATOR
 
     class rgb8;
-    class rgb8out;
+    class rgb16out;
     class hsl;
     class hsv;
     class hsp;
@@ -60,9 +60,11 @@ namespace colors {
             b(from.b) {
         }
 
+        rgb &operator=(const rgb &) = default;
+
         explicit rgb(const uint32_t color);
         explicit rgb(const rgb8 &from);
-        explicit rgb(const rgb8out &from);
+        explicit rgb(const rgb16out &from);
         explicit rgb(const hsl &from);
         explicit rgb(const hsv &from);
         explicit rgb(const hsp &from);
@@ -181,6 +183,8 @@ namespace colors {
             x(0) {
         }
 
+        rgb8 &operator=(const rgb8 &) = default;
+
         explicit rgb8(const rgb &from) {
             r = sat8(from.r);
             g = sat8(from.g);
@@ -238,6 +242,8 @@ namespace colors {
             s(from.s),
             l(from.l) {
         }
+
+        hsl &operator=(const hsl &) = default;
     
         explicit hsl(const rgb &from) {
             float hi = std::max(std::max(from.r, from.g), from.b);
@@ -286,6 +292,8 @@ namespace colors {
             s(from.s),
             v(from.v) {
         }
+
+        hsv &operator=(const hsv &) = default;
     
         explicit hsv(const rgb &from) {
             float hi = std::max(std::max(from.r, from.g), from.b);
@@ -316,6 +324,7 @@ namespace colors {
 class led_control {
 public:
     static void init();
+    static const char *EffectName(uint32_t effect);
     static void PerformV2MessageEffect(uint32_t color, bool remove = false);
     static void PerformV3MessageEffect(colors::rgb8 color, bool remove = false);
 
@@ -323,6 +332,53 @@ public:
     static void PerformColorBirdDisplay(colors::rgb8 color, bool remove = false);
     static void PerformColorRingDisplay(colors::rgb8 color, bool remove = false);
     static void PerformFlashlight(colors::rgb8 color, bool remove = false);
+
+    // Estimated LED supply current of the last frame sent in mA and its
+    // integral since boot in uAs, what the limiter allows at the present
+    // battery and charger state, and whether the limiter needs another
+    // frame to follow a change of that budget
+    static float Current();
+    static int64_t Charge();
+    static float CurrentBudget();
+    static bool CurrentLimitPending();
+
+    // What the LEDs would draw without the limiter, and what the limiter
+    // allows at a battery voltage, for the runtime prediction
+    static float CurrentDemand();
+    static float BatteryCurrentBudget(float voltage);
+
+#ifdef EMULATOR
+    // Largest deviation of the fixed point color pipeline from the float one
+    // in 8 bit output steps, over quantization and gradient sampling
+    static int32_t FixedPointColorError();
+    static uint32_t SampleColorPipeline(bool fixed_point, uint32_t samples);
+
+    // Largest deviation of the gradient tables from the former float
+    // gradients in 8 bit output steps, and the memory they take
+    static int32_t GradientTableError();
+    static void GradientMemory(size_t &ram_before, size_t &ram_after, size_t &flash);
+
+    // RAM the effect state took as statics and takes in the arena slots,
+    // and how many slots hold the state of an effect right now
+    static void EffectStateMemory(size_t &ram_before, size_t &ram_after);
+    static size_t EffectStateSlots();
+
+    // Largest deviation of a compositor blend mode from the same blend in
+    // float, in 16 bit steps, for crossfade, add, multiply and mask
+    static double BlendError(uint32_t mode);
+
+    // Distinct output levels over a gray ramp at one brightness setting,
+    // 8 bit truncated as before and averaged over the temporal dither,
+    // and the cost of encoding frames with and without the dither
+    static void GrayLevels(float brightness, uint32_t &truncated, uint32_t &dithered);
+    static uint32_t EncodeFrames(bool dither, uint32_t frames);
+
+    static void SetCurrentLimiter(bool state);
+
+    // Runs only the calculation of an effect, without encoding or sending,
+    // over frames 10ms apart from the current model time
+    static void CalcEffect(uint32_t effect, uint32_t frames);
+#endif  // #ifdef EMULATOR
 };
 
 #endif /* LEDS_H_ */
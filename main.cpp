@@ -28,7 +28,12 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include <atmel_start.h>
 
 #ifdef EMULATOR
+#ifdef BENCHMARK
+#include "./benchmark.h"
+#endif  // #ifdef BENCHMARK
+
 #include <unistd.h> 
+#include <poll.h>
 #include <stdlib.h>
 #include <termios.h>
 #endif  // #ifdef EMULATOR
@@ -41,18 +46,31 @@ void WDT_Handler() {
 
 }
 
+#ifndef BENCHMARK
 int main(void)
+#else  // #ifndef BENCHMARK
+int main(int argc, char *argv[])
+#endif  // #ifndef BENCHMARK
 {
 #ifdef EMULATOR
+#ifdef BENCHMARK
+    if (!Benchmark::instance().ParseArgs(argc, argv)) {
+        return 1;
+    }
+#endif  // #ifdef BENCHMARK
+
     static struct termios tty_opts_backup, tty_opts_raw;
-    // Back up current TTY settings
-    tcgetattr(STDIN_FILENO, &tty_opts_backup);
 
-    // Change TTY settings to raw mode
-    cfmakeraw(&tty_opts_raw);
-    tcsetattr(STDIN_FILENO, TCSANOW, &tty_opts_raw);
+    if (!emulator_headless()) {
+        // Back up current TTY settings
+        tcgetattr(STDIN_FILENO, &tty_opts_backup);
+
+        // Change TTY settings to raw mode
+        cfmakeraw(&tty_opts_raw);
+        tcsetattr(STDIN_FILENO, TCSANOW, &tty_opts_raw);
 
-    printf("\x1b[2J\x1b[?25l");
+        printf("\x1b[2J\x1b[?25l");
+    }
 #endif  // #ifdef EMULATOR
 
     /* Initializes MCU, drivers and middleware */
@@ -68,9 +86,22 @@ int main(void)
 #ifndef EMULATOR
     while (1) {
         __WFI();
+        Commands::instance().OnIdle();
     }
 #else  // #ifndef EMULATOR
+#ifdef BENCHMARK
+    if (Benchmark::instance().Headless()) {
+        return Benchmark::instance().Run();
+    }
+#endif  // #ifdef BENCHMARK
+
     while (1) {
+        // Stands in for the wakeups of the device's main loop
+        struct pollfd input = { STDIN_FILENO, POLLIN, 0 };
+        if (poll(&input, 1, 10) <= 0) {
+            Commands::instance().OnIdle();
+            continue;
+        }
         int key = getc(stdin);
         switch (key) {
             case    0x03:
@@ -105,96 +105,202 @@ std::string Model::ChargeCurrentString() {
     return std::string(str);
 }
 
-void Model::load() {
-    uint32_t page_size = flash_get_page_size(&FLASH_0);
-    uint32_t model_page = flash_get_total_pages(&FLASH_0) - 1;
-    uint8_t *buf = static_cast<uint8_t *>(alloca(page_size));
-    size_t buf_pos = 0;
-    flash_read(&FLASH_0, model_page * page_size, buf, page_size);
+static void write_uint32(uint32_t val, uint8_t *b, size_t &bp) {
+    b[bp++] = (val >> 24) & 0xFF;
+    b[bp++] = (val >> 16) & 0xFF;
+    b[bp++] = (val >>  8) & 0xFF;
+    b[bp++] = (val >>  0) & 0xFF;
+}
 
-    auto read_uint32 = [](uint8_t *b, size_t &bp) {
-        uint32_t ret = (static_cast<uint32_t>(b[bp+0]) << 24)|
-                       (static_cast<uint32_t>(b[bp+1]) << 16)|
-                       (static_cast<uint32_t>(b[bp+2]) <<  8)|
-                       (static_cast<uint32_t>(b[bp+3]) <<  0);
-        bp += 4;
-        return ret;
-    };
-
-    auto read_uint16 = [](uint8_t *b, size_t &bp) {
-        uint16_t ret = static_cast<uint16_t>((static_cast<uint16_t>(b[bp+0]) <<  8)|
-                                             (static_cast<uint16_t>(b[bp+1]) <<  0));
-        bp += 2;
-        return ret;
-    };
-
-    auto read_float = [](uint8_t *b, size_t &bp) {
-        uint32_t val = (static_cast<uint32_t>(b[bp+0]) << 24)|
-                       (static_cast<uint32_t>(b[bp+1]) << 16)|
-                       (static_cast<uint32_t>(b[bp+2]) <<  8)|
-                       (static_cast<uint32_t>(b[bp+3]) <<  0);
-        union {
-            uint32_t int32;
-            float float32;
-        } a;
-        a.int32 = val;
-        bp += 4;
-        return a.float32;
-    };
-
-    auto read_double = [](uint8_t *b, size_t &bp) {
-        uint64_t val = (static_cast<uint64_t>(b[bp+0]) << 56)|
-                       (static_cast<uint64_t>(b[bp+1]) << 48)|
-                       (static_cast<uint64_t>(b[bp+2]) << 40)|
-                       (static_cast<uint64_t>(b[bp+3]) << 32)|
-                       (static_cast<uint64_t>(b[bp+4]) << 24)|
-                       (static_cast<uint64_t>(b[bp+5]) << 16)|
-                       (static_cast<uint64_t>(b[bp+6]) <<  8)|
-                       (static_cast<uint64_t>(b[bp+7]) <<  0);
-        union {
-            uint64_t int64;
-            double float64;
-        } a;
-        a.int64 = val;
-        bp += 8;
-        return a.float64;
-    };
-    
-    auto read_buf = [](uint8_t *dst, size_t len, uint8_t *b, size_t &bp) {
-        for (size_t c=0; c<len; c++) {
-            *dst++ = b[bp++];
-        }
-    };
+static void write_uint16(uint16_t val, uint8_t *b, size_t &bp) {
+    b[bp++] = (val >>  8) & 0xFF;
+    b[bp++] = (val >>  0) & 0xFF;
+}
+
+static void write_float(float val, uint8_t *b, size_t &bp) {
+    union {
+        uint32_t int32;
+        float float32;
+    } a;
+    a.float32 = val;
+    write_uint32(a.int32, b, bp);
+}
+
+static void write_double(double val, uint8_t *b, size_t &bp) {
+    union {
+        uint64_t int64;
+        double float64;
+    } a;
+    a.float64 = val;
+    write_uint32(static_cast<uint32_t>(a.int64 >> 32), b, bp);
+    write_uint32(static_cast<uint32_t>(a.int64 >>  0), b, bp);
+}
+
+static void write_buf(const uint8_t *src, size_t len, uint8_t *b, size_t &bp) {
+    for (size_t c=0; c<len; c++) {
+        b[bp++] = *src++;
+    }
+}
+
+static uint32_t read_uint32(const uint8_t *b, size_t &bp) {
+    uint32_t ret = (static_cast<uint32_t>(b[bp+0]) << 24)|
+                   (static_cast<uint32_t>(b[bp+1]) << 16)|
+                   (static_cast<uint32_t>(b[bp+2]) <<  8)|
+                   (static_cast<uint32_t>(b[bp+3]) <<  0);
+    bp += 4;
+    return ret;
+}
 
-    if (read_uint32(buf, buf_pos) == marker) {
+static uint16_t read_uint16(const uint8_t *b, size_t &bp) {
+    uint16_t ret = static_cast<uint16_t>((static_cast<uint16_t>(b[bp+0]) <<  8)|
+                                         (static_cast<uint16_t>(b[bp+1]) <<  0));
+    bp += 2;
+    return ret;
+}
+
+static float read_float(const uint8_t *b, size_t &bp) {
+    union {
+        uint32_t int32;
+        float float32;
+    } a;
+    a.int32 = read_uint32(b, bp);
+    return a.float32;
+}
+
+static double read_double(const uint8_t *b, size_t &bp) {
+    union {
+        uint64_t int64;
+        double float64;
+    } a;
+    a.int64 = static_cast<uint64_t>(read_uint32(b, bp)) << 32;
+    a.int64 |= read_uint32(b, bp);
+    return a.float64;
+}
+
+static void read_buf(uint8_t *dst, size_t len, const uint8_t *b, size_t &bp) {
+    for (size_t c=0; c<len; c++) {
+        *dst++ = b[bp++];
+    }
+}
+
+size_t Model::EncodeRecord(uint8_t key, uint8_t *buf) const {
+    size_t buf_pos = 0;
+    if (key == keySettings) {
+        write_uint32(bird_color.rgbx, buf, buf_pos);
+        write_uint32(ring_color.rgbx, buf, buf_pos);
+        write_uint32(message_color.rgbx, buf, buf_pos);
+        write_uint32(effect, buf, buf_pos);
+        write_uint32(radio_on ? 1UL : 0UL, buf, buf_pos);
+        write_uint32(selected_message, buf, buf_pos);
+        write_float(brightness, buf, buf_pos);
+        write_double(time_zone_offset, buf, buf_pos);
+    } else if (key == keyName) {
+        write_buf(name, sizeof(name), buf, buf_pos);
+    } else if (key == keySentCount) {
+        write_uint32(sent_message_count, buf, buf_pos);
+    } else if (key == keyRecvPos) {
+        write_uint32(revc_messages_pos, buf, buf_pos);
+    } else if (key >= keyMessage && key < keyMessage + messageCount) {
+        write_buf(messages[key - keyMessage], messageLength, buf, buf_pos);
+    } else if (key >= keyRecvMessage && key < keyRecvMessage + messageRecvCount) {
+        const struct Message &msg = recv_messages[key - keyRecvMessage];
+        write_double(msg.datetime, buf, buf_pos);
+        write_uint32(msg.uid, buf, buf_pos);
+        write_uint32(msg.col.rgbx, buf, buf_pos);
+        write_uint32(msg.flg, buf, buf_pos);
+        write_uint16(msg.cnt, buf, buf_pos);
+        write_buf(msg.name, sizeof(msg.name), buf, buf_pos);
+        write_buf(msg.message, sizeof(msg.message), buf, buf_pos);
+    }
+    return buf_pos;
+}
+
+void Model::DecodeRecord(uint8_t key, const uint8_t *buf, size_t size) {
+    // Records from another firmware version are skipped rather than misread
+    uint8_t expected[Journal::max_payload];
+    if (EncodeRecord(key, expected) != size) {
+        return;
+    }
+    size_t buf_pos = 0;
+    if (key == keySettings) {
         bird_color.rgbx = read_uint32(buf, buf_pos);
         ring_color.rgbx = read_uint32(buf, buf_pos);
         message_color.rgbx = read_uint32(buf, buf_pos);
         effect = read_uint32(buf, buf_pos);
         radio_on = read_uint32(buf, buf_pos) ? true : false;
         selected_message = read_uint32(buf, buf_pos);
-        sent_message_count = read_uint32(buf, buf_pos);
-
         brightness = read_float(buf, buf_pos);
         time_zone_offset = read_double(buf, buf_pos);
+    } else if (key == keyName) {
+        read_buf(name, sizeof(name), buf, buf_pos);
+    } else if (key == keySentCount) {
+        sent_message_count = read_uint32(buf, buf_pos);
+    } else if (key == keyRecvPos) {
+        revc_messages_pos = read_uint32(buf, buf_pos) % messageRecvCount;
+    } else if (key >= keyMessage && key < keyMessage + messageCount) {
+        read_buf(messages[key - keyMessage], messageLength, buf, buf_pos);
+    } else if (key >= keyRecvMessage && key < keyRecvMessage + messageRecvCount) {
+        struct Message &msg = recv_messages[key - keyRecvMessage];
+        msg.datetime = read_double(buf, buf_pos);
+        msg.uid = read_uint32(buf, buf_pos);
+        msg.col.rgbx = read_uint32(buf, buf_pos);
+        msg.flg = read_uint32(buf, buf_pos);
+        msg.cnt = read_uint16(buf, buf_pos);
+        read_buf(msg.name, sizeof(msg.name), buf, buf_pos);
+        read_buf(msg.message, sizeof(msg.message), buf, buf_pos);
+    }
+}
 
-        read_buf(reinterpret_cast<uint8_t *>(messages), sizeof(messages), buf, buf_pos);
-        read_buf(reinterpret_cast<uint8_t *>(name), sizeof(name), buf, buf_pos);
+bool Model::loadLegacy() {
+    // Whole-state page written by firmware before the journal
+    uint32_t page_size = flash_get_page_size(&FLASH_0);
+    uint32_t model_page = flash_get_total_pages(&FLASH_0) - 1;
+    uint8_t *buf = static_cast<uint8_t *>(alloca(page_size * 2));
+    memset(buf, 0, page_size * 2);
+    size_t buf_pos = 0;
+    flash_read(&FLASH_0, model_page * page_size, buf, page_size);
+
+    if (read_uint32(buf, buf_pos) != marker) {
+        return false;
+    }
 
-        revc_messages_pos = read_uint32(buf, buf_pos);
-        
-        for (size_t c=0; c<messageRecvCount; c++) {
-            recv_messages[c].datetime = read_double(buf, buf_pos);
+    bird_color.rgbx = read_uint32(buf, buf_pos);
+    ring_color.rgbx = read_uint32(buf, buf_pos);
+    message_color.rgbx = read_uint32(buf, buf_pos);
+    effect = read_uint32(buf, buf_pos);
+    radio_on = read_uint32(buf, buf_pos) ? true : false;
+    selected_message = read_uint32(buf, buf_pos);
+    sent_message_count = read_uint32(buf, buf_pos);
 
-            recv_messages[c].uid = read_uint32(buf, buf_pos);
-            recv_messages[c].col.rgbx = read_uint32(buf, buf_pos);
-            recv_messages[c].flg = read_uint32(buf, buf_pos);
-            recv_messages[c].cnt = read_uint16(buf, buf_pos);
+    brightness = read_float(buf, buf_pos);
+    time_zone_offset = read_double(buf, buf_pos);
 
-            read_buf(reinterpret_cast<uint8_t *>(recv_messages[c].name), sizeof(recv_messages[c].name), buf, buf_pos);
-            read_buf(reinterpret_cast<uint8_t *>(recv_messages[c].message), sizeof(recv_messages[c].message), buf, buf_pos);
-        }
-    } else {
+    read_buf(reinterpret_cast<uint8_t *>(messages), sizeof(messages), buf, buf_pos);
+    read_buf(reinterpret_cast<uint8_t *>(name), sizeof(name), buf, buf_pos);
+
+    revc_messages_pos = read_uint32(buf, buf_pos) % messageRecvCount;
+
+    for (size_t c=0; c<messageRecvCount; c++) {
+        recv_messages[c].datetime = read_double(buf, buf_pos);
+
+        recv_messages[c].uid = read_uint32(buf, buf_pos);
+        recv_messages[c].col.rgbx = read_uint32(buf, buf_pos);
+        recv_messages[c].flg = read_uint32(buf, buf_pos);
+        recv_messages[c].cnt = read_uint16(buf, buf_pos);
+
+        read_buf(reinterpret_cast<uint8_t *>(recv_messages[c].name), sizeof(recv_messages[c].name), buf, buf_pos);
+        read_buf(reinterpret_cast<uint8_t *>(recv_messages[c].message), sizeof(recv_messages[c].message), buf, buf_pos);
+    }
+    return true;
+}
+
+void Model::load() {
+    journal.init();
+    if (journal.Replay([this](uint8_t key, const uint8_t *data, size_t size) { DecodeRecord(key, data, size); })) {
+        return;
+    }
+
+    if (!loadLegacy()) {
         memcpy(
             messages,
             "QUACK!QUACK!"
@@ -211,88 +317,43 @@ void Model::load() {
     }
 }
 
-void Model::save() {
-    uint32_t page_size = flash_get_page_size(&FLASH_0);
-    uint32_t model_page = flash_get_total_pages(&FLASH_0) - 1;
-    uint8_t *buf = static_cast<uint8_t *>(alloca(page_size));
-    size_t buf_pos = 0;
-
-    auto write_uint32 = [](uint32_t val, uint8_t *b, size_t &bp) {
-        b[bp++] = (val >> 24) & 0xFF;
-        b[bp++] = (val >> 16) & 0xFF;
-        b[bp++] = (val >>  8) & 0xFF;
-        b[bp++] = (val >>  0) & 0xFF;
-    };
-
-    auto write_uint16 = [](uint16_t val, uint8_t *b, size_t &bp) {
-        b[bp++] = (val >>  8) & 0xFF;
-        b[bp++] = (val >>  0) & 0xFF;
-    };
-
-    auto write_float = [](float val, uint8_t *b, size_t &bp) {
-        union {
-            uint32_t int32;
-            float float32;
-        } a;
-        a.float32 = val;
-        b[bp++] = (a.int32 >> 24) & 0xFF;
-        b[bp++] = (a.int32 >> 16) & 0xFF;
-        b[bp++] = (a.int32 >>  8) & 0xFF;
-        b[bp++] = (a.int32 >>  0) & 0xFF;
-    };
-
-    auto write_double = [](double val, uint8_t *b, size_t &bp) {
-        union {
-            uint64_t int64;
-            double float64;
-        } a;
-        a.float64 = val;
-        b[bp++] = (a.int64 >> 56) & 0xFF;
-        b[bp++] = (a.int64 >> 48) & 0xFF;
-        b[bp++] = (a.int64 >> 40) & 0xFF;
-        b[bp++] = (a.int64 >> 32) & 0xFF;
-        b[bp++] = (a.int64 >> 24) & 0xFF;
-        b[bp++] = (a.int64 >> 16) & 0xFF;
-        b[bp++] = (a.int64 >>  8) & 0xFF;
-        b[bp++] = (a.int64 >>  0) & 0xFF;
-    };
-
-
-    auto write_buf = [](uint8_t *src, size_t len, uint8_t *b, size_t &bp) {
-        for (size_t c=0; c<len; c++) {
-            b[bp++] = *src++;
-        }
-    };
-
-    write_uint32(marker, buf, buf_pos); 
-
-    write_uint32(bird_color.rgbx, buf, buf_pos);
-    write_uint32(ring_color.rgbx, buf, buf_pos);
-    write_uint32(message_color.rgbx, buf, buf_pos);
-    write_uint32(effect, buf, buf_pos);
-    write_uint32(radio_on ? 1UL : 0UL, buf, buf_pos);
-    write_uint32(selected_message, buf, buf_pos);
-    write_uint32(sent_message_count, buf, buf_pos);
-
-    write_float(brightness, buf, buf_pos);
-    write_double(time_zone_offset, buf, buf_pos);
+void Model::flush(bool force) {
+    if (!dirty) {
+        return;
+    }
 
-    write_buf(reinterpret_cast<uint8_t *>(messages), sizeof(messages), buf, buf_pos);
-    write_buf(reinterpret_cast<uint8_t *>(name), sizeof(name), buf, buf_pos);
+    // Battery readings are 0 until the BQ25895 has converted once. Without
+    // USB (VBUS below 4V) a low battery may not last another interval.
+    bool power_failing = battery_voltage > 0.0f && battery_voltage < SavePowerFailVoltage() &&
+                         vbus_voltage < 4.0f;
 
-    write_uint32(revc_messages_pos, buf, buf_pos);
+    if (force || power_failing || (Time() - save_time) >= saveInterval) {
+        dirty = false;
+        save_time = Time();
+        write();
+    }
+}
 
-    for (size_t c=0; c<messageRecvCount; c++) {
-        write_double(recv_messages[c].datetime, buf, buf_pos);
+void Model::write() {
+    uint8_t buf[Journal::max_payload];
 
-        write_uint32(recv_messages[c].uid, buf, buf_pos);
-        write_uint32(recv_messages[c].col.rgbx, buf, buf_pos);
-        write_uint32(recv_messages[c].flg, buf, buf_pos);
-        write_uint16(recv_messages[c].cnt, buf, buf_pos);
+    // Only records whose content changed since the last save are appended
+    bool full = false;
+    for (uint8_t key = 0; key < keyCount && !full; key++) {
+        size_t size = EncodeRecord(key, buf);
+        if (size) {
+            full = !journal.Append(key, buf, size);
+        }
+    }
 
-        write_buf(reinterpret_cast<uint8_t *>(recv_messages[c].name), sizeof(recv_messages[c].name), buf, buf_pos);
-        write_buf(reinterpret_cast<uint8_t *>(recv_messages[c].message), sizeof(recv_messages[c].message), buf, buf_pos);
+    if (full) {
+        journal.StartSnapshot();
+        for (uint8_t key = 0; key < keyCount; key++) {
+            size_t size = EncodeRecord(key, buf);
+            if (size) {
+                journal.Append(key, buf, size);
+            }
+        }
+        journal.Commit();
     }
-    
-    flash_write(&FLASH_0, model_page * page_size, buf, page_size);
 }
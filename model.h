@@ -24,6 +24,8 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #define MODEL_H_
 
 #include "./leds.h"
+#include "./journal.h"
+#include "./system_time.h"
 
 #include <cstdint>
 #include <cstring>
@@ -59,8 +61,18 @@ public:
     void SetEffect(uint32_t neweffect) { effect = neweffect; }
     static constexpr uint32_t EffectCount() { return 32; }
 
-    double Time() const { return time; }
-    void SetTime(double current_time) { time = current_time; }
+    // Time of the current timer task pass, set once when it starts. Ticks
+    // are for the frame path, seconds for slow paths like the UI.
+    ticks_t Ticks() const { return ticks; }
+    double Time() const { return static_cast<double>(ticks) * (1.0 / static_cast<double>(ticks_per_second)); }
+    void SetTicks(ticks_t current_ticks) { ticks = current_ticks; frame_time = static_cast<float>(ticks) * (1.0f / static_cast<float>(ticks_per_second)); }
+
+    // Seconds since boot in single precision, converted once per pass, and
+    // the position within a repeating period in [0, 1) for effects. The
+    // phase stays exact at any uptime; the seconds lose resolution after
+    // a few hours.
+    float FrameTime() const { return frame_time; }
+    float Phase(ticks_t period) const { return static_cast<float>(ticks % period) * (1.0f / static_cast<float>(period)); }
 
     colors::rgb8 BirdColor() const { return bird_color; }
     void SetBirdColor(colors::rgb8 color) { bird_color = color; }
@@ -93,8 +105,8 @@ public:
     void SetChargeCurrent(float current) { charge_current = current; }
     std::string ChargeCurrentString();
     
-    double DateTime() const { if (date_time_offset == 0.0) { return -1.0; } return time + date_time_offset; };
-    void SetDateTime(double date_time) { date_time_offset = date_time - time; }
+    double DateTime() const { if (date_time_offset == 0.0) { return -1.0; } return Time() + date_time_offset; };
+    void SetDateTime(double date_time) { date_time_offset = date_time - Time(); }
 
     double TimeZoneOffset() const { return time_zone_offset; }
     void SetTimeZoneOffset(double new_time_zone_offset) { time_zone_offset = new_time_zone_offset; }
@@ -177,10 +189,22 @@ public:
     const struct Message &CurrentRecvMessage() { uint32_t index = revc_messages_pos - 1; index %= messageRecvCount; return recv_messages[index]; }
     void PushRecvMessage(struct Message &msg) { recv_messages[revc_messages_pos++] = msg; revc_messages_pos %= messageRecvCount; }
 
-    void save();
+    // Marks the model dirty; safe from interrupt context. The journal
+    // write happens in flush(), called from the main loop.
+    void save() { dirty = true; }
+    // Writes pending changes if saveInterval has passed since the last
+    // write, power is failing or force is set.
+    void flush(bool force = false);
+    bool Dirty() const { return dirty; }
+
+    // Pending changes are written at most this often (seconds)
+    static constexpr double saveInterval = 10.0;
+    // On battery below this voltage pending changes are written right away
+    static constexpr float SavePowerFailVoltage() { return 3.6f; }
 
 private:
     friend class Commands;
+    friend class Benchmark;
 
     void SetSwitch1Down(double timestamp) { switch_1_down = timestamp; }
     void SetSwitch2Down(double timestamp) { switch_2_down = timestamp; }
@@ -190,6 +214,38 @@ private:
 
     void init();
     void load();
+    bool loadLegacy();
+    void write();
+
+    // Journal keys, one per independently persisted piece of state
+    static constexpr uint8_t keySettings = 0;
+    static constexpr uint8_t keyName = 1;
+    static constexpr uint8_t keySentCount = 2;
+    static constexpr uint8_t keyRecvPos = 3;
+    static constexpr uint8_t keyMessage = 8;
+    static constexpr uint8_t keyRecvMessage = keyMessage + messageCount;
+    static constexpr uint8_t keyCount = keyRecvMessage + messageRecvCount;
+    static_assert(keyCount <= Journal::key_count, "journal key space exhausted");
+
+    // Size of each record as EncodeRecord writes it
+    static constexpr size_t settingsRecordSize = 6 * sizeof(uint32_t) + sizeof(float) + sizeof(double);
+    static constexpr size_t recvMessageRecordSize = sizeof(double) + 3 * sizeof(uint32_t) + sizeof(uint16_t) + nameLength + messageLength;
+    static_assert(settingsRecordSize <= Journal::max_payload && nameLength <= Journal::max_payload &&
+                  messageLength <= Journal::max_payload && recvMessageRecordSize <= Journal::max_payload,
+                  "record larger than a journal entry");
+    static constexpr size_t RecordSize(uint8_t key) {
+        return key == keySettings ? settingsRecordSize :
+               key == keyName ? nameLength :
+               key == keySentCount || key == keyRecvPos ? sizeof(uint32_t) :
+               key >= keyMessage && key < keyRecvMessage ? messageLength :
+               key >= keyRecvMessage && key < keyCount ? recvMessageRecordSize :
+               0;
+    }
+
+    size_t EncodeRecord(uint8_t key, uint8_t *buf) const;
+    void DecodeRecord(uint8_t key, const uint8_t *buf, size_t size);
+
+    Journal journal;
 
     // Settings
     float brightness = 1.0f;
@@ -214,7 +270,8 @@ private:
     std::array<struct Message, messageRecvCount> recv_messages;
     
     // Volatile
-    double time = 0;
+    ticks_t ticks = 0;
+    float frame_time = 0.0f;
     double date_time_offset = 0;
 
     float battery_voltage = 0;
@@ -230,6 +287,9 @@ private:
 
     uint8_t resetCause;
 
+    bool dirty = false;
+    double save_time = 0.0;
+
     bool initialized = false;
 };
 
@@ -0,0 +1,55 @@
+/*
+Copyright 2019 Tinic Uro
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#include "./random.h"
+#include "./murmur_hash3.h"
+
+#ifndef EMULATOR
+#include "./model.h"
+#endif  // #ifndef EMULATOR
+
+Random &Random::instance() {
+    static Random random;
+    if (!random.initialized) {
+        random.initialized = true;
+        random.init();
+    }
+    return random;
+}
+
+void Random::init() {
+#ifndef EMULATOR
+    SetSeed(Model::instance().RandomUInt32());
+#else  // #ifndef EMULATOR
+    SetSeed(default_seed);
+#endif  // #ifndef EMULATOR
+}
+
+void Random::SetSeed(uint32_t new_seed) {
+    seed = new_seed;
+    streams = 0;
+}
+
+Random::Stream Random::NewStream() {
+    uint32_t index = streams++;
+    return Stream(MurmurHash3_32(&index, static_cast<int>(sizeof(index)), seed));
+}
@@ -0,0 +1,105 @@
+/*
+Copyright 2019 Tinic Uro
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef RANDOM_H_
+#define RANDOM_H_
+
+#include <cstdint>
+
+// Random numbers for the effects. Every user draws from a stream of its
+// own, a 16 byte JSF generator seeded from the service seed and the
+// number of streams handed out before, so a replay with the same seed and
+// the same effect switches renders the same frames. The seed comes from
+// the TRNG on the device and is fixed in the emulator unless set with
+// --seed=N.
+class Random {
+public:
+    class Stream {
+    public:
+        explicit Stream(uint32_t seed = 0) {
+            Seed(seed);
+        }
+
+        void Seed(uint32_t seed) {
+            a = 0xf1ea5eed;
+            b = c = d = seed;
+            for (uint32_t i = 0; i < 20; i++) {
+                (void)Get();
+            }
+        }
+
+        uint32_t Get() {
+            uint32_t e = a - rot(b, 27);
+            a = b ^ rot(c, 17);
+            b = c + d;
+            c = d + e;
+            d = e + a;
+            return d;
+        }
+
+        // In [0, n) from the high word of a 32x32 bit product instead of a
+        // modulo, biased by at most n / 2^32
+        uint32_t Bounded(uint32_t n) {
+            return static_cast<uint32_t>((static_cast<uint64_t>(Get()) * n) >> 32);
+        }
+
+        // In [lower, upper) from the top 24 bits
+        float Uniform(float lower, float upper) {
+            return static_cast<float>(Get() >> 8) * ( (upper - lower) * (1.0f / 16777216.0f) ) + lower;
+        }
+
+        // -1 or +1
+        float Sign() {
+            return static_cast<float>(static_cast<int32_t>(Get() >> 31) * 2 - 1);
+        }
+
+    private:
+        static uint32_t rot(uint32_t x, uint32_t k) {
+            return (x << k) | (x >> (32 - k));
+        }
+
+        uint32_t a;
+        uint32_t b;
+        uint32_t c;
+        uint32_t d;
+    };
+
+    static Random &instance();
+
+    void SetSeed(uint32_t seed);
+    uint32_t Seed() const { return seed; }
+
+    Stream NewStream();
+
+private:
+#ifdef EMULATOR
+    static constexpr uint32_t default_seed = 0x2019;
+#endif  // #ifdef EMULATOR
+
+    void init();
+
+    uint32_t seed = 0;
+    uint32_t streams = 0;
+    bool initialized = false;
+};
+
+#endif /* RANDOM_H_ */
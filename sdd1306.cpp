@@ -22,6 +22,7 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 */
 #include "./sdd1306.h"
 #include "./emulator.h"
+#include "./system_time.h"
 
 #include <atmel_start.h>
 
@@ -58,6 +59,8 @@ SDD1306::SDD1306() {
     memset(text_attr_cache, 0, sizeof(text_attr_cache));
     memset(text_attr_screen, 0, sizeof(text_attr_screen));
     memset(scroll_message, 0, sizeof(scroll_message));
+    memset(framebuffer, 0, sizeof(framebuffer));
+    memset(dirty_columns, 0, sizeof(dirty_columns));
 }
     
 SDD1306 &SDD1306::instance() {
@@ -168,19 +171,25 @@ void SDD1306::SetBootScreen(bool on, int32_t xpos) {
     
 void SDD1306::SetAsciiScrollMessage(const char *str, int32_t offset) {
     if (str) {
+        uint8_t message[sizeof(scroll_message)];
         size_t len = std::min(strlen(str), sizeof(scroll_message));
-        memset(scroll_message, 0, sizeof(scroll_message));
+        memset(message, 0, sizeof(message));
         for (size_t c=0; c<len; c++) {
             uint8_t ch = static_cast<uint8_t>(str[c]);
             if ((ch < 0x20)) {
-                scroll_message[c] = 0;
+                message[c] = 0;
             } else {
-                scroll_message[c] = ch - 0x20;
+                message[c] = ch - 0x20;
             }
         }
+        if (memcmp(message, scroll_message, sizeof(message)) != 0 || 
+            scroll_message_len != static_cast<int32_t>(len)) {
+            memcpy(scroll_message, message, sizeof(message));
+            scroll_message_changed = true;
+        }
         display_scroll_message = true;
         scroll_message_offset = offset;
-        scroll_message_len = static_cast<uint16_t>(strlen(str));
+        scroll_message_len = static_cast<int32_t>(len);
     } else {
         memset(text_buffer_screen, 0, sizeof(text_buffer_screen));
         memset(text_attr_screen, 0, sizeof(text_attr_screen));
@@ -189,14 +198,17 @@ void SDD1306::SetAsciiScrollMessage(const char *str, int32_t offset) {
 }
 
 #ifdef EMULATOR
-void SDD1306::DrawBuffer(uint8_t *buf, int32_t x, int32_t y, int32_t len) {
+void SDD1306::DrawBuffer(const uint8_t *buf, int32_t x, int32_t y, int32_t len) {
+	if (emulator_headless()) {
+		return;
+	}
 	std::lock_guard<std::recursive_mutex> lock(g_print_mutex);
 	for (int32_t py = 0; py < 8; py ++) {
 		int32_t real_y  = y * 8 + static_cast<uint32_t>(py) - vertical_shift;
 		if (real_y >= 0 && real_y < 16) {
 			printf("\x1b[%d;%df",18 + real_y,2+x);
-			for (int32_t px = 0; px < (len-1); px ++) {
-				if (((buf[1+px] >> py) & 1) != 0) {
+			for (int32_t px = 0; px < len; px ++) {
+				if (((buf[px] >> py) & 1) != 0) {
 					printf("\x1b[30;47m \x1b[0m");
 				} else {
 					printf(" ");
@@ -211,21 +223,23 @@ void SDD1306::Display() {
 
 #ifdef EMULATOR
     std::lock_guard<std::recursive_mutex> lock(g_print_mutex);
-    printf("\x1b[17;1f┌────────────────────────────────────────────────────────────────────────────────────────────────┐");
-    for (int32_t y=0; y<16; y++) {
-        printf("\x1b[%d;%df│",18+y,1);
-        printf("\x1b[%d;%df│",18+y,98);
-    }
-    printf("\x1b[34;1f└────────────────────────────────────────────────────────────────────────────────────────────────┘");
-    if (vertical_shift < 0) {
-	    for (int32_t y=0; y<-vertical_shift; y++) {
-			printf("\x1b[%d;1f│                                                                                                │", 18+y);
-		}
-    }
-    if (vertical_shift > 0) {
-	    for (int32_t y=16-vertical_shift; y<16; y++) {
-			printf("\x1b[%d;1f│                                                                                                │", 18+y);
-		}
+    if (!emulator_headless()) {
+        printf("\x1b[17;1f┌────────────────────────────────────────────────────────────────────────────────────────────────┐");
+        for (int32_t y=0; y<16; y++) {
+            printf("\x1b[%d;%df│",18+y,1);
+            printf("\x1b[%d;%df│",18+y,98);
+        }
+        printf("\x1b[34;1f└────────────────────────────────────────────────────────────────────────────────────────────────┘");
+        if (vertical_shift < 0) {
+            for (int32_t y=0; y<-vertical_shift; y++) {
+                printf("\x1b[%d;1f│                                                                                                │", 18+y);
+            }
+        }
+        if (vertical_shift > 0) {
+            for (int32_t y=16-vertical_shift; y<16; y++) {
+                printf("\x1b[%d;1f│                                                                                                │", 18+y);
+            }
+        }
     }
 #endif  // #ifdef EMULATOR
 
@@ -234,129 +248,268 @@ void SDD1306::Display() {
         center_flip_screen = center_flip_cache;
         display_center_flip = true;
     }
-    for (uint32_t y=0; y<2; y++) {
-        if (display_boot_screen) {
-
-            WriteCommand(0xB0+0);
-			WriteCommand(0x00);
-			WriteCommand(0x10);
-
-            uint8_t buf[97];
-            buf[0] = 0x40;
-                
-            // write first line
-            for (int32_t x = 0; x < 96; x++) {
-                int32_t rx = (boot_screen_offset + x ) % (27 * 8) ;
-                int32_t cx = rx >> 3;
-                buf[x+1] = duck_font_raw[0x0EA8 + cx * 8 + (rx & 0x07)];
+    bool hardware_scroll = hardware_scroll_enabled && display_scroll_message && !display_boot_screen && !display_center_flip;
+    if (hardware_scroll_active && (!hardware_scroll || scroll_message_changed)) {
+        StopHardwareScroll();
+    }
+
+    if (hardware_scroll) {
+        if (!hardware_scroll_active) {
+            StartHardwareScroll(scroll_message_offset);
+        } else {
+            RefillHardwareScroll();
+        }
+    } else {
+        for (uint32_t y=0; y<2; y++) {
+            if (display_boot_screen) {
+                DisplayBootScreen(y);
+            } else if (display_scroll_message) {
+                DisplayScrollMessage(y);
+            } else {
+                for (uint32_t x=0; x<12; x++) {
+                    text_buffer_screen[y*12+x] = text_buffer_cache[y*12+x];
+                    text_attr_screen[y*12+x] = text_attr_cache[y*12+x];
+                    if (!display_center_flip) {
+                        DisplayChar(x,y,text_buffer_screen[y*12+x],text_attr_screen[y*12+x]);
+                    }
+                }
             }
+        }
+        if (display_center_flip) {
+            DisplayCenterFlip();
+        }
 
-            io_write(I2C_0_io, buf, 0x61);
+        Flush();
+    }
 
 #ifdef EMULATOR
-			DrawBuffer(buf, 0, 0, 0x61);
+    // Paint what the modeled panel shows, so hardware scrolling and vertical
+    // shifts show up even when nothing had to be sent
+    uint8_t panel[pages * width];
+    emulator_oled_visible(panel);
+    for (uint32_t y=0; y<pages; y++) {
+        DrawBuffer(&panel[y * width], 0, static_cast<int32_t>(y), width);
+    }
 #endif  // #ifdef EMULATOR
+}
 
-            WriteCommand(0xB0+1);
-			WriteCommand(0x00);
-			WriteCommand(0x10);
+uint8_t SDD1306::ScrollColumn(uint32_t y, int32_t rx) const {
+    // Same layout as the software scroll: blank until the message starts,
+    // then repeated at its own length
+    if (rx < 0 || scroll_message_len == 0) {
+        return 0;
+    }
+    rx %= scroll_message_len * 16;
+    const uint8_t *font = &duck_font_raw[y ? 0x1800 : 0x1000];
+    return font[scroll_message[rx >> 4] * 16 + (rx & 0x0F)];
+}
 
-            // write second line
-            for (int32_t x = 0; x < 96; x++) {
-                int32_t rx = (boot_screen_offset + x ) % (27 * 8) ;
-                int32_t cx = rx >> 3;
-                buf[x+1] = duck_font_raw[0x16A8 + cx * 8 + (rx & 0x07)];
-            }
-                
-            io_write(I2C_0_io, buf, 0x61);
+int32_t SDD1306::HardwareScrollColumns() const {
+    int64_t elapsed = system_ticks() - hardware_scroll_start;
+    return static_cast<int32_t>(elapsed * scroll_clock_hz / (scroll_clocks_per_column * ticks_per_second));
+}
 
-#ifdef EMULATOR
-			DrawBuffer(buf, 0, 1, 0x61);
-#endif  // #ifdef EMULATOR
-        
-        } else if (display_scroll_message) {
-                
-            WriteCommand(0xB0+0);
-			WriteCommand(0x00);
-			WriteCommand(0x10);
-
-            uint8_t buf[97];
-            buf[0] = 0x40;
-                
-            // write first line
-            for (int32_t x = 0; x < 96; x++) {
-                int32_t rx = (scroll_message_offset + x ) % (scroll_message_len * 16) ;
-                if (rx >= 0) {
-					int32_t cx = rx >> 4;
-					buf[x+1] = duck_font_raw[0x1000 + scroll_message[cx] * 16 + (rx & 0x0F)];
-				} else {
-					buf[x+1] = 0;
-				}
-            }
+void SDD1306::StartHardwareScroll(int32_t offset) {
+    SelectDevice();
+
+    hardware_scroll_offset = offset;
+    for (uint32_t y=0; y<pages; y++) {
+        uint8_t ram[gddram_width];
+        for (uint32_t x = 0; x < gddram_width; x++) {
+            ram[x] = ScrollColumn(y, offset + static_cast<int32_t>(x));
+        }
+        const uint8_t cmds[] = { static_cast<uint8_t>(0xB0 + y), 0x00, 0x10 };
+        WriteCommands(cmds, sizeof(cmds));
+        BulkTransfer(ram, sizeof(ram));
+    }
 
-            io_write(I2C_0_io, buf, 0x61);
+    const uint8_t cmds[] = {
+        0x27,                               // Left horizontal scroll
+        0x00,
+        0x00,                               // Start page
+        scroll_interval,
+        static_cast<uint8_t>(pages - 1),    // End page
+        0x00, 0xFF,
+        0x2F                                // Activate scroll
+    };
+    WriteCommands(cmds, sizeof(cmds));
 
+    hardware_scroll_start = system_ticks();
+    hardware_scroll_filled = static_cast<int32_t>(gddram_width);
+    hardware_scroll_active = true;
+    scroll_message_changed = false;
 #ifdef EMULATOR
-			DrawBuffer(buf, 0, 0, 0x61);
+    verify_scroll_shift = 0;
 #endif  // #ifdef EMULATOR
+}
 
-            WriteCommand(0xB0+1);
-			WriteCommand(0x00);
-			WriteCommand(0x10);
+void SDD1306::RefillHardwareScroll() {
+    int32_t scrolled = HardwareScrollColumns();
 
-            // write second line
-            for (int32_t x = 0; x < 96; x++) {
-                int32_t rx = (scroll_message_offset + x ) % (scroll_message_len * 16) ;
-                int32_t cx = rx >> 4;
-                if (rx >= 0) {
-					buf[x+1] = duck_font_raw[0x1800 + scroll_message[cx] * 16 + (rx & 0x0F)];
-				} else {
-					buf[x+1] = 0;
-				}
+    // Start over where the controller should be once per lap, so the error
+    // of the estimate stays within the margin, or if the columns about to
+    // come up were not written in time
+    if (scrolled >= static_cast<int32_t>(gddram_width) ||
+        hardware_scroll_filled < scrolled + static_cast<int32_t>(width) + scroll_margin) {
+        StopHardwareScroll();
+        StartHardwareScroll(hardware_scroll_offset + scrolled);
+        return;
+    }
+
+    SelectDevice();
+
+    int32_t end = scrolled + static_cast<int32_t>(gddram_width) - scroll_margin;
+    while (hardware_scroll_filled < end) {
+        uint32_t first = static_cast<uint32_t>(hardware_scroll_filled) % gddram_width;
+        uint32_t count = std::min(static_cast<uint32_t>(end - hardware_scroll_filled), gddram_width - first);
+        for (uint32_t y=0; y<pages; y++) {
+            uint8_t band[gddram_width - width];
+            for (uint32_t x = 0; x < count; x++) {
+                band[x] = ScrollColumn(y, hardware_scroll_offset + hardware_scroll_filled + static_cast<int32_t>(x));
             }
+            const uint8_t cmds[] = {
+                static_cast<uint8_t>(0xB0 + y),
+                static_cast<uint8_t>(0x0f&(first   )),
+                static_cast<uint8_t>(0x10|(first>>4))
+            };
+            WriteCommands(cmds, sizeof(cmds));
+            BulkTransfer(band, count);
+        }
+        hardware_scroll_filled += static_cast<int32_t>(count);
+    }
+}
 
-            io_write(I2C_0_io, buf, 0x61);
+void SDD1306::StopHardwareScroll() {
+    SelectDevice();
+    WriteCommand(0x2E);
+    hardware_scroll_active = false;
+
+    // Display RAM has to be rewritten after a scroll is deactivated
+    memset(dirty_columns, 0xFF, sizeof(dirty_columns));
+}
 
 #ifdef EMULATOR
-			DrawBuffer(buf, 0, 1, 0x61);
+bool SDD1306::VerifyPanel() const {
+    uint8_t panel[pages * width];
+    emulator_oled_visible(panel);
+
+    if (!hardware_scroll_active) {
+        return memcmp(panel, framebuffer, sizeof(panel)) == 0;
+    }
+
+    // The controller advances on its own clock, so the image only has to be
+    // the message moved a few columns further left than last time
+    static constexpr int32_t max_step = 8;
+    for (int32_t step = 0; step <= max_step; step++) {
+        int32_t shift = verify_scroll_shift + step;
+        bool match = true;
+        for (uint32_t y=0; y<pages && match; y++) {
+            for (uint32_t x=0; x<width && match; x++) {
+                match = panel[y * width + x] == ScrollColumn(y, hardware_scroll_offset + shift + static_cast<int32_t>(x));
+            }
+        }
+        if (match) {
+            verify_scroll_shift = shift;
+            return true;
+        }
+    }
+    return false;
+}
 #endif  // #ifdef EMULATOR
-                
-        } else {
-            for (uint32_t x=0; x<12; x++) {
-                if (text_buffer_cache[y*12+x] != text_buffer_screen[y*12+x] ||
-                    text_attr_cache[y*12+x] != text_attr_screen[y*12+x]) {
-                    text_buffer_screen[y*12+x] = text_buffer_cache[y*12+x];
-                    text_attr_screen[y*12+x] = text_attr_cache[y*12+x];
-                    if (!display_center_flip) {
-                        DisplayChar(x,y,text_buffer_screen[y*12+x],text_attr_screen[y*12+x]);
-                    }
+
+void SDD1306::Flush() {
+    SelectDevice();
+
+    for (uint32_t y=0; y<pages; y++) {
+        uint32_t x = 0;
+        while (x < width) {
+            if (((dirty_columns[y][x/32] >> (x&31)) & 1) == 0) {
+                x++;
+                continue;
+            }
+
+            // Extend the span across clean gaps which are cheaper to resend
+            // than to start a new span for
+            uint32_t first = x;
+            uint32_t last = x;
+            for (x++; x < width && (x - last) <= span_merge_gap + 1; x++) {
+                if (((dirty_columns[y][x/32] >> (x&31)) & 1) != 0) {
+                    last = x;
                 }
             }
+            x = last + 1;
+
+            const uint8_t cmds[] = {
+                static_cast<uint8_t>(0xB0 + y),
+                static_cast<uint8_t>(0x0f&(first   )),
+                static_cast<uint8_t>(0x10|(first>>4))
+            };
+            WriteCommands(cmds, sizeof(cmds));
+            BulkTransfer(&framebuffer[y][first], last - first + 1);
         }
+        memset(dirty_columns[y], 0, sizeof(dirty_columns[y]));
     }
-    if (display_center_flip) {
-        DisplayCenterFlip();
+}
+
+void SDD1306::SetColumn(uint32_t x, uint32_t y, uint8_t v) {
+    if (framebuffer[y][x] != v) {
+        framebuffer[y][x] = v;
+        dirty_columns[y][x/32] |= 1UL << (x&31);
     }
+}
 
+void SDD1306::DisplayBootScreen(uint32_t y) {
+    const uint8_t *font = &duck_font_raw[y ? 0x16A8 : 0x0EA8];
+    for (uint32_t x = 0; x < width; x++) {
+        int32_t rx = (boot_screen_offset + static_cast<int32_t>(x) ) % (27 * 8) ;
+        int32_t cx = rx >> 3;
+        SetColumn(x, y, font[cx * 8 + (rx & 0x07)]);
+    }
 }
-    
+
+void SDD1306::DisplayScrollMessage(uint32_t y) {
+    const uint8_t *font = &duck_font_raw[y ? 0x1800 : 0x1000];
+    for (uint32_t x = 0; x < width; x++) {
+        int32_t rx = (scroll_message_offset + static_cast<int32_t>(x) ) % (scroll_message_len * 16) ;
+        if (rx >= 0) {
+            int32_t cx = rx >> 4;
+            SetColumn(x, y, font[scroll_message[cx] * 16 + (rx & 0x0F)]);
+        } else {
+            SetColumn(x, y, 0);
+        }
+    }
+}
+
 void SDD1306::SetVerticalShift(int8_t val) {
 	vertical_shift = static_cast<int32_t>(val);
-    WriteCommand(0xD3);
     if (val < 0) {
         val = 64+val;
-        WriteCommand(val&0x3F);
-    } else {
-        WriteCommand(val&0x3F);
     }
+    const uint8_t cmds[] = { 0xD3, static_cast<uint8_t>(val&0x3F) };
+    SelectDevice();
+    WriteCommands(cmds, sizeof(cmds));
 }
 
 void SDD1306::DisplayOn() {
+    SelectDevice();
     WriteCommand(0xAF);
+    displayOn = true;
 }
 
 void SDD1306::DisplayOff() {
+    SelectDevice();
     WriteCommand(0xAE);
+    displayOn = false;
+}
+
+uint32_t SDD1306::LitPixels() const {
+    uint32_t lit = 0;
+    for (uint32_t y = 0; y < pages; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            lit += static_cast<uint32_t>(__builtin_popcount(framebuffer[y][x]));
+        }
+    }
+    return lit;
 }
 
 void SDD1306::Init() {
@@ -398,25 +551,22 @@ void SDD1306::Init() {
         0xAF            // Display on
     };
 
-    for (size_t c = 0; c < sizeof(startup_sequence); c++) {
-        WriteCommand(startup_sequence[c]);
-    }
+    WriteCommands(startup_sequence, sizeof(startup_sequence));
+    displayOn = true;
+
+    // Display RAM is undefined after reset, so the first flush sends everything
+    memset(dirty_columns, 0xFF, sizeof(dirty_columns));
 }
 
 void SDD1306::DisplayCenterFlip() {
-    uint8_t buf[0x61];
-    buf[0] = 0x40;
     for (uint32_t y=0; y<2; y++) {
-        WriteCommand(static_cast<uint8_t>(0xB0+y));
-        WriteCommand(0x00);
-        WriteCommand(0x10);
         for (uint32_t x = 0; x < 96; x++) {
             if (center_flip_screen == 48) {
-                buf[x+1] = 0x00;
+                SetColumn(x, y, 0x00);
             } else {
                 int32_t rx = ( ( ( static_cast<int32_t>(x) - 48 ) * 48 ) / static_cast<int32_t>(48 - center_flip_screen) ) + 48;
                 if (rx < 0 || rx > 95) {
-                    buf[x+1] = 0x00;
+                    SetColumn(x, y, 0x00);
                 } else {
                     uint8_t a = text_attr_screen[y*12+static_cast<uint32_t>(rx/8)];
                     uint8_t r = (a & 4) ? (7-(rx&7)) : (rx&7);
@@ -427,16 +577,10 @@ void SDD1306::DisplayCenterFlip() {
                     if (a & 2) {
                         v = rev_bits[v];
                     }
-                    buf[x+1] = v;
+                    SetColumn(x, y, v);
                 }
             }
         }
-
-        io_write(I2C_0_io, buf, 0x61);
-
-#ifdef EMULATOR
-		DrawBuffer(buf, 0, y, 0x61);
-#endif  // #ifdef EMULATOR
     }
 }
     
@@ -444,69 +588,46 @@ void SDD1306::DisplayChar(uint32_t x, uint32_t y, uint16_t ch, uint8_t attr) {
 
     x = x * 8;
 
-    WriteCommand(static_cast<uint8_t>(0xB0 + y));
-    WriteCommand(static_cast<uint8_t>(0x0f&(x   )));
-    WriteCommand(static_cast<uint8_t>(0x10|(x>>4)));
-        
-    uint8_t buf[9];
-    buf[0] = 0x40;
-    if ((attr & 4)) {
-        if ((attr & 1)) {
-            if ((attr & 2)) {
-                for (uint32_t c=0; c<8; c++) {
-                    buf[c+1] = ~rev_bits[duck_font_raw[ch*8+7-c]];
-                }
-            } else {
-                for (uint32_t c=0; c<8; c++) {
-                    buf[c+1] = ~duck_font_raw[ch*8+7-c];
-                }
-            }
-        } else {
-            if ((attr & 2)) {
-                for (uint32_t c=0; c<8; c++) {
-                    buf[c+1] =  rev_bits[duck_font_raw[ch*8+7-c]];
-                }
-                } else {
-                for (uint32_t c=0; c<8; c++) {
-                    buf[c+1] =  duck_font_raw[ch*8+7-c];
-                }
-            }
+    const uint8_t *glyph = &duck_font_raw[ch*8];
+    for (uint32_t c=0; c<8; c++) {
+        uint8_t v = glyph[(attr & 4) ? (7-c) : c];
+        if ((attr & 2)) {
+            v = rev_bits[v];
         }
-    } else {
         if ((attr & 1)) {
-            if ((attr & 2)) {
-                for (uint32_t c=0; c<8; c++) {
-                    buf[c+1] = ~rev_bits[duck_font_raw[ch*8+c]];
-                }
-                } else {
-                for (uint32_t c=0; c<8; c++) {
-                    buf[c+1] = ~duck_font_raw[ch*8+c];
-                }
-            }
-        } else {
-            if ((attr & 2)) {
-                for (uint32_t c=0; c<8; c++) {
-                    buf[c+1] =  rev_bits[duck_font_raw[ch*8+c]];
-                }
-                } else {
-                for (uint32_t c=0; c<8; c++) {
-                    buf[c+1] =  duck_font_raw[ch*8+c];
-                }
-            }
+            v = ~v;
         }
+        SetColumn(x+c, y, v);
     }
+}
 
-    io_write(I2C_0_io, buf, 9);
-
-#ifdef EMULATOR
-	DrawBuffer(buf, x, y, 0x09);
-#endif  // #ifdef EMULATOR
+void SDD1306::SelectDevice() const {
+    // The bus is shared with the charger, so the address is set once per
+    // batch of transactions rather than assumed
+    i2c_m_sync_set_slaveaddr(&I2C_0, i2caddr, I2C_M_SEVEN);
 }
 
 void SDD1306::WriteCommand(uint8_t cmd_val) const {
-    uint8_t cmd[2];
-    cmd[0] = 0;
-    cmd[1] = cmd_val;
-    i2c_m_sync_set_slaveaddr(&I2C_0, i2caddr, I2C_M_SEVEN);
-    io_write(I2C_0_io, cmd, sizeof(cmd));
+    WriteCommands(&cmd_val, 1);
+}
+
+void SDD1306::WriteCommands(const uint8_t *cmds, size_t size) const {
+    // Control byte 0x00: every following byte is a command
+    uint8_t buf[32];
+    while (size > 0) {
+        size_t len = std::min(size, sizeof(buf) - 1);
+        buf[0] = 0x00;
+        memcpy(&buf[1], cmds, len);
+        io_write(I2C_0_io, buf, static_cast<uint16_t>(len + 1));
+        cmds += len;
+        size -= len;
+    }
+}
+
+void SDD1306::BulkTransfer(const uint8_t *data, size_t size) const {
+    // Control byte 0x40: every following byte goes to display RAM
+    uint8_t buf[gddram_width + 1];
+    buf[0] = 0x40;
+    memcpy(&buf[1], data, size);
+    io_write(I2C_0_io, buf, static_cast<uint16_t>(size + 1));
 }
@@ -51,22 +51,72 @@ public:
     void DisplayUID();
 
     bool DevicePresent() const { return devicePresent; }
+    bool DisplayIsOn() const { return displayOn; }
+    // Pixels lit on the panel, which is what an OLED draws current for
+    uint32_t LitPixels() const;
+    bool HardwareScrolling() const { return hardware_scroll_active; }
+    void EnableHardwareScroll(bool on) { hardware_scroll_enabled = on; }
+
+#ifdef EMULATOR
+    bool VerifyPanel() const;
+#endif  // #ifdef EMULATOR
 
 private:
     void Init();
 
     static constexpr uint32_t i2caddr = 0x3C;
 
+    static constexpr uint32_t width = 96;
+    static constexpr uint32_t pages = 2;
+
+    // A new span costs an addressing transaction (address byte, control byte,
+    // 3 commands) plus the address and control byte of its data burst, so
+    // resending up to that many clean columns is never more expensive.
+    static constexpr uint32_t span_merge_gap = 7;
+
+    // Scroll messages are uploaded once and scrolled by the controller.
+    // 0b100 steps one column every 3 panel frames, close to the 128
+    // columns/s of the software scroll. Display RAM is 32 columns wider than
+    // the panel; those are refilled with the rest of a longer message as they
+    // scroll out, going by where the controller is on its nominal clock: a
+    // ~370kHz oscillator and 16 rows of 53 clocks per panel frame.
+    static constexpr uint32_t gddram_width = 128;
+    static constexpr uint8_t scroll_interval = 0x04;
+    static constexpr int64_t scroll_clock_hz = 370000;
+    static constexpr int64_t scroll_clocks_per_column = 53 * 16 * 3;
+
+    // Refills keep this many columns away from both edges of the panel, and
+    // the scroll is restarted from a fresh upload after every lap of display
+    // RAM, so the oscillator may be off by 12/128 before a refill shows.
+    static constexpr int32_t scroll_margin = 12;
+
 #ifdef EMULATOR
-	void DrawBuffer(uint8_t *buf, int32_t x, int32_t y, int32_t len);
+	void DrawBuffer(const uint8_t *buf, int32_t x, int32_t y, int32_t len);
 #endif  // #ifdef EMULATOR
 
+    void DisplayBootScreen(uint32_t y);
+    void DisplayScrollMessage(uint32_t y);
     void DisplayCenterFlip();
+    uint8_t ScrollColumn(uint32_t y, int32_t rx) const;
+    int32_t HardwareScrollColumns() const;
+    void StartHardwareScroll(int32_t offset);
+    void RefillHardwareScroll();
+    void StopHardwareScroll();
     void DisplayChar(uint32_t x, uint32_t y, uint16_t ch, uint8_t attr);
+    void SetColumn(uint32_t x, uint32_t y, uint8_t v);
+    void Flush();
+    void SelectDevice() const;
     void WriteCommand(uint8_t v) const;
+    void WriteCommands(const uint8_t *cmds, size_t size) const;
     void BulkTransfer(const uint8_t *buf, size_t size) const;
 
     bool devicePresent = false;
+    bool displayOn = false;
+
+    // Column bytes as they should appear in display RAM; a set bit in
+    // dirty_columns means the column differs from what was last sent
+    uint8_t framebuffer[pages][width];
+    uint32_t dirty_columns[pages][width / 32];
 
     int8_t center_flip_screen = 0;
     int8_t center_flip_cache = 0;
@@ -79,6 +129,17 @@ private:
     uint8_t scroll_message[64];
     int32_t scroll_message_offset = 0;
     int32_t scroll_message_len = 0;
+    bool scroll_message_changed = false;
+    bool hardware_scroll_enabled = true;
+    bool hardware_scroll_active = false;
+    // Message column in display RAM column 0 when the scroll was started,
+    // when that was and how many RAM columns from there on have been written
+    int32_t hardware_scroll_offset = 0;
+    int64_t hardware_scroll_start = 0;
+    int32_t hardware_scroll_filled = 0;
+#ifdef EMULATOR
+    mutable int32_t verify_scroll_shift = 0;
+#endif  // #ifdef EMULATOR
 
     bool display_boot_screen = false;
     int32_t boot_screen_offset = 0;
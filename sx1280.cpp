@@ -24,8 +24,12 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include "./emulator.h"
 #include "./model.h"
 #include "./sdd1306.h"
+#include "./system_time.h"
 
 #include <atmel_start.h>
+#ifndef EMULATOR
+#include <hpl_dma.h>
+#endif  // #ifndef EMULATOR
 
 #include <algorithm>
 #include <memory.h>
@@ -155,6 +159,8 @@ void SX1280::init() {
 }
 
 void SX1280::Reset() {
+    InvalidateShadow();
+
     disableIRQ();
     
     do_pin_reset();
@@ -169,10 +175,8 @@ void SX1280::Reset() {
 void SX1280::Wakeup() {
     disableIRQ();
 
-    spi_csel_low();
-    spi_write(RADIO_GET_STATUS);
-    spi_write(0);
-    spi_csel_high();
+    const uint8_t header[] = { RADIO_GET_STATUS, 0 };
+    spi_transaction(header, sizeof(header), 0, 0, 0);
 
     WaitOnBusy( );
 
@@ -205,12 +209,8 @@ void SX1280::WaitOnBusy() {
 void SX1280::WriteCommand(RadioCommand command, const uint8_t *buffer, uint32_t size) {
     WaitOnBusy();
 
-    spi_csel_low();
-    spi_write( static_cast<uint8_t>(command) );
-    for( uint16_t i = 0; i < size; i++ ) {
-        spi_write( buffer[i] );
-    }
-    spi_csel_high();
+    const uint8_t header[] = { static_cast<uint8_t>(command) };
+    spi_transaction(header, sizeof(header), buffer, 0, size);
 
     if( command != RADIO_SET_SLEEP ) {
         WaitOnBusy( );
@@ -220,20 +220,18 @@ void SX1280::WriteCommand(RadioCommand command, const uint8_t *buffer, uint32_t
 void SX1280::ReadCommand(RadioCommand command, uint8_t *buffer, uint32_t size ) {
     WaitOnBusy();
 
-    spi_csel_low();
     if( command == RADIO_GET_STATUS ) {
-        buffer[0] = spi_write( RADIO_GET_STATUS );
-        spi_write( 0 );
-        spi_write( 0 );
+        // The status is clocked out with the opcode itself
+        const uint8_t tx[] = { RADIO_GET_STATUS, 0, 0 };
+        uint8_t rx[sizeof(tx)];
+        spi_csel_low();
+        spi_transfer(tx, rx, sizeof(tx));
+        spi_csel_high();
+        buffer[0] = rx[0];
     } else {
-        spi_write( static_cast<uint8_t>(command) );
-        spi_write( 0 );
-        for( uint16_t i = 0; i < size; i++ )
-        {
-             buffer[i] = spi_write( 0 );
-        }
+        const uint8_t header[] = { static_cast<uint8_t>(command), 0 };
+        spi_transaction(header, sizeof(header), 0, buffer, size);
     }
-    spi_csel_high();
 
     WaitOnBusy( );
 }
@@ -241,14 +239,10 @@ void SX1280::ReadCommand(RadioCommand command, uint8_t *buffer, uint32_t size )
 void SX1280::WriteRegister( uint32_t address, const uint8_t *buffer, uint32_t size ) {
     WaitOnBusy( );
 
-    spi_csel_low();
-    spi_write( RADIO_WRITE_REGISTER );
-    spi_write( ( address & 0xFF00 ) >> 8 );
-    spi_write( address & 0x00FF );
-    for( uint16_t i = 0; i < size; i++ ) {
-        spi_write( buffer[i] );
-    }
-    spi_csel_high();
+    const uint8_t header[] = { RADIO_WRITE_REGISTER, 
+                               static_cast<uint8_t>( ( address & 0xFF00 ) >> 8 ), 
+                               static_cast<uint8_t>( address & 0x00FF ) };
+    spi_transaction(header, sizeof(header), buffer, 0, size);
 
     WaitOnBusy( );
 }
@@ -260,15 +254,11 @@ void SX1280::WriteRegister( uint32_t address, uint8_t value ) {
 void SX1280::ReadRegister( uint32_t address, uint8_t *buffer, uint32_t size ) {
     WaitOnBusy( );
 
-    spi_csel_low();
-    spi_write( RADIO_READ_REGISTER );
-    spi_write( ( address & 0xFF00 ) >> 8 );
-    spi_write( address & 0x00FF );
-    spi_write( 0 );
-    for( uint16_t i = 0; i < size; i++ ) {
-        buffer[i] = spi_write( 0 );
-    }
-    spi_csel_high();
+    const uint8_t header[] = { RADIO_READ_REGISTER, 
+                               static_cast<uint8_t>( ( address & 0xFF00 ) >> 8 ), 
+                               static_cast<uint8_t>( address & 0x00FF ), 
+                               0 };
+    spi_transaction(header, sizeof(header), 0, buffer, size);
 
     WaitOnBusy( );
 }
@@ -282,13 +272,8 @@ uint8_t SX1280::ReadRegister( uint32_t address ) {
 void SX1280::WriteBuffer( uint8_t offset, const uint8_t *buffer, uint8_t size ) {
     WaitOnBusy( );
 
-    spi_csel_low();
-    spi_write( RADIO_WRITE_BUFFER );
-    spi_write( offset );
-    for( uint16_t i = 0; i < size; i++ ) {
-        spi_write( buffer[i] );
-    }
-    spi_csel_high();
+    const uint8_t header[] = { RADIO_WRITE_BUFFER, offset };
+    spi_transaction(header, sizeof(header), buffer, 0, size);
 
     WaitOnBusy( );
 }
@@ -296,40 +281,56 @@ void SX1280::WriteBuffer( uint8_t offset, const uint8_t *buffer, uint8_t size )
 void SX1280::ReadBuffer( uint8_t offset, uint8_t *buffer, uint8_t size ) {
     WaitOnBusy( );
 
-    spi_csel_low();
-    spi_write( RADIO_READ_BUFFER );
-    spi_write( offset );
-    spi_write( 0 );
-    for( uint16_t i = 0; i < size; i++ ) {
-        buffer[i] = spi_write( 0 );
-    }
-    spi_csel_high();
+    const uint8_t header[] = { RADIO_READ_BUFFER, offset, 0 };
+    spi_transaction(header, sizeof(header), 0, buffer, size);
 
     WaitOnBusy( );
 }
 
 
+void SX1280::SetOperatingMode( RadioOperatingModes mode ) {
+    double now = system_time();
+    ModeTime[OperatingMode] += now - ModeSince;
+    ModeSince = now;
+    OperatingMode = mode;
+}
+
+double SX1280::OperatingModeTime( RadioOperatingModes mode ) {
+    double time = ModeTime[mode];
+    if (mode == OperatingMode) {
+        time += system_time() - ModeSince;
+    }
+    return time;
+}
+
 void SX1280::SetSleep( SleepParams sleepConfig ) {
     uint8_t sleep = static_cast<uint8_t>(( sleepConfig.WakeUpRTC << 3 ) |
                                          ( sleepConfig.InstructionRamRetention << 2 ) |
                                          ( sleepConfig.DataBufferRetention << 1 ) |
                                          ( sleepConfig.DataRamRetention ));
-    OperatingMode = MODE_SLEEP;
+    SetOperatingMode( MODE_SLEEP );
     WriteCommand( RADIO_SET_SLEEP, &sleep, 1 );
+
+    // Retention is optional, so assume everything has to be sent again
+    InvalidateShadow();
 }
 
 void SX1280::SetStandby( RadioStandbyModes standbyConfig ) {
+    if( ( standbyConfig == STDBY_RC && OperatingMode == MODE_STDBY_RC ) ||
+        ( standbyConfig == STDBY_XOSC && OperatingMode == MODE_STDBY_XOSC ) ) {
+        return;
+    }
     WriteCommand( RADIO_SET_STANDBY, reinterpret_cast<uint8_t *>(&standbyConfig), 1 );
     if( standbyConfig == STDBY_RC ) {
-        OperatingMode = MODE_STDBY_RC;
+        SetOperatingMode( MODE_STDBY_RC );
     } else {
-        OperatingMode = MODE_STDBY_XOSC;
+        SetOperatingMode( MODE_STDBY_XOSC );
     }
 }
 
 void SX1280::SetFs( void ) {
     WriteCommand( RADIO_SET_FS, 0, 0 );
-    OperatingMode = MODE_FS;
+    SetOperatingMode( MODE_FS );
 }
 
 void SX1280::SetTx( TickTime timeout ) {
@@ -347,7 +348,7 @@ void SX1280::SetTx( TickTime timeout ) {
         SetRangingRole( RADIO_RANGING_ROLE_MASTER );
     }
     WriteCommand( RADIO_SET_TX, buf, 3 );
-    OperatingMode = MODE_TX;
+    SetOperatingMode( MODE_TX );
 }
 
 void SX1280::SetRx( TickTime timeout ) {
@@ -365,7 +366,7 @@ void SX1280::SetRx( TickTime timeout ) {
         SetRangingRole( RADIO_RANGING_ROLE_SLAVE );
     }
     WriteCommand( RADIO_SET_RX, buf, 3 );
-    OperatingMode = MODE_RX;
+    SetOperatingMode( MODE_RX );
 }
 
 void SX1280::SetRxDutyCycle( RadioTickSizes periodBase, uint16_t periodBaseCountRx, uint16_t periodBaseCountSleep ) {
@@ -377,12 +378,12 @@ void SX1280::SetRxDutyCycle( RadioTickSizes periodBase, uint16_t periodBaseCount
     buf[3] = static_cast<uint8_t>( ( periodBaseCountSleep >> 8 ) & 0x00FF );
     buf[4] = static_cast<uint8_t>( periodBaseCountSleep & 0x00FF );
     WriteCommand( RADIO_SET_RXDUTYCYCLE, buf, 5 );
-    OperatingMode = MODE_RX;
+    SetOperatingMode( MODE_RX );
 }
 
 void SX1280::SetCad( void ) {
     WriteCommand( RADIO_SET_CAD, 0, 0 );
-    OperatingMode = MODE_CAD;
+    SetOperatingMode( MODE_CAD );
 }
 
 void SX1280::SetTxContinuousWave( void ) {
@@ -397,7 +398,12 @@ void SX1280::SetPacketType( RadioPacketTypes packetType ) {
     // Save packet type internally to avoid questioning the radio
     PacketType = packetType;
 
-    WriteCommand( RADIO_SET_PACKETTYPE, reinterpret_cast<uint8_t *>(&packetType), 1 );
+    uint8_t buf = static_cast<uint8_t>(packetType);
+    if( WriteCommandShadowed( SHADOW_PACKET_TYPE, RADIO_SET_PACKETTYPE, &buf, 1 ) ) {
+        // Modulation and packet parameters are interpreted per packet type
+        Shadow[SHADOW_MODULATION_PARAMS].Valid = false;
+        Shadow[SHADOW_PACKET_PARAMS].Valid = false;
+    }
 }
 
 SX1280::RadioPacketTypes SX1280::GetPacketType( bool returnLocalCopy ) {
@@ -427,7 +433,7 @@ void SX1280::SetRfFrequency( uint32_t rfFrequency ) {
     buf[0] = static_cast<uint8_t>( ( freq >> 16 ) & 0xFF );
     buf[1] = static_cast<uint8_t>( ( freq >> 8  ) & 0xFF );
     buf[2] = static_cast<uint8_t>( ( freq       ) & 0xFF );
-    WriteCommand( RADIO_SET_RFFREQUENCY, buf, 3 );
+    WriteCommandShadowed( SHADOW_RF_FREQUENCY, RADIO_SET_RFFREQUENCY, buf, 3 );
 }
 
 void SX1280::SetTxParams( int8_t power, RadioRampTimes rampTime ) {
@@ -437,12 +443,12 @@ void SX1280::SetTxParams( int8_t power, RadioRampTimes rampTime ) {
     // physical output power is in the range [-18..13]dBm
     buf[0] = static_cast<uint8_t>(power + 18);
     buf[1] = static_cast<uint8_t>(rampTime);
-    WriteCommand( RADIO_SET_TXPARAMS, buf, 2 );
+    WriteCommandShadowed( SHADOW_TX_PARAMS, RADIO_SET_TXPARAMS, buf, 2 );
 }
 
 void SX1280::SetCadParams( RadioLoRaCadSymbols cadSymbolNum ) {
     WriteCommand( RADIO_SET_CADPARAMS, reinterpret_cast<uint8_t *>(&cadSymbolNum), 1 );
-    OperatingMode = MODE_CAD;
+    SetOperatingMode( MODE_CAD );
 }
 
 void SX1280::SetBufferBaseAddresses( uint8_t txBaseAddress, uint8_t rxBaseAddress ) {
@@ -450,7 +456,7 @@ void SX1280::SetBufferBaseAddresses( uint8_t txBaseAddress, uint8_t rxBaseAddres
 
     buf[0] = txBaseAddress;
     buf[1] = rxBaseAddress;
-    WriteCommand( RADIO_SET_BUFFERBASEADDRESS, buf, 2 );
+    WriteCommandShadowed( SHADOW_BUFFER_BASE_ADDRESS, RADIO_SET_BUFFERBASEADDRESS, buf, 2 );
 }
 
 void SX1280::SetModulationParams(const ModulationParams &modParams) {
@@ -494,7 +500,7 @@ void SX1280::SetModulationParams(const ModulationParams &modParams) {
             buf[2] = 0;
             break;
     }
-    WriteCommand( RADIO_SET_MODULATIONPARAMS, buf, 3 );
+    WriteCommandShadowed( SHADOW_MODULATION_PARAMS, RADIO_SET_MODULATIONPARAMS, buf, 3 );
 }
 
 void SX1280::SetPacketParams(const PacketParams &packetParams) {
@@ -557,7 +563,7 @@ void SX1280::SetPacketParams(const PacketParams &packetParams) {
             buf[6] = 0;
             break;
     }
-    WriteCommand( RADIO_SET_PACKETPARAMS, buf, 7 );
+    WriteCommandShadowed( SHADOW_PACKET_PARAMS, RADIO_SET_PACKETPARAMS, buf, 7 );
 }
 
 void SX1280::ForcePreambleLength( RadioPreambleLengths preambleLength ) {
@@ -694,7 +700,7 @@ void SX1280::SetDioIrqParams( uint16_t irqMask, uint16_t dio1Mask, uint16_t dio2
     buf[5] = static_cast<uint8_t>( dio2Mask & 0x00FF );
     buf[6] = static_cast<uint8_t>( ( dio3Mask >> 8 ) & 0x00FF );
     buf[7] = static_cast<uint8_t>( dio3Mask & 0x00FF );
-    WriteCommand( RADIO_SET_DIOIRQPARAMS, buf, 8 );
+    WriteCommandShadowed( SHADOW_DIO_IRQ_PARAMS, RADIO_SET_DIOIRQPARAMS, buf, 8 );
 }
 
 uint16_t SX1280::GetIrqStatus( void ) {
@@ -1040,11 +1046,41 @@ float SX1280::GetFrequencyError( ) {
 }
 
 void SX1280::SetHighSensitivity() {
-    WriteRegister(REG_LNA_REGIME, (ReadRegister(REG_LNA_REGIME) | 0xC0));
+    uint8_t regime = ( ShadowLnaRegime >= 0 ) ? static_cast<uint8_t>(ShadowLnaRegime) : ReadRegister(REG_LNA_REGIME);
+    uint8_t wanted = static_cast<uint8_t>(regime | 0xC0);
+    if( ShadowLnaRegime != wanted ) {
+        WriteRegister(REG_LNA_REGIME, wanted);
+        ShadowLnaRegime = wanted;
+    }
 }
 
 void SX1280::SetLowPowerMode() {
-    WriteRegister(REG_LNA_REGIME, (ReadRegister(REG_LNA_REGIME) & (~0xC0)));
+    uint8_t regime = ( ShadowLnaRegime >= 0 ) ? static_cast<uint8_t>(ShadowLnaRegime) : ReadRegister(REG_LNA_REGIME);
+    uint8_t wanted = static_cast<uint8_t>(regime & (~0xC0));
+    if( ShadowLnaRegime != wanted ) {
+        WriteRegister(REG_LNA_REGIME, wanted);
+        ShadowLnaRegime = wanted;
+    }
+}
+
+void SX1280::InvalidateShadow() {
+    for( size_t c = 0; c < SHADOW_COUNT; c++ ) {
+        Shadow[c].Valid = false;
+    }
+    ShadowLnaRegime = -1;
+}
+
+bool SX1280::WriteCommandShadowed(ShadowSlot slot, RadioCommand command, const uint8_t *buffer, uint32_t size) {
+    ShadowCommand &shadow = Shadow[slot];
+    if( shadow.Valid && shadow.Size == size && memcmp( shadow.Data, buffer, size ) == 0 ) {
+        return false;
+    }
+
+    WriteCommand( command, buffer, size );
+    shadow.Valid = true;
+    shadow.Size = static_cast<uint8_t>(size);
+    memcpy( shadow.Data, buffer, size );
+    return true;
 }
 
 uint8_t SX1280::GetRangingPowerDeltaThresholdIndicator()
@@ -1324,11 +1360,14 @@ void SX1280::ProcessIrqs( void ) {
                 case MODE_TX:
                     if( ( irqRegs & IRQ_TX_DONE ) == IRQ_TX_DONE )
                     {
+                        // The radio falls back to STDBY_RC on its own
+                        SetOperatingMode( MODE_STDBY_RC );
                         if (txDone) {
                             txDone( );
                         }
                         SetLoraRX();
                     } else if( ( irqRegs & IRQ_RX_TX_TIMEOUT ) == IRQ_RX_TX_TIMEOUT ) {
+                        SetOperatingMode( MODE_STDBY_RC );
                         if (txTimeout) {
                             txTimeout( );
                         }
@@ -1400,11 +1439,14 @@ void SX1280::ProcessIrqs( void ) {
                 case MODE_TX:
                     if( ( irqRegs & IRQ_TX_DONE ) == IRQ_TX_DONE )
                     {
+                        // The radio falls back to STDBY_RC on its own
+                        SetOperatingMode( MODE_STDBY_RC );
                         if (txDone) {
                             txDone( );
                         }
                         SetLoraRX();
                     } else if( ( irqRegs & IRQ_RX_TX_TIMEOUT ) == IRQ_RX_TX_TIMEOUT ) {
+                        SetOperatingMode( MODE_STDBY_RC );
                         if (txTimeout) {
                             txTimeout( );
                         }
@@ -1676,6 +1718,7 @@ void SX1280::RxDone(const uint8_t *payload, uint8_t size, PacketStatus packetSta
 void SX1280::pins_init()
 {
     spi_m_sync_enable(&SPI_0);
+    spi_dma_init();
 }
 
 void SX1280::pin_irq_init()
@@ -1692,12 +1735,84 @@ void SX1280::spi_csel_high() {
     gpio_set_pin_level(SX1280_SSEL, true);
 }
 
-uint8_t SX1280::spi_write(uint8_t write_value) {
+// One chip select cycle per radio transaction: header and payload are
+// framed into a single buffer and clocked out with one transfer. Writes
+// discard what comes back, reads send zeros after the header.
+void SX1280::spi_transaction(const uint8_t *header, uint32_t header_size, const uint8_t *payload, uint8_t *response, uint32_t size) {
+    uint8_t tx[SPI_HEADER_MAX + LORA_MAX_BUFFER_SIZE];
+    uint8_t rx[SPI_HEADER_MAX + LORA_MAX_BUFFER_SIZE];
+
+    size = std::min(size, uint32_t(LORA_MAX_BUFFER_SIZE));
+    memcpy(tx, header, header_size);
+    if (payload) {
+        memcpy(&tx[header_size], payload, size);
+    } else {
+        memset(&tx[header_size], 0, size);
+    }
+
+    spi_csel_low();
+    if (size >= SPI_DMA_THRESHOLD) {
+        spi_transfer_dma(tx, response ? rx : 0, header_size + size);
+    } else {
+        spi_transfer(tx, response ? rx : 0, header_size + size);
+    }
+    spi_csel_high();
+
+    if (response) {
+        memcpy(response, &rx[header_size], size);
+    }
+}
+
+void SX1280::spi_transfer(const uint8_t *tx, uint8_t *rx, uint32_t size) {
     spi_xfer xfer;
-    uint8_t read_value = 0;
-    xfer.rxbuf = &read_value;
-    xfer.txbuf = &write_value;
-    xfer.size = 1;
+    xfer.txbuf = const_cast<uint8_t *>(tx);
+    xfer.rxbuf = rx;
+    xfer.size = size;
     spi_m_sync_transfer(&SPI_0, &xfer);
-    return read_value;
+}
+
+#ifndef EMULATOR
+// SERCOM0 RX drains into channel 1, channel 2 feeds TX; both are
+// triggered per byte by the SERCOM (see hpl_dmac_config.h).
+static constexpr uint8_t spi_dma_rx_channel = 1;
+static constexpr uint8_t spi_dma_tx_channel = 2;
+static uint8_t spi_dma_sink = 0;
+#endif  // #ifndef EMULATOR
+
+// Transfers are also started from the DIO, switch and timer interrupts,
+// where a same priority DMAC interrupt could never run. Completion is
+// therefore polled from the channel flags with its interrupts left off.
+void SX1280::spi_dma_init() {
+#ifndef EMULATOR
+    _dma_set_irq_state(spi_dma_rx_channel, DMA_TRANSFER_COMPLETE_CB, false);
+    _dma_set_irq_state(spi_dma_rx_channel, DMA_TRANSFER_ERROR_CB, false);
+#endif  // #ifndef EMULATOR
+}
+
+void SX1280::spi_transfer_dma(const uint8_t *tx, uint8_t *rx, uint32_t size) {
+#ifndef EMULATOR
+    volatile void *data = &SERCOM0->SPI.DATA.reg;
+
+    // The RX channel completes last, so it signals the end of the transfer
+    hri_dmac_clear_CHINTFLAG_TCMPL_bit(DMAC, spi_dma_rx_channel);
+    hri_dmac_clear_CHINTFLAG_TERR_bit(DMAC, spi_dma_rx_channel);
+    _dma_set_source_address(spi_dma_rx_channel, const_cast<void *>(data));
+    _dma_set_destination_address(spi_dma_rx_channel, rx ? rx : &spi_dma_sink);
+    _dma_dstinc_enable(spi_dma_rx_channel, rx != 0);
+    _dma_set_data_amount(spi_dma_rx_channel, size);
+    _dma_enable_transaction(spi_dma_rx_channel, false);
+
+    _dma_set_source_address(spi_dma_tx_channel, tx);
+    _dma_set_destination_address(spi_dma_tx_channel, const_cast<void *>(data));
+    _dma_set_data_amount(spi_dma_tx_channel, size);
+    _dma_enable_transaction(spi_dma_tx_channel, false);
+
+    while (!hri_dmac_get_CHINTFLAG_TCMPL_bit(DMAC, spi_dma_rx_channel) &&
+           !hri_dmac_get_CHINTFLAG_TERR_bit(DMAC, spi_dma_rx_channel)) { }
+    hri_dmac_clear_CHINTFLAG_TCMPL_bit(DMAC, spi_dma_rx_channel);
+    hri_dmac_clear_CHINTFLAG_TERR_bit(DMAC, spi_dma_rx_channel);
+#else  // #ifndef EMULATOR
+    EMULATOR_COUNT(spi_dma_transfers, 1);
+    spi_transfer(tx, rx, size);
+#endif  // #ifndef EMULATOR
 }
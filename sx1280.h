@@ -665,6 +665,8 @@ public:
     uint16_t GetFirmwareVersion(void);
     RadioStatus GetStatus(void);
     RadioOperatingModes GetOperatingMode(void) { return OperatingMode; }
+    // Seconds spent in a mode since boot, for the energy accounting
+    double OperatingModeTime(RadioOperatingModes mode);
 
 	// Perform a transfer
     void LoraTxStart(const uint8_t *payload, uint8_t size, TickTime timeout = { RX_TIMEOUT_TICK_SIZE, TX_TIMEOUT_VALUE }, uint8_t offset = 0);
@@ -740,6 +742,9 @@ public:
 	void SetLoraRX(TickTime timeout = { RX_TIMEOUT_TICK_SIZE, RX_TIMEOUT_VALUE });
 	void SetLoraTX(TickTime timeout = { TX_TIMEOUT_TICK_SIZE, TX_TIMEOUT_VALUE });
 
+	// Forget what has been applied so the next configuration is sent in full
+	void InvalidateShadow();
+
 #ifdef EMULATOR
 	void RxDone(const uint8_t *payload, uint8_t size, PacketStatus packetStatus);
 #endif  // #ifdef EMULATOR
@@ -784,6 +789,27 @@ private:
     void WriteBuffer(uint8_t offset, const uint8_t *buffer, uint8_t size);
     void ReadBuffer(uint8_t offset, uint8_t *buffer, uint8_t size);
 
+    // Configuration commands whose last applied payload is remembered, so
+    // re-applying an unchanged setting costs no SPI traffic
+    enum ShadowSlot {
+        SHADOW_PACKET_TYPE,
+        SHADOW_RF_FREQUENCY,
+        SHADOW_TX_PARAMS,
+        SHADOW_BUFFER_BASE_ADDRESS,
+        SHADOW_MODULATION_PARAMS,
+        SHADOW_PACKET_PARAMS,
+        SHADOW_DIO_IRQ_PARAMS,
+        SHADOW_COUNT
+    };
+
+    struct ShadowCommand {
+        bool Valid = false;
+        uint8_t Size = 0;
+        uint8_t Data[8] = { 0 };
+    };
+
+    bool WriteCommandShadowed(ShadowSlot slot, RadioCommand command, const uint8_t *buffer, uint32_t size);
+
     RadioPacketTypes GetPacketType(bool returnLocalCopy);
     void SetPacketType(RadioPacketTypes packetType);
     void SetRfFrequency(uint32_t rfFrequency);
@@ -829,18 +855,33 @@ private:
 	void pin_irq_init();
 	void spi_csel_low();
 	void spi_csel_high();
-    uint8_t spi_write(uint8_t val);
+    void spi_transaction(const uint8_t *header, uint32_t header_size, const uint8_t *payload, uint8_t *response, uint32_t size);
+    void spi_transfer(const uint8_t *tx, uint8_t *rx, uint32_t size);
+    void spi_transfer_dma(const uint8_t *tx, uint8_t *rx, uint32_t size);
+    void spi_dma_init();
+
+    // Opcode plus up to 3 address/offset/NOP bytes precede every payload
+    static constexpr uint32_t SPI_HEADER_MAX = 4;
+    // Payloads at least this long go through the DMAC
+    static constexpr uint32_t SPI_DMA_THRESHOLD = 16;
 
 	static void OnDioIrq_C();
 	static void OnBusyIrq_C();
 
+    void SetOperatingMode(RadioOperatingModes mode);
+
     RadioOperatingModes OperatingMode = MODE_SLEEP;
+    double ModeTime[MODE_CAD + 1] = {};
+    double ModeSince = 0.0;
     RadioPacketTypes PacketType = PACKET_TYPE_NONE;
     RadioLoRaBandwidths LoRaBandwidth = LORA_BW_0200;
 
     bool IrqState = false;
     bool PollingMode = false;
     bool Initialized = false;
+
+    ShadowCommand Shadow[SHADOW_COUNT];
+    int16_t ShadowLnaRegime = -1;
 };
 
 #endif // #ifndef SX1280_H_
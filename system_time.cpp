@@ -21,12 +21,17 @@ TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
 SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 */
 #include "./system_time.h"
+#include "./emulator.h"
 
 #include <atmel_start.h>
 #include <chrono>
+#include <cmath>
 #include <stdio.h>
 
-// Generate system time based on 32-bit cycle count
+// Generate system time based on 32-bit cycle count, extended to 64 bits.
+// The count wraps every 71.6s; if nothing sampled it for longer than that
+// the RTC timer tick, which keeps running at 32768/32 Hz, tells how many
+// wraps were missed.
 #ifndef EMULATOR
 static uint64_t large_dwt_cyccnt() {
     volatile uint32_t *DWT_CYCCNT  = reinterpret_cast<volatile uint32_t *>(0xE0001004);
@@ -34,8 +39,12 @@ static uint64_t large_dwt_cyccnt() {
     volatile uint32_t *SCB_DEMCR   = reinterpret_cast<volatile uint32_t *>(0xE000EDFC);
 
     static uint32_t PREV_DWT_CYCCNT = 0;
+    static uint32_t PREV_RTC_TICK = 0;
     static uint64_t LARGE_DWT_CYCCNT = 0;
 
+    // CPU cycles per RTC timer tick, 60MHz * 32 / 32768 = 1875000 / 32
+    static constexpr uint64_t cycles_per_rtc_tick_x32 = 1875000;
+
     static bool init = false;
     if (!init) {
 
@@ -44,26 +53,38 @@ static uint64_t large_dwt_cyccnt() {
         *DWT_CYCCNT  = 0; // reset the counter
         *DWT_CONTROL = 0; 
         *DWT_CONTROL = *DWT_CONTROL | 1 ; // enable the counter
+        PREV_RTC_TICK = TIMER_0.time;
 
     }
 
     uint32_t CURRENT_DWT_CYCCNT = *DWT_CYCCNT;
+    uint32_t CURRENT_RTC_TICK = TIMER_0.time;
 
-    // wrap around
-    if (PREV_DWT_CYCCNT > CURRENT_DWT_CYCCNT) {
-        LARGE_DWT_CYCCNT += 0x100000000UL;
-    }
+    // cycles since the last sample modulo 2^32, plus the whole wraps the
+    // RTC saw in between, rounded to the nearest
+    uint32_t delta = CURRENT_DWT_CYCCNT - PREV_DWT_CYCCNT;
+    uint64_t elapsed = (static_cast<uint64_t>(CURRENT_RTC_TICK - PREV_RTC_TICK) * cycles_per_rtc_tick_x32) >> 5;
+    uint64_t wraps = elapsed > delta ? ((elapsed - delta + 0x80000000UL) >> 32) : 0;
 
     PREV_DWT_CYCCNT = CURRENT_DWT_CYCCNT;
+    PREV_RTC_TICK = CURRENT_RTC_TICK;
+    LARGE_DWT_CYCCNT += (wraps << 32) + delta;
 
-    return LARGE_DWT_CYCCNT + CURRENT_DWT_CYCCNT;
+    return LARGE_DWT_CYCCNT;
 }
 #endif  // #ifndef EMULATOR
 
 double system_time() {
+    return static_cast<double>(system_ticks()) * (1.0 / static_cast<double>(ticks_per_second));
+}
+
+ticks_t system_ticks() {
 #ifndef EMULATOR
-    return double(static_cast<double>(large_dwt_cyccnt()) / 65536.0) * (1.0 / ( 60000000.0 / 65536.0 ) );
+    return static_cast<ticks_t>(large_dwt_cyccnt());
 #else  // #ifndef EMULATOR
-    return double(clock()) / double(CLOCKS_PER_SEC);
+    if (emulator_headless()) {
+        return static_cast<ticks_t>(llround(emulator_virtual_time() * static_cast<double>(ticks_per_second)));
+    }
+    return static_cast<ticks_t>(clock()) * (ticks_per_second / CLOCKS_PER_SEC);
 #endif  // #ifndef EMULATOR
 }
@@ -23,6 +23,17 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #ifndef SYSTEM_TIME_H_
 #define SYSTEM_TIME_H_
 
+#include <cstdint>
+
 double system_time(); // in seconds
 
+// Monotonic time in CPU cycles since boot. The frame path does all of its
+// time arithmetic on these so it stays off the soft double helpers of the
+// single precision FPU; seconds as double are for slow paths only.
+typedef int64_t ticks_t;
+static constexpr ticks_t ticks_per_second = 60000000;
+static constexpr ticks_t ticks_infinite = INT64_MAX;
+
+ticks_t system_ticks();
+
 #endif /* SYSTEM_TIME_H_ */
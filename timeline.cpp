@@ -26,6 +26,7 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 #include <limits>
 #include <array>
+#include <algorithm>
 
 #include "./model.h"
 #include "./sdd1306.h"
@@ -79,112 +80,203 @@ Timeline &Timeline::instance() {
 }
 
 bool Timeline::Scheduled(Timeline::Span &span) {
-    for (Span *i = head; i ; i = i->next) {
-        if ( i == &span ) {
-            return true;
-        }
-    }
-    return false;
+    return span.scheduled;
 }
 
 void Timeline::Add(Timeline::Span &span) {
-    for (Span *i = head; i ; i = i->next) {
-        if ( i == &span ) {
-            return;
-        }
+    if (span.scheduled) {
+        return;
     }
 
-    span.next = head;
-    head = &span;
+    Queue &q = queues[span.type];
+    span.queued = span.type;
+    span.scheduled = true;
+    span.prev = 0;
+    span.next = q.head;
+    if (q.head) {
+        q.head->prev = &span;
+    }
+    q.head = &span;
+    q.changed = true;
+    q.process = true;
+    if (wakeCallback) {
+        wakeCallback(span.type);
+    }
 }
 
 void Timeline::Remove(Timeline::Span &span) {
-    Span *p = 0;
-    for (Span *i = head; i ; i = i->next) {
-        if ( i == &span ) {
-            if (p) {
-                p->next = i->next;
-            } else {
-                head = i->next;
-            }
-            i->next = 0;
-            i->Done();
-            return;
-        }
-        p = i;
+    if (!span.scheduled) {
+        return;
+    }
+
+    Queue &q = queues[span.queued];
+    if (span.prev) {
+        span.prev->next = span.next;
+    } else {
+        q.head = span.next;
     }
+    if (span.next) {
+        span.next->prev = span.prev;
+    }
+    span.next = 0;
+    span.prev = 0;
+    span.scheduled = false;
+    q.changed = true;
+    q.process = true;
+    if (wakeCallback) {
+        wakeCallback(span.queued);
+    }
+    span.Done();
 }
 
 void Timeline::Process(Span::Type type) {
+    Queue &q = queues[type];
+    ticks_t time = Model::instance().Ticks();
+
+    // Nothing to start since the last pass and nothing has expired yet
+    if (!q.process && time <= q.next_expiry) {
+        return;
+    }
+
     static std::array<Span *, 64> collected;
     size_t collected_num = 0;
-    double time = Model::instance().Time();
-    Span *p = 0;
-    for (Span *i = head; i ; i = i->next) {
-        if (i->type == type) {
-            if ((i->time) >= time && !i->active) {
-                i->active = true;
-                i->Start();
-            }
-            if (i->duration != std::numeric_limits<double>::infinity() && ((i->time + i->duration) < time)) {
-                if (p) {
-                    p->next = i->next;
+    q.next_expiry = ticks_infinite;
+    for (Span *i = q.head; i ; ) {
+        Span *n = i->next;
+        if ((i->time) >= time && !i->active) {
+            i->active = true;
+            i->Start();
+        }
+        if (!i->Infinite()) {
+            if (i->End() < time) {
+                if (i->prev) {
+                    i->prev->next = i->next;
                 } else {
-                    head = i->next;
+                    q.head = i->next;
+                }
+                if (i->next) {
+                    i->next->prev = i->prev;
                 }
+                i->scheduled = false;
+                q.changed = true;
                 collected[collected_num++] = i;
+                if (collected_num == collected.size()) {
+                    break;
+                }
+            } else {
+                q.next_expiry = std::min(q.next_expiry, i->End());
             }
         }
-        p = i;
+        i = n;
     }
+    q.process = collected_num == collected.size();
     for (size_t c = 0; c < collected_num; c++) {
         collected[c]->next = 0;
+        collected[c]->prev = 0;
         collected[c]->Done();
     }
 }
 
-Timeline::Span &Timeline::Top(Span::Type type) const {
-    static Timeline::Span empty;
-    double time = Model::instance().Time();
-    for (Span *i = head; i ; i = i->next) {
-        if ((i->type == type) &&
-            (i->time <= time) &&
-            ( (i->duration == std::numeric_limits<double>::infinity()) || ((i->time + i->duration) > time) ) ) {
-            return *i;
+Timeline::Queue &Timeline::Refresh(Span::Type type) const {
+    Queue &q = queues[type];
+    ticks_t time = Model::instance().Ticks();
+    // Spans may push their own timeout out while scheduled, so the cached
+    // answers are rechecked; that is O(1)
+    auto covers = [time](const Span *i) {
+        return !i || ((i->time <= time) && (i->End() > time));
+    };
+    if (!q.changed && time >= q.cache_time && time < q.cache_until && covers(q.top) && covers(q.below)) {
+        return q;
+    }
+
+    q.top = 0;
+    q.below = 0;
+    q.cache_time = time;
+    q.cache_until = ticks_infinite;
+    for (Span *i = q.head; i ; i = i->next) {
+        ticks_t end = i->End();
+        bool infinite = i->Infinite();
+        if (i->time > time) {
+            q.cache_until = std::min(q.cache_until, i->time);
+        } else if (!infinite && end <= time) {
+            // Shortened in place after the last pass, so Process has not
+            // seen it end yet
+            q.process = true;
+        } else {
+            if (!infinite) {
+                q.cache_until = std::min(q.cache_until, end);
+            }
+            if (!q.top) {
+                q.top = i;
+            } else if (!q.below) {
+                q.below = i;
+            }
         }
     }
-    return empty;
+    q.changed = false;
+    return q;
+}
+
+Timeline::Span &Timeline::Top(Span::Type type) const {
+    static Timeline::Span empty;
+    const Queue &q = Refresh(type);
+    return q.top ? *q.top : empty;
 }
 
 Timeline::Span &Timeline::Below(Span *context, Span::Type type) const {
     static Timeline::Span empty;
-    double time = Model::instance().Time();
-    for (Span *i = head; i ; i = i->next) {
-        if (i == context) {
-            continue;
-        }
-        if ((i->type == type) &&
-            (i->time <= time) &&
-            ( (i->duration == std::numeric_limits<double>::infinity()) || ((i->time + i->duration) > time) ) ) {
-            return *i;
-        }
+    const Queue &q = Refresh(type);
+    Span *below = (context == q.top) ? q.below : q.top;
+    return below ? *below : empty;
+}
+
+ticks_t Timeline::NextDeadline(Span::Type type) const {
+    Queue &q = Refresh(type);
+    if (q.process) {
+        return 0;
+    }
+    ticks_t time = Model::instance().Ticks();
+    // Spans can move their own end while scheduled, so those are not
+    // taken from the cache. ticks_infinite stays infinite.
+    auto until = [time](ticks_t at) {
+        return at == ticks_infinite ? ticks_infinite : at - time;
+    };
+    ticks_t next = until(std::min(q.cache_until, q.next_expiry));
+    if (q.top) {
+        next = std::min(next, until(q.top->End()));
+        next = std::min(next, q.top->Next());
     }
-    return empty;
+    if (q.below) {
+        next = std::min(next, until(q.below->End()));
+    }
+    return std::max(next, ticks_t(0));
+}
+
+float Timeline::Span::Elapsed() const {
+    return static_cast<float>(Model::instance().Ticks() - time) * (1.0f / static_cast<float>(ticks_per_second));
+}
+
+float Timeline::Span::Remaining() const {
+    return static_cast<float>(End() - Model::instance().Ticks()) * (1.0f / static_cast<float>(ticks_per_second));
+}
+
+float Timeline::Span::Progress() const {
+    return static_cast<float>(Model::instance().Ticks() - time) / static_cast<float>(duration);
 }
 
-bool Timeline::Span::InBeginPeriod(float &interpolation, float period_length) {
-    double now = Model::instance().Time();
-    if ( (now - time) < static_cast<double>(period_length)) {
-        interpolation = static_cast<float>((now - time) * (1.0 / static_cast<double>(period_length)));
+bool Timeline::Span::InBeginPeriod(float &interpolation, ticks_t period_length) {
+    ticks_t now = Model::instance().Ticks();
+    if ( (now - time) < period_length) {
+        interpolation = static_cast<float>(now - time) * (1.0f / static_cast<float>(period_length));
         return true;
     }
     return false;
 }
 
-bool Timeline::Span::InEndPeriod(float &interpolation, float period_length) {
-    double now = Model::instance().Time();
-    if ( ((time + duration) - now) < static_cast<double>(period_length)) {
-        interpolation = 1.0f - static_cast<float>(((time + duration) - now) * (1.0 / static_cast<double>(period_length)));
+bool Timeline::Span::InEndPeriod(float &interpolation, ticks_t period_length) {
+    ticks_t now = Model::instance().Ticks();
+    if ( (End() - now) < period_length) {
+        interpolation = 1.0f - static_cast<float>(End() - now) * (1.0f / static_cast<float>(period_length));
         return true;
     }
     return false;
@@ -25,6 +25,10 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 #include <cstdint>
 #include <functional>
+#include <limits>
+
+#include "./emulator.h"
+#include "./system_time.h"
 
 class Quad {
 public:
@@ -55,37 +59,58 @@ public:
         };
 
         Type type = None;
-        double time = 0.0;
-        double duration = 0.0;
+        ticks_t time = 0;
+        ticks_t duration = 0;
 
         std::function<void (Span &span)> startFunc;
         std::function<void (Span &span, Span &below)> calcFunc;
         std::function<void (Span &span)> commitFunc;
         std::function<void (Span &span)> doneFunc;
 
+        // Ticks until the span has to be calculated again. Without one
+        // the span is calculated on every pass of its timer task; Idle
+        // spans only change on events like switches or radio packets.
+        std::function<ticks_t (Span &span)> nextFunc;
+
         std::function<void (Span &span)> switch1Func;
         std::function<void (Span &span)> switch2Func;
         std::function<void (Span &span)> switch3Func;
 
-        void Start() { if (startFunc) startFunc(*this); }
-        void Calc() { if (calcFunc) calcFunc(*this, Timeline::instance().Below(this, type)); }
-        void Commit() { if (commitFunc) commitFunc(*this); }
-        void Done() { if (doneFunc) doneFunc(*this); }
+        void Start() { if (startFunc) { EMULATOR_COUNT(function_calls, 1); startFunc(*this); } }
+        void Calc() { if (calcFunc) { EMULATOR_COUNT(function_calls, 1); calcFunc(*this, Timeline::instance().Below(this, type)); } }
+        void Commit() { if (commitFunc) { EMULATOR_COUNT(function_calls, 1); commitFunc(*this); } }
+        void Done() { if (doneFunc) { EMULATOR_COUNT(function_calls, 1); doneFunc(*this); } }
+        ticks_t Next() { if (nextFunc) { EMULATOR_COUNT(function_calls, 1); return nextFunc(*this); } return 0; }
+
+        static ticks_t Idle(Span &) { return ticks_infinite; }
+
+        // Spans with a duration of ticks_infinite run until removed
+        bool Infinite() const { return duration == ticks_infinite; }
+        ticks_t End() const { return Infinite() ? ticks_infinite : time + duration; }
+
+        // Seconds since the start and until the end at the model time, and
+        // the fraction of the duration passed, for animations
+        float Elapsed() const;
+        float Remaining() const;
+        float Progress() const;
         
-        void ProcessSwitch1() { if (switch1Func) switch1Func(*this); }
-        void ProcessSwitch2() { if (switch2Func) switch2Func(*this); }
-        void ProcessSwitch3() { if (switch3Func) switch3Func(*this); }
+        void ProcessSwitch1() { if (switch1Func) { EMULATOR_COUNT(function_calls, 1); switch1Func(*this); } }
+        void ProcessSwitch2() { if (switch2Func) { EMULATOR_COUNT(function_calls, 1); switch2Func(*this); } }
+        void ProcessSwitch3() { if (switch3Func) { EMULATOR_COUNT(function_calls, 1); switch3Func(*this); } }
 
         bool Valid() const { return type != None; }
 
-        bool InBeginPeriod(float &interpolation, float period_length = 0.25f);
-        bool InEndPeriod(float &interpolation, float period_length = 0.25f);
+        bool InBeginPeriod(float &interpolation, ticks_t period_length = ticks_per_second / 4);
+        bool InEndPeriod(float &interpolation, ticks_t period_length = ticks_per_second / 4);
 
     private:
 
         friend class Timeline;
         bool active = false;
+        bool scheduled = false;
+        Type queued = None;
         Span *next = 0;
+        Span *prev = 0;
     };
 
     static Timeline &instance();
@@ -94,6 +119,12 @@ public:
     void Remove(Timeline::Span &span);
     bool Scheduled(Timeline::Span &span);
 
+    // Ticks until spans of this type need processing again: the next
+    // frame of the top span or the next span start or end. Add and Remove
+    // call the wake callback so an idle timer task can be restarted.
+    ticks_t NextDeadline(Span::Type type) const;
+    void SetWakeCallback(std::function<void (Span::Type type)> callback) { wakeCallback = callback; }
+
     void ProcessEffect();
     Span &TopEffect() const;
 
@@ -107,11 +138,34 @@ public:
     Span &TopMeasurement() const;
 
 private:
+#ifdef EMULATOR
+    friend class Benchmark;
+#endif  // #ifdef EMULATOR
+
     void Process(Span::Type type);
     Span &Top(Span::Type type) const;
     Span &Below(Span *context, Span::Type type) const;
 
-    Span *head = 0;
+    // One list per span type, most recently added first, which is also the
+    // priority order. Top and Below are cached until the list changes or
+    // the time passes the next span start or end.
+    struct Queue {
+        Span *head = 0;
+        bool changed = true;
+        bool process = true;
+        ticks_t next_expiry = 0;
+        ticks_t cache_time = 0;
+        ticks_t cache_until = 0;
+        Span *top = 0;
+        Span *below = 0;
+    };
+
+    static constexpr size_t queueCount = Span::Measurement + 1;
+    mutable Queue queues[queueCount];
+
+    Queue &Refresh(Span::Type type) const;
+
+    std::function<void (Span::Type type)> wakeCallback;
 
     void init();
     bool initialized = false;
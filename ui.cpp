@@ -31,6 +31,7 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include "./model.h"
 #include "./sdd1306.h"
 #include "./bq25895.h"
+#include "./battery.h"
 #include "./timeline.h"
 #include "./leds.h"
 #include "./commands.h"
@@ -63,16 +64,15 @@ static void FlipAnimation(Timeline::Span *parent) {
 	}
 
 	flipSpan.type = Timeline::Span::Display;
-	flipSpan.time = Model::instance().Time();
-	flipSpan.duration = 0.25; // timeout
+	flipSpan.time = Model::instance().Ticks();
+	flipSpan.duration = ticks_per_second / 4; // timeout
 	flipSpan.startFunc = [=](Timeline::Span &) {
 		SDD1306::instance().SetVerticalShift(0);
 		SDD1306::instance().SetBootScreen(false, 0);
 		SDD1306::instance().Display();
 	};
 	flipSpan.calcFunc = [=](Timeline::Span &span, Timeline::Span &below) {
-		double now = Model::instance().Time();
-		float delta = 1.0f - static_cast<float>( ( (span.time + span.duration) - now ) / span.duration );
+		float delta = span.Progress();
 		if (delta > 0.5f) {
 			below.Calc();
 			delta = 1.0f - (2.0f * (delta - 0.5f));
@@ -108,8 +108,8 @@ UI &UI::instance() {
 void UI::enterSendMessage(Timeline::Span &parent) {
     static Timeline::Span s;
     s.type = Timeline::Span::Display;
-    s.time = Model::instance().Time();
-    s.duration = 10.0; // timeout
+    s.time = Model::instance().Ticks();
+    s.duration = 10 * ticks_per_second; // timeout
 
     static int32_t currentMessage = 0;
 
@@ -129,11 +129,12 @@ void UI::enterSendMessage(Timeline::Span &parent) {
     s.commitFunc = [=](Timeline::Span &) {
         SDD1306::instance().Display();
     };
+    s.nextFunc = Timeline::Span::Idle;
     s.doneFunc = [=](Timeline::Span &) {
 		FlipAnimation(&s);
     };
     s.switch1Func = [=](Timeline::Span &span) {
-        span.time = Model::instance().Time(); // reset timeout
+        span.time = Model::instance().Ticks(); // reset timeout
         currentMessage --;
         if (currentMessage < -1) {
             currentMessage = Model::instance().MessageCount() - 1;
@@ -142,7 +143,7 @@ void UI::enterSendMessage(Timeline::Span &parent) {
 		Model::instance().save();
     };
     s.switch2Func = [=](Timeline::Span &span) {
-        span.time = Model::instance().Time(); // reset timeout
+        span.time = Model::instance().Ticks(); // reset timeout
         currentMessage ++;
         if (currentMessage >= static_cast<int32_t>(Model::instance().MessageCount())) {
             currentMessage = -1;
@@ -179,8 +180,8 @@ void UI::enterChangeMessageColor(Timeline::Span &parent) {
     led_control::PerformMessageColorDisplay(colors::rgb8(colors::rgb(currentColor)));
 
     s.type = Timeline::Span::Display;
-    s.time = Model::instance().Time();
-    s.duration = 10.0; // timeout
+    s.time = Model::instance().Ticks();
+    s.duration = 10 * ticks_per_second; // timeout
     s.calcFunc = [=](Timeline::Span &, Timeline::Span &) {
         char str[max_string_length];
         snprintf(str, max_string_length, " H\xc2\xd1%03d", static_cast<int>(currentColor.h * 360.f));
@@ -210,19 +211,20 @@ void UI::enterChangeMessageColor(Timeline::Span &parent) {
     s.commitFunc = [=](Timeline::Span &) {
         SDD1306::instance().Display();
     };
+    s.nextFunc = Timeline::Span::Idle;
     s.doneFunc = [=](Timeline::Span &) {
 		FlipAnimation(&s);
         led_control::PerformMessageColorDisplay(colors::rgb8(colors::rgb(currentColor)), true);
     };
     s.switch1Func = [=](Timeline::Span &span) {
-        span.time = Model::instance().Time(); // reset timeout
+        span.time = Model::instance().Ticks(); // reset timeout
         currentSelection --;
         if (currentSelection < 0) {
             currentSelection = 3;
         }
     };
     s.switch2Func = [=](Timeline::Span &span) {
-        span.time = Model::instance().Time(); // reset timeout
+        span.time = Model::instance().Ticks(); // reset timeout
         currentSelection ++;
         if (currentSelection > 3) {
             currentSelection = 0;
@@ -231,10 +233,10 @@ void UI::enterChangeMessageColor(Timeline::Span &parent) {
     
     s.switch3Func = [=](Timeline::Span &span) {
         const float step_size = 0.05f;
-        span.time = Model::instance().Time(); // reset timeout
+        span.time = Model::instance().Ticks(); // reset timeout
         switch(currentSelection) {
             case 0: {
-                span.time = Model::instance().Time(); // reset timeout
+                span.time = Model::instance().Ticks(); // reset timeout
                 currentColor.h += step_size / 3.6f;
                 if (currentColor.h > 1.01f) {
                     currentColor.h = 0.0f;
@@ -242,7 +244,7 @@ void UI::enterChangeMessageColor(Timeline::Span &parent) {
                 led_control::PerformMessageColorDisplay(colors::rgb8(colors::rgb(currentColor)));
             } break;
             case 1: {
-                span.time = Model::instance().Time(); // reset timeout
+                span.time = Model::instance().Ticks(); // reset timeout
                 currentColor.s += step_size;
                 if (currentColor.s > 1.01f) {
                     currentColor.s = 0.0f;
@@ -250,7 +252,7 @@ void UI::enterChangeMessageColor(Timeline::Span &parent) {
                 led_control::PerformMessageColorDisplay(colors::rgb8(colors::rgb(currentColor)));
             } break;
             case 2: {
-                span.time = Model::instance().Time(); // reset timeout
+                span.time = Model::instance().Ticks(); // reset timeout
                 currentColor.v += step_size ;
                 if (currentColor.v >= 1.01f) {
                     currentColor.v = 0.0f;
@@ -290,8 +292,8 @@ void UI::enterChangeMessages(Timeline::Span &parent) {
     selectedMessage = 0;
     
     s.type = Timeline::Span::Display;
-    s.time = Model::instance().Time();
-    s.duration = 10.0; // timeout
+    s.time = Model::instance().Ticks();
+    s.duration = 10 * ticks_per_second; // timeout
     s.calcFunc = [=](Timeline::Span &, Timeline::Span &) {
         if (currentMode == 0) {
             char str[max_string_length];
@@ -319,11 +321,12 @@ void UI::enterChangeMessages(Timeline::Span &parent) {
     s.commitFunc = [=](Timeline::Span &) {
         SDD1306::instance().Display();
     };
+    s.nextFunc = Timeline::Span::Idle;
     s.doneFunc = [=](Timeline::Span &) {
 		FlipAnimation(&s);
     };
     s.switch1Func = [=](Timeline::Span &span) {
-        span.time = Model::instance().Time(); // reset timeout
+        span.time = Model::instance().Ticks(); // reset timeout
         if (currentMode == 0) {
             selectedMessage --;
             if (selectedMessage < 0) {
@@ -337,7 +340,7 @@ void UI::enterChangeMessages(Timeline::Span &parent) {
         }
     };
     s.switch2Func = [=](Timeline::Span &span) {
-        span.time = Model::instance().Time(); // reset timeout
+        span.time = Model::instance().Ticks(); // reset timeout
         if (currentMode == 0) {
             selectedMessage ++;
             if (selectedMessage >= static_cast<int32_t>(Model::MessageCount())) {
@@ -351,7 +354,7 @@ void UI::enterChangeMessages(Timeline::Span &parent) {
         }
     };
     s.switch3Func = [=](Timeline::Span &span) {
-        span.time = Model::instance().Time(); // reset timeout
+        span.time = Model::instance().Ticks(); // reset timeout
         if (currentMode == 0) {
             currentMode = 1;
             strncpy(currentMessage, Model::instance().Message(static_cast<size_t>(selectedMessage)), 12);
@@ -359,7 +362,7 @@ void UI::enterChangeMessages(Timeline::Span &parent) {
                 currentMessage[c] = std::min(static_cast<char>(0x5f), std::max(static_cast<char>(0x20), currentMessage[c])); 
             }
         } else {
-            span.time = Model::instance().Time(); // reset timeout
+            span.time = Model::instance().Ticks(); // reset timeout
             if (currentChar == Model::MessageLength()) {
                 for (int32_t c=11; c>=0; c--) {
                     if (currentMessage[c] == 0x20) {
@@ -406,8 +409,8 @@ void UI::enterChangeName(Timeline::Span &parent) {
     currentChar = 0;
 
     s.type = Timeline::Span::Display;
-    s.time = Model::instance().Time();
-    s.duration = 10.0; // timeout
+    s.time = Model::instance().Ticks();
+    s.duration = 10 * ticks_per_second; // timeout
     s.calcFunc = [=](Timeline::Span &, Timeline::Span &) {
         char str[max_string_length];
         snprintf(str, max_string_length, "%s", currentName);
@@ -427,25 +430,26 @@ void UI::enterChangeName(Timeline::Span &parent) {
     s.commitFunc = [=](Timeline::Span &) {
         SDD1306::instance().Display();
     };
+    s.nextFunc = Timeline::Span::Idle;
     s.doneFunc = [=](Timeline::Span &) {
 		FlipAnimation(&s);
     };
     s.switch1Func = [=](Timeline::Span &span) {
-        span.time = Model::instance().Time(); // reset timeout
+        span.time = Model::instance().Ticks(); // reset timeout
         currentChar --;
         if (currentChar < 0) {
             currentChar = 12;
         }
     };
     s.switch2Func = [=](Timeline::Span &span) {
-        span.time = Model::instance().Time(); // reset timeout
+        span.time = Model::instance().Ticks(); // reset timeout
         currentChar ++;
         if (currentChar >= 13) {
             currentChar = 0;
         }
     };
     s.switch3Func = [=](Timeline::Span &span) {
-        span.time = Model::instance().Time(); // reset timeout
+        span.time = Model::instance().Ticks(); // reset timeout
         if (currentChar == 12) {
             for (int32_t c=11; c>=0; c--) {
                 if (currentName[c] == 0x20) {
@@ -488,8 +492,8 @@ void UI::enterChangeBirdColor(Timeline::Span &parent) {
     led_control::PerformColorBirdDisplay(colors::rgb8(colors::rgb(currentColor)));
 
     s.type = Timeline::Span::Display;
-    s.time = Model::instance().Time();
-    s.duration = 10.0; // timeout
+    s.time = Model::instance().Ticks();
+    s.duration = 10 * ticks_per_second; // timeout
     s.calcFunc = [=](Timeline::Span &, Timeline::Span &) {
         char str[max_string_length];
         snprintf(str, max_string_length, " H\xc2\xd1%03d", static_cast<int>(currentColor.h * 360.f));
@@ -519,19 +523,20 @@ void UI::enterChangeBirdColor(Timeline::Span &parent) {
     s.commitFunc = [=](Timeline::Span &) {
         SDD1306::instance().Display();
     };
+    s.nextFunc = Timeline::Span::Idle;
     s.doneFunc = [=](Timeline::Span &) {
 		FlipAnimation(&s);
         led_control::PerformColorBirdDisplay(colors::rgb8(colors::rgb(currentColor)), true);
     };
     s.switch1Func = [=](Timeline::Span &span) {
-        span.time = Model::instance().Time(); // reset timeout
+        span.time = Model::instance().Ticks(); // reset timeout
         currentSelection --;
         if (currentSelection < 0) {
             currentSelection = 3;
         }
     };
     s.switch2Func = [=](Timeline::Span &span) {
-        span.time = Model::instance().Time(); // reset timeout
+        span.time = Model::instance().Ticks(); // reset timeout
         currentSelection ++;
         if (currentSelection > 3) {
             currentSelection = 0;
@@ -539,10 +544,10 @@ void UI::enterChangeBirdColor(Timeline::Span &parent) {
     };
     s.switch3Func = [=](Timeline::Span &span) {
         const float step_size = 0.05f;
-        span.time = Model::instance().Time(); // reset timeout
+        span.time = Model::instance().Ticks(); // reset timeout
         switch(currentSelection) {
             case 0: {
-                span.time = Model::instance().Time(); // reset timeout
+                span.time = Model::instance().Ticks(); // reset timeout
                 currentColor.h += step_size / 3.6f;
                 if (currentColor.h > 1.01f) {
                     currentColor.h = 0.0f;
@@ -550,7 +555,7 @@ void UI::enterChangeBirdColor(Timeline::Span &parent) {
                 led_control::PerformColorBirdDisplay(colors::rgb8(colors::rgb(currentColor)));
             } break;
             case 1: {
-                span.time = Model::instance().Time(); // reset timeout
+                span.time = Model::instance().Ticks(); // reset timeout
                 currentColor.s += step_size;
                 if (currentColor.s > 1.01f) {
                     currentColor.s = 0.0f;
@@ -558,7 +563,7 @@ void UI::enterChangeBirdColor(Timeline::Span &parent) {
                 led_control::PerformColorBirdDisplay(colors::rgb8(colors::rgb(currentColor)));
             } break;
             case 2: {
-                span.time = Model::instance().Time(); // reset timeout
+                span.time = Model::instance().Ticks(); // reset timeout
                 currentColor.v += step_size;
                 if (currentColor.v > 1.01f) {
                     currentColor.v = 0.0f;
@@ -592,8 +597,8 @@ void UI::enterChangeRingColor(Timeline::Span &parent) {
     led_control::PerformColorRingDisplay(colors::rgb8(colors::rgb(currentColor)));
 
     s.type = Timeline::Span::Display;
-    s.time = Model::instance().Time();
-    s.duration = 10.0; // timeout
+    s.time = Model::instance().Ticks();
+    s.duration = 10 * ticks_per_second; // timeout
     s.calcFunc = [=](Timeline::Span &, Timeline::Span &) {
         char str[max_string_length];
         snprintf(str, max_string_length, " H\xc2\xd1%03d", static_cast<int>(currentColor.h * 360.f));
@@ -623,19 +628,20 @@ void UI::enterChangeRingColor(Timeline::Span &parent) {
     s.commitFunc = [=](Timeline::Span &) {
         SDD1306::instance().Display();
     };
+    s.nextFunc = Timeline::Span::Idle;
     s.doneFunc = [=](Timeline::Span &) {
 		FlipAnimation(&s);
         led_control::PerformColorRingDisplay(colors::rgb8(colors::rgb(currentColor)), true);
     };
     s.switch1Func = [=](Timeline::Span &span) {
-        span.time = Model::instance().Time(); // reset timeout
+        span.time = Model::instance().Ticks(); // reset timeout
         currentSelection --;
         if (currentSelection < 0) {
             currentSelection = 3;
         }
     };
     s.switch2Func = [=](Timeline::Span &span) {
-        span.time = Model::instance().Time(); // reset timeout
+        span.time = Model::instance().Ticks(); // reset timeout
         currentSelection ++;
         if (currentSelection > 3) {
             currentSelection = 0;
@@ -643,10 +649,10 @@ void UI::enterChangeRingColor(Timeline::Span &parent) {
     };
     s.switch3Func = [=](Timeline::Span &span) {
         const float step_size = 0.05f;
-        span.time = Model::instance().Time(); // reset timeout
+        span.time = Model::instance().Ticks(); // reset timeout
         switch(currentSelection) {
             case 0: {
-                span.time = Model::instance().Time(); // reset timeout
+                span.time = Model::instance().Ticks(); // reset timeout
                 currentColor.h += step_size / 3.6f;
                 if (currentColor.h > 1.01f) {
                     currentColor.h = 0.0f;
@@ -654,7 +660,7 @@ void UI::enterChangeRingColor(Timeline::Span &parent) {
                 led_control::PerformColorRingDisplay(colors::rgb8(colors::rgb(currentColor)));
             } break;
             case 1: {
-                span.time = Model::instance().Time(); // reset timeout
+                span.time = Model::instance().Ticks(); // reset timeout
                 currentColor.s += step_size;
                 if (currentColor.s > 1.01f) {
                     currentColor.s = 0.0f;
@@ -662,7 +668,7 @@ void UI::enterChangeRingColor(Timeline::Span &parent) {
                 led_control::PerformColorRingDisplay(colors::rgb8(colors::rgb(currentColor)));
             } break;
             case 2: {
-                span.time = Model::instance().Time(); // reset timeout
+                span.time = Model::instance().Ticks(); // reset timeout
                 currentColor.v += step_size;
                 if (currentColor.v > 1.01f) {
                     currentColor.v = 0.0f;
@@ -685,8 +691,8 @@ void UI::enterChangeRingColor(Timeline::Span &parent) {
 void UI::enterRadioOnOff(Timeline::Span &parent) {
     static Timeline::Span s;
     s.type = Timeline::Span::Display;
-    s.time = Model::instance().Time();
-    s.duration = 10.0; // timeout
+    s.time = Model::instance().Ticks();
+    s.duration = 10 * ticks_per_second; // timeout
 
 
     static int32_t currentSelection = 0;
@@ -703,18 +709,19 @@ void UI::enterRadioOnOff(Timeline::Span &parent) {
     s.commitFunc = [=](Timeline::Span &) {
         SDD1306::instance().Display();
     };
+    s.nextFunc = Timeline::Span::Idle;
     s.doneFunc = [=](Timeline::Span &) {
 		FlipAnimation(&s);
     };
     s.switch1Func = [=](Timeline::Span &span) {
-        span.time = Model::instance().Time(); // reset timeout
+        span.time = Model::instance().Ticks(); // reset timeout
         currentSelection --;
         if (currentSelection < 0) {
             currentSelection = 1;
         }
     };
     s.switch2Func = [=](Timeline::Span &span) {
-        span.time = Model::instance().Time(); // reset timeout
+        span.time = Model::instance().Ticks(); // reset timeout
         currentSelection ++;
         if (currentSelection > 1) {
             currentSelection = 0;
@@ -733,8 +740,8 @@ void UI::enterRadioOnOff(Timeline::Span &parent) {
 void UI::enterFlashlight(Timeline::Span &parent) {
     static Timeline::Span s;
     s.type = Timeline::Span::Display;
-    s.time = Model::instance().Time();
-    s.duration = std::numeric_limits<double>::infinity(); // timeout
+    s.time = Model::instance().Ticks();
+    s.duration = ticks_infinite; // timeout
 	led_control::PerformFlashlight(colors::rgb8(255,255,255),false);
  	SDD1306::instance().Invert();
     s.calcFunc = [=](Timeline::Span &, Timeline::Span &) {
@@ -744,6 +751,7 @@ void UI::enterFlashlight(Timeline::Span &parent) {
     s.commitFunc = [=](Timeline::Span &) {
         SDD1306::instance().Display();
     };
+    s.nextFunc = Timeline::Span::Idle;
     s.doneFunc = [=](Timeline::Span &) {
 		FlipAnimation(&s);
     };
@@ -773,8 +781,8 @@ void UI::enterFlashlight(Timeline::Span &parent) {
 void UI::enterShowVersion(Timeline::Span &parent) {
     static Timeline::Span s;
     s.type = Timeline::Span::Display;
-    s.time = Model::instance().Time();
-    s.duration = 10.0; // timeout
+    s.time = Model::instance().Ticks();
+    s.duration = 10 * ticks_per_second; // timeout
     s.calcFunc = [=](Timeline::Span &, Timeline::Span &) {
         char str[max_string_length];
         snprintf(str, max_string_length, "    %01d.%02d    ", static_cast<int>(version_number), static_cast<int>(build_number));
@@ -785,6 +793,53 @@ void UI::enterShowVersion(Timeline::Span &parent) {
     s.commitFunc = [=](Timeline::Span &) {
         SDD1306::instance().Display();
     };
+    s.nextFunc = Timeline::Span::Idle;
+    s.doneFunc = [=](Timeline::Span &) {
+		FlipAnimation(&s);
+    };
+    s.switch1Func = [=](Timeline::Span &span) {
+        Timeline::instance().Remove(span);
+        Timeline::instance().ProcessDisplay();
+    };
+    s.switch2Func = [=](Timeline::Span &span) {
+        Timeline::instance().Remove(span);
+        Timeline::instance().ProcessDisplay();
+    };
+    s.switch3Func = [=](Timeline::Span &span) {
+        Timeline::instance().Remove(span);
+        Timeline::instance().ProcessDisplay();
+    };
+    Timeline::instance().Remove(parent);
+    Timeline::instance().Add(s);
+}
+
+void UI::enterShowBattery(Timeline::Span &parent) {
+    static Timeline::Span s;
+    s.type = Timeline::Span::Display;
+    s.time = Model::instance().Ticks();
+    s.duration = 10 * ticks_per_second; // timeout
+    s.calcFunc = [=](Timeline::Span &, Timeline::Span &) {
+        char str[max_string_length];
+        double runtime = Battery::instance().Runtime();
+        if (Battery::instance().Charging()) {
+            snprintf(str, max_string_length, "Charging    ");
+        } else if (runtime < 0.0) {
+            snprintf(str, max_string_length, "Left  --    ");
+        } else {
+            int32_t minutes = static_cast<int32_t>(runtime / 60.0);
+            snprintf(str, max_string_length, "Left %2dh%02dm ", static_cast<int>(std::min(minutes / 60, 99)), static_cast<int>(minutes % 60));
+        }
+        SDD1306::instance().PlaceUTF8String(0, 0, str);
+        snprintf(str, max_string_length, "%3d%%  %sV ",
+            static_cast<int>(Battery::instance().StateOfCharge() * 100.0f),
+            Model::instance().BatteryVoltageString().c_str());
+        SDD1306::instance().PlaceUTF8String(0, 1, str);
+    };
+    s.commitFunc = [=](Timeline::Span &) {
+        SDD1306::instance().Display();
+    };
+    // Redrawn when the ADC task wakes the display
+    s.nextFunc = Timeline::Span::Idle;
     s.doneFunc = [=](Timeline::Span &) {
 		FlipAnimation(&s);
     };
@@ -814,8 +869,8 @@ void UI::enterDebug(Timeline::Span &parent) {
     const int32_t maxSelection = 0x12;
 
     s.type = Timeline::Span::Display;
-    s.time = Model::instance().Time();
-    s.duration = 10.0; // timeout
+    s.time = Model::instance().Ticks();
+    s.duration = 10 * ticks_per_second; // timeout
     s.calcFunc = [=](Timeline::Span &, Timeline::Span &) {
         char str[max_string_length];
         snprintf(str, max_string_length, "%02d          ", static_cast<int>(currentSelection));
@@ -832,18 +887,19 @@ void UI::enterDebug(Timeline::Span &parent) {
     s.commitFunc = [=](Timeline::Span &) {
         SDD1306::instance().Display();
     };
+    s.nextFunc = Timeline::Span::Idle;
     s.doneFunc = [=](Timeline::Span &) {
 		FlipAnimation(&s);
     };
     s.switch1Func = [=](Timeline::Span &span) {
-        span.time = Model::instance().Time(); // reset timeout
+        span.time = Model::instance().Ticks(); // reset timeout
         currentSelection --;
         if (currentSelection < 0) {
             currentSelection = maxSelection;
         }
     };
     s.switch2Func = [=](Timeline::Span &span) {
-        span.time = Model::instance().Time(); // reset timeout
+        span.time = Model::instance().Ticks(); // reset timeout
         currentSelection ++;
         if (currentSelection >= maxSelection) {
             currentSelection = 0;
@@ -865,8 +921,8 @@ void UI::enterResetEverything(Timeline::Span &parent) {
     currentSelection = 0;
 
     s.type = Timeline::Span::Display;
-    s.time = Model::instance().Time();
-    s.duration = 10.0; // timeout
+    s.time = Model::instance().Ticks();
+    s.duration = 10 * ticks_per_second; // timeout
     s.calcFunc = [=](Timeline::Span &, Timeline::Span &) {
         char str[max_string_length];
         snprintf(str, max_string_length, "Are U Sure? ");
@@ -887,18 +943,19 @@ void UI::enterResetEverything(Timeline::Span &parent) {
     s.commitFunc = [=](Timeline::Span &) {
         SDD1306::instance().Display();
     };
+    s.nextFunc = Timeline::Span::Idle;
     s.doneFunc = [=](Timeline::Span &) {
 		FlipAnimation(&s);
     };
     s.switch1Func = [=](Timeline::Span &span) {
-        span.time = Model::instance().Time(); // reset timeout
+        span.time = Model::instance().Ticks(); // reset timeout
         currentSelection --;
         if (currentSelection < 0) {
             currentSelection = 1;
         }
     };
     s.switch2Func = [=](Timeline::Span &span) {
-        span.time = Model::instance().Time(); // reset timeout
+        span.time = Model::instance().Ticks(); // reset timeout
         currentSelection ++;
         if (currentSelection > 1) {
             currentSelection = 0;
@@ -923,48 +980,51 @@ void UI::enterPrefs(Timeline::Span &) {
 
     static int32_t currentPage = 0;
     
-    const int32_t maxPage = 9;
+    const int32_t maxPage = 10;
     
     const char *pageText[] = {
-        "01/11 Send  "      // 1
+        "01/12 Send  "      // 1
         "  Message!  ",
 
-        "02/11 Change"      // 2
+        "02/12 Change"      // 2
         "Message Col.",
 
-        "03/11 Change"      // 3
+        "03/12 Change"      // 3
         "  Messages  ",
 
-        "04/11 Change"      // 4
+        "04/12 Change"      // 4
         "    Name    ",
 
-        "05/11 Change"      // 5
+        "05/12 Change"      // 5
         " Bird Color ",
 
-        "06/11 Change"      // 6
+        "06/12 Change"      // 6
         " Ring Color ",
 
-        "07/11 Radio "       // 7
+        "07/12 Radio "       // 7
         "   On/Off   ",
 
-        "08/11 Enable"      // 8
+        "08/12 Enable"      // 8
         " Flashlight ",
 
-        "09/11 Show  "      // 8
+        "09/12 Show  "      // 8
         "  Version   ",
 
-        "10/11 Debug "      // 9
+        "10/12 Show  "      // 10
+        "  Battery   ",
+
+        "11/12 Debug "      // 9
         "Information ",
 
-        "11/11 Reset "      // 10
+        "12/12 Reset "      // 10
         " Everything "
     };
 
     currentPage = 0;
     
     s.type = Timeline::Span::Display;
-    s.time = Model::instance().Time();
-    s.duration = 10.0; // timeout
+    s.time = Model::instance().Ticks();
+    s.duration = 10 * ticks_per_second; // timeout
     s.calcFunc = [=](Timeline::Span &, Timeline::Span &) {
         SDD1306::instance().PlaceUTF8String(0, 0, &pageText[currentPage][0]);
         SDD1306::instance().PlaceUTF8String(0, 1, &pageText[currentPage][12]);
@@ -972,25 +1032,26 @@ void UI::enterPrefs(Timeline::Span &) {
     s.commitFunc = [=](Timeline::Span &) {
         SDD1306::instance().Display();
     };
+    s.nextFunc = Timeline::Span::Idle;
     s.doneFunc = [=](Timeline::Span &) {
 		FlipAnimation(&s);
     };
     s.switch1Func = [=](Timeline::Span &span) {
-        span.time = Model::instance().Time(); // reset timeout
+        span.time = Model::instance().Ticks(); // reset timeout
         currentPage --;
         if (currentPage < 0) {
             currentPage = maxPage - 1;
         }
     };
     s.switch2Func = [=](Timeline::Span &span) {
-        span.time = Model::instance().Time(); // reset timeout
+        span.time = Model::instance().Ticks(); // reset timeout
         currentPage ++;
         if (currentPage >= maxPage) {
             currentPage = 0;
         }
     };
     s.switch3Func = [=](Timeline::Span &span) {
-        span.time = Model::instance().Time(); // reset timeout
+        span.time = Model::instance().Ticks(); // reset timeout
         switch (currentPage) {
             case 0: {
                 enterSendMessage(span);
@@ -1020,9 +1081,12 @@ void UI::enterPrefs(Timeline::Span &) {
                 enterShowVersion(span);
             } break;
             case 9: {
-                enterDebug(span);
+                enterShowBattery(span);
             } break;
             case 10: {
+                enterDebug(span);
+            } break;
+            case 11: {
                 enterResetEverything(span);
             } break;
         }
@@ -1034,8 +1098,8 @@ void UI::init() {
     if (SDD1306::instance().DevicePresent()) {
         static Timeline::Span s;
         s.type = Timeline::Span::Display;
-        s.time = Model::instance().Time();
-        s.duration = std::numeric_limits<double>::infinity();
+        s.time = Model::instance().Ticks();
+        s.duration = ticks_infinite;
         s.calcFunc = [=](Timeline::Span &, Timeline::Span &) {
             char str[max_string_length];
             snprintf(str, max_string_length, "\xc2\x88%02d/%02d", static_cast<int>(Model::instance().Effect()), static_cast<int>(Model::instance().EffectCount()));
@@ -1154,6 +1218,13 @@ void UI::init() {
         s.commitFunc = [=](Timeline::Span &) {
             SDD1306::instance().Display();
         };
+        // Redrawn by the switches, the ADC task and when the minute changes
+        s.nextFunc = [=](Timeline::Span &span) {
+            if (Model::instance().DateTime() >= 0.0) {
+                return static_cast<ticks_t>((60.0 - fmod(Model::instance().DateTime(), 60.0)) * static_cast<double>(ticks_per_second));
+            }
+            return Timeline::Span::Idle(span);
+        };
         s.doneFunc = [=](Timeline::Span &) {
         };
         s.switch1Func = [=](Timeline::Span &) {
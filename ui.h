@@ -44,6 +44,7 @@ private:
     void enterRadioOnOff(Timeline::Span &parent);
     void enterFlashlight(Timeline::Span &parent);
     void enterShowVersion(Timeline::Span &parent);
+    void enterShowBattery(Timeline::Span &parent);
     void enterDebug(Timeline::Span &parent);
     void enterResetEverything(Timeline::Span &parent);
     
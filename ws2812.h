@@ -0,0 +1,109 @@
+/*
+Copyright 2019 Tinic Uro
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+#ifndef WS2812_H_
+#define WS2812_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// WS2812 bit stream encoding for 4 rails driven in parallel from QSPI.
+// Every WS2812 bit time is one 4 byte QSPI symbol in which each nibble
+// carries one sample for all 4 rails.
+namespace ws2812 {
+
+    static constexpr size_t bytes_per_component = 8 * 4;
+
+    // QSPI symbol per 4 rail bit pattern (rail 0 in bit 3, rail 3 in bit 0)
+    alignas(4) static constexpr uint8_t conv_lookup[16][4] = {
+        {   0b11111111, 0b00000000, 0b00000000, 0b00000000 }, // 0b0000
+        {   0b11111111, 0b00010001, 0b00010000, 0b00000000 }, // 0b0001
+        {   0b11111111, 0b00100010, 0b00100000, 0b00000000 }, // 0b0010
+        {   0b11111111, 0b00110011, 0b00110000, 0b00000000 }, // 0b0011
+        {   0b11111111, 0b01000100, 0b01000000, 0b00000000 }, // 0b0100
+        {   0b11111111, 0b01010101, 0b01010000, 0b00000000 }, // 0b0101
+        {   0b11111111, 0b01101100, 0b01100000, 0b00000000 }, // 0b0110
+        {   0b11111111, 0b01110111, 0b01110000, 0b00000000 }, // 0b0111
+        {   0b11111111, 0b10001000, 0b10000000, 0b00000000 }, // 0b1000
+        {   0b11111111, 0b10011001, 0b10010000, 0b00000000 }, // 0b1001
+        {   0b11111111, 0b10101010, 0b10100000, 0b00000000 }, // 0b1010
+        {   0b11111111, 0b10111011, 0b10110000, 0b00000000 }, // 0b1011
+        {   0b11111111, 0b11001100, 0b11000000, 0b00000000 }, // 0b1100
+        {   0b11111111, 0b11011101, 0b11010000, 0b00000000 }, // 0b1101
+        {   0b11111111, 0b11101110, 0b11100000, 0b00000000 }, // 0b1110
+        {   0b11111111, 0b11111111, 0b11110000, 0b00000000 }, // 0b1111
+    };
+
+    // Spreads the bits of a byte into the low bit of each nibble, MSB into
+    // the lowest nibble, so 4 spread bytes combine into 8 bit-plane indices.
+    struct spread_table {
+        uint32_t v[256];
+
+        constexpr spread_table() : v() {
+            for (uint32_t c = 0; c < 256; c++) {
+                uint32_t s = 0;
+                for (uint32_t d = 0; d < 8; d++) {
+                    s |= ((c >> d) & 1) << (4 * (7 - d));
+                }
+                v[c] = s;
+            }
+        }
+    };
+
+    static constexpr spread_table spread;
+
+    // Encodes one color component of 4 rails into 8 QSPI symbols
+    static inline uint8_t *encode4(uint8_t p0, uint8_t p1, uint8_t p2, uint8_t p3, uint8_t *buf) {
+        uint32_t planes = (spread.v[p0] << 3) |
+                          (spread.v[p1] << 2) |
+                          (spread.v[p2] << 1) |
+                          (spread.v[p3] << 0);
+        for (size_t d = 0; d < 8; d++) {
+            memcpy(buf, conv_lookup[planes & 0xF], 4);
+            planes >>= 4;
+            buf += 4;
+        }
+        return buf;
+    }
+
+#ifdef EMULATOR
+    // Original per-bit encoder, kept to verify encode4 in the benchmark
+    static inline uint8_t *encode4_reference(uint8_t p0, uint8_t p1, uint8_t p2, uint8_t p3, uint8_t *buf) {
+        for(int32_t d = 7; d >=0; d--) {
+            const uint8_t *src = conv_lookup[
+            ((p0&(1<<d))?0x8:0x0)|
+            ((p1&(1<<d))?0x4:0x0)|
+            ((p2&(1<<d))?0x2:0x0)|
+            ((p3&(1<<d))?0x1:0x0)];
+            *buf++ = *src++;
+            *buf++ = *src++;
+            *buf++ = *src++;
+            *buf++ = *src++;
+        }
+        return buf;
+    }
+#endif  // #ifdef EMULATOR
+
+}
+
+#endif  // #ifndef WS2812_H_